@@ -0,0 +1,93 @@
+/*
+ * Argon2id throughput and latency across cost settings: for each memory
+ * size, number of passes and lanes, several threads hash at once through a
+ * MemoryPool whose budget fits a fixed number of hashes. Hashes per second
+ * and the p50/p99 latency, which includes the wait for memory, show what
+ * a cost setting does to a login under load; the pool's waits show how
+ * often the memory bound held threads back.
+ *
+ * It ends with the pool against allocating the blocks for every hash.
+ *
+ * ./bench_argon2 [threads] [hashes per thread] [pool MiB]
+ */
+#include "argon2.h"
+#include "bench_util.h"
+#include <atomic>
+#include <thread>
+
+static void run(MemoryPool &pool, const Argon2::Params &params, int threads,
+                int hashes, bool pooled) {
+  std::vector<Latencies> latencies(threads);
+  std::atomic<int> failed(0);
+  auto start = Latencies::clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::string salt = "saltsalt" + std::to_string(t);
+      for (int i = 0; i < hashes; i++) {
+        auto t0 = Latencies::clock::now();
+        if (pooled) {
+          failed += Argon2::hash("password", salt, params, pool).empty();
+        } else {
+          // A pool of its own has nothing cached, every hash allocates
+          MemoryPool fresh(pool.stats().budget);
+          failed += Argon2::hash("password", salt, params, fresh).empty();
+        }
+        latencies[t].add(Latencies::clock::now() - t0);
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  double seconds =
+      std::chrono::duration<double>(Latencies::clock::now() - start).count();
+  Latencies all;
+  for (auto &l : latencies) {
+    all.merge(l);
+  }
+  printf("m %4u MiB  t %u  p %2u  %2d threads %8.1f hashes/s  p50 %8.1f ms  "
+         "p99 %8.1f ms%s%s\n",
+         params.memory_kib / 1024, params.passes, params.lanes, threads,
+         all.count() / seconds, all.percentile(50) / 1000,
+         all.percentile(99) / 1000, pooled ? "" : "  allocating",
+         failed ? "  FAILED" : "");
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? std::stoi(argv[1]) : 4;
+  int hashes = argc > 2 ? std::stoi(argv[2]) : 4;
+  size_t pool_mb = argc > 3 ? std::stoul(argv[3]) : 256;
+  printf("%u hardware threads, pool of %zu MiB\n",
+         std::thread::hardware_concurrency(), pool_mb);
+
+  MemoryPool pool(pool_mb << 20);
+  Argon2::Params params;
+  for (uint32_t mb : {8u, 32u, 128u}) {
+    for (uint32_t passes : {1u, 3u}) {
+      for (uint32_t lanes : {1u, 4u}) {
+        params.memory_kib = mb * 1024;
+        params.passes = passes;
+        params.lanes = lanes;
+        for (int t : {1, threads}) {
+          run(pool, params, t, hashes, true);
+        }
+      }
+    }
+  }
+  MemoryPool::Stats stats = pool.stats();
+  printf("pool: %llu acquires, %llu allocations, %llu waits for %.2f s\n",
+         static_cast<unsigned long long>(stats.acquires),
+         static_cast<unsigned long long>(stats.allocations),
+         static_cast<unsigned long long>(stats.waits), stats.wait_seconds);
+
+  printf("\npooled blocks against an allocation per hash\n");
+  for (uint32_t mb : {8u, 64u}) {
+    params.memory_kib = mb * 1024;
+    params.passes = 1;
+    params.lanes = 1;
+    run(pool, params, 1, hashes * 4, true);
+    run(pool, params, 1, hashes * 4, false);
+  }
+  return 0;
+}
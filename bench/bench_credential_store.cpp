@@ -0,0 +1,125 @@
+/*
+ * Runs the same workload against each CredentialStore backend:
+ * add N users, then logins (salt lookup + password check) with a skewed
+ * account distribution, password updates and deletes.
+ *
+ * ./bench_credential_store [users] [logins]
+ */
+#include "bench_util.h"
+#include "database.h"
+#include "hash_password.h"
+#include "log_store.h"
+#include "memory_store.h"
+#include <memory>
+#include <random>
+
+static void runWorkload(const std::string &name, CredentialStore &store,
+                        int users, int logins) {
+  std::vector<std::string> secids, hashes;
+  for (int i = 0; i < users; i++) {
+    secids.push_back("user" + std::to_string(i) + "@mail.io");
+    hashes.push_back(
+        HashPassword::digestSHA256("password" + std::to_string(i)));
+  }
+  std::mt19937 rng(42);
+  // Zipf-like skew: a few accounts take most logins
+  std::geometric_distribution<int> skew(20.0 / users);
+
+  Latencies add, login, update, del;
+  for (int i = 0; i < users; i++) {
+    auto t0 = Latencies::clock::now();
+    store.addUser(secids[i], hashes[i], "salt");
+    add.add(Latencies::clock::now() - t0);
+  }
+  for (int i = 0; i < logins; i++) {
+    int u = skew(rng) % users;
+    std::string salt;
+    auto t0 = Latencies::clock::now();
+    store.getUserSalt(secids[u], salt);
+    store.checkPassword(secids[u], hashes[u]);
+    login.add(Latencies::clock::now() - t0);
+  }
+  for (int i = 0; i < users / 10; i++) {
+    auto t0 = Latencies::clock::now();
+    store.updatePassword(secids[i], hashes[i], "new salt");
+    update.add(Latencies::clock::now() - t0);
+  }
+  for (int i = 0; i < users; i++) {
+    auto t0 = Latencies::clock::now();
+    store.deleteUser(secids[i], hashes[i]);
+    del.add(Latencies::clock::now() - t0);
+  }
+
+  std::cout << name << "\n";
+  add.print("  addUser");
+  login.print("  getUserSalt+checkPassword");
+  update.print("  updatePassword");
+  del.print("  deleteUser");
+}
+
+int main(int argc, char **argv) {
+  int users = argc > 1 ? std::stoi(argv[1]) : 5000;
+  int logins = argc > 2 ? std::stoi(argv[2]) : 50000;
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+
+  const std::string db_path = "/tmp/bench_credential_store.db";
+  if (!createBenchDatabase(db_path)) {
+    std::cerr << "Could not create " << db_path << std::endl;
+    return 1;
+  }
+  {
+    Database db(db_path.c_str());
+    db.setLogger(&log);
+    runWorkload("Database (SQLite)", db, users, logins);
+  }
+  {
+    // Cost of leaving the statement profiler on
+    Database db(db_path.c_str());
+    db.setLogger(&log);
+    db.enableProfiling(true);
+    runWorkload("Database (SQLite) + profiler", db, users, logins);
+  }
+  {
+    Database db(db_path.c_str());
+    db.setLogger(&log);
+    db.enableCache(64 * 1024 * 1024);
+    runWorkload("Database (SQLite) + cache", db, users, logins);
+  }
+  {
+    // Served from memory, snapshots written back every second
+    Database db(db_path.c_str(), PERSIST_INTERVAL_MS);
+    db.setLogger(&log);
+    runWorkload("Database (SQLite, memory-first)", db, users, logins);
+    // What one snapshot of the result costs
+    PersistStats stats;
+    db.persist();
+    db.persistStats(stats);
+    printf("  snapshot of %d pages in %.1f ms\n", stats.pages,
+           stats.last_seconds * 1000);
+  }
+  {
+    MemoryStore memory;
+    memory.setLogger(&log);
+    runWorkload("MemoryStore", memory, users, logins);
+  }
+  {
+    const std::string aof_path = "/tmp/bench_credential_store.aof";
+    std::remove(aof_path.c_str());
+    MemoryStore memory(aof_path);
+    memory.setLogger(&log);
+    runWorkload("MemoryStore + append-only file", memory, users, logins);
+  }
+  {
+    const std::string log_path = "/tmp/bench_credential_store.log";
+    std::remove((log_path + ".idx").c_str());
+    for (int seq = 1; seq < 100; seq++) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), ".%06d", seq);
+      std::remove((log_path + suffix).c_str());
+    }
+    LogStore log_store(log_path);
+    log_store.setLogger(&log);
+    runWorkload("LogStore", log_store, users, logins);
+  }
+  return 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * Hashing on the request threads against a HashPool. Request threads hash
+ * passwords one after another, either inline or by submitting to a pool
+ * and waiting for the future, for plain SHA-256 and PBKDF2. Alongside, a
+ * probe thread stands in for I/O work: it sleeps 200 us at a time and
+ * records how late it wakes up, which is what hashing on every request
+ * thread does to a socket or SQLite thread. With the pool, the hashing
+ * is bounded by its threads and SHA-256 jobs that queue are batched.
+ *
+ * ./bench_hash_pool [request threads] [hashes per thread] [pool threads]
+ */
+#include "bench_util.h"
+#include "hash_pool.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+static void run(const HashScheme &scheme, int threads, int hashes,
+                size_t pool_threads) {
+  std::unique_ptr<HashPool> pool;
+  if (pool_threads > 0) {
+    pool.reset(new HashPool(pool_threads));
+  }
+  std::atomic<bool> done(false);
+  Latencies probe;
+  std::thread io([&] {
+    while (!done) {
+      auto t0 = Latencies::clock::now();
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      probe.add(Latencies::clock::now() - t0 -
+                std::chrono::microseconds(200));
+    }
+  });
+
+  std::vector<Latencies> latencies(threads);
+  auto start = Latencies::clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      const std::string salt(SALT_SIZE, static_cast<char>('a' + t % 26));
+      for (int i = 0; i < hashes; i++) {
+        std::string password = "password" + std::to_string(i);
+        std::string hashed;
+        auto t0 = Latencies::clock::now();
+        if (pool) {
+          hashed = pool->submit(scheme, "42", password, salt).get();
+        } else {
+          scheme.hash("42", password, salt, hashed);
+        }
+        latencies[t].add(Latencies::clock::now() - t0);
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  double seconds =
+      std::chrono::duration<double>(Latencies::clock::now() - start).count();
+  done = true;
+  io.join();
+
+  Latencies all;
+  for (auto &l : latencies) {
+    all.merge(l);
+  }
+  printf("%-13s %-8s %2d threads %10.0f hashes/s  p50 %8.1f us  p99 %8.1f "
+         "us  probe late p99 %7.1f us",
+         scheme.name(), pool ? "pool" : "inline", threads,
+         all.count() / seconds, all.percentile(50), all.percentile(99),
+         probe.percentile(99));
+  if (pool) {
+    printf("  mean batch %.1f", pool->stats().meanBatch());
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? std::stoi(argv[1]) : 16;
+  int hashes = argc > 2 ? std::stoi(argv[2]) : 2000;
+  size_t pool_threads = argc > 3 ? std::stoul(argv[3]) : 1;
+  printf("%u hardware threads, %zu pool threads, batch width %zu\n",
+         std::thread::hardware_concurrency(), pool_threads,
+         HashPool::batchWidth());
+  HashScheme pbkdf2;
+  pbkdf2.algorithm = HashScheme::PBKDF2_SHA256;
+  pbkdf2.cost = HASH_MIN_PBKDF2_ITERATIONS;
+  for (const HashScheme &scheme : {HashScheme(), pbkdf2}) {
+    int n = scheme == pbkdf2 ? hashes / 20 : hashes;
+    for (int t : {1, threads}) {
+      run(scheme, t, n, 0);
+      run(scheme, t, n, pool_threads);
+    }
+  }
+  return 0;
+}
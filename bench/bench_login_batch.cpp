@@ -0,0 +1,86 @@
+/*
+ * Batch verification: the same logins made with login() in a loop and with
+ * loginBatch() in batches of several sizes, on a SQLite store with plain
+ * SHA-256 users, and once more with PBKDF2 users where the hash dominates.
+ * The loop pays a salt query, a password query and a hash per login; a
+ * batch reads salts and hashes with IN-list queries of up to 64 usernames
+ * and hashes SHA-256 users 8 or 16 at a time with AVX2 or AVX-512. Adds
+ * compare addLogin() in a loop with addLogins() in one transaction.
+ *
+ * ./bench_login_batch [users] [logins]
+ */
+#include "bench_util.h"
+#include "login_manager.h"
+#include <random>
+
+using clock_type = std::chrono::steady_clock;
+
+static std::string user(int i) { return std::to_string(i) + "@mail.io"; }
+static std::string password(int i) { return "pw" + std::to_string(i); }
+
+static double seconds(clock_type::time_point since) {
+  return std::chrono::duration<double>(clock_type::now() - since).count();
+}
+
+static void run(const std::string &path, const char *name,
+                const HashScheme &scheme, int users, int logins) {
+  std::remove(path.c_str());
+  LoginManager lm(path);
+  lm.setHashScheme(scheme);
+
+  std::vector<Credential> all;
+  for (int i = 0; i < users; i++) {
+    all.push_back({user(i), password(i)});
+  }
+  const int half = users / 2;
+  auto start = clock_type::now();
+  for (int i = 0; i < half; i++) {
+    lm.addLogin(all[i].username, all[i].password);
+  }
+  double loop_s = seconds(start);
+  start = clock_type::now();
+  lm.addLogins(std::vector<Credential>(all.begin() + half, all.end()));
+  double batch_s = seconds(start);
+  printf("%-8s addLogin loop %9.0f/s   addLogins %9.0f/s   x%.1f\n", name,
+         half / loop_s, (users - half) / batch_s, loop_s / batch_s);
+
+  std::mt19937 rng(1);
+  std::vector<Credential> picked;
+  for (int i = 0; i < logins; i++) {
+    picked.push_back(all[rng() % users]);
+  }
+  int failed = 0;
+  start = clock_type::now();
+  for (const Credential &credential : picked) {
+    failed += lm.login(credential.username, credential.password) != 0;
+  }
+  loop_s = seconds(start);
+  printf("%-8s login loop    %9.0f/s", name, logins / loop_s);
+  for (size_t size : {8, 64, 512}) {
+    start = clock_type::now();
+    for (size_t i = 0; i < picked.size(); i += size) {
+      auto end = picked.begin() + std::min(picked.size(), i + size);
+      for (int rc : lm.loginBatch(
+               std::vector<Credential>(picked.begin() + i, end))) {
+        failed += rc != 0;
+      }
+    }
+    batch_s = seconds(start);
+    printf("   batch %3zu %9.0f/s x%.1f", size, logins / batch_s,
+           loop_s / batch_s);
+  }
+  printf("%s\n", failed ? "  FAILED LOGINS" : "");
+  std::remove(path.c_str());
+}
+
+int main(int argc, char **argv) {
+  int users = argc > 1 ? std::stoi(argv[1]) : 20000;
+  int logins = argc > 2 ? std::stoi(argv[2]) : 50000;
+  const std::string path = "/tmp/bench_login_batch.db";
+  run(path, "sha256", HashScheme(), users, logins);
+  HashScheme pbkdf2;
+  pbkdf2.algorithm = HashScheme::PBKDF2_SHA256;
+  pbkdf2.cost = 1000;
+  run(path, "pbkdf2", pbkdf2, users / 10, logins / 10);
+  return 0;
+}
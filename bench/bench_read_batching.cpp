@@ -0,0 +1,166 @@
+/*
+ * Read batching: several threads log in (getUserSalt + checkPassword) at
+ * once on one Database. Without batching the connection's statements can
+ * only be used by one thread at a time, so the lookups are serialized by a
+ * mutex. With batching, lookups that meet are answered by one IN-list
+ * query; once with no collection window, once with the adaptive one. The
+ * single thread runs show what batching costs when there is no one to
+ * batch with.
+ *
+ * It starts with the queries alone: the cost per secid of k lookups by
+ * secid = ? against one IN list of k, without any threads involved.
+ *
+ * ./bench_read_batching [threads] [users] [logins per thread]
+ */
+#include "bench_util.h"
+#include "database.h"
+#include "hash_password.h"
+#include <mutex>
+#include <random>
+#include <thread>
+
+static void queryCost(const std::string &path, int users) {
+  sqlite3 *db = nullptr;
+  sqlite3_open(path.c_str(), &db);
+  const char *select = "SELECT l.secid, l.salt, p.password FROM login l "
+                       "INNER JOIN password p on l.id = p.login_id ";
+  Statement<string, string, string> single;
+  single.prepare(db, (string(select) + "WHERE l.secid = :secid;").c_str(),
+                 {":secid"});
+  std::mt19937 rng(1);
+  for (int k : {1, 4, 8, 16, 64}) {
+    string sql = string(select) + "WHERE l.secid IN (";
+    int length = k <= READ_BATCH_SMALL ? READ_BATCH_SMALL : READ_BATCH_MAX;
+    for (int i = 1; i <= length; i++) {
+      sql += (i > 1 ? ", ?" : "?") + std::to_string(i);
+    }
+    Statement<string, string, string> in_list;
+    in_list.prepare(db, (sql + ");").c_str(), {});
+
+    std::vector<string> secids(k);
+    const int rounds = 100000 / k;
+    double single_s = 0, in_list_s = 0;
+    for (int r = 0; r < rounds; r++) {
+      for (string &secid : secids) {
+        secid = std::to_string(rng() % users) + "@mail.io";
+      }
+      auto t0 = Latencies::clock::now();
+      for (const string &secid : secids) {
+        auto get = single.bind(secid);
+        while (get.step() == SQLITE_ROW) {
+          get.row();
+        }
+      }
+      auto t1 = Latencies::clock::now();
+      auto get = in_list.bindRange(secids);
+      while (get.step() == SQLITE_ROW) {
+        get.row();
+      }
+      auto t2 = Latencies::clock::now();
+      single_s += std::chrono::duration<double>(t1 - t0).count();
+      in_list_s += std::chrono::duration<double>(t2 - t1).count();
+    }
+    printf("%2d secids   by secid = ? %6.2f us each   IN list of %2d %6.2f "
+           "us each\n",
+           k, single_s * 1e6 / rounds / k, length,
+           in_list_s * 1e6 / rounds / k);
+  }
+  sqlite3_close_v2(db);
+}
+
+enum Mode { SERIALIZED, BATCH_NO_WAIT, BATCH };
+
+static void run(const std::string &path, Mode mode, int threads, int users,
+                int logins) {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  Database db(path.c_str());
+  db.setLogger(&log);
+  if (mode != SERIALIZED) {
+    db.enableReadBatching(true, mode == BATCH ? READ_BATCH_MAX_WAIT_US : 0);
+  }
+
+  std::mutex serial;
+  std::vector<Latencies> latencies(threads);
+  std::atomic<int> failed(0);
+  auto start = Latencies::clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::mt19937 rng(t);
+      for (int i = 0; i < logins; i++) {
+        std::string secid = std::to_string(rng() % users) + "@mail.io";
+        std::string hash = HashPassword::digestSHA256(secid);
+        std::string salt;
+        auto t0 = Latencies::clock::now();
+        if (mode == SERIALIZED) {
+          std::lock_guard<std::mutex> lock(serial);
+          failed += db.getUserSalt(secid, salt) != SQLITE_OK ||
+                    db.checkPassword(secid, hash) != SQLITE_OK;
+        } else {
+          failed += db.getUserSalt(secid, salt) != SQLITE_OK ||
+                    db.checkPassword(secid, hash) != SQLITE_OK;
+        }
+        latencies[t].add(Latencies::clock::now() - t0);
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  double seconds =
+      std::chrono::duration<double>(Latencies::clock::now() - start).count();
+
+  Latencies all;
+  for (auto &l : latencies) {
+    all.merge(l);
+  }
+  const char *names[] = {"serialized", "batching, no window",
+                         "batching, adaptive window"};
+  printf("%-26s %2d threads %9.0f logins/s  p50 %7.1f us  p99 %7.1f us",
+         names[mode], threads, all.count() / seconds, all.percentile(50),
+         all.percentile(99));
+  ReadBatcher::Stats stats;
+  if (db.readBatchStats(stats)) {
+    printf("  mean batch %.1f", stats.meanBatch());
+  }
+  printf("%s\n", failed ? "  FAILED LOGINS" : "");
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? std::stoi(argv[1]) : 16;
+  int users = argc > 2 ? std::stoi(argv[2]) : 100000;
+  int logins = argc > 3 ? std::stoi(argv[3]) : 5000;
+  const std::string path = "/tmp/bench_read_batching.db";
+  if (!createBenchDatabase(path)) {
+    std::cerr << "Could not create " << path << std::endl;
+    return 1;
+  }
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_open(path.c_str(), &db);
+    sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    Statement<> login, password;
+    login.prepare(db, "INSERT INTO login (id, secid, salt) "
+                      "VALUES (:id, :secid, 'salt');",
+                  {":id", ":secid"});
+    password.prepare(db, "INSERT INTO password VALUES (:id, :password);",
+                     {":id", ":password"});
+    for (int i = 0; i < users; i++) {
+      std::string secid = std::to_string(i) + "@mail.io";
+      std::string hash = HashPassword::digestSHA256(secid);
+      sqlite3_int64 id = i + 1;
+      login.bind(id, secid).step();
+      password.bind(id, Blob(hash)).step();
+    }
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    sqlite3_close_v2(db);
+  }
+
+  queryCost(path, users);
+  for (int t : {1, threads}) {
+    run(path, SERIALIZED, t, users, logins);
+    run(path, BATCH_NO_WAIT, t, users, logins);
+    run(path, BATCH, t, users, logins);
+  }
+  return 0;
+}
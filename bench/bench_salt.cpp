@@ -0,0 +1,72 @@
+/*
+ * Salt generation from several threads at once: SaltGenerator's per
+ * thread ChaCha20 keystream, against one mt19937 behind a mutex (how
+ * salts were made before) and a getrandom system call per salt. With a
+ * thread of its own per generator there is nothing shared, so the rate
+ * should grow with the threads as far as there are cores.
+ *
+ * ./bench_salt [max threads] [salts per thread]
+ */
+#include "salt_generator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <sys/random.h>
+#include <thread>
+#include <vector>
+
+enum Mode { CHACHA20, MT19937_MUTEX, GETRANDOM };
+
+static void run(Mode mode, int threads, int salts) {
+  std::mutex mtx;
+  std::mt19937 shared(1);
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&] {
+      SaltGenerator::Salt salt;
+      unsigned sum = 0;
+      for (int i = 0; i < salts; i++) {
+        if (mode == CHACHA20) {
+          SaltGenerator::generate(salt);
+        } else if (mode == MT19937_MUTEX) {
+          std::lock_guard<std::mutex> lock(mtx);
+          for (size_t b = 0; b < salt.size(); b += 4) {
+            uint32_t word = shared();
+            std::memcpy(&salt[b], &word, 4);
+          }
+        } else {
+          getrandom(salt.data(), salt.size(), 0);
+        }
+        sum += salt[0];
+      }
+      volatile unsigned sink = sum;
+      (void)sink;
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  const char *names[] = {"chacha20 per thread", "mt19937 + mutex",
+                         "getrandom per salt"};
+  printf("%-20s %2d threads %8.2f M salts/s\n", names[mode], threads,
+         threads * salts / seconds / 1e6);
+}
+
+int main(int argc, char **argv) {
+  int max_threads = argc > 1 ? std::stoi(argv[1]) : 8;
+  int salts = argc > 2 ? std::stoi(argv[2]) : 1000000;
+  printf("%u hardware threads\n", std::thread::hardware_concurrency());
+  for (Mode mode : {CHACHA20, MT19937_MUTEX, GETRANDOM}) {
+    for (int t = 1; t <= max_threads; t *= 2) {
+      run(mode, t, mode == GETRANDOM ? salts / 10 : salts);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * SHA-256 throughput of each compression implementation the CPU supports,
+ * over message sizes from a password (16 bytes, one block) to 64 KiB.
+ * Small messages are dominated by padding and the one or two blocks they
+ * fill, large ones by the compression function alone.
+ *
+ * The batch part hashes 1024 salted-password sized messages with
+ * digestSHA256Batch, one at a time with each single-buffer implementation
+ * and in vector lanes with each multi-buffer one.
+ *
+ * Last, a login's salted hash: STATIC_SALT + password + salt built as a
+ * string and hashed, against the same pieces fed to a Hasher.
+ *
+ * ./bench_sha256 [seconds per size]
+ */
+#include "hash_password.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static void batch(HashPassword::Impl impl, size_t size, double seconds) {
+  using clock = std::chrono::steady_clock;
+  std::vector<std::string> messages(1024);
+  for (size_t i = 0; i < messages.size(); i++) {
+    messages[i] = std::string(size, 'p') + std::to_string(i);
+    messages[i].resize(size);
+  }
+  std::vector<std::string_view> views(messages.begin(), messages.end());
+  size_t hashes = 0;
+  unsigned char sink = 0;
+  auto start = clock::now();
+  double elapsed = 0;
+  while (elapsed < seconds) {
+    sink ^= static_cast<unsigned char>(
+        HashPassword::digestSHA256Batch(views)[hashes % 1024][0]);
+    hashes += views.size();
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  }
+  printf("batch %-8s %4zu bytes %10.0f hashes/s %9.1f ns/hash (%02x)\n",
+         HashPassword::name(impl), size, hashes / elapsed,
+         elapsed * 1e9 / hashes, sink);
+}
+
+template <class Hash>
+static void salted(const char *name, double seconds, Hash hash) {
+  using clock = std::chrono::steady_clock;
+  const std::string static_salt = "42", salt(16, 's');
+  std::string password = "correct horse battery";
+  size_t hashes = 0;
+  unsigned char sink = 0;
+  auto start = clock::now();
+  double elapsed = 0;
+  while (elapsed < seconds) {
+    for (int i = 0; i < 64; i++) {
+      password[0] = static_cast<char>(hashes + i);
+      sink ^= hash(static_salt, password, salt);
+    }
+    hashes += 64;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  }
+  printf("salted %-12s %10.0f hashes/s %9.1f ns/hash (%02x)\n", name,
+         hashes / elapsed, elapsed * 1e9 / hashes, sink);
+}
+
+int main(int argc, char **argv) {
+  double seconds = argc > 1 ? std::stod(argv[1]) : 0.2;
+  const HashPassword::Impl impls[] = {HashPassword::Impl::SCALAR,
+                                      HashPassword::Impl::SHA_NI,
+                                      HashPassword::Impl::ARMV8};
+  const size_t sizes[] = {16, 55, 64, 256, 1024, 4096, 65536};
+  printf("default implementation: %s\n",
+         HashPassword::name(HashPassword::implementation()));
+
+  for (HashPassword::Impl impl : impls) {
+    if (!HashPassword::useImplementation(impl)) {
+      printf("%-8s not supported by this CPU\n", HashPassword::name(impl));
+      continue;
+    }
+    for (size_t size : sizes) {
+      using clock = std::chrono::steady_clock;
+      std::string message(size, 'p');
+      size_t hashes = 0;
+      unsigned char sink = 0;
+      auto start = clock::now();
+      double elapsed = 0;
+      while (elapsed < seconds) {
+        for (int i = 0; i < 64; i++) {
+          message[0] = static_cast<char>(hashes + i);
+          sink ^= static_cast<unsigned char>(
+              HashPassword::digestSHA256(message)[0]);
+        }
+        hashes += 64;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+      }
+      printf("%-8s %6zu bytes %10.0f hashes/s %9.1f MB/s %9.1f ns/hash"
+             " (%02x)\n",
+             HashPassword::name(impl), size, hashes / elapsed,
+             hashes * size / elapsed / 1e6, elapsed * 1e9 / hashes, sink);
+    }
+  }
+
+  const HashPassword::Impl batch_impls[] = {
+      HashPassword::Impl::SCALAR, HashPassword::Impl::SHA_NI,
+      HashPassword::Impl::ARMV8, HashPassword::Impl::AVX2,
+      HashPassword::Impl::AVX512};
+  for (HashPassword::Impl impl : batch_impls) {
+    // Single-buffer ones run one at a time through useImplementation
+    if (!HashPassword::useBatchImplementation(impl) ||
+        (impl != HashPassword::Impl::AVX2 &&
+         impl != HashPassword::Impl::AVX512 &&
+         !HashPassword::useImplementation(impl))) {
+      continue;
+    }
+    for (size_t size : {size_t(16), size_t(48), size_t(100)}) {
+      batch(impl, size, seconds);
+    }
+  }
+
+  HashPassword::useImplementation(HashPassword::implementation());
+  salted("concatenated", seconds,
+         [](const std::string &a, const std::string &b, const std::string &c) {
+           return static_cast<unsigned char>(
+               HashPassword::digestSHA256(a + b + c)[0]);
+         });
+  salted("streamed", seconds,
+         [](const std::string &a, const std::string &b, const std::string &c) {
+           HashPassword::Digest digest;
+           HashPassword::Hasher().update(a).update(b).update(c).final(digest);
+           return digest[0];
+         });
+  return 0;
+}
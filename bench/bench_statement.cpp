@@ -0,0 +1,98 @@
+/*
+ * Per-query cost of the Statement wrapper against the hand-written pattern
+ * it replaced in Database: parameter index lookup by name on every call and
+ * values bound with SQLITE_TRANSIENT, which makes SQLite copy each one.
+ * Both run the password check query of Database on the same data.
+ *
+ * ./bench_statement [users] [queries]
+ */
+#include "bench_util.h"
+#include "hash_password.h"
+#include "statement.h"
+#include <random>
+
+static const char *CHECK_SQL =
+    "SELECT count(*) FROM login lg "
+    "INNER JOIN password pw ON lg.id = pw.login_id "
+    "WHERE lg.secid = :secid AND pw.password = :password;";
+
+static int checkRaw(sqlite3_stmt *stmt, const std::string &secid,
+                    const std::string &password) {
+  sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":secid"),
+                    secid.c_str(), secid.length(), SQLITE_TRANSIENT);
+  sqlite3_bind_blob(stmt, sqlite3_bind_parameter_index(stmt, ":password"),
+                    password.data(), password.size(), SQLITE_TRANSIENT);
+  int exists = -1;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    exists = sqlite3_column_int(stmt, 0);
+  }
+  sqlite3_reset(stmt);
+  return exists;
+}
+
+static int checkWrapped(Statement<int> &stmt, const std::string &secid,
+                        const std::string &password) {
+  auto scope = stmt.bind(secid, Blob(password));
+  return scope.step() == SQLITE_ROW ? std::get<0>(scope.row()) : -1;
+}
+
+int main(int argc, char **argv) {
+  int users = argc > 1 ? std::stoi(argv[1]) : 1000;
+  int queries = argc > 2 ? std::stoi(argv[2]) : 200000;
+
+  const std::string db_path = "/tmp/bench_statement.db";
+  if (!createBenchDatabase(db_path)) {
+    std::cerr << "Could not create " << db_path << std::endl;
+    return 1;
+  }
+  sqlite3 *db = nullptr;
+  sqlite3_open(db_path.c_str(), &db);
+  std::vector<std::string> secids, hashes;
+  Statement<> add_login, add_password;
+  add_login.prepare(db, "INSERT INTO login (secid, salt) VALUES (:s, 'salt');",
+                    {":s"});
+  add_password.prepare(db,
+                       "INSERT INTO password (login_id, password) "
+                       "VALUES (last_insert_rowid(), :p);",
+                       {":p"});
+  sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+  for (int i = 0; i < users; i++) {
+    secids.push_back("user" + std::to_string(i) + "@mail.io");
+    hashes.push_back(
+        HashPassword::digestSHA256("password" + std::to_string(i)));
+  }
+  for (int i = 0; i < users; i++) {
+    add_login.bind(secids[i]).step();
+    add_password.bind(Blob(hashes[i])).step();
+  }
+  sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+  sqlite3_stmt *raw = nullptr;
+  sqlite3_prepare_v2(db, CHECK_SQL, -1, &raw, nullptr);
+  Statement<int> wrapped;
+  wrapped.prepare(db, CHECK_SQL, {":secid", ":password"});
+
+  // Interleaved rounds so both see the same cache state
+  Latencies raw_lat, wrapped_lat;
+  std::mt19937 rng(42);
+  int found = 0;
+  for (int i = 0; i < queries; i++) {
+    int u = rng() % users;
+    auto t0 = Latencies::clock::now();
+    found += checkRaw(raw, secids[u], hashes[u]);
+    auto t1 = Latencies::clock::now();
+    found += checkWrapped(wrapped, secids[u], hashes[u]);
+    auto t2 = Latencies::clock::now();
+    raw_lat.add(t1 - t0);
+    wrapped_lat.add(t2 - t1);
+  }
+  if (found != 2 * queries) {
+    std::cerr << "Unexpected results: " << found << std::endl;
+  }
+  raw_lat.print("name lookup + TRANSIENT");
+  wrapped_lat.print("Statement (STATIC)");
+
+  sqlite3_finalize(raw);
+  sqlite3_close_v2(db);
+  return 0;
+}
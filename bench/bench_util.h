@@ -0,0 +1,66 @@
+/*
+ * Small helpers shared by the benchmarks: a latency recorder with
+ * percentiles and throwaway benchmark databases with the Database schema.
+ */
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include "database.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+
+class Latencies {
+public:
+  using clock = std::chrono::steady_clock;
+  void add(clock::duration d) {
+    m_ns.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  }
+  size_t count() const { return m_ns.size(); }
+  void merge(const Latencies &other) {
+    m_ns.insert(m_ns.end(), other.m_ns.begin(), other.m_ns.end());
+  }
+  double percentile(double p) {
+    if (m_ns.empty()) {
+      return 0;
+    }
+    std::sort(m_ns.begin(), m_ns.end());
+    size_t i = static_cast<size_t>(p / 100.0 * (m_ns.size() - 1));
+    return m_ns[i] / 1000.0;
+  }
+  double total_s() const {
+    double sum = 0;
+    for (long long ns : m_ns) {
+      sum += ns;
+    }
+    return sum / 1e9;
+  }
+  void print(const std::string &name) {
+    printf("%-28s %9zu ops %12.0f ops/s  p50 %8.2f us  p99 %8.2f us\n",
+           name.c_str(), count(), total_s() > 0 ? count() / total_s() : 0,
+           percentile(50), percentile(99));
+  }
+
+private:
+  std::vector<long long> m_ns;
+};
+
+// Creates an empty login database at path, removing any old file
+inline bool createBenchDatabase(const std::string &path) {
+  std::remove(path.c_str());
+  sqlite3 *db = nullptr;
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+    sqlite3_close(db);
+    return false;
+  }
+  int rc = Database::createSchema(db);
+  sqlite3_close(db);
+  return rc == SQLITE_OK;
+}
+
+#endif // BENCH_UTIL_H
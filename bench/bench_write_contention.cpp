@@ -0,0 +1,98 @@
+/*
+ * Write contention: several threads, each with its own Database connection
+ * to the same file, add, update and delete their own users. Every write
+ * takes the file's write lock, so they collide constantly. Runs once with
+ * a busy deadline of 0, where a locked file fails the write, and once with
+ * the default deadline, where the busy handler backs off and retries.
+ *
+ * ./bench_write_contention [threads] [users per thread]
+ */
+#include "bench_util.h"
+#include "database.h"
+#include "hash_password.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+static void run(const std::string &path, int threads, int users,
+                int deadline_ms) {
+  if (!createBenchDatabase(path)) {
+    std::cerr << "Could not create " << path << std::endl;
+    return;
+  }
+  // Failed writes are logged, keep them out of the results
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::FILE,
+             "/tmp/bench_write_contention.log");
+  const std::string hash = HashPassword::digestSHA256("password");
+
+  std::vector<std::unique_ptr<Database>> dbs;
+  for (int t = 0; t < threads; t++) {
+    dbs.emplace_back(new Database(path.c_str()));
+    dbs.back()->setLogger(&log);
+    dbs.back()->setBusyDeadline(deadline_ms);
+  }
+
+  std::vector<Latencies> latencies(threads);
+  std::atomic<int> failed(0);
+  auto start = Latencies::clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      Database &db = *dbs[t];
+      for (int i = 0; i < users; i++) {
+        std::string secid =
+            std::to_string(t) + "." + std::to_string(i) + "@mail.io";
+        auto t0 = Latencies::clock::now();
+        failed += db.addUser(secid, hash, "salt") != SQLITE_OK;
+        auto t1 = Latencies::clock::now();
+        failed += db.updatePassword(secid, hash, "salt2") != SQLITE_OK;
+        auto t2 = Latencies::clock::now();
+        failed += db.deleteUser(secid, hash) != SQLITE_OK;
+        auto t3 = Latencies::clock::now();
+        latencies[t].add(t1 - t0);
+        latencies[t].add(t2 - t1);
+        latencies[t].add(t3 - t2);
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  double seconds =
+      std::chrono::duration<double>(Latencies::clock::now() - start).count();
+
+  Latencies all;
+  BusyStats total = {};
+  for (int t = 0; t < threads; t++) {
+    all.merge(latencies[t]);
+    BusyStats stats;
+    dbs[t]->busyStats(stats);
+    total.contended += stats.contended;
+    total.retries += stats.retries;
+    total.gave_up += stats.gave_up;
+    total.wait_seconds += stats.wait_seconds;
+    total.max_wait_seconds =
+        std::max(total.max_wait_seconds, stats.max_wait_seconds);
+  }
+
+  printf("busy deadline %d ms, %d threads\n", deadline_ms, threads);
+  printf("  %zu writes in %.2f s, %.0f writes/s, %d failed\n", all.count(),
+         seconds, all.count() / seconds, failed.load());
+  printf("  p50 %.0f us  p99 %.0f us  max wait %.1f ms\n",
+         all.percentile(50), all.percentile(99),
+         total.max_wait_seconds * 1000);
+  printf("  %llu statements waited, %llu retries, %llu gave up, "
+         "%.2f s waiting\n",
+         static_cast<unsigned long long>(total.contended),
+         static_cast<unsigned long long>(total.retries),
+         static_cast<unsigned long long>(total.gave_up), total.wait_seconds);
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? std::stoi(argv[1]) : 8;
+  int users = argc > 2 ? std::stoi(argv[2]) : 200;
+  const std::string path = "/tmp/bench_write_contention.db";
+  run(path, threads, users, 0);
+  run(path, threads, users, BUSY_DEADLINE_MS);
+  return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Argon2id (RFC 9106), the memory-hard password hash. Its lanes are
+ * filled in parallel, one thread per lane, meeting at the four sync points
+ * of every pass. The blocks come from a MemoryPool, so concurrent hashes
+ * reuse buffers instead of allocating tens of MB each, and wait for memory
+ * when the pool's budget is taken.
+ */
+#ifndef ARGON2_H
+#define ARGON2_H
+
+#include "memory_pool.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#define ARGON2_BLOCK_SIZE 1024
+#define ARGON2_SYNC_POINTS 4
+#define ARGON2_VERSION 0x13
+#define ARGON2_MAX_LANES 16
+
+class Argon2 {
+public:
+  struct Params {
+    uint32_t passes = 3;       // t
+    uint32_t memory_kib = 65536; // m, at least 8 KiB per lane
+    uint32_t lanes = 1;        // p, up to ARGON2_MAX_LANES
+    uint32_t tag_length = 32;
+  };
+
+  // The tag of password and salt, empty if the parameters are invalid or
+  // the memory is larger than the whole pool. secret and ad are the
+  // optional key K and associated data X of the RFC.
+  static std::string hash(std::string_view password, std::string_view salt,
+                          const Params &params,
+                          MemoryPool &pool = MemoryPool::shared(),
+                          std::string_view secret = {},
+                          std::string_view ad = {});
+};
+
+#endif // ARGON2_H
@@ -0,0 +1,69 @@
+/*
+ * AsyncStore gives a CredentialStore a non-blocking interface. It owns the
+ * store, and every call runs on one dedicated executor thread, so the store
+ * and its connection are only ever used from that thread. Each operation
+ * comes in two forms:
+ *
+ *   std::future<int> f = async.async_addUser(secid, password, salt);
+ *   async.async_addUser(secid, password, salt, [](int rc) { ... });
+ *
+ * Lookups deliver the rc and the value. Callbacks run on the executor
+ * thread and must not block, or they hold up every call queued behind them.
+ * Calls run in the order they were made. Arguments are copied, so the
+ * caller's strings need not outlive the call. Configure the store (logger,
+ * cache, filter) before handing it over.
+ */
+#ifndef ASYNC_STORE_H
+#define ASYNC_STORE_H
+
+#include "credential_store.h"
+#include "executor.h"
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+
+class AsyncStore {
+public:
+  struct Result {
+    int rc;
+    string value; // salt or password when rc is SQLITE_OK
+  };
+  using Callback = std::function<void(int rc)>;
+  using ResultCallback = std::function<void(const Result &result)>;
+
+  explicit AsyncStore(std::unique_ptr<CredentialStore> store);
+  ~AsyncStore();
+
+  std::future<Result> async_getUserSalt(const string &secid);
+  std::future<Result> async_getUserPassword(const string &secid);
+  std::future<int> async_checkPassword(const string &secid,
+                                       const string &password);
+  std::future<int> async_addUser(const string &secid, const string &password,
+                                 const string &salt);
+  std::future<int> async_deleteUser(const string &secid,
+                                    const string &password);
+  std::future<int> async_updatePassword(const string &secid,
+                                        const string &password,
+                                        const string &salt);
+
+  void async_getUserSalt(const string &secid, ResultCallback done);
+  void async_getUserPassword(const string &secid, ResultCallback done);
+  void async_checkPassword(const string &secid, const string &password,
+                           Callback done);
+  void async_addUser(const string &secid, const string &password,
+                     const string &salt, Callback done);
+  void async_deleteUser(const string &secid, const string &password,
+                        Callback done);
+  void async_updatePassword(const string &secid, const string &password,
+                            const string &salt, Callback done);
+
+  // Calls queued and not yet started
+  size_t pending();
+
+private:
+  std::unique_ptr<CredentialStore> m_store;
+  std::unique_ptr<Executor> m_executor;
+};
+
+#endif // ASYNC_STORE_H
@@ -0,0 +1,79 @@
+/*
+ * ChangeFeed publishes committed credential changes as an ordered stream of
+ * events. A Database given a feed captures its changes with SQLite hooks and
+ * publishes them once the transaction has committed, so every event is for
+ * data that is on disk. Each event gets the next sequence number; a gap seen
+ * by a subscriber means events were lost and its view should be rebuilt.
+ *
+ * Events are delivered on the feed's own thread, in sequence order:
+ *  - to in-process subscribers, which must not block for long,
+ *  - to every client of the local socket given to listen(), one line per
+ *    event: "<seq> <op> <secid>\n" with op A (add), U (update) or D (delete).
+ *    A client that does not keep up is disconnected.
+ */
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+#include "executor.h"
+#include "logger.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CHANGE_FEED_BACKLOG 16
+#define CHANGE_FEED_POLL_MS 100
+
+class ChangeFeed {
+public:
+  enum Op : char { ADD = 'A', UPDATE = 'U', DELETE = 'D' };
+  struct Event {
+    uint64_t seq;
+    Op op;
+    std::string secid;
+  };
+  using Subscriber = std::function<void(const Event &)>;
+
+  ChangeFeed();
+  ~ChangeFeed();
+  ChangeFeed(const ChangeFeed &) = delete;
+  ChangeFeed &operator=(const ChangeFeed &) = delete;
+
+  // Returns an id for unsubscribe(). An event being delivered while
+  // unsubscribe() runs may still reach the subscriber.
+  int subscribe(Subscriber subscriber);
+  void unsubscribe(int id);
+  // Accepts clients on a Unix stream socket at path. SQLite result code.
+  int listen(const std::string &path);
+  // Numbers the events and queues them for delivery, in the given order
+  void publish(std::vector<Event> events);
+  uint64_t lastSeq();
+  // Blocks until every event published so far has been delivered
+  void flush();
+
+  void setLogger(Logger *log);
+
+private:
+  Logger *m_log;
+  std::mutex m_mtx;
+  uint64_t m_seq;
+  int m_next_id;
+  std::map<int, Subscriber> m_subscribers;
+  std::vector<int> m_clients; // only used on the delivery thread
+  std::mutex m_clients_mtx;   // guards m_accepted
+  std::vector<int> m_accepted;
+  std::string m_socket_path;
+  int m_listen_fd;
+  std::atomic<bool> m_stop;
+  std::thread m_accept_thread;
+  Executor m_delivery; // declared last, so it stops first
+
+  void acceptLoop();
+  void deliver(const std::vector<Event> &events);
+};
+
+#endif // CHANGE_FEED_H
@@ -0,0 +1,117 @@
+/*
+ * CredentialCache keeps recently used credentials (secid -> salt, password
+ * hash) in memory so that repeated logins for the same accounts are served
+ * without a round trip to SQLite.
+ *
+ * The cache is split into shards, each with its own lock, and is bounded by
+ * the number of bytes held. Admission follows W-TinyLFU: new entries enter a
+ * small LRU window, and when they leave it they only replace an entry of the
+ * main segmented LRU if they have been requested more often, as estimated by
+ * a count-min sketch.
+ */
+#ifndef CREDENTIAL_CACHE_H
+#define CREDENTIAL_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define CACHE_SHARDS 16
+#define CACHE_ENTRY_OVERHEAD 128 // bytes of bookkeeping charged per entry
+
+class CredentialCache {
+public:
+  struct Entry {
+    std::string salt;
+    std::string password;
+  };
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t admitted;
+    uint64_t rejected; // candidates refused by the frequency filter
+    uint64_t evictions;
+    uint64_t invalidations;
+    size_t entries;
+    size_t bytes;
+    size_t capacity;
+    double hitRate() const {
+      return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0;
+    }
+  };
+
+  CredentialCache(size_t capacity_bytes, size_t shards = CACHE_SHARDS);
+  bool get(const std::string &secid, Entry &entry);
+  // Version to pass to put(). A put is dropped if the secid has been
+  // invalidated since the version was taken, so a read that raced with a
+  // write can never repopulate the cache with old credentials.
+  uint64_t version(const std::string &secid);
+  void put(const std::string &secid, const Entry &entry, uint64_t version);
+  void invalidate(const std::string &secid);
+  Stats stats();
+
+private:
+  // 4-bit style count-min sketch with periodic aging
+  class FrequencySketch {
+  public:
+    explicit FrequencySketch(size_t expected_entries);
+    void increment(uint64_t hash);
+    uint8_t frequency(uint64_t hash) const;
+
+  private:
+    static const int DEPTH = 4;
+    std::vector<uint8_t> m_table;
+    size_t m_mask;
+    size_t m_additions;
+    size_t m_sample_size;
+    size_t index(uint64_t hash, int row) const;
+    void reset();
+  };
+
+  enum Segment { WINDOW, PROBATION, PROTECTED };
+  struct Node {
+    std::string secid;
+    Entry entry;
+    uint64_t hash;
+    Segment segment;
+    size_t bytes;
+  };
+  using NodeList = std::list<Node>;
+  struct Shard {
+    std::mutex mtx;
+    NodeList window;
+    NodeList probation;
+    NodeList protected_;
+    std::unordered_map<std::string, NodeList::iterator> index;
+    FrequencySketch sketch;
+    uint64_t epoch;
+    size_t window_bytes;
+    size_t probation_bytes;
+    size_t protected_bytes;
+    Stats stats;
+    explicit Shard(size_t expected_entries)
+        : sketch(expected_entries), epoch(0), window_bytes(0),
+          probation_bytes(0), protected_bytes(0), stats() {}
+  };
+
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  size_t m_capacity;
+  size_t m_window_capacity;    // per shard
+  size_t m_main_capacity;      // per shard
+  size_t m_protected_capacity; // per shard
+
+  static uint64_t hashOf(const std::string &secid);
+  Shard &shardFor(uint64_t hash);
+  void onHit(Shard &shard, NodeList::iterator it);
+  void evictFromWindow(Shard &shard);
+  void erase(Shard &shard, NodeList::iterator it);
+  NodeList &listOf(Shard &shard, Segment segment);
+  size_t &bytesOf(Shard &shard, Segment segment);
+};
+
+#endif // CREDENTIAL_CACHE_H
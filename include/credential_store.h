@@ -0,0 +1,111 @@
+/*
+ * CredentialStore is the storage interface used by the LoginManager.
+ * Database (SQLite) and MemoryStore (in-memory hash table) implement it.
+ *
+ * All methods return SQLite result codes, whatever the backend, so callers
+ * see the same values: SQLITE_OK on success, SQLITE_DONE when a lookup finds
+ * no user, SQLITE_NOTFOUND for a wrong password, SQLITE_CONSTRAINT for an
+ * existing user and SQLITE_ABORT for an update of a missing user.
+ */
+#ifndef CREDENTIAL_STORE_H
+#define CREDENTIAL_STORE_H
+
+#include "change_feed.h"
+#include "credential_cache.h"
+#include "cuckoo_filter.h"
+#include "logger.h"
+#include "profiler.h"
+#include "read_batcher.h"
+#include <memory>
+#include <sqlite3.h>
+#include <string>
+#include <vector>
+using std::string;
+
+struct BackupStats {
+  int pages;          // pages copied into the backup
+  int page_size;      // bytes per page
+  double seconds;     // wall time of the whole backup
+  double pages_per_sec;
+};
+
+struct BusyStats {
+  uint64_t contended;      // statements that found the database locked
+  uint64_t retries;        // backoff waits before trying the lock again
+  uint64_t gave_up;        // statements that returned SQLITE_BUSY
+  double wait_seconds;     // total time spent waiting
+  double max_wait_seconds; // longest wait of a single statement
+};
+
+struct PersistStats {
+  uint64_t snapshots;  // snapshots written to the database file
+  uint64_t failures;   // snapshots that could not be written
+  int pages;           // pages in the last snapshot
+  double last_seconds; // time taken by the last snapshot
+  double copy_seconds; // of which writers waited for its copy in memory
+  double age_seconds;  // since the last snapshot, the changes at risk
+};
+
+struct NewUser {
+  string secid;
+  string password;
+  string salt;
+};
+
+class CredentialStore {
+public:
+  virtual ~CredentialStore() = default;
+  virtual int getUserPassword(const string &secid, string &password) = 0;
+  virtual int getUserSalt(const string &secid, string &salt) = 0;
+  virtual int addUser(const string &secid, const string &password,
+                      const string &salt) = 0;
+  virtual int deleteUser(const string &secid, const string &password) = 0;
+  virtual int checkPassword(const string &secid, const string &password) = 0;
+  virtual int updatePassword(const string &secid, const string &password,
+                             const string &salt) = 0;
+  virtual void setLogger(Logger *log) = 0;
+
+  // Batches, results in input order. By default one call per item.
+  // entries[i] gets the salt and password of secids[i]; rcs[i] is
+  // SQLITE_OK, SQLITE_DONE when it is not a user, or the lookup's error.
+  // Returns the first such error, SQLITE_OK otherwise.
+  virtual int getCredentials(const std::vector<string> &secids,
+                             std::vector<CredentialCache::Entry> &entries,
+                             std::vector<int> &rcs);
+  // rcs[i] is what addUser would return for users[i], the result is the
+  // first of them other than SQLITE_CONSTRAINT. Stores that can commit
+  // them in one transaction do; an existing user only fails itself.
+  virtual int addUsers(const std::vector<NewUser> &users,
+                       std::vector<int> &rcs);
+
+  // Optional features, by default reported as not supported
+  virtual int backup(const char * /*destFile*/,
+                     BackupStats * /*stats*/ = nullptr) {
+    return SQLITE_MISUSE;
+  }
+  virtual void setBackupRate(int /*pages_per_step*/,
+                             int /*max_pages_per_sec*/) {}
+  virtual void enableCache(size_t /*capacity_bytes*/) {}
+  virtual bool cacheStats(CredentialCache::Stats & /*stats*/) { return false; }
+  virtual int enableFilter(bool /*enable*/) { return SQLITE_MISUSE; }
+  virtual bool filterStats(CuckooFilter::Stats & /*stats*/) { return false; }
+  // Lookups made by several threads at once share one query
+  virtual int enableReadBatching(bool /*enable*/,
+                                 int /*max_wait_us*/ = READ_BATCH_MAX_WAIT_US) {
+    return SQLITE_MISUSE;
+  }
+  virtual bool readBatchStats(ReadBatcher::Stats & /*stats*/) { return false; }
+  // Per-statement latency histograms and SQLite page cache counters
+  virtual int enableProfiling(bool /*enable*/) { return SQLITE_MISUSE; }
+  virtual bool profile(Profiler::Snapshot & /*snapshot*/) { return false; }
+  // Memory-first stores: how their file keeps up
+  virtual bool persistStats(PersistStats & /*stats*/) { return false; }
+  virtual void setBusyDeadline(int /*deadline_ms*/) {}
+  virtual bool busyStats(BusyStats & /*stats*/) { return false; }
+  // Publishes committed adds, updates and deletes to feed, nullptr stops it
+  virtual int setChangeFeed(std::shared_ptr<ChangeFeed> /*feed*/) {
+    return SQLITE_MISUSE;
+  }
+};
+
+#endif // CREDENTIAL_STORE_H
@@ -0,0 +1,66 @@
+/*
+ * CuckooFilter is a compact approximate set of secids. It answers "may
+ * contain" with a small false positive rate and never gives a false
+ * negative for a key that was inserted and not removed, which lets the
+ * Database turn away logins for unknown accounts without a SQLite lookup.
+ *
+ * Each key is stored as a 16-bit fingerprint in one of two candidate
+ * buckets of four slots. Unlike a Bloom filter, keys can be removed again.
+ * The two bucket indexes map onto each other with i2 = (h(fp) - i1) mod n,
+ * which works for any bucket count, so the table is sized to the expected
+ * number of users instead of the next power of two.
+ */
+#ifndef CUCKOO_FILTER_H
+#define CUCKOO_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#define CUCKOO_BUCKET_SLOTS 4
+#define CUCKOO_MAX_KICKS 500
+
+class CuckooFilter {
+public:
+  struct Stats {
+    size_t items;
+    size_t capacity;
+    size_t bytes;
+    uint64_t lookups;
+    uint64_t rejected; // lookups answered "not present"
+  };
+
+  explicit CuckooFilter(size_t capacity);
+  bool insert(const std::string &secid); // false when the filter is full
+  bool contains(const std::string &secid);
+  bool remove(const std::string &secid);
+  Stats stats();
+
+private:
+  struct Bucket {
+    uint16_t slot[CUCKOO_BUCKET_SLOTS];
+  };
+  std::vector<Bucket> m_buckets;
+  size_t m_items;
+  std::atomic<uint64_t> m_lookups;
+  std::atomic<uint64_t> m_rejected;
+  uint64_t m_rng;
+  struct {
+    bool used;
+    size_t index;
+    uint16_t fingerprint;
+  } m_victim; // item that could not be placed after CUCKOO_MAX_KICKS
+  std::shared_mutex m_mtx;
+
+  static uint64_t hashOf(const std::string &secid);
+  static uint16_t fingerprintOf(uint64_t hash);
+  size_t altIndex(size_t index, uint16_t fingerprint) const;
+  bool insertInto(size_t index, uint16_t fingerprint);
+  bool removeFrom(size_t index, uint16_t fingerprint);
+  bool bucketHas(size_t index, uint16_t fingerprint) const;
+};
+
+#endif // CUCKOO_FILTER_H
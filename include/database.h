@@ -1,40 +1,147 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
-#include "logger.h"
+#include "credential_store.h"
+#include "statement.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <sqlite3.h>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 using std::string;
-#define SALT_SIZE 10
-#define PASSWORD_SIZE 65
+#define SALT_SIZE 16     // bytes in a new salt, older salts are hex text
+#define PASSWORD_SIZE 32 // bytes of a SHA-256 digest
+#define SCHEMA_VERSION 1 // PRAGMA user_version, 0 is the hex text schema
+#define BACKUP_PAGES_PER_STEP 64
+#define BACKUP_MAX_PAGES_PER_SEC 4096
+#define BUSY_DEADLINE_MS 2000 // longest a statement waits for a lock
+#define BUSY_BASE_US 100      // first backoff, doubled on every retry
+#define BUSY_MAX_US 20000     // backoff cap
+#define PERSIST_INTERVAL_MS 1000 // default snapshot interval, memory-first
 
-class Database {
+class Database : public CredentialStore {
 public:
-  Database(const char *dbFile);
+  // With persist_interval_ms > 0 the database is memory-first: it is
+  // loaded from dbFile into memory and served from there, and a background
+  // thread writes a snapshot back to dbFile every persist_interval_ms when
+  // something changed. A crash loses at most the changes of one interval.
+  Database(const char *dbFile, int persist_interval_ms = 0);
   ~Database();
-  int getUserPassword(const string &secid, string &password);
-  int getUserSalt(const string &secid, string &salt);
-  int addUser(const string &secid, const string &password, const string &salt);
-  int deleteUser(const string &secid, const string &password);
-  int checkPassword(const string &secid, const string &password);
+  int getUserPassword(const string &secid, string &password) override;
+  int getUserSalt(const string &secid, string &salt) override;
+  int addUser(const string &secid, const string &password,
+              const string &salt) override;
+  int deleteUser(const string &secid, const string &password) override;
+  int checkPassword(const string &secid, const string &password) override;
   int updatePassword(const string &secid, const string &password,
-                     const string &salt);
+                     const string &salt) override;
+  int getCredentials(const std::vector<string> &secids,
+                     std::vector<CredentialCache::Entry> &entries,
+                     std::vector<int> &rcs) override;
+  int addUsers(const std::vector<NewUser> &users,
+               std::vector<int> &rcs) override;
 
-  void setLogger(Logger *log);
+  int backup(const char *destFile, BackupStats *stats = nullptr) override;
+  void setBackupRate(int pages_per_step, int max_pages_per_sec) override;
+  void enableCache(size_t capacity_bytes) override;
+  bool cacheStats(CredentialCache::Stats &stats) override;
+  int enableFilter(bool enable) override;
+  bool filterStats(CuckooFilter::Stats &stats) override;
+  int setChangeFeed(std::shared_ptr<ChangeFeed> feed) override;
+  // Call before the store is shared between threads. While it is on,
+  // lookups may be made from several threads at once.
+  int enableReadBatching(bool enable,
+                         int max_wait_us = READ_BATCH_MAX_WAIT_US) override;
+  bool readBatchStats(ReadBatcher::Stats &stats) override;
+  // Call before the store is shared between threads
+  int enableProfiling(bool enable) override;
+  bool profile(Profiler::Snapshot &snapshot) override;
+  // 0 returns SQLITE_BUSY at once
+  void setBusyDeadline(int deadline_ms) override;
+  bool busyStats(BusyStats &stats) override;
+  // Memory-first: writes a snapshot now, also done by the destructor
+  int persist();
+  bool persistStats(PersistStats &stats) override;
+
+  void setLogger(Logger *log) override;
+
+  // Creates the schema in a new database and migrates an older one
+  static int createSchema(sqlite3 *db);
+  // Registers hash_from_hex(), used when reading hex hashes of schema 0
+  static int addSqlFunctions(sqlite3 *db);
 
 private:
   Logger *m_log;
+  struct {
+    int pages_per_step = BACKUP_PAGES_PER_STEP;
+    int max_pages_per_sec = BACKUP_MAX_PAGES_PER_SEC; // 0 = unbounded
+  } m_backup;
+  std::unique_ptr<CredentialCache> m_cache;
+  std::shared_ptr<CuckooFilter> m_filter; // swapped atomically on rebuild
+  // db and its statements; held for a whole transaction, so a lookup from
+  // another thread never runs inside it. Taken before m_filter_mtx.
+  std::mutex m_conn_mtx;
+  std::mutex m_filter_mtx; // orders commits with filter and feed updates
+  std::atomic<int> m_busy_deadline_ms;
+  struct {
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> gave_up{0};
+    std::atomic<uint64_t> wait_us{0};
+    std::atomic<uint64_t> max_wait_us{0};
+  } m_busy;
+  struct {
+    string path;           // empty unless memory-first
+    int interval_ms;
+    sqlite3 *db = nullptr; // reads the snapshots, sees committed data only
+    std::thread thread;
+    std::mutex mtx;        // stop flag and stats
+    std::condition_variable cv;
+    bool stop = false;
+    std::mutex run_mtx;    // one snapshot at a time
+    std::atomic<sqlite3_int64> changes{0}; // total_changes at last snapshot
+    PersistStats stats = {};
+    std::chrono::steady_clock::time_point last;
+  } m_persist;
+  std::unique_ptr<ReadBatcher> m_batcher;
+  std::unique_ptr<Profiler> m_profiler;
+  std::shared_ptr<ChangeFeed> m_feed;
+  std::vector<ChangeFeed::Event> m_changes;   // of the open transaction
+  std::vector<ChangeFeed::Event> m_committed; // moved here by the commit hook
   sqlite3 *db;
-  sqlite3_stmt *check_password_stmt;
-  sqlite3_stmt *select_id_stmt;
-  sqlite3_stmt *delete_login_stmt;
-  sqlite3_stmt *delete_password_stmt;
-  sqlite3_stmt *add_login_stmt;
-  sqlite3_stmt *add_password_stmt;
-  sqlite3_stmt *get_password_stmt;
-  sqlite3_stmt *get_salt_stmt;
-  sqlite3_stmt *upd_salt_stmt;
-  sqlite3_stmt *upd_password_stmt;
+  Statement<int> check_password_stmt;
+  Statement<sqlite3_int64> select_id_stmt;
+  Statement<> delete_login_stmt;
+  Statement<> delete_password_stmt;
+  Statement<> add_login_stmt;
+  Statement<> add_password_stmt;
+  Statement<string> get_password_stmt;
+  Statement<string> get_salt_stmt;
+  Statement<> upd_salt_stmt;
+  Statement<> upd_password_stmt;
+  Statement<string, string> get_credentials_stmt;
+  Statement<string, string, string> get_credentials_batch_small_stmt;
+  Statement<string, string, string> get_credentials_batch_stmt;
+  int openInMemory(const char *dbFile);
+  void persistLoop();
+  int fail(const char *what, int rc,
+           Logger::LogLevel level = Logger::LogLevel::ERROR);
+  int loadCredentials(const string &secid, string &salt);
+  int fetchCredentials(
+      const std::vector<string> &secids,
+      std::unordered_map<string, CredentialCache::Entry> &found);
+  int buildFilter(size_t min_capacity);
+  bool knownUser(const string &secid);
+  void publishChanges();
+  static void feedChange(sqlite3_context *ctx, int argc, sqlite3_value **argv);
+  static int onBusy(void *self, int count);
+  static int onCommit(void *self);
+  static void onRollback(void *self);
 };
 
 #endif // DATABASE_H
@@ -0,0 +1,45 @@
+/*
+ * Executor runs tasks on one dedicated thread in the order they were posted.
+ * It is how a connection, or anything else that must not be used from two
+ * threads at once, gets its own thread: every use is posted to its
+ * executor. The destructor runs the tasks still queued, then joins.
+ */
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class Executor {
+public:
+  Executor();
+  ~Executor();
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  void post(std::function<void()> task);
+  // Runs f on the executor thread, the future holds its result
+  template <typename F> auto submit(F &&f) -> std::future<decltype(f())> {
+    using R = decltype(f());
+    auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+    std::future<R> result = task->get_future();
+    post([task] { (*task)(); });
+    return result;
+  }
+  size_t pending();
+
+private:
+  std::thread m_thread;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::deque<std::function<void()>> m_tasks;
+  bool m_stop;
+  void loop();
+};
+
+#endif // EXECUTOR_H
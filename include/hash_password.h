@@ -8,17 +8,122 @@
 #ifndef HASH_PASSWORD
 #define HASH_PASSWORD
 #include <string>
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <string_view>
 #include <vector>
 
+#define SHA256_BYTES 32
+
 class HashPassword{
 public:
-  static std::string usingSHA256(const std::string& text);
+  using Digest = std::array<uint8_t, SHA256_BYTES>;
+  // Incremental hashing of a message fed in pieces, see below
+  class Hasher;
+
+  // Hex encoded digest, 64 characters
+  static std::string usingSHA256(std::string_view text);
+  // Raw digest, SHA256_BYTES bytes. This is what the stores keep.
+  static std::string digestSHA256(std::string_view text);
+  // Digests of many independent messages, in order. With AVX2 or AVX-512
+  // they are hashed 8 or 16 at a time, one message per vector lane;
+  // messages of any length can be mixed. Otherwise one at a time.
+  static std::vector<std::string> digestSHA256Batch(
+      const std::vector<std::string_view>& messages);
+  static std::vector<std::string> usingSHA256Batch(
+      const std::vector<std::string_view>& messages);
+  // HMAC-SHA256 (RFC 2104) of message under key
+  static void hmacSHA256(std::string_view key, std::string_view message,
+                         Digest& mac);
+  // PBKDF2-HMAC-SHA256 (RFC 8018): length bytes derived from password and
+  // salt with iterations rounds, at least one. The HMAC pad blocks are
+  // compressed once per derivation, so an iteration costs two compressions.
+  static std::string pbkdf2SHA256(std::string_view password,
+                                  std::string_view salt, uint32_t iterations,
+                                  size_t length = SHA256_BYTES);
+  // Argon2id (RFC 9106), memory-hard: passes over memory_kib KiB of blocks,
+  // filled in lanes on as many threads. The memory comes from
+  // MemoryPool::shared(), empty if the pool can never hold it.
+  static std::string argon2id(std::string_view password,
+                              std::string_view salt, uint32_t passes,
+                              uint32_t memory_kib, uint32_t lanes = 1,
+                              size_t length = SHA256_BYTES);
+  static std::string toHex(const std::string& bytes);
+  // Writes 2 * n hex digits to hex, no terminator
+  static void toHex(const uint8_t* bytes, size_t n, char* hex);
+  // Decodes a 64 character hex digest as stored before hashes were kept as
+  // bytes. False, and bytes untouched, for anything else.
+  static bool fromHexDigest(const std::string& hex, std::string& bytes);
+
+  // Implementations of the compression function. The fastest one the CPU
+  // has is picked from CPUID (x86) or HWCAP (ARMv8) the first time a digest
+  // is taken, SCALAR runs everywhere. All give the same digests. AVX2 and
+  // AVX512 are multi-buffer and only used by the batch functions.
+  enum class Impl { SCALAR, SHA_NI, ARMV8, AVX2, AVX512 };
+  static bool supported(Impl impl);
+  static Impl implementation();
+  static const char* name(Impl impl);
+  // Switches implementation, for tests and benchmarks. False, and nothing
+  // changed, if the CPU lacks impl. Digests already running are not affected.
+  static bool useImplementation(Impl impl);
+  // AVX2 or AVX512 when the batch functions use them, else implementation().
+  // useBatchImplementation with any other impl hashes batches one at a time.
+  static Impl batchImplementation();
+  static bool useBatchImplementation(Impl impl);
 private:
+  // One message laid out as blocks for a multi-buffer lane
+  struct Lane;
+  // An HMAC key's ipad and opad blocks, compressed
+  struct HmacPads {
+    uint32_t inner[8];
+    uint32_t outer[8];
+  };
+  // Runs n 64 byte blocks through the compression function
+  using Compress = void (*)(uint32_t state[8], const uint8_t* blocks,
+                            size_t n);
   const static uint32_t h_init[8];
   const static uint32_t k[64];
-  static std::vector<uint8_t> padd(const std::string& text);
   static uint32_t rrot(const uint32_t v, const uint32_t n);
+  static Compress compressFor(Impl impl);
+  static std::atomic<Compress>& compressor();
+  static void compressScalar(uint32_t state[8], const uint8_t* blocks,
+                             size_t n);
+  static void compressSHANI(uint32_t state[8], const uint8_t* blocks,
+                            size_t n);
+  static void compressARMv8(uint32_t state[8], const uint8_t* blocks,
+                            size_t n);
+  static std::atomic<Impl>& batchImpl();
+  static void hmacPads(std::string_view key, HmacPads& pads);
+  static void hmac(const HmacPads& pads, std::string_view message,
+                   Digest& mac);
+  static void setLane(Lane& lane, std::string_view message);
+  static void digestAVX2(const Lane* lanes, char* const* digests);
+  static void digestAVX512(const Lane* lanes, char* const* digests);
+
+};
 
+/*
+ * SHA-256 of the concatenation of everything passed to update(), without
+ * building it: salt and password can be fed as they are. The state and the
+ * partial block live in the object, hashing never allocates. After final()
+ * the hasher must be init()ed before it is used again.
+ */
+class HashPassword::Hasher{
+public:
+  Hasher() { init(); }
+  void init();
+  Hasher& update(std::string_view data);
+  void final(Digest& digest);
+private:
+  friend class HashPassword;
+  // Continues after a compressed first block, as for HMAC
+  void resume(const uint32_t state[8]);
+  uint32_t m_state[8];
+  uint8_t m_block[64];
+  size_t m_used;
+  uint64_t m_length;
+  Compress m_compress;
 };
 #endif 
@@ -0,0 +1,71 @@
+/*
+ * HashPool runs password hashing on threads of its own, so the hash work
+ * of logins does not compete with socket and SQLite work on the request
+ * threads, and how much CPU goes to hashing is set by its thread count
+ * and, on Linux, the cores they are pinned to.
+ *
+ * A free worker takes the oldest job and starts on it at once. When it
+ * is a plain SHA-256 job and more of those are queued, it takes up to the
+ * SIMD width of the batch implementation (HashPassword::digestSHA256Batch)
+ * of them and hashes them in one batch. PBKDF2 and Argon2id jobs always
+ * run one at a time. The destructor runs the jobs still queued, then
+ * joins.
+ */
+#ifndef HASH_POOL_H
+#define HASH_POOL_H
+
+#include "hash_scheme.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HashPool {
+public:
+  struct Stats {
+    uint64_t jobs;
+    uint64_t batches;   // SHA-256 batches of more than one job
+    uint64_t batched;   // jobs hashed in those batches
+    uint64_t max_batch;
+    double meanBatch() const {
+      return batches ? static_cast<double>(batched) / batches : 0;
+    }
+  };
+
+  // threads workers, the i-th pinned to cpus[i % cpus.size()] if any
+  explicit HashPool(size_t threads, const std::vector<int> &cpus = {});
+  ~HashPool();
+  HashPool(const HashPool &) = delete;
+  HashPool &operator=(const HashPool &) = delete;
+
+  // What scheme.hash(pepper, password, salt, hashed) gives, as a future.
+  // The pool's copy of the password is cleared once it is hashed.
+  std::future<std::string> submit(const HashScheme &scheme,
+                                  std::string pepper, std::string password,
+                                  std::string salt);
+  Stats stats();
+  size_t threads() const { return m_threads.size(); }
+  // Jobs per batch: 16 with AVX-512, 8 with AVX2, otherwise 1
+  static size_t batchWidth();
+
+private:
+  struct Job {
+    HashScheme scheme;
+    std::string pepper, password, salt;
+    std::promise<std::string> result;
+  };
+  std::vector<std::thread> m_threads;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  std::deque<Job> m_jobs;
+  bool m_stop;
+  Stats m_stats;
+  void loop();
+  void run(std::vector<Job> &batch);
+};
+
+#endif // HASH_POOL_H
@@ -0,0 +1,69 @@
+/*
+ * HashScheme is the algorithm and cost a stored password hash was made
+ * with. It is kept in front of the user's salt, so every store keeps it
+ * without knowing about it: a versioned salt is HASH_SCHEME_MAGIC, the
+ * algorithm, the cost as 4 big-endian bytes and the SALT_SIZE random bytes.
+ * Any other salt is LEGACY_SHA256, one SHA-256 of the static salt, the
+ * password and the salt; those salts are SALT_SIZE random bytes or hex
+ * text, never a '$' followed by SALT_SIZE + 5 bytes.
+ */
+#ifndef HASH_SCHEME_H
+#define HASH_SCHEME_H
+
+#include <cstdint>
+#include <string>
+
+#define HASH_SCHEME_MAGIC '$'
+#define HASH_SCHEME_HEADER 6         // magic, algorithm, cost
+#define HASH_TARGET_MS 10            // default verification time to calibrate
+#define HASH_MIN_PBKDF2_ITERATIONS 1000
+#define HASH_COST_TOLERANCE 0.25
+#define HASH_ARGON2_PASSES 2         // t of a calibrated Argon2id
+#define HASH_ARGON2_MIN_MB 8
+#define HASH_ARGON2_MAX_MB 1024
+
+struct HashScheme {
+  // In order of strength, a rehash only ever moves up
+  enum Algorithm : uint8_t {
+    LEGACY_SHA256 = 0,
+    PBKDF2_SHA256 = 1,
+    ARGON2ID = 2
+  };
+  Algorithm algorithm = LEGACY_SHA256;
+  // PBKDF2 iterations, 0 for LEGACY_SHA256. For ARGON2ID the passes in
+  // the top 8 bits, the lanes - 1 in the next 4 and the MiB in the rest.
+  uint32_t cost = 0;
+
+  bool operator==(const HashScheme &other) const {
+    return algorithm == other.algorithm && cost == other.cost;
+  }
+  bool operator!=(const HashScheme &other) const { return !(*this == other); }
+  const char *name() const;
+  // Whether a hash made with this scheme should be redone with current:
+  // always to a stronger algorithm, never back, and for a cost more than
+  // HASH_COST_TOLERANCE away, so calibration noise between restarts does
+  // not rehash everyone. For Argon2id only the memory gets the tolerance.
+  bool needsRehash(const HashScheme &current) const;
+
+  static HashScheme argon2id(uint32_t passes, uint32_t memory_mb,
+                             uint32_t lanes);
+  uint32_t passes() const { return cost >> 24; }
+  uint32_t lanes() const { return (cost >> 20 & 0xf) + 1; }
+  uint32_t memoryMB() const { return cost & 0xfffff; }
+
+  // Splits a stored salt into its scheme and random salt. False for a
+  // versioned salt of an unknown algorithm or without a cost.
+  static bool decode(const std::string &stored, HashScheme &scheme,
+                     std::string &salt);
+  // The stored salt for a hash made with this scheme and salt
+  std::string encode(const std::string &salt) const;
+  // SHA256_BYTES of pepper + password under salt into hashed
+  void hash(const std::string &pepper, const std::string &password,
+            const std::string &salt, std::string &hashed) const;
+  // The scheme of algorithm whose hash takes about target_ms here. Argon2id
+  // keeps HASH_ARGON2_PASSES and lanes and calibrates the memory.
+  static HashScheme calibrate(Algorithm algorithm, double target_ms,
+                              uint32_t lanes = 1);
+};
+
+#endif // HASH_SCHEME_H
@@ -0,0 +1,151 @@
+/*
+ * LogStore is a log-structured credential engine. Every mutation appends one
+ * fixed-size record to the active segment file (path.000001, path.000002,
+ * ...). A hash index in a memory-mapped file (path.idx) maps each secid to
+ * the segment and record number of its latest record, and the segments are
+ * mapped read-only, so a lookup is one index probe plus one mapped read and a
+ * write is one append.
+ *
+ * The index header holds a checkpoint: the log position up to which the
+ * index is known to be on disk. On open the log tail after the checkpoint is
+ * replayed and a torn record at the end of a segment is cut off. The kernel
+ * writes changed index pages back in any order, so the first change after a
+ * checkpoint first marks the index dirty on disk. If the index is missing,
+ * dirty or does not match the log it is rebuilt from all segments.
+ *
+ * A background thread checkpoints the index and compacts sealed segments
+ * whose records are mostly overwritten or deleted: live records are copied
+ * to the active segment and the old segment file is removed.
+ */
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include "credential_store.h"
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+#define LOG_STORE_RECORD_SIZE 256
+#define LOG_STORE_SEGMENT_RECORDS 65536 // 16 MiB segments
+#define LOG_STORE_INIT_SLOTS 1024
+#define LOG_STORE_COMPACT_RATIO 0.5 // garbage share that triggers compaction
+#define LOG_STORE_COMPACT_CHUNK 1024 // records copied per hold of the lock
+#define LOG_STORE_INTERVAL_MS 1000  // checkpoint and compaction period
+
+class LogStore : public CredentialStore {
+public:
+  struct Stats {
+    size_t users;
+    size_t segments;
+    size_t records;     // records in all segments
+    size_t live;        // records the index points to
+    size_t compactions; // segments reclaimed since open
+    size_t index_bytes;
+  };
+
+  LogStore(const string &path, bool sync = false,
+           uint32_t segment_records = LOG_STORE_SEGMENT_RECORDS);
+  ~LogStore();
+  int getUserPassword(const string &secid, string &password) override;
+  int getUserSalt(const string &secid, string &salt) override;
+  int addUser(const string &secid, const string &password,
+              const string &salt) override;
+  int deleteUser(const string &secid, const string &password) override;
+  int checkPassword(const string &secid, const string &password) override;
+  int updatePassword(const string &secid, const string &password,
+                     const string &salt) override;
+  // Writes the current users as a new, compacted log at destFile
+  int backup(const char *destFile, BackupStats *stats = nullptr) override;
+
+  void setLogger(Logger *log) override;
+
+  // Compacts eligible sealed segments now, returns how many were removed
+  int compact();
+  // Syncs the log and the index and advances the checkpoint
+  int checkpoint();
+  Stats stats();
+
+private:
+  enum Op : uint8_t { OP_ADD = 'A', OP_UPDATE = 'U', OP_DELETE = 'D' };
+  // On-disk record, fields are not null terminated
+  struct Record {
+    uint32_t checksum; // FNV-1a over the rest of the record
+    uint8_t op;
+    uint8_t secid_len;
+    uint8_t salt_len;
+    uint8_t password_len;
+    char secid[128];
+    char salt[56];
+    char password[64];
+  };
+  static_assert(sizeof(Record) == LOG_STORE_RECORD_SIZE, "record layout");
+  struct Slot {
+    uint64_t hash; // 0 marks an empty slot
+    uint32_t segment;
+    uint32_t record;
+  };
+  struct IndexHeader {
+    uint64_t magic;
+    uint64_t slots;
+    uint64_t size;
+    uint32_t checkpoint_segment;
+    uint32_t checkpoint_record;
+    uint64_t dirty; // changed since the checkpoint, set on disk first
+    uint64_t reserved[3];
+  };
+  struct Segment {
+    int fd;
+    const char *map;
+    size_t map_bytes;
+    uint32_t records;
+    uint32_t live;
+  };
+
+  Logger *m_log;
+  string m_path;
+  bool m_sync;
+  uint32_t m_segment_records;
+  std::map<uint32_t, Segment> m_segments; // by sequence, last one is active
+  int m_index_fd;
+  IndexHeader *m_header;
+  Slot *m_slots;
+  size_t m_mask;
+  size_t m_compactions;
+  string m_recovery_note;
+  std::shared_mutex m_mtx;
+  std::mutex m_maintenance_mtx; // one compaction or checkpoint at a time
+
+  std::thread m_thread;
+  std::mutex m_thread_mtx;
+  std::condition_variable m_thread_cv;
+  bool m_stop;
+
+  static uint64_t hashOf(const char *secid, size_t len);
+  static uint32_t checksum(const Record &record);
+  string segmentPath(uint32_t seq) const;
+  void openSegment(uint32_t seq);
+  void closeSegment(Segment &segment);
+  const Record *recordAt(uint32_t seq, uint32_t record) const;
+  size_t find(const string &secid, uint64_t hash) const;
+  // sync = false leaves the record to the next checkpoint even with m_sync
+  int append(Op op, const string &secid, const string &salt,
+             const string &password, uint32_t &seq, uint32_t &record,
+             bool sync = true);
+  bool markDirty();
+  void put(size_t slot, uint64_t hash, uint32_t seq, uint32_t number);
+  void erase(size_t slot);
+  void release(uint32_t seq);
+  void apply(const Record &record, uint32_t seq, uint32_t number);
+  bool mapIndex(const string &file, size_t slots, bool create);
+  void unmapIndex();
+  bool reserve();
+  void recover();
+  bool replay(uint32_t from_seq, uint32_t from_record);
+  void loop();
+};
+
+#endif // LOG_STORE_H
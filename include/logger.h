@@ -1,6 +1,8 @@
 #ifndef LOGGER_H
 #define LOGGER_H
+#include <atomic>
 #include <fstream>
+#include <mutex>
 #include <string>
 //#include <sys/_types/_u_int32_t.h>
 #include <cstdint>
@@ -16,10 +18,13 @@ public:
   ~Logger();
   void outFilePath(string fpath);
   void level(LogLevel level);
+  // Safe to call from several threads, a line is formatted by the calling
+  // thread and only its write is serialized
   void entry(LogLevel const &level, std::string const &text);
 
 private:
-  LogLevel m_level;
+  std::atomic<LogLevel> m_level;
+  std::mutex m_mtx; // m_out and m_file
   LogOut m_out;
   u_int32_t m_limit_buffer; // nr of entries before content is flushed to output
   u_int32_t m_current_buffer;
@@ -1,14 +1,37 @@
 #ifndef LOGIN_MANAGER_H
 #define LOGIN_MANAGER_H
 
+#include "credential_store.h"
 #include "database.h"
+#include "executor.h"
+#include "hash_pool.h"
+#include "hash_scheme.h"
 #include "logger.h"
-#include <random>
+#include "single_flight.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+#define LOGIN_WRITE_LOCKS 16
+#define LOGIN_VERIFY_ATTEMPTS 3 // checks while the salt changes under a login
+
+struct RehashStats {
+  uint64_t rehashed; // logins moved to the current hash scheme
+  uint64_t skipped;  // password changed or user deleted before the rehash
+  uint64_t failed;   // the store refused the update
+};
+
+struct Credential {
+  std::string username;
+  std::string password;
+};
 
 class LoginManager {
 public:
   LoginManager(const std::string &dbFile);
+  LoginManager(std::unique_ptr<CredentialStore> store);
   void logToFile(string const &fpath);
   void setLogLevel(Logger::LogLevel const &level);
   void logToStdout();
@@ -18,18 +41,84 @@ public:
   int addLogin(const std::string &username, const std::string &password);
   int delLogin(const std::string &username, const std::string &password);
   int changePassword(const std::string &username, const std::string &password);
+  // login and addLogin for many users at once, results in input order. The
+  // salts are read in one pass over the store and hashed together; the
+  // users are added in one transaction where the store supports it.
+  std::vector<int> loginBatch(const std::vector<Credential> &credentials);
+  std::vector<int> addLogins(const std::vector<Credential> &credentials);
+  int backup(const std::string &path, BackupStats *stats = nullptr);
+  void setBackupRate(int pages_per_step, int max_pages_per_sec);
+  void setCacheSize(size_t capacity_bytes);
+  bool cacheStats(CredentialCache::Stats &stats);
+  int enableUserFilter(bool enable);
+  bool userFilterStats(CuckooFilter::Stats &stats);
+  int setChangeFeed(std::shared_ptr<ChangeFeed> feed);
+  int enableReadBatching(bool enable,
+                         int max_wait_us = READ_BATCH_MAX_WAIT_US);
+  bool readBatchStats(ReadBatcher::Stats &stats);
+  int enableProfiling(bool enable);
+  bool profile(Profiler::Snapshot &snapshot);
+  void setBusyDeadline(int deadline_ms);
+  bool busyStats(BusyStats &stats);
+  bool persistStats(PersistStats &stats);
+  // Logins answered by an identical login already running
+  SingleFlight::Stats loginFlightStats();
+  // Scheme for new and changed passwords, may be changed while serving. A
+  // login that succeeds on an outdated scheme (HashScheme::needsRehash) is
+  // rehashed in the background.
+  void setHashScheme(const HashScheme &scheme);
+  HashScheme hashScheme() const;
+  RehashStats rehashStats() const;
+  // Hashes on a HashPool of threads pinned to cpus (any CPU if empty)
+  // instead of the calling thread; 0 threads hashes inline again. Hashes
+  // already submitted finish on the old pool.
+  void enableHashPool(size_t threads, const std::vector<int> &cpus = {});
+  bool hashPoolStats(HashPool::Stats &stats);
 
 private:
-  Database m_db;
+  std::unique_ptr<CredentialStore> m_store;
   std::string const STATIC_SALT = "42";
-  std::mt19937 m_salt_generator;
+  SingleFlight m_logins;
+  std::string m_flight_key; // random, keys the password digest of m_logins
   Logger m_log;
   void *pm_api_status;
+  std::atomic<HashScheme> m_scheme;
+  // Order a user's rehash against changes of the same user, by username
+  std::mutex m_write_mtx[LOGIN_WRITE_LOCKS];
+  // Per lock, odd while a password is being replaced
+  std::atomic<uint64_t> m_write_seq[LOGIN_WRITE_LOCKS] = {};
+  std::atomic<uint64_t> m_rehashed{0}, m_rehash_skipped{0},
+      m_rehash_failed{0};
+  std::shared_ptr<HashPool> m_hash_pool; // swapped atomically
+  Executor m_rehasher; // last, its tasks use the members above
+  int verify(const std::string &username, const std::string &password);
+  // Queues a rehash; the task holds the only copy of password
+  void postRehash(const std::string &username, const std::string &password,
+                  const std::string &stored_salt);
+  // Wipes password once it is hashed
+  void rehash(const std::string &username, std::string &password,
+              const std::string &stored_salt);
+  // scheme.hash with the static salt, on the hash pool if there is one
+  void hash(const HashScheme &scheme, const std::string &password,
+            const std::string &salt, std::string &hashed);
+  // hash for every item, plain SHA-256 ones SIMD batched when inline
+  void hashBatch(const std::vector<HashScheme> &schemes,
+                 const std::vector<const std::string *> &passwords,
+                 const std::vector<std::string> &salts,
+                 std::vector<std::string> &hashed);
+  // The hash of pw for usid under the scheme its stored salt names
   bool getHashedPassword(const std::string &usid, const std::string &pw,
-                         std::string &hashed_pw);
+                         std::string &hashed_pw,
+                         std::string *stored_salt = nullptr,
+                         HashScheme *scheme = nullptr);
+  size_t writeStripe(const std::string &username);
+  std::mutex &writeLock(const std::string &username);
+  // updatePassword under writeLock(username), counted in m_write_seq
+  int replacePassword(const std::string &username,
+                      const std::string &hashed_pw,
+                      const std::string &stored_salt);
   bool getSalt(const std::string &username, std::string &salt);
   std::string generateSalt();
-  void hash(const std::string &input, std::string &output);
 };
 
 #endif // LOGIN_MANAGER_H
@@ -0,0 +1,76 @@
+/*
+ * MemoryPool hands out large working buffers, such as the blocks of a
+ * memory-hard hash, from a fixed budget of bytes. Released buffers are
+ * kept for the next acquire of the same size instead of being freed, so
+ * steady use never reaches the allocator. An acquire that does not fit in
+ * the budget frees cached buffers of other sizes, and if that is not
+ * enough it waits for a release: how many hashes run at once is bounded
+ * by memory, not by the number of threads asking.
+ */
+#ifndef MEMORY_POOL_H
+#define MEMORY_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#define MEMORY_POOL_MB 256 // budget of MemoryPool::shared()
+#define MEMORY_POOL_ALIGN 64
+
+class MemoryPool {
+public:
+  struct Stats {
+    size_t budget;
+    size_t in_use;          // bytes held by leases
+    size_t cached;          // bytes kept for reuse
+    uint64_t acquires;
+    uint64_t allocations;   // acquires that had to allocate
+    uint64_t waits;         // acquires that waited for a release
+    double wait_seconds;
+  };
+
+  // A buffer owned until the lease is destroyed. Empty if the request was
+  // larger than the whole budget.
+  class Lease {
+  public:
+    Lease() = default;
+    Lease(Lease &&other) noexcept;
+    Lease &operator=(Lease &&other) noexcept;
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    ~Lease();
+    void *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    explicit operator bool() const { return m_data != nullptr; }
+
+  private:
+    friend class MemoryPool;
+    MemoryPool *m_pool = nullptr;
+    void *m_data = nullptr;
+    size_t m_size = 0;
+  };
+
+  explicit MemoryPool(size_t budget_bytes);
+  ~MemoryPool();
+  MemoryPool(const MemoryPool &) = delete;
+  MemoryPool &operator=(const MemoryPool &) = delete;
+
+  Lease acquire(size_t bytes);
+  // Raising the budget wakes waiters, lowering it lets leases drain
+  void setBudget(size_t budget_bytes);
+  Stats stats();
+  // Process-wide pool, MEMORY_POOL_MB until setBudget
+  static MemoryPool &shared();
+
+private:
+  std::mutex m_mtx;
+  std::condition_variable m_released;
+  std::multimap<size_t, void *> m_free; // cached buffers by size
+  Stats m_stats;
+  void release(void *data, size_t size);
+  void trim(size_t need); // frees cached buffers until need fits
+};
+
+#endif // MEMORY_POOL_H
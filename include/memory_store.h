@@ -0,0 +1,75 @@
+/*
+ * MemoryStore keeps all credentials in an open-addressing hash table with
+ * linear probing. The probe sequence only touches a packed array of 64-bit
+ * hashes, eight slots per cache line; the record itself is only read when a
+ * hash matches. Deletes use backward shifting, so no tombstones build up.
+ *
+ * Given a file path, every mutation is appended to it before it is applied
+ * (append-only file) and the file is replayed at startup. Records carry a
+ * checksum and a torn record at the end of the file is cut off on replay.
+ * A record that fails to be written or synced is cut off at once, so later
+ * records never follow a broken one.
+ * Without a path the store is ephemeral.
+ */
+#ifndef MEMORY_STORE_H
+#define MEMORY_STORE_H
+
+#include "credential_store.h"
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#define MEMORY_STORE_INIT_SLOTS 1024
+
+class MemoryStore : public CredentialStore {
+public:
+  MemoryStore(const string &aofFile = "", bool sync = false);
+  ~MemoryStore();
+  int getUserPassword(const string &secid, string &password) override;
+  int getUserSalt(const string &secid, string &salt) override;
+  int addUser(const string &secid, const string &password,
+              const string &salt) override;
+  int deleteUser(const string &secid, const string &password) override;
+  int checkPassword(const string &secid, const string &password) override;
+  int updatePassword(const string &secid, const string &password,
+                     const string &salt) override;
+  // Writes a compacted append-only file with the current users
+  int backup(const char *destFile, BackupStats *stats = nullptr) override;
+
+  void setLogger(Logger *log) override;
+
+private:
+  struct Record {
+    string secid;
+    string salt;
+    string password;
+  };
+  enum AofOp : uint8_t { AOF_ADD = 'A', AOF_UPDATE = 'U', AOF_DELETE = 'D' };
+
+  Logger *m_log;
+  std::vector<uint64_t> m_hashes; // 0 marks an empty slot
+  std::vector<Record> m_records;
+  size_t m_size;
+  size_t m_mask;
+  int m_aof_fd;
+  off_t m_aof_size;  // end of the last complete record
+  bool m_aof_broken; // a failed record could not be cut off, no more writes
+  bool m_sync;
+  string m_replay_note;
+  std::shared_mutex m_mtx;
+
+  static uint64_t hashOf(const string &secid);
+  size_t find(const string &secid, uint64_t hash) const;
+  void insert(uint64_t hash, Record &&record);
+  void erase(size_t slot);
+  void grow();
+  void apply(AofOp op, Record &&record);
+  int append(AofOp op, const Record &record);
+  int discardAppend(const char *what);
+  void replay(const string &aofFile);
+  static string encode(AofOp op, const Record &record);
+};
+
+#endif // MEMORY_STORE_H
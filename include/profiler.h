@@ -0,0 +1,93 @@
+/*
+ * Profiler records a latency histogram for every statement run on one
+ * SQLite connection, from the SQLITE_TRACE_STMT and SQLITE_TRACE_PROFILE
+ * events of sqlite3_trace_v2, and samples the connection's sqlite3_db_status
+ * counters (page cache hits, misses, writes and spills, lookaside use) at
+ * most every PROFILE_SAMPLE_MS from the same callback. A trace event costs one map
+ * lookup and a few counter updates, so it can stay on in production.
+ *
+ * The time SQLite passes with TRACE_PROFILE comes from the VFS clock, which
+ * has millisecond resolution, so runs are timed from their TRACE_STMT event
+ * with steady_clock instead.
+ *
+ * Histogram buckets are powers of two in microseconds: bucket 0 holds runs
+ * under 2 us, bucket i runs of [2^i, 2^(i+1)) us.
+ */
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define PROFILE_BUCKETS 24
+#define PROFILE_SAMPLE_MS 1000
+
+class Profiler {
+public:
+  struct Histogram {
+    std::string name;
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t buckets[PROFILE_BUCKETS] = {};
+    // Upper bound in microseconds of the bucket holding percentile p
+    double percentile(double p) const;
+    double meanMicros() const { return count ? total_ns / 1000.0 / count : 0; }
+  };
+  // Counts are totals since profiling started, the rest current values
+  struct DbStatus {
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    uint64_t cache_writes = 0;
+    uint64_t cache_spills = 0;
+    uint64_t cache_bytes = 0;
+    uint64_t lookaside_slots_used = 0;
+    uint64_t lookaside_hits = 0;
+    uint64_t lookaside_misses = 0;
+    uint64_t samples = 0;
+    double cacheHitRate() const {
+      uint64_t total = cache_hits + cache_misses;
+      return total ? static_cast<double>(cache_hits) / total : 0;
+    }
+  };
+  struct Snapshot {
+    std::vector<Histogram> statements;
+    DbStatus status;
+  };
+
+  explicit Profiler(sqlite3 *db);
+  ~Profiler();
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+
+  // Names a statement that lives as long as the profiler. Other statements
+  // are recorded under their SQL text.
+  void name(sqlite3_stmt *stmt, const std::string &name);
+  // Takes a fresh status sample, statements sorted by total time
+  Snapshot snapshot();
+  // Adds from into into, statements are matched by name
+  static void merge(Snapshot &into, const Snapshot &from);
+
+private:
+  sqlite3 *m_db;
+  std::mutex m_mtx;
+  std::map<std::string, Histogram> m_statements; // by name, nodes are stable
+  std::unordered_map<sqlite3_stmt *, Histogram *> m_named;
+  std::unordered_map<sqlite3_stmt *, std::chrono::steady_clock::time_point>
+      m_started;
+  DbStatus m_status;
+  std::chrono::steady_clock::time_point m_last_sample;
+
+  static int onTrace(unsigned type, void *self, void *stmt, void *arg);
+  void start(sqlite3_stmt *stmt, const char *sql);
+  void record(sqlite3_stmt *stmt, uint64_t sqlite_ns);
+  void sample();
+};
+
+#endif // PROFILER_H
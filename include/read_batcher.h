@@ -0,0 +1,80 @@
+/*
+ * ReadBatcher coalesces credential lookups made at the same time by several
+ * threads into one query. Callers block in lookup(); one of them becomes
+ * the leader, collects the secids that are waiting, resolves them with a
+ * single fetch (an IN-list SELECT in Database) and hands every caller its
+ * row.
+ *
+ * Lookups that arrive while a fetch runs form the next batch by themselves.
+ * On top of that the leader may wait a short window for more callers, and
+ * stops early once READ_BATCH_IDLE_US pass without one or the batch holds
+ * READ_BATCH_MAX. The window adapts to load: it doubles while batches hold
+ * several lookups, up to max_wait_us, and halves down to 0 while they hold
+ * one, so a lone login never waits.
+ */
+#ifndef READ_BATCHER_H
+#define READ_BATCHER_H
+
+#include "credential_cache.h"
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define READ_BATCH_MAX 64          // secids per fetch
+#define READ_BATCH_SMALL 8         // IN-list length for small batches
+#define READ_BATCH_MAX_WAIT_US 200 // default longest collection window
+#define READ_BATCH_MIN_WAIT_US 10  // smallest non-zero window
+#define READ_BATCH_IDLE_US 20      // no new lookup for this long ends a wait
+
+class ReadBatcher {
+public:
+  using Entry = CredentialCache::Entry;
+  // Resolves distinct secids, found gets a row per existing user. Returns
+  // SQLITE_OK or the error every caller in the batch receives.
+  using Fetch =
+      std::function<int(const std::vector<std::string> &secids,
+                        std::unordered_map<std::string, Entry> &found)>;
+  struct Stats {
+    uint64_t lookups;
+    uint64_t batches;
+    uint64_t max_batch;
+    uint64_t wait_us; // current collection window
+    double meanBatch() const {
+      return batches ? static_cast<double>(lookups) / batches : 0;
+    }
+  };
+
+  ReadBatcher(Fetch fetch, int max_wait_us = READ_BATCH_MAX_WAIT_US);
+  ReadBatcher(const ReadBatcher &) = delete;
+  ReadBatcher &operator=(const ReadBatcher &) = delete;
+
+  // SQLITE_OK with the entry, SQLITE_DONE when secid is not a user
+  int lookup(const std::string &secid, Entry &entry);
+  Stats stats();
+
+private:
+  struct Pending {
+    const std::string *secid;
+    Entry *entry;
+    int rc;
+    bool done;
+  };
+
+  Fetch m_fetch;
+  const uint64_t m_max_wait_us;
+  std::mutex m_mtx;
+  std::condition_variable m_cv;      // batch done, a new leader may be needed
+  std::condition_variable m_arrival; // the collecting leader waits here
+  std::vector<Pending *> m_queue;
+  bool m_leading; // a caller is collecting or fetching a batch
+  uint64_t m_wait_us;
+  Stats m_stats;
+
+  void lead(std::unique_lock<std::mutex> &lock);
+};
+
+#endif // READ_BATCHER_H
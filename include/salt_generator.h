@@ -0,0 +1,35 @@
+/*
+ * SaltGenerator makes random salts from a ChaCha20 keystream kept per
+ * thread. Each thread seeds its own key from the kernel (getrandom) the
+ * first time it asks, then refills a small buffer of keystream when it
+ * runs out, so a salt is a copy out of that buffer: no lock, no system
+ * call, no allocation. The first 32 bytes of every refill become the next
+ * key and used bytes are wiped, so a later memory leak does not reveal
+ * earlier salts. The key is reseeded from the kernel every
+ * SALT_RESEED_BYTES, and in a child process after fork, whose threads
+ * would otherwise repeat their parent's keystream.
+ */
+#ifndef SALT_GENERATOR_H
+#define SALT_GENERATOR_H
+
+#include "database.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#define SALT_BUFFER_BLOCKS 16           // ChaCha20 blocks per refill
+#define SALT_RESEED_BYTES (1 << 20)     // keystream between kernel reseeds
+
+class SaltGenerator {
+public:
+  using Salt = std::array<uint8_t, SALT_SIZE>;
+
+  // n random bytes into out. False only if the kernel gave no seed.
+  static bool fill(void *out, size_t n);
+  static bool generate(Salt &salt) { return fill(salt.data(), salt.size()); }
+  // The ChaCha20 block function (RFC 8439 2.3)
+  static void chacha20Block(const uint32_t key[8], uint32_t counter,
+                            const uint32_t nonce[3], uint8_t out[64]);
+};
+
+#endif // SALT_GENERATOR_H
@@ -0,0 +1,83 @@
+/*
+ * ShardedStore spreads users over N SQLite files by a stable hash of the
+ * secid. SQLite allows one writer per file, so with N files N mutations can
+ * commit at the same time.
+ *
+ * Each shard has its own Database (connection) and its own writer thread.
+ * addUser, updatePassword and deleteUser are queued to the writer of the
+ * user's shard and the caller waits for the result; lookups run directly on
+ * the calling thread.
+ *
+ * Shard files are named after the configured path: login.db with 4 shards
+ * is login.0-of-4.db ... login.3-of-4.db. A changed shard count therefore
+ * never reads a layout it was not written with; use reshard() to move the
+ * users over first.
+ */
+#ifndef SHARDED_STORE_H
+#define SHARDED_STORE_H
+
+#include "database.h"
+#include "executor.h"
+#include <memory>
+#include <vector>
+
+#define RESHARD_BATCH 10000 // users per commit when resharding
+
+class ShardedStore : public CredentialStore {
+public:
+  // persist_interval_ms > 0 makes every shard memory-first, see Database
+  ShardedStore(const string &dbFile, int shards, int persist_interval_ms = 0);
+  ~ShardedStore();
+  int getUserPassword(const string &secid, string &password) override;
+  int getUserSalt(const string &secid, string &salt) override;
+  int addUser(const string &secid, const string &password,
+              const string &salt) override;
+  int deleteUser(const string &secid, const string &password) override;
+  int checkPassword(const string &secid, const string &password) override;
+  int updatePassword(const string &secid, const string &password,
+                     const string &salt) override;
+  // Split by shard; adds commit one transaction per shard, in parallel
+  int getCredentials(const std::vector<string> &secids,
+                     std::vector<CredentialCache::Entry> &entries,
+                     std::vector<int> &rcs) override;
+  int addUsers(const std::vector<NewUser> &users,
+               std::vector<int> &rcs) override;
+
+  // Backs up every shard, into destFile named like the shard files
+  int backup(const char *destFile, BackupStats *stats = nullptr) override;
+  void setBackupRate(int pages_per_step, int max_pages_per_sec) override;
+  void enableCache(size_t capacity_bytes) override;
+  bool cacheStats(CredentialCache::Stats &stats) override;
+  int enableFilter(bool enable) override;
+  bool filterStats(CuckooFilter::Stats &stats) override;
+  int setChangeFeed(std::shared_ptr<ChangeFeed> feed) override;
+  int enableReadBatching(bool enable,
+                         int max_wait_us = READ_BATCH_MAX_WAIT_US) override;
+  bool readBatchStats(ReadBatcher::Stats &stats) override;
+  int enableProfiling(bool enable) override;
+  bool profile(Profiler::Snapshot &snapshot) override;
+  void setBusyDeadline(int deadline_ms) override;
+  bool busyStats(BusyStats &stats) override;
+  bool persistStats(PersistStats &stats) override;
+
+  void setLogger(Logger *log) override;
+
+  static string shardPath(const string &dbFile, int shard, int shards);
+  static int shardOf(const string &secid, int shards);
+  // Offline copy of all users from one layout into another. A shard count
+  // of 1 means the plain, unsharded file.
+  static int reshard(const string &srcFile, int srcShards,
+                     const string &dstFile, int dstShards, Logger *log);
+
+private:
+  struct Shard {
+    std::unique_ptr<Database> db;
+    std::unique_ptr<Executor> writer;
+  };
+
+  Logger *m_log;
+  std::vector<Shard> m_shards;
+  Shard &shardFor(const string &secid);
+};
+
+#endif // SHARDED_STORE_H
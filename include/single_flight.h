@@ -0,0 +1,46 @@
+/*
+ * SingleFlight lets concurrent identical calls share one execution. The
+ * first caller with a key runs the function; callers that arrive with the
+ * same key while it runs wait for it and get its result. Once the call
+ * has returned the key is forgotten, later callers run it again, so a
+ * result is never older than the call it was shared with.
+ *
+ * The keys are spread over SINGLE_FLIGHT_SHARDS maps with a lock each, so
+ * unrelated calls rarely meet on a lock.
+ *
+ * Keys are kept only while their call runs. They should not hold secrets,
+ * LoginManager uses the username and a keyed digest of the password.
+ */
+#ifndef SINGLE_FLIGHT_H
+#define SINGLE_FLIGHT_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define SINGLE_FLIGHT_SHARDS 16
+
+class SingleFlight {
+public:
+  struct Stats {
+    uint64_t calls;
+    uint64_t shared; // calls answered by a call already in flight
+  };
+
+  int run(const std::string &key, const std::function<int()> &call);
+  Stats stats();
+
+private:
+  struct alignas(64) Shard {
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_future<int>> flights;
+    Stats stats = {};
+  };
+  std::array<Shard, SINGLE_FLIGHT_SHARDS> m_shards;
+};
+
+#endif // SINGLE_FLIGHT_H
@@ -0,0 +1,197 @@
+/*
+ * Statement wraps a prepared SQLite statement whose result columns have the
+ * types given as template arguments:
+ *
+ *   Statement<string, string> get_credentials;
+ *   get_credentials.prepare(db, "SELECT salt, password ... :secid;",
+ *                           {":secid"});
+ *   auto scope = get_credentials.bind(secid);
+ *   if (scope.step() == SQLITE_ROW) {
+ *     std::tie(salt, password) = scope.row();
+ *   }
+ *
+ * Parameter indices are looked up once in prepare(). bind() takes the values
+ * in the order the names were given there. Text is bound with SQLITE_STATIC,
+ * so SQLite does not copy it; the caller's strings must outlive the returned
+ * Scope, which resets the statement and clears its bindings when it goes out
+ * of scope. Passing a temporary std::string does not compile. Wrap bytes
+ * that are not text in Blob to bind them as a BLOB. bindRange() binds a
+ * list to positional parameters, for IN lists of a fixed length.
+ *
+ * Transaction runs BEGIN IMMEDIATE and rolls back in its destructor unless
+ * commit() succeeded.
+ */
+#ifndef STATEMENT_H
+#define STATEMENT_H
+
+#include <cstddef>
+#include <initializer_list>
+#include <sqlite3.h>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Binds its bytes as a BLOB instead of TEXT, also not copied
+struct Blob {
+  explicit Blob(std::string_view data) : bytes(data) {}
+  std::string_view bytes;
+};
+
+template <typename... Columns> class Statement {
+public:
+  using Row = std::tuple<Columns...>;
+
+  class Scope {
+  public:
+    Scope(sqlite3_stmt *stmt, int rc) : m_stmt(stmt), m_rc(rc) {}
+    Scope(Scope &&other) : m_stmt(other.m_stmt), m_rc(other.m_rc) {
+      other.m_stmt = nullptr;
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    ~Scope() {
+      if (m_stmt) {
+        sqlite3_reset(m_stmt);
+        sqlite3_clear_bindings(m_stmt);
+      }
+    }
+
+    // SQLITE_ROW, SQLITE_DONE or an error, including a failed bind
+    int step() { return m_rc != SQLITE_OK ? m_rc : sqlite3_step(m_stmt); }
+    // Columns of the current row, valid after step() returned SQLITE_ROW
+    Row row() const { return read(std::index_sequence_for<Columns...>{}); }
+
+  private:
+    sqlite3_stmt *m_stmt;
+    int m_rc;
+
+    template <size_t... I> Row read(std::index_sequence<I...>) const {
+      Row row;
+      (column(static_cast<int>(I), std::get<I>(row)), ...);
+      return row;
+    }
+    void column(int i, int &out) const { out = sqlite3_column_int(m_stmt, i); }
+    void column(int i, sqlite3_int64 &out) const {
+      out = sqlite3_column_int64(m_stmt, i);
+    }
+    // TEXT or BLOB, the bytes are read as stored
+    void column(int i, std::string &out) const {
+      const void *data = sqlite3_column_type(m_stmt, i) == SQLITE_BLOB
+                             ? sqlite3_column_blob(m_stmt, i)
+                             : sqlite3_column_text(m_stmt, i);
+      const char *bytes = static_cast<const char *>(data);
+      out.assign(bytes ? bytes : "", sqlite3_column_bytes(m_stmt, i));
+    }
+  };
+
+  Statement() : m_stmt(nullptr) {}
+  Statement(const Statement &) = delete;
+  Statement &operator=(const Statement &) = delete;
+  ~Statement() { sqlite3_finalize(m_stmt); }
+
+  // Compiles sql and resolves the named parameters. SQLITE_RANGE when a
+  // name is not in sql, SQLITE_MISMATCH when the column count is not
+  // the number of Columns.
+  int prepare(sqlite3 *db, const char *sql,
+              std::initializer_list<const char *> params) {
+    sqlite3_finalize(m_stmt);
+    m_indices.clear();
+    int rc = sqlite3_prepare_v2(db, sql, -1, &m_stmt, nullptr);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+    for (const char *name : params) {
+      int index = sqlite3_bind_parameter_index(m_stmt, name);
+      if (index == 0) {
+        return SQLITE_RANGE;
+      }
+      m_indices.push_back(index);
+    }
+    if (sqlite3_column_count(m_stmt) != sizeof...(Columns)) {
+      return SQLITE_MISMATCH;
+    }
+    return SQLITE_OK;
+  }
+
+  sqlite3_stmt *handle() const { return m_stmt; }
+
+  template <typename... Args> Scope bind(Args &&...args) {
+    // The text is not copied, a temporary string would be gone before step()
+    static_assert(
+        (... && (std::is_lvalue_reference<Args>::value ||
+                 !std::is_same<std::decay_t<Args>, std::string>::value)),
+        "bind() needs strings that outlive the Scope");
+    int rc = sizeof...(Args) == m_indices.size() ? SQLITE_OK : SQLITE_RANGE;
+    size_t i = 0;
+    ((rc = rc == SQLITE_OK ? bindValue(m_indices[i++], args) : rc), ...);
+    return Scope(m_stmt, rc);
+  }
+
+  // Binds values to ?1, ?2, ... in order, the parameters left over stay
+  // NULL. SQLITE_RANGE when there are more values than parameters.
+  Scope bindRange(const std::vector<std::string> &values) {
+    int rc = values.size() <= static_cast<size_t>(
+                                  sqlite3_bind_parameter_count(m_stmt))
+                 ? SQLITE_OK
+                 : SQLITE_RANGE;
+    for (size_t i = 0; rc == SQLITE_OK && i < values.size(); i++) {
+      rc = bindValue(static_cast<int>(i) + 1, values[i]);
+    }
+    return Scope(m_stmt, rc);
+  }
+
+private:
+  sqlite3_stmt *m_stmt;
+  std::vector<int> m_indices;
+
+  int bindValue(int index, std::string_view value) {
+    // An empty view may have no data pointer, which SQLite would bind as NULL
+    return sqlite3_bind_text(m_stmt, index, value.data() ? value.data() : "",
+                             static_cast<int>(value.size()), SQLITE_STATIC);
+  }
+  int bindValue(int index, Blob value) {
+    return sqlite3_bind_blob(m_stmt, index,
+                             value.bytes.data() ? value.bytes.data() : "",
+                             static_cast<int>(value.bytes.size()),
+                             SQLITE_STATIC);
+  }
+  int bindValue(int index, int value) {
+    return sqlite3_bind_int(m_stmt, index, value);
+  }
+  int bindValue(int index, sqlite3_int64 value) {
+    return sqlite3_bind_int64(m_stmt, index, value);
+  }
+};
+
+class Transaction {
+public:
+  explicit Transaction(sqlite3 *db) : m_db(db), m_open(false) {}
+  Transaction(const Transaction &) = delete;
+  Transaction &operator=(const Transaction &) = delete;
+  ~Transaction() {
+    if (m_open) {
+      sqlite3_exec(m_db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    }
+  }
+
+  int begin() {
+    int rc = sqlite3_exec(m_db, "BEGIN IMMEDIATE TRANSACTION;", nullptr,
+                          nullptr, nullptr);
+    m_open = rc == SQLITE_OK;
+    return rc;
+  }
+  int commit() {
+    int rc = sqlite3_exec(m_db, "COMMIT;", nullptr, nullptr, nullptr);
+    m_open = rc != SQLITE_OK && !sqlite3_get_autocommit(m_db);
+    return rc;
+  }
+
+private:
+  sqlite3 *m_db;
+  bool m_open;
+};
+
+#endif // STATEMENT_H
@@ -2,6 +2,7 @@
 #define UDP_SERVER_H
 
 #include "login_manager.h"
+#include <condition_variable>
 #include <mutex>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -13,9 +14,10 @@ public:
 
 private:
   struct Status {
-    int control;
-    int current_transactions;
+    int control;              // guarded by mtx
+    int current_transactions; // handlers running, guarded by mtx
     std::mutex mtx;
+    std::condition_variable idle; // current_transactions reached 0
     Status() : control(0x10), current_transactions(0) {}
   };
   struct Operation {
@@ -37,7 +39,7 @@ private:
   };
   static void listen(int sockfd, sockaddr_in servaddr, Status *st,
                      LoginManager &lm);
-  static void handle_client(Operation *op, const int sockfd);
+  static void handle_client(Operation *op, const int sockfd, Status *st);
   static int addTransaction(Status &st);
   static int delTransaction(Status &st);
   static int getTransactions(Status &st);
@@ -0,0 +1,436 @@
+#include "argon2.h"
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/*
+ * BLAKE2b (RFC 7693), unkeyed, which Argon2 uses for its initial hash and
+ * the variable-length hash H'.
+ */
+const uint64_t blake2b_iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+    0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL};
+const uint8_t blake2b_sigma[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}};
+
+inline uint64_t rotr64(uint64_t v, int n) { return (v >> n) | (v << (64 - n)); }
+
+inline uint64_t load64(const uint8_t *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = v << 8 | p[i];
+  }
+  return v;
+}
+
+inline void store32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = static_cast<uint8_t>(v >> (8 * i));
+  }
+}
+
+inline void store64(uint8_t *p, uint64_t v) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = static_cast<uint8_t>(v >> (8 * i));
+  }
+}
+
+class Blake2b {
+public:
+  explicit Blake2b(size_t out_length) : m_out(out_length) {
+    for (int i = 0; i < 8; i++) {
+      m_h[i] = blake2b_iv[i];
+    }
+    m_h[0] ^= 0x01010000 ^ out_length;
+  }
+  Blake2b &update(const void *data, size_t n) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    while (n > 0) {
+      // The last block is compressed by final(), with its flag
+      if (m_used == sizeof(m_block)) {
+        m_counter += m_used;
+        compress(false);
+        m_used = 0;
+      }
+      size_t take = std::min(n, sizeof(m_block) - m_used);
+      std::memcpy(m_block + m_used, bytes, take);
+      m_used += take;
+      bytes += take;
+      n -= take;
+    }
+    return *this;
+  }
+  Blake2b &update32(uint32_t v) {
+    uint8_t le[4];
+    store32(le, v);
+    return update(le, 4);
+  }
+  void final(uint8_t *out) {
+    m_counter += m_used;
+    std::memset(m_block + m_used, 0, sizeof(m_block) - m_used);
+    compress(true);
+    uint8_t digest[64];
+    for (int i = 0; i < 8; i++) {
+      store64(digest + 8 * i, m_h[i]);
+    }
+    std::memcpy(out, digest, m_out);
+  }
+
+private:
+  uint64_t m_h[8];
+  uint8_t m_block[128];
+  size_t m_used = 0;
+  uint64_t m_counter = 0;
+  size_t m_out;
+
+  void compress(bool last) {
+    uint64_t m[16], v[16];
+    for (int i = 0; i < 16; i++) {
+      m[i] = load64(m_block + 8 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+      v[i] = m_h[i];
+      v[i + 8] = blake2b_iv[i];
+    }
+    v[12] ^= m_counter;
+    if (last) {
+      v[14] = ~v[14];
+    }
+    auto g = [&](int a, int b, int c, int d, uint64_t x, uint64_t y) {
+      v[a] = v[a] + v[b] + x;
+      v[d] = rotr64(v[d] ^ v[a], 32);
+      v[c] = v[c] + v[d];
+      v[b] = rotr64(v[b] ^ v[c], 24);
+      v[a] = v[a] + v[b] + y;
+      v[d] = rotr64(v[d] ^ v[a], 16);
+      v[c] = v[c] + v[d];
+      v[b] = rotr64(v[b] ^ v[c], 63);
+    };
+    for (int r = 0; r < 12; r++) {
+      const uint8_t *s = blake2b_sigma[r];
+      g(0, 4, 8, 12, m[s[0]], m[s[1]]);
+      g(1, 5, 9, 13, m[s[2]], m[s[3]]);
+      g(2, 6, 10, 14, m[s[4]], m[s[5]]);
+      g(3, 7, 11, 15, m[s[6]], m[s[7]]);
+      g(0, 5, 10, 15, m[s[8]], m[s[9]]);
+      g(1, 6, 11, 12, m[s[10]], m[s[11]]);
+      g(2, 7, 8, 13, m[s[12]], m[s[13]]);
+      g(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; i++) {
+      m_h[i] ^= v[i] ^ v[i + 8];
+    }
+  }
+};
+
+// H' of RFC 9106 3.3, out_length bytes of the concatenated inputs
+void hashLong(uint8_t *out, size_t out_length, const uint8_t *in,
+              size_t in_length) {
+  if (out_length <= 64) {
+    Blake2b(out_length).update32(out_length).update(in, in_length).final(out);
+    return;
+  }
+  uint8_t v[64];
+  Blake2b(64).update32(out_length).update(in, in_length).final(v);
+  std::memcpy(out, v, 32);
+  size_t done = 32;
+  while (out_length - done > 64) {
+    Blake2b(64).update(v, 64).final(v);
+    std::memcpy(out + done, v, 32);
+    done += 32;
+  }
+  Blake2b(out_length - done).update(v, 64).final(out + done);
+}
+
+struct Block {
+  uint64_t v[ARGON2_BLOCK_SIZE / 8];
+};
+
+// GB of RFC 9106 3.6, BLAKE2b's G with a multiplication added
+inline void gb(uint64_t &a, uint64_t &b, uint64_t &c, uint64_t &d) {
+  const uint64_t low = 0xffffffffULL;
+  a = a + b + 2 * (a & low) * (b & low);
+  d = rotr64(d ^ a, 32);
+  c = c + d + 2 * (c & low) * (d & low);
+  b = rotr64(b ^ c, 24);
+  a = a + b + 2 * (a & low) * (b & low);
+  d = rotr64(d ^ a, 16);
+  c = c + d + 2 * (c & low) * (d & low);
+  b = rotr64(b ^ c, 63);
+}
+
+// The permutation P on 16 words, given by their indices in the block
+inline void permute(uint64_t *w, const int (&i)[16]) {
+  gb(w[i[0]], w[i[4]], w[i[8]], w[i[12]]);
+  gb(w[i[1]], w[i[5]], w[i[9]], w[i[13]]);
+  gb(w[i[2]], w[i[6]], w[i[10]], w[i[14]]);
+  gb(w[i[3]], w[i[7]], w[i[11]], w[i[15]]);
+  gb(w[i[0]], w[i[5]], w[i[10]], w[i[15]]);
+  gb(w[i[1]], w[i[6]], w[i[11]], w[i[12]]);
+  gb(w[i[2]], w[i[7]], w[i[8]], w[i[13]]);
+  gb(w[i[3]], w[i[4]], w[i[9]], w[i[14]]);
+}
+
+/*
+ * The compression G: R = X ^ Y, P over the eight rows of 16 words and
+ * then the eight columns, next = P(R) ^ R. From the second pass on the
+ * block's old contents are folded in too (with_xor).
+ */
+void fillBlock(const Block &prev, const Block &ref, Block &next,
+               bool with_xor) {
+  Block r, tmp;
+  for (int i = 0; i < 128; i++) {
+    r.v[i] = prev.v[i] ^ ref.v[i];
+    tmp.v[i] = with_xor ? r.v[i] ^ next.v[i] : r.v[i];
+  }
+  for (int row = 0; row < 8; row++) {
+    const int b = 16 * row;
+    const int idx[16] = {b,      b + 1,  b + 2,  b + 3, b + 4,  b + 5,
+                         b + 6,  b + 7,  b + 8,  b + 9, b + 10, b + 11,
+                         b + 12, b + 13, b + 14, b + 15};
+    permute(r.v, idx);
+  }
+  for (int col = 0; col < 8; col++) {
+    const int b = 2 * col;
+    const int idx[16] = {b,      b + 1,  b + 16, b + 17, b + 32, b + 33,
+                         b + 48, b + 49, b + 64, b + 65, b + 80, b + 81,
+                         b + 96, b + 97, b + 112, b + 113};
+    permute(r.v, idx);
+  }
+  for (int i = 0; i < 128; i++) {
+    next.v[i] = tmp.v[i] ^ r.v[i];
+  }
+}
+
+// Lets the lane threads wait for each other at a sync point
+class Barrier {
+public:
+  explicit Barrier(size_t count) : m_count(count), m_waiting(0), m_round(0) {}
+  void wait() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    size_t round = m_round;
+    if (++m_waiting == m_count) {
+      m_waiting = 0;
+      m_round++;
+      m_cv.notify_all();
+      return;
+    }
+    m_cv.wait(lock, [&] { return m_round != round; });
+  }
+
+private:
+  std::mutex m_mtx;
+  std::condition_variable m_cv;
+  size_t m_count, m_waiting, m_round;
+};
+
+struct Instance {
+  Block *memory;
+  uint32_t lanes;
+  uint32_t lane_length;
+  uint32_t segment_length;
+  uint32_t passes;
+  uint32_t memory_blocks;
+};
+
+// RFC 9106 3.4.1.2, the index in ref_lane that position i refers to
+uint32_t referenceIndex(const Instance &in, uint32_t pass, uint32_t slice,
+                        uint32_t index, uint32_t j1, bool same_lane) {
+  uint64_t area;
+  if (pass == 0) {
+    if (slice == 0) {
+      area = index - 1;
+    } else if (same_lane) {
+      area = uint64_t(slice) * in.segment_length + index - 1;
+    } else {
+      area = uint64_t(slice) * in.segment_length - (index == 0 ? 1 : 0);
+    }
+  } else if (same_lane) {
+    area = in.lane_length - in.segment_length + index - 1;
+  } else {
+    area = in.lane_length - in.segment_length - (index == 0 ? 1 : 0);
+  }
+  uint64_t x = uint64_t(j1) * j1 >> 32;
+  uint64_t relative = area - 1 - (area * x >> 32);
+  uint64_t start = 0;
+  if (pass != 0 && slice != ARGON2_SYNC_POINTS - 1) {
+    start = uint64_t(slice + 1) * in.segment_length;
+  }
+  return static_cast<uint32_t>((start + relative) % in.lane_length);
+}
+
+void fillSegment(const Instance &in, uint32_t pass, uint32_t lane,
+                 uint32_t slice) {
+  // Argon2id: data-independent addresses in the first half of pass 0
+  const bool independent = pass == 0 && slice < ARGON2_SYNC_POINTS / 2;
+  Block zero = {}, input = {}, addresses = {};
+  auto nextAddresses = [&] {
+    input.v[6]++;
+    fillBlock(zero, input, addresses, false);
+    fillBlock(zero, addresses, addresses, false);
+  };
+  if (independent) {
+    input.v[0] = pass;
+    input.v[1] = lane;
+    input.v[2] = slice;
+    input.v[3] = in.memory_blocks;
+    input.v[4] = in.passes;
+    input.v[5] = 2; // Argon2id
+  }
+  uint32_t start = 0;
+  if (pass == 0 && slice == 0) {
+    start = 2;
+    if (independent) {
+      nextAddresses();
+    }
+  }
+  uint32_t offset =
+      lane * in.lane_length + slice * in.segment_length + start;
+  for (uint32_t i = start; i < in.segment_length; i++, offset++) {
+    uint32_t prev =
+        offset % in.lane_length == 0 ? offset + in.lane_length - 1
+                                     : offset - 1;
+    uint64_t random;
+    if (independent) {
+      if (i % 128 == 0) {
+        nextAddresses();
+      }
+      random = addresses.v[i % 128];
+    } else {
+      random = in.memory[prev].v[0];
+    }
+    uint32_t ref_lane = static_cast<uint32_t>((random >> 32) % in.lanes);
+    if (pass == 0 && slice == 0) {
+      ref_lane = lane;
+    }
+    uint32_t ref_index =
+        referenceIndex(in, pass, slice, i, static_cast<uint32_t>(random),
+                       ref_lane == lane);
+    fillBlock(in.memory[prev], in.memory[ref_lane * in.lane_length +
+                                         ref_index],
+              in.memory[offset], pass != 0);
+  }
+}
+
+// memset called through a volatile pointer, so clearing memory that is
+// not read again is never optimized away
+void *(*const volatile wipe)(void *, int, size_t) = std::memset;
+
+// Clears a buffer of password-derived data on every way out of its scope
+struct Wiped {
+  void *data;
+  size_t size;
+  ~Wiped() { wipe(data, 0, size); }
+};
+
+} // namespace
+
+std::string Argon2::hash(std::string_view password, std::string_view salt,
+                         const Params &params, MemoryPool &pool,
+                         std::string_view secret, std::string_view ad) {
+  const uint32_t p = params.lanes;
+  if (p < 1 || p > ARGON2_MAX_LANES || params.passes < 1 ||
+      params.tag_length < 4 || params.memory_kib < 8 * p || salt.size() < 8) {
+    return std::string();
+  }
+  Instance in;
+  in.lanes = p;
+  in.passes = params.passes;
+  in.segment_length = params.memory_kib / (ARGON2_SYNC_POINTS * p);
+  in.lane_length = in.segment_length * ARGON2_SYNC_POINTS;
+  in.memory_blocks = in.lane_length * p;
+  MemoryPool::Lease lease =
+      pool.acquire(size_t(in.memory_blocks) * ARGON2_BLOCK_SIZE);
+  if (!lease) {
+    return std::string();
+  }
+  in.memory = static_cast<Block *>(lease.data());
+  // The pool hands the buffer to the next hash as it is, so the blocks
+  // derived from this password are cleared before the lease returns it,
+  // like the reference implementation's clear-memory option
+  Wiped memory{lease.data(), lease.size()};
+
+  // H0 over the parameters and inputs, then the first two blocks per lane
+  uint8_t h0[64 + 8];
+  Wiped h0_wiped{h0, sizeof(h0)};
+  Blake2b(64)
+      .update32(p)
+      .update32(params.tag_length)
+      .update32(params.memory_kib)
+      .update32(params.passes)
+      .update32(ARGON2_VERSION)
+      .update32(2) // Argon2id
+      .update32(password.size())
+      .update(password.data(), password.size())
+      .update32(salt.size())
+      .update(salt.data(), salt.size())
+      .update32(secret.size())
+      .update(secret.data(), secret.size())
+      .update32(ad.size())
+      .update(ad.data(), ad.size())
+      .final(h0);
+  uint8_t bytes[ARGON2_BLOCK_SIZE];
+  Wiped bytes_wiped{bytes, sizeof(bytes)};
+  for (uint32_t lane = 0; lane < p; lane++) {
+    for (uint32_t i = 0; i < 2; i++) {
+      store32(h0 + 64, i);
+      store32(h0 + 68, lane);
+      hashLong(bytes, sizeof(bytes), h0, sizeof(h0));
+      Block &block = in.memory[lane * in.lane_length + i];
+      for (int w = 0; w < 128; w++) {
+        block.v[w] = load64(bytes + 8 * w);
+      }
+    }
+  }
+
+  // Lane 0 runs here, the others on their own threads
+  Barrier barrier(p);
+  auto fillLane = [&](uint32_t lane) {
+    for (uint32_t pass = 0; pass < in.passes; pass++) {
+      for (uint32_t slice = 0; slice < ARGON2_SYNC_POINTS; slice++) {
+        fillSegment(in, pass, lane, slice);
+        barrier.wait();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (uint32_t lane = 1; lane < p; lane++) {
+    threads.emplace_back(fillLane, lane);
+  }
+  fillLane(0);
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  Block last = in.memory[in.lane_length - 1];
+  Wiped last_wiped{&last, sizeof(last)};
+  for (uint32_t lane = 1; lane < p; lane++) {
+    const Block &block = in.memory[lane * in.lane_length + in.lane_length - 1];
+    for (int w = 0; w < 128; w++) {
+      last.v[w] ^= block.v[w];
+    }
+  }
+  for (int w = 0; w < 128; w++) {
+    store64(bytes + 8 * w, last.v[w]);
+  }
+  std::string tag(params.tag_length, '\0');
+  hashLong(reinterpret_cast<uint8_t *>(&tag[0]), tag.size(), bytes,
+           sizeof(bytes));
+  return tag;
+}
@@ -0,0 +1,103 @@
+#include "async_store.h"
+
+AsyncStore::AsyncStore(std::unique_ptr<CredentialStore> store)
+    : m_store(std::move(store)), m_executor(new Executor()) {}
+
+// The executor finishes the queued calls before the store goes away
+AsyncStore::~AsyncStore() { m_executor.reset(); }
+
+size_t AsyncStore::pending() { return m_executor->pending(); }
+
+std::future<AsyncStore::Result>
+AsyncStore::async_getUserSalt(const string &secid) {
+  return m_executor->submit([this, secid] {
+    Result result;
+    result.rc = m_store->getUserSalt(secid, result.value);
+    return result;
+  });
+}
+
+std::future<AsyncStore::Result>
+AsyncStore::async_getUserPassword(const string &secid) {
+  return m_executor->submit([this, secid] {
+    Result result;
+    result.rc = m_store->getUserPassword(secid, result.value);
+    return result;
+  });
+}
+
+std::future<int> AsyncStore::async_checkPassword(const string &secid,
+                                                 const string &password) {
+  return m_executor->submit([this, secid, password] {
+    return m_store->checkPassword(secid, password);
+  });
+}
+
+std::future<int> AsyncStore::async_addUser(const string &secid,
+                                           const string &password,
+                                           const string &salt) {
+  return m_executor->submit([this, secid, password, salt] {
+    return m_store->addUser(secid, password, salt);
+  });
+}
+
+std::future<int> AsyncStore::async_deleteUser(const string &secid,
+                                              const string &password) {
+  return m_executor->submit([this, secid, password] {
+    return m_store->deleteUser(secid, password);
+  });
+}
+
+std::future<int> AsyncStore::async_updatePassword(const string &secid,
+                                                  const string &password,
+                                                  const string &salt) {
+  return m_executor->submit([this, secid, password, salt] {
+    return m_store->updatePassword(secid, password, salt);
+  });
+}
+
+void AsyncStore::async_getUserSalt(const string &secid, ResultCallback done) {
+  m_executor->post([this, secid, done] {
+    Result result;
+    result.rc = m_store->getUserSalt(secid, result.value);
+    done(result);
+  });
+}
+
+void AsyncStore::async_getUserPassword(const string &secid,
+                                       ResultCallback done) {
+  m_executor->post([this, secid, done] {
+    Result result;
+    result.rc = m_store->getUserPassword(secid, result.value);
+    done(result);
+  });
+}
+
+void AsyncStore::async_checkPassword(const string &secid,
+                                     const string &password, Callback done) {
+  m_executor->post([this, secid, password, done] {
+    done(m_store->checkPassword(secid, password));
+  });
+}
+
+void AsyncStore::async_addUser(const string &secid, const string &password,
+                               const string &salt, Callback done) {
+  m_executor->post([this, secid, password, salt, done] {
+    done(m_store->addUser(secid, password, salt));
+  });
+}
+
+void AsyncStore::async_deleteUser(const string &secid, const string &password,
+                                  Callback done) {
+  m_executor->post([this, secid, password, done] {
+    done(m_store->deleteUser(secid, password));
+  });
+}
+
+void AsyncStore::async_updatePassword(const string &secid,
+                                      const string &password,
+                                      const string &salt, Callback done) {
+  m_executor->post([this, secid, password, salt, done] {
+    done(m_store->updatePassword(secid, password, salt));
+  });
+}
@@ -0,0 +1,172 @@
+#include "change_feed.h"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sqlite3.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using LogLevel = Logger::LogLevel;
+
+ChangeFeed::ChangeFeed()
+    : m_log(nullptr), m_seq(0), m_next_id(0), m_listen_fd(-1),
+      m_stop(false) {}
+
+ChangeFeed::~ChangeFeed() {
+  flush();
+  m_stop = true;
+  if (m_accept_thread.joinable()) {
+    m_accept_thread.join();
+  }
+  if (m_listen_fd >= 0) {
+    close(m_listen_fd);
+    unlink(m_socket_path.c_str());
+  }
+  for (int fd : m_clients) {
+    close(fd);
+  }
+  for (int fd : m_accepted) {
+    close(fd);
+  }
+}
+
+void ChangeFeed::setLogger(Logger *log) {
+  if (log) {
+    m_log = log;
+    m_log->entry(LogLevel::INFO,
+                 "ChangeFeed::setLogger Logger added to ChangeFeed object.");
+  }
+}
+
+int ChangeFeed::subscribe(Subscriber subscriber) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_subscribers[m_next_id] = std::move(subscriber);
+  return m_next_id++;
+}
+
+void ChangeFeed::unsubscribe(int id) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_subscribers.erase(id);
+}
+
+uint64_t ChangeFeed::lastSeq() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_seq;
+}
+
+void ChangeFeed::flush() { m_delivery.submit([] { return 0; }).get(); }
+
+/*
+ * Sequence numbers are taken and the delivery is queued under the same lock,
+ * so events from different writers are delivered in sequence order.
+ */
+void ChangeFeed::publish(std::vector<Event> events) {
+  if (events.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(m_mtx);
+  for (Event &event : events) {
+    event.seq = ++m_seq;
+  }
+  m_delivery.post([this, events = std::move(events)] { deliver(events); });
+}
+
+// Runs on the delivery thread
+void ChangeFeed::deliver(const std::vector<Event> &events) {
+  std::vector<Subscriber> subscribers;
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto &entry : m_subscribers) {
+      subscribers.push_back(entry.second);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_clients_mtx);
+    m_clients.insert(m_clients.end(), m_accepted.begin(), m_accepted.end());
+    m_accepted.clear();
+  }
+
+  std::string lines;
+  for (const Event &event : events) {
+    for (const Subscriber &subscriber : subscribers) {
+      subscriber(event);
+    }
+    lines.append(std::to_string(event.seq));
+    lines.push_back(' ');
+    lines.push_back(static_cast<char>(event.op));
+    lines.push_back(' ');
+    lines.append(event.secid);
+    lines.push_back('\n');
+  }
+
+  for (size_t i = 0; i < m_clients.size();) {
+    // Non-blocking, a full socket buffer means the client fell behind
+    ssize_t sent = send(m_clients[i], lines.data(), lines.size(),
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent == static_cast<ssize_t>(lines.size())) {
+      i++;
+      continue;
+    }
+    if (m_log) {
+      m_log->entry(LogLevel::WARNING,
+                   "ChangeFeed::deliver client dropped, it missed events.");
+    }
+    close(m_clients[i]);
+    m_clients.erase(m_clients.begin() + i);
+  }
+}
+
+/*
+ * Binds a Unix stream socket at path, replacing a stale socket file, and
+ * starts accepting clients. A client receives the events published after it
+ * was accepted.
+ */
+int ChangeFeed::listen(const std::string &path) {
+  if (m_listen_fd >= 0) {
+    return SQLITE_MISUSE;
+  }
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    return SQLITE_CANTOPEN;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return SQLITE_CANTOPEN;
+  }
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, CHANGE_FEED_BACKLOG) != 0) {
+    if (m_log) {
+      m_log->entry(LogLevel::ERROR,
+                   "ChangeFeed::listen Can't listen on " + path + ": " +
+                       strerror(errno));
+    }
+    close(fd);
+    return SQLITE_CANTOPEN;
+  }
+  m_listen_fd = fd;
+  m_socket_path = path;
+  m_accept_thread = std::thread(&ChangeFeed::acceptLoop, this);
+  return SQLITE_OK;
+}
+
+// Polls so the destructor can stop it without closing the socket under it
+void ChangeFeed::acceptLoop() {
+  while (!m_stop) {
+    pollfd pfd{m_listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, CHANGE_FEED_POLL_MS) <= 0) {
+      continue;
+    }
+    int client = accept(m_listen_fd, nullptr, nullptr);
+    if (client < 0) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(m_clients_mtx);
+    m_accepted.push_back(client);
+  }
+}
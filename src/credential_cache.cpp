@@ -0,0 +1,266 @@
+#include "credential_cache.h"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+
+/*
+ * FrequencySketch. Four rows of saturating counters indexed by independent
+ * hashes of the key; the estimate is the minimum over the rows. All counters
+ * are halved once the number of increments reaches the sample size, so old
+ * popularity fades out.
+ */
+CredentialCache::FrequencySketch::FrequencySketch(size_t expected_entries)
+    : m_additions(0) {
+  size_t width = 16;
+  while (width < expected_entries) {
+    width <<= 1;
+  }
+  m_table.assign(width * DEPTH, 0);
+  m_mask = width - 1;
+  m_sample_size = 10 * width;
+}
+
+size_t CredentialCache::FrequencySketch::index(uint64_t hash, int row) const {
+  static const uint64_t seeds[DEPTH] = {0xc3a5c85c97cb3127ULL,
+                                        0xb492b66fbe98f273ULL,
+                                        0x9ae16a3b2f90404fULL,
+                                        0xcbf29ce484222325ULL};
+  uint64_t h = (hash + seeds[row]) * 0x9e3779b97f4a7c15ULL;
+  h ^= h >> 32;
+  return row * (m_mask + 1) + (h & m_mask);
+}
+
+void CredentialCache::FrequencySketch::increment(uint64_t hash) {
+  bool added = false;
+  for (int row = 0; row < DEPTH; row++) {
+    uint8_t &counter = m_table[index(hash, row)];
+    if (counter < 15) {
+      counter++;
+      added = true;
+    }
+  }
+  if (added && ++m_additions >= m_sample_size) {
+    reset();
+  }
+}
+
+uint8_t CredentialCache::FrequencySketch::frequency(uint64_t hash) const {
+  uint8_t freq = 15;
+  for (int row = 0; row < DEPTH; row++) {
+    freq = std::min(freq, m_table[index(hash, row)]);
+  }
+  return freq;
+}
+
+void CredentialCache::FrequencySketch::reset() {
+  for (auto &counter : m_table) {
+    counter >>= 1;
+  }
+  m_additions /= 2;
+}
+
+/*
+ * CredentialCache
+ */
+CredentialCache::CredentialCache(size_t capacity_bytes, size_t shards)
+    : m_capacity(capacity_bytes) {
+  if (shards == 0) {
+    shards = 1;
+  }
+  size_t shard_capacity = capacity_bytes / shards;
+  // 1% admission window, the main area is split 20/80 probation/protected
+  m_window_capacity = shard_capacity / 100;
+  m_main_capacity = shard_capacity - m_window_capacity;
+  m_protected_capacity = m_main_capacity * 8 / 10;
+
+  size_t expected_entries = std::max<size_t>(shard_capacity / 256, 16);
+  for (size_t i = 0; i < shards; i++) {
+    m_shards.emplace_back(new Shard(expected_entries));
+  }
+}
+
+uint64_t CredentialCache::hashOf(const std::string &secid) {
+  // std::hash may be the identity on some platforms, mix it (splitmix64)
+  uint64_t h = std::hash<std::string>{}(secid);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+CredentialCache::Shard &CredentialCache::shardFor(uint64_t hash) {
+  return *m_shards[(hash >> 32) % m_shards.size()];
+}
+
+CredentialCache::NodeList &CredentialCache::listOf(Shard &shard,
+                                                   Segment segment) {
+  switch (segment) {
+  case WINDOW:
+    return shard.window;
+  case PROBATION:
+    return shard.probation;
+  default:
+    return shard.protected_;
+  }
+}
+
+size_t &CredentialCache::bytesOf(Shard &shard, Segment segment) {
+  switch (segment) {
+  case WINDOW:
+    return shard.window_bytes;
+  case PROBATION:
+    return shard.probation_bytes;
+  default:
+    return shard.protected_bytes;
+  }
+}
+
+bool CredentialCache::get(const std::string &secid, Entry &entry) {
+  uint64_t hash = hashOf(secid);
+  Shard &shard = shardFor(hash);
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  shard.sketch.increment(hash);
+  auto found = shard.index.find(secid);
+  if (found == shard.index.end()) {
+    shard.stats.misses++;
+    return false;
+  }
+  shard.stats.hits++;
+  entry = found->second->entry;
+  onHit(shard, found->second);
+  return true;
+}
+
+uint64_t CredentialCache::version(const std::string &secid) {
+  Shard &shard = shardFor(hashOf(secid));
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  return shard.epoch;
+}
+
+void CredentialCache::put(const std::string &secid, const Entry &entry,
+                          uint64_t version) {
+  uint64_t hash = hashOf(secid);
+  Shard &shard = shardFor(hash);
+  size_t bytes = secid.size() + entry.salt.size() + entry.password.size() +
+                 CACHE_ENTRY_OVERHEAD;
+  if (bytes > m_main_capacity) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  if (shard.epoch != version) {
+    // Invalidated while the caller read from the database
+    return;
+  }
+  auto found = shard.index.find(secid);
+  if (found != shard.index.end()) {
+    Node &node = *found->second;
+    bytesOf(shard, node.segment) += bytes - node.bytes;
+    node.entry = entry;
+    node.bytes = bytes;
+    return;
+  }
+
+  shard.window.push_front(Node{secid, entry, hash, WINDOW, bytes});
+  shard.index[secid] = shard.window.begin();
+  shard.window_bytes += bytes;
+  while (shard.window_bytes > m_window_capacity && !shard.window.empty()) {
+    evictFromWindow(shard);
+  }
+}
+
+void CredentialCache::invalidate(const std::string &secid) {
+  Shard &shard = shardFor(hashOf(secid));
+  std::lock_guard<std::mutex> lock(shard.mtx);
+  shard.epoch++;
+  auto found = shard.index.find(secid);
+  if (found != shard.index.end()) {
+    erase(shard, found->second);
+    shard.stats.invalidations++;
+  }
+}
+
+CredentialCache::Stats CredentialCache::stats() {
+  Stats total = {};
+  for (auto &shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard->mtx);
+    total.hits += shard->stats.hits;
+    total.misses += shard->stats.misses;
+    total.admitted += shard->stats.admitted;
+    total.rejected += shard->stats.rejected;
+    total.evictions += shard->stats.evictions;
+    total.invalidations += shard->stats.invalidations;
+    total.entries += shard->index.size();
+    total.bytes +=
+        shard->window_bytes + shard->probation_bytes + shard->protected_bytes;
+  }
+  total.capacity = m_capacity;
+  return total;
+}
+
+// Window entries move to the front, a probation hit is promoted to protected
+// which in turn demotes its least recent entries back to probation.
+void CredentialCache::onHit(Shard &shard, NodeList::iterator it) {
+  switch (it->segment) {
+  case WINDOW:
+    shard.window.splice(shard.window.begin(), shard.window, it);
+    break;
+  case PROBATION:
+    shard.protected_.splice(shard.protected_.begin(), shard.probation, it);
+    it->segment = PROTECTED;
+    shard.probation_bytes -= it->bytes;
+    shard.protected_bytes += it->bytes;
+    while (shard.protected_bytes > m_protected_capacity &&
+           shard.protected_.size() > 1) {
+      auto demoted = std::prev(shard.protected_.end());
+      shard.probation.splice(shard.probation.begin(), shard.protected_,
+                             demoted);
+      demoted->segment = PROBATION;
+      shard.protected_bytes -= demoted->bytes;
+      shard.probation_bytes += demoted->bytes;
+    }
+    break;
+  case PROTECTED:
+    shard.protected_.splice(shard.protected_.begin(), shard.protected_, it);
+    break;
+  }
+}
+
+// The least recent window entry competes with the main area's eviction
+// victim; it is only admitted if the sketch has seen it more often.
+void CredentialCache::evictFromWindow(Shard &shard) {
+  auto candidate = std::prev(shard.window.end());
+  size_t main_bytes = shard.probation_bytes + shard.protected_bytes;
+  if (main_bytes + candidate->bytes > m_main_capacity) {
+    NodeList &victims =
+        shard.probation.empty() ? shard.protected_ : shard.probation;
+    auto victim = std::prev(victims.end());
+    if (shard.sketch.frequency(candidate->hash) <=
+        shard.sketch.frequency(victim->hash)) {
+      erase(shard, candidate);
+      shard.stats.rejected++;
+      return;
+    }
+  }
+
+  shard.probation.splice(shard.probation.begin(), shard.window, candidate);
+  candidate->segment = PROBATION;
+  shard.window_bytes -= candidate->bytes;
+  shard.probation_bytes += candidate->bytes;
+  shard.stats.admitted++;
+  while (shard.probation_bytes + shard.protected_bytes > m_main_capacity) {
+    if (shard.probation.size() > 1) {
+      erase(shard, std::prev(shard.probation.end()));
+    } else if (!shard.protected_.empty()) {
+      erase(shard, std::prev(shard.protected_.end()));
+    } else {
+      break;
+    }
+    shard.stats.evictions++;
+  }
+}
+
+void CredentialCache::erase(Shard &shard, NodeList::iterator it) {
+  bytesOf(shard, it->segment) -= it->bytes;
+  shard.index.erase(it->secid);
+  listOf(shard, it->segment).erase(it);
+}
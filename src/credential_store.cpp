@@ -0,0 +1,34 @@
+#include "credential_store.h"
+
+int CredentialStore::getCredentials(
+    const std::vector<string> &secids,
+    std::vector<CredentialCache::Entry> &entries, std::vector<int> &rcs) {
+  entries.assign(secids.size(), CredentialCache::Entry());
+  rcs.assign(secids.size(), SQLITE_OK);
+  int first = SQLITE_OK;
+  for (size_t i = 0; i < secids.size(); i++) {
+    int rc = getUserSalt(secids[i], entries[i].salt);
+    if (rc == SQLITE_OK) {
+      rc = getUserPassword(secids[i], entries[i].password);
+    }
+    rcs[i] = rc;
+    if (rc != SQLITE_OK && rc != SQLITE_DONE && first == SQLITE_OK) {
+      first = rc;
+    }
+  }
+  return first;
+}
+
+int CredentialStore::addUsers(const std::vector<NewUser> &users,
+                              std::vector<int> &rcs) {
+  rcs.assign(users.size(), SQLITE_OK);
+  int first = SQLITE_OK;
+  for (size_t i = 0; i < users.size(); i++) {
+    rcs[i] = addUser(users[i].secid, users[i].password, users[i].salt);
+    if (rcs[i] != SQLITE_OK && rcs[i] != SQLITE_CONSTRAINT &&
+        first == SQLITE_OK) {
+      first = rcs[i];
+    }
+  }
+  return first;
+}
@@ -0,0 +1,152 @@
+#include "cuckoo_filter.h"
+#include <functional>
+#include <mutex>
+
+CuckooFilter::CuckooFilter(size_t capacity)
+    : m_items(0), m_lookups(0), m_rejected(0), m_rng(0x2545f4914f6cdd1dULL),
+      m_victim{false, 0, 0} {
+  // Cuckoo insertion stays reliable up to ~95% load with 4-slot buckets
+  size_t buckets = (capacity * 100 / 95 + CUCKOO_BUCKET_SLOTS - 1) /
+                   CUCKOO_BUCKET_SLOTS;
+  m_buckets.assign(buckets > 0 ? buckets : 1, Bucket{});
+}
+
+uint64_t CuckooFilter::hashOf(const std::string &secid) {
+  uint64_t h = std::hash<std::string>{}(secid);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+// Fingerprint 0 marks an empty slot
+uint16_t CuckooFilter::fingerprintOf(uint64_t hash) {
+  uint16_t fp = static_cast<uint16_t>(hash >> 48);
+  return fp ? fp : 1;
+}
+
+size_t CuckooFilter::altIndex(size_t index, uint16_t fingerprint) const {
+  size_t n = m_buckets.size();
+  size_t h = (fingerprint * 0x5bd1e995ULL) % n;
+  return (h + n - index) % n;
+}
+
+bool CuckooFilter::bucketHas(size_t index, uint16_t fingerprint) const {
+  for (uint16_t fp : m_buckets[index].slot) {
+    if (fp == fingerprint) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CuckooFilter::insertInto(size_t index, uint16_t fingerprint) {
+  for (uint16_t &fp : m_buckets[index].slot) {
+    if (fp == 0) {
+      fp = fingerprint;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CuckooFilter::removeFrom(size_t index, uint16_t fingerprint) {
+  for (uint16_t &fp : m_buckets[index].slot) {
+    if (fp == fingerprint) {
+      fp = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CuckooFilter::insert(const std::string &secid) {
+  uint64_t hash = hashOf(secid);
+  uint16_t fp = fingerprintOf(hash);
+  size_t i1 = hash % m_buckets.size();
+
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  if (m_victim.used) {
+    return false;
+  }
+  size_t i2 = altIndex(i1, fp);
+  if (insertInto(i1, fp) || insertInto(i2, fp)) {
+    m_items++;
+    return true;
+  }
+
+  // Both buckets full, relocate existing fingerprints to their other bucket
+  size_t index = (m_rng & 1) ? i1 : i2;
+  for (int kick = 0; kick < CUCKOO_MAX_KICKS; kick++) {
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 7;
+    m_rng ^= m_rng << 17;
+    uint16_t &slot = m_buckets[index].slot[m_rng % CUCKOO_BUCKET_SLOTS];
+    std::swap(fp, slot);
+    index = altIndex(index, fp);
+    if (insertInto(index, fp)) {
+      m_items++;
+      return true;
+    }
+  }
+  // Keep the homeless fingerprint so no inserted key is ever lost
+  m_victim = {true, index, fp};
+  m_items++;
+  return false;
+}
+
+bool CuckooFilter::contains(const std::string &secid) {
+  uint64_t hash = hashOf(secid);
+  uint16_t fp = fingerprintOf(hash);
+  size_t i1 = hash % m_buckets.size();
+
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  size_t i2 = altIndex(i1, fp);
+  bool found = bucketHas(i1, fp) || bucketHas(i2, fp) ||
+               (m_victim.used && m_victim.fingerprint == fp &&
+                (m_victim.index == i1 || m_victim.index == i2));
+  m_lookups.fetch_add(1, std::memory_order_relaxed);
+  if (!found) {
+    m_rejected.fetch_add(1, std::memory_order_relaxed);
+  }
+  return found;
+}
+
+// Only remove keys that are known to have been inserted, removing a key
+// that was never added may delete another key's matching fingerprint.
+bool CuckooFilter::remove(const std::string &secid) {
+  uint64_t hash = hashOf(secid);
+  uint16_t fp = fingerprintOf(hash);
+  size_t i1 = hash % m_buckets.size();
+
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  size_t i2 = altIndex(i1, fp);
+  if (removeFrom(i1, fp) || removeFrom(i2, fp)) {
+    m_items--;
+  } else if (m_victim.used && m_victim.fingerprint == fp &&
+             (m_victim.index == i1 || m_victim.index == i2)) {
+    m_victim.used = false;
+    m_items--;
+    return true;
+  } else {
+    return false;
+  }
+  // A slot was freed, give the homeless fingerprint a place again
+  if (m_victim.used &&
+      (insertInto(m_victim.index, m_victim.fingerprint) ||
+       insertInto(altIndex(m_victim.index, m_victim.fingerprint),
+                  m_victim.fingerprint))) {
+    m_victim.used = false;
+  }
+  return true;
+}
+
+CuckooFilter::Stats CuckooFilter::stats() {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  Stats stats;
+  stats.items = m_items;
+  stats.capacity = m_buckets.size() * CUCKOO_BUCKET_SLOTS;
+  stats.bytes = m_buckets.size() * sizeof(Bucket) + sizeof(*this);
+  stats.lookups = m_lookups.load(std::memory_order_relaxed);
+  stats.rejected = m_rejected.load(std::memory_order_relaxed);
+  return stats;
+}
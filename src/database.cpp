@@ -9,182 +9,710 @@
  * Get salt associated to existing user,
  * Get password associated to existing user.
  * Update password (and salt) using secid
+ * Online backup of the whole database into another file.
  *
  * SQLite supports prepared statements. These statements are compiled into
  * SQLite byte code. This Database object creates and compiles these statments
  * at initatilzation. They are then reused at each transatction to the database
  * - without the need to recompile the byte code.
  *
+ * An optional CredentialCache sits in front of the salt and password lookups.
+ * Every committed add, update or delete invalidates the cached entry.
+ * An optional CuckooFilter over all secids rejects lookups for accounts that
+ * do not exist before any statement is run.
+ * An optional ChangeFeed receives every committed change of the login table.
+ * A statement that finds the file locked by another connection backs off and
+ * retries until a deadline (onBusy).
+ * Memory-first, the database lives in memory and a background thread writes
+ * consistent snapshots of it back to the file (persist).
+ * With read batching, lookups made by several threads at the same time are
+ * resolved together by one IN-list query (ReadBatcher).
+ *
  */
 
 #include "database.h"
+#include "hash_password.h"
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <random>
 #include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
 #include <stdexcept>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 
 using LogLevel = Logger::LogLevel;
 
 /*
- * Constructor needs filepath to an existing sqlite3 database
+ * hash_from_hex(x): the 32 byte digest when x is a 64 character hex digest
+ * as stored by schema 0, x unchanged otherwise.
+ */
+static void hashFromHex(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  const char *data = static_cast<const char *>(sqlite3_value_blob(argv[0]));
+  string hex(data ? data : "", sqlite3_value_bytes(argv[0]));
+  string bytes;
+  if (sqlite3_value_type(argv[0]) == SQLITE_TEXT &&
+      HashPassword::fromHexDigest(hex, bytes)) {
+    sqlite3_result_blob(ctx, bytes.data(), static_cast<int>(bytes.size()),
+                        SQLITE_TRANSIENT);
+  } else {
+    sqlite3_result_value(ctx, argv[0]);
+  }
+}
+
+// URI of the memdb database of a memory-first Database
+static string memoryUri(const void *database) {
+  return "file:/login-" +
+         std::to_string(reinterpret_cast<uintptr_t>(database)) +
+         "?vfs=memdb";
+}
+
+int Database::addSqlFunctions(sqlite3 *db) {
+  return sqlite3_create_function(db, "hash_from_hex", 1,
+                                 SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                 hashFromHex, nullptr, nullptr);
+}
+
+/*
+ * Creates the login and password tables in a database that has none.
+ * Salts and password hashes are BLOBs, a hash is always PASSWORD_SIZE bytes.
+ *
+ * A database of schema 0 keeps both as hex TEXT. It is migrated in one
+ * transaction: hashes are decoded to bytes, salts keep their bytes so that
+ * hashes made with them still match. The version is kept in user_version.
+ */
+int Database::createSchema(sqlite3 *db) {
+  sqlite3_stmt *stmt = nullptr;
+  int rc = sqlite3_prepare_v2(db,
+                              "SELECT count(*) FROM sqlite_master "
+                              "WHERE type = 'table' AND name = 'login';",
+                              -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  int tables = 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    tables = sqlite3_column_int(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+
+  int version = 0;
+  rc = sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    version = sqlite3_column_int(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+  if (tables > 0 && version >= SCHEMA_VERSION) {
+    return SQLITE_OK;
+  }
+  if ((rc = addSqlFunctions(db)) != SQLITE_OK) {
+    return rc;
+  }
+
+  const char *create =
+      u8"CREATE TABLE login_v1 ("
+      u8"id INTEGER PRIMARY KEY AUTOINCREMENT, "
+      u8"secid TEXT NOT NULL UNIQUE, salt BLOB NOT NULL);"
+      u8"CREATE TABLE password_v1 ("
+      u8"login_id INTEGER NOT NULL, password BLOB NOT NULL "
+      u8"CHECK (length(password) = 32));";
+  const char *migrate =
+      u8"INSERT INTO login_v1 (id, secid, salt) "
+      u8"SELECT id, secid, CAST(salt AS BLOB) FROM login;"
+      u8"INSERT INTO password_v1 (login_id, password) "
+      u8"SELECT login_id, hash_from_hex(password) FROM password;"
+      u8"DROP TABLE password;"
+      u8"DROP TABLE login;";
+  const char *finish =
+      u8"ALTER TABLE login_v1 RENAME TO login;"
+      u8"ALTER TABLE password_v1 RENAME TO password;"
+      u8"CREATE INDEX password_login_id ON password (login_id);"
+      u8"PRAGMA user_version = 1;";
+
+  Transaction transaction(db);
+  if ((rc = transaction.begin()) != SQLITE_OK ||
+      (rc = sqlite3_exec(db, create, nullptr, nullptr, nullptr)) !=
+          SQLITE_OK ||
+      (tables > 0 &&
+       (rc = sqlite3_exec(db, migrate, nullptr, nullptr, nullptr)) !=
+           SQLITE_OK) ||
+      (rc = sqlite3_exec(db, finish, nullptr, nullptr, nullptr)) !=
+          SQLITE_OK) {
+    return rc;
+  }
+  return transaction.commit();
+}
+
+/*
+ * Constructor needs filepath to a sqlite3 database, the schema is created
+ * if the database is new. All statements are prepared here, a statement
+ * that does not compile makes the constructor throw. Memory-first, the
+ * file is loaded into memory first and a snapshot of the result is written
+ * back before the constructor returns if the file was new or migrated.
  */
-Database::Database(const char *dbFile) {
-  if (sqlite3_open(dbFile, &db)) {
+Database::Database(const char *dbFile, int persist_interval_ms)
+    : m_log(nullptr), m_busy_deadline_ms(BUSY_DEADLINE_MS), db(nullptr) {
+  int rc = persist_interval_ms > 0 ? openInMemory(dbFile)
+                                   : sqlite3_open(dbFile, &db);
+  if (rc != SQLITE_OK) {
     string text = "Database::Database Can't open database: ";
-    text.append(sqlite3_errmsg(db));
-    m_log->entry(LogLevel::ERROR, text);
+    text.append(db ? sqlite3_errmsg(db) : sqlite3_errstr(rc));
     sqlite3_close(db);
     db = nullptr;
     throw std::runtime_error(text);
   }
+  sqlite3_busy_handler(db, onBusy, this);
 
-  if (db) {
-    // Prepare satement for checking password
-    std::string zSql = u8"SELECT count(*) FROM login lg "
-                       "INNER JOIN password pw ON lg.id = pw.login_id "
-                       "WHERE lg.secid = :secid AND pw.password = :password;";
+  if (createSchema(db) != SQLITE_OK) {
+    string text = "Database::Database Can't create schema: ";
+    text.append(sqlite3_errmsg(db));
+    sqlite3_close(db);
+    db = nullptr;
+    throw std::runtime_error(text);
+  }
 
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(),
-                           &check_password_stmt, nullptr)) {
-      string text = "Database::Database Prepare check_password_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      check_password_stmt = nullptr;
+  auto prepared = [this](const char *name, int rc) {
+    if (rc != SQLITE_OK) {
+      string text = "Database::Database Prepare ";
+      text.append(name);
+      text.append(": ");
+      text.append(rc == SQLITE_RANGE || rc == SQLITE_MISMATCH
+                      ? sqlite3_errstr(rc)
+                      : sqlite3_errmsg(db));
+      sqlite3_close_v2(db);
+      db = nullptr;
+      throw std::runtime_error(text);
     }
-
-    // Prepare satements for delete login data
-    zSql = u8"SELECT lg.id FROM login lg "
-           "INNER JOIN password pw ON lg.id = pw.login_id "
-           "WHERE lg.secid = :secid AND pw.password = :password;";
-
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &select_id_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare select_id_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      select_id_stmt = nullptr;
+  };
+
+  prepared("check_password_stmt",
+           check_password_stmt.prepare(
+               db,
+               u8"SELECT count(*) FROM login lg "
+               u8"INNER JOIN password pw ON lg.id = pw.login_id "
+               u8"WHERE lg.secid = :secid AND pw.password = :password;",
+               {":secid", ":password"}));
+
+  // Statements for delete login data
+  prepared("select_id_stmt",
+           select_id_stmt.prepare(
+               db,
+               u8"SELECT lg.id FROM login lg "
+               u8"INNER JOIN password pw ON lg.id = pw.login_id "
+               u8"WHERE lg.secid = :secid AND pw.password = :password;",
+               {":secid", ":password"}));
+  prepared("delete_login_stmt",
+           delete_login_stmt.prepare(
+               db, u8"DELETE FROM login WHERE id = :id;", {":id"}));
+  prepared("delete_password_stmt",
+           delete_password_stmt.prepare(
+               db, u8"DELETE FROM password WHERE login_id = :id;", {":id"}));
+
+  prepared("add_login_stmt",
+           add_login_stmt.prepare(
+               db, u8"INSERT INTO login (secid, salt) VALUES (:secid, :salt);",
+               {":secid", ":salt"}));
+  prepared("add_password_stmt",
+           add_password_stmt.prepare(
+               db,
+               u8"INSERT INTO password (login_id, password) "
+               u8"VALUES (:login_id, :password);",
+               {":login_id", ":password"}));
+
+  prepared("get_password_stmt",
+           get_password_stmt.prepare(
+               db,
+               u8"SELECT p.password FROM login l "
+               u8"INNER JOIN password p on l.id = p.login_id "
+               u8"WHERE l.secid = :secid;",
+               {":secid"}));
+  prepared("get_salt_stmt",
+           get_salt_stmt.prepare(
+               db, u8"SELECT salt FROM login WHERE secid = :secid;",
+               {":secid"}));
+
+  prepared("upd_salt_stmt",
+           upd_salt_stmt.prepare(
+               db, u8"UPDATE login SET salt = :salt WHERE secid = :secid;",
+               {":salt", ":secid"}));
+  prepared("upd_password_stmt",
+           upd_password_stmt.prepare(
+               db,
+               u8"UPDATE password SET password = :password WHERE login_id = "
+               u8"(SELECT id FROM login WHERE secid = :secid);",
+               {":password", ":secid"}));
+
+  prepared("get_credentials_stmt",
+           get_credentials_stmt.prepare(
+               db,
+               u8"SELECT l.salt, p.password FROM login l "
+               u8"INNER JOIN password p on l.id = p.login_id "
+               u8"WHERE l.secid = :secid;",
+               {":secid"}));
+
+  // IN lists of ?1 ... ?length, bound with bindRange(). A short list for
+  // small batches, unused parameters are not free.
+  auto batch_sql = [](int length) {
+    string sql = u8"SELECT l.secid, l.salt, p.password FROM login l "
+                 u8"INNER JOIN password p on l.id = p.login_id "
+                 u8"WHERE l.secid IN (";
+    for (int i = 1; i <= length; i++) {
+      sql.append(i > 1 ? ", ?" : "?");
+      sql.append(std::to_string(i));
     }
-
-    zSql = u8"DELETE FROM login WHERE id = :id;";
-
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &delete_login_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare delete_login_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      delete_login_stmt = nullptr;
+    return sql + ");";
+  };
+  prepared("get_credentials_batch_small_stmt",
+           get_credentials_batch_small_stmt.prepare(
+               db, batch_sql(READ_BATCH_SMALL).c_str(), {}));
+  prepared("get_credentials_batch_stmt",
+           get_credentials_batch_stmt.prepare(
+               db, batch_sql(READ_BATCH_MAX).c_str(), {}));
+
+  if (persist_interval_ms > 0) {
+    struct stat st;
+    bool existed = stat(dbFile, &st) == 0;
+    m_persist.path = dbFile;
+    m_persist.interval_ms = persist_interval_ms;
+    m_persist.last = std::chrono::steady_clock::now();
+    rc = sqlite3_open_v2(memoryUri(this).c_str(), &m_persist.db,
+                         SQLITE_OPEN_READONLY | SQLITE_OPEN_URI, nullptr);
+    if (rc == SQLITE_OK) {
+      sqlite3_busy_timeout(m_persist.db, BUSY_DEADLINE_MS);
+      if (!existed || sqlite3_total_changes64(db) > 0) {
+        rc = persist();
+      } else {
+        m_persist.changes = sqlite3_total_changes64(db);
+      }
     }
-
-    zSql = u8"DELETE FROM password WHERE login_id = :id;";
-
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(),
-                           &delete_password_stmt, nullptr)) {
-      string text = "Database::Database Prepare delete_password_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      delete_password_stmt = nullptr;
+    if (rc != SQLITE_OK) {
+      string text = "Database::Database Can't persist to ";
+      text.append(dbFile);
+      text.append(": ");
+      text.append(sqlite3_errstr(rc));
+      sqlite3_close_v2(m_persist.db);
+      sqlite3_close_v2(db);
+      db = nullptr;
+      throw std::runtime_error(text);
     }
+    m_persist.thread = std::thread(&Database::persistLoop, this);
+  }
+}
 
-    zSql = u8"INSERT INTO login (secid, salt) VALUES (:secid, :salt);";
-
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &add_login_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare add_login_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      add_login_stmt = nullptr;
+/*
+ * Memory-first, db is a memdb database named after this object, so that
+ * m_persist.db can open the same one. It starts as a copy of dbFile.
+ */
+int Database::openInMemory(const char *dbFile) {
+  int rc = sqlite3_open_v2(memoryUri(this).c_str(), &db,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                               SQLITE_OPEN_URI,
+                           nullptr);
+  struct stat st;
+  if (rc != SQLITE_OK || stat(dbFile, &st) != 0) {
+    return rc; // a new database starts empty
+  }
+  sqlite3 *file = nullptr;
+  rc = sqlite3_open_v2(dbFile, &file, SQLITE_OPEN_READONLY, nullptr);
+  if (rc == SQLITE_OK) {
+    sqlite3_backup *bk = sqlite3_backup_init(db, "main", file, "main");
+    if (!bk) {
+      rc = sqlite3_errcode(db);
+    } else {
+      rc = sqlite3_backup_step(bk, -1);
+      int finish_rc = sqlite3_backup_finish(bk);
+      rc = rc == SQLITE_DONE ? finish_rc : rc;
     }
+  }
+  sqlite3_close(file);
+  return rc;
+}
 
-    zSql = u8"INSERT INTO password (login_id, password) VALUES (:login_id, "
-           u8":password);";
-
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &add_password_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare add_password_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      add_password_stmt = nullptr;
+// Copies all of src into dest, waiting out writers that hold src
+static int copyPages(sqlite3 *dest, sqlite3 *src, int *pages) {
+  sqlite3_backup *bk = sqlite3_backup_init(dest, "main", src, "main");
+  if (!bk) {
+    return sqlite3_errcode(dest);
+  }
+  int rc = SQLITE_OK;
+  for (int tries = 0; tries < 100; tries++) {
+    rc = sqlite3_backup_step(bk, -1);
+    if (rc != SQLITE_BUSY && rc != SQLITE_LOCKED) {
+      break;
     }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (pages) {
+    *pages = sqlite3_backup_pagecount(bk);
+  }
+  int finish_rc = sqlite3_backup_finish(bk);
+  return rc == SQLITE_DONE ? finish_rc : rc;
+}
 
-    zSql = u8"SELECT p.password FROM login l "
-           u8"INNER JOIN password p on l.id = p.login_id "
-           u8"WHERE l.secid = :secid;";
-
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &get_password_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare get_password_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      get_password_stmt = nullptr;
+/*
+ * Writes a snapshot of the in-memory database to a temporary file with
+ * the backup API and renames it over the database file, so the file is
+ * always a complete snapshot, whenever the process stops. The pages are
+ * first copied through m_persist.db, which only sees committed
+ * transactions, into a private in-memory database; writers wait in onBusy
+ * for that memory copy only, not for the disk write that follows. Nothing
+ * is logged here: the destructor persists after the owner's Logger may be
+ * gone. Failures are counted.
+ */
+int Database::persist() {
+  if (m_persist.path.empty()) {
+    return SQLITE_MISUSE;
+  }
+  using clock = std::chrono::steady_clock;
+  std::lock_guard<std::mutex> run(m_persist.run_mtx);
+  auto start = clock::now();
+  sqlite3_int64 changes = sqlite3_total_changes64(db);
+  string tmp = m_persist.path + ".snapshot";
+  unlink(tmp.c_str());
+
+  sqlite3 *copy = nullptr;
+  sqlite3 *dest = nullptr;
+  int pages = 0;
+  int rc = sqlite3_open(":memory:", &copy);
+  if (rc == SQLITE_OK) {
+    rc = copyPages(copy, m_persist.db, &pages);
+  }
+  double copy_seconds =
+      std::chrono::duration<double>(clock::now() - start).count();
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_open(tmp.c_str(), &dest);
+  }
+  if (rc == SQLITE_OK) {
+    rc = copyPages(dest, copy, nullptr);
+  }
+  sqlite3_close(copy);
+  sqlite3_close(dest);
+  if (rc == SQLITE_OK && rename(tmp.c_str(), m_persist.path.c_str()) != 0) {
+    rc = SQLITE_IOERR;
+  }
+  if (rc == SQLITE_OK) {
+    // Make the rename itself durable
+    size_t slash = m_persist.path.find_last_of('/');
+    string dir =
+        slash == string::npos ? "." : m_persist.path.substr(0, slash + 1);
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd >= 0) {
+      fsync(fd);
+      close(fd);
     }
+  }
 
-    zSql = u8"SELECT salt FROM login WHERE secid = :secid ;";
+  std::lock_guard<std::mutex> lock(m_persist.mtx);
+  if (rc != SQLITE_OK) {
+    m_persist.stats.failures++;
+    return rc;
+  }
+  m_persist.changes = changes;
+  m_persist.stats.snapshots++;
+  m_persist.stats.pages = pages;
+  m_persist.stats.copy_seconds = copy_seconds;
+  m_persist.stats.last_seconds =
+      std::chrono::duration<double>(clock::now() - start).count();
+  m_persist.last = start;
+  return SQLITE_OK;
+}
 
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &get_salt_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare get_salt_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      get_salt_stmt = nullptr;
+// Snapshots every interval, if the connection changed anything since
+void Database::persistLoop() {
+  std::unique_lock<std::mutex> lock(m_persist.mtx);
+  while (!m_persist.stop) {
+    m_persist.cv.wait_for(lock,
+                          std::chrono::milliseconds(m_persist.interval_ms),
+                          [this] { return m_persist.stop; });
+    if (m_persist.stop) {
+      break;
+    }
+    lock.unlock();
+    if (sqlite3_total_changes64(db) != m_persist.changes) {
+      persist();
     }
+    lock.lock();
+  }
+}
 
-    zSql = u8"UPDATE login SET salt = :salt "
-           u8"WHERE secid = :secid;";
+bool Database::persistStats(PersistStats &stats) {
+  if (m_persist.path.empty()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(m_persist.mtx);
+  stats = m_persist.stats;
+  stats.age_seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - m_persist.last)
+                          .count();
+  return true;
+}
 
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &upd_salt_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare upd_salt_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      upd_salt_stmt = nullptr;
+// Statements are finalized by their destructors, close_v2 waits for them
+Database::~Database() {
+  if (m_persist.thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_persist.mtx);
+      m_persist.stop = true;
     }
+    m_persist.cv.notify_all();
+    m_persist.thread.join();
+    if (sqlite3_total_changes64(db) != m_persist.changes) {
+      persist();
+    }
+  }
+  if (m_persist.db) {
+    sqlite3_close_v2(m_persist.db);
+  }
+  // Removes its trace hook, which needs the connection still open
+  m_profiler.reset();
+  if (db) {
+    sqlite3_close_v2(db);
+  }
+}
 
-    zSql = u8"UPDATE password SET password = :password "
-           u8"WHERE login_id = (SELECT id FROM login WHERE secid = :secid);";
+/*
+ * Logs what failed together with the connection's error message and
+ * returns rc, so error paths read `return fail("Database::x ...", rc);`.
+ */
+int Database::fail(const char *what, int rc, Logger::LogLevel level) {
+  string text = what;
+  text.append(": ");
+  text.append(sqlite3_errmsg(db));
+  text.append(", rc: ");
+  text.append(std::to_string(rc));
+  m_log->entry(level, text);
+  return rc;
+}
 
-    if (sqlite3_prepare_v2(db, zSql.c_str(), zSql.length(), &upd_password_stmt,
-                           nullptr)) {
-      string text = "Database::Database Prepare upd_password_stmt: ";
-      text.append(sqlite3_errmsg(db));
-      m_log->entry(LogLevel::ERROR, text);
-      upd_password_stmt = nullptr;
-    }
+/*
+ * Busy handler. SQLite calls it when a statement finds the database locked
+ * by another connection, count is the number of calls for that statement.
+ * It sleeps an exponentially growing backoff and has SQLite try again until
+ * m_busy_deadline_ms has passed since the first call; after that the
+ * statement returns SQLITE_BUSY. With BEGIN IMMEDIATE the writers of a busy
+ * file queue here instead of failing.
+ */
+int Database::onBusy(void *self, int count) {
+  using clock = std::chrono::steady_clock;
+  thread_local clock::time_point first;
+  thread_local std::minstd_rand jitter(std::random_device{}());
+  Database *database = static_cast<Database *>(self);
+  auto &busy = database->m_busy;
+  auto now = clock::now();
+  if (count == 0) {
+    first = now;
+    busy.contended++;
   }
+  uint64_t waited =
+      std::chrono::duration_cast<std::chrono::microseconds>(now - first)
+          .count();
+  uint64_t deadline = static_cast<uint64_t>(database->m_busy_deadline_ms) *
+                      1000;
+  if (waited >= deadline) {
+    busy.gave_up++;
+    return 0;
+  }
+
+  // Half of the backoff is random, so writers that collided spread out
+  uint64_t backoff = std::min<uint64_t>(
+      BUSY_MAX_US, static_cast<uint64_t>(BUSY_BASE_US) << std::min(count, 16));
+  backoff = backoff / 2 + jitter() % (backoff / 2 + 1);
+  backoff = std::min(backoff, deadline - waited);
+  std::this_thread::sleep_for(std::chrono::microseconds(backoff));
+
+  busy.retries++;
+  busy.wait_us += backoff;
+  uint64_t total = waited + backoff;
+  uint64_t max = busy.max_wait_us;
+  while (total > max && !busy.max_wait_us.compare_exchange_weak(max, total)) {
+  }
+  return 1;
 }
 
-Database::~Database() {
-  if (check_password_stmt) {
-    sqlite3_finalize(check_password_stmt);
+/*
+ * Installs a Profiler on the connection and names the prepared statements,
+ * other statements show up under their SQL.
+ */
+int Database::enableProfiling(bool enable) {
+  m_profiler.reset();
+  if (!enable) {
+    return SQLITE_OK;
   }
-  if (select_id_stmt) {
-    sqlite3_finalize(select_id_stmt);
+  m_profiler.reset(new Profiler(db));
+  m_profiler->name(check_password_stmt.handle(), "check_password_stmt");
+  m_profiler->name(select_id_stmt.handle(), "select_id_stmt");
+  m_profiler->name(delete_login_stmt.handle(), "delete_login_stmt");
+  m_profiler->name(delete_password_stmt.handle(), "delete_password_stmt");
+  m_profiler->name(add_login_stmt.handle(), "add_login_stmt");
+  m_profiler->name(add_password_stmt.handle(), "add_password_stmt");
+  m_profiler->name(get_password_stmt.handle(), "get_password_stmt");
+  m_profiler->name(get_salt_stmt.handle(), "get_salt_stmt");
+  m_profiler->name(upd_salt_stmt.handle(), "upd_salt_stmt");
+  m_profiler->name(upd_password_stmt.handle(), "upd_password_stmt");
+  m_profiler->name(get_credentials_stmt.handle(), "get_credentials_stmt");
+  m_profiler->name(get_credentials_batch_small_stmt.handle(),
+                   "get_credentials_batch_small_stmt");
+  m_profiler->name(get_credentials_batch_stmt.handle(),
+                   "get_credentials_batch_stmt");
+  m_log->entry(LogLevel::INFO, "Database::enableProfiling statement "
+                               "profiling enabled.");
+  return SQLITE_OK;
+}
+
+bool Database::profile(Profiler::Snapshot &snapshot) {
+  if (!m_profiler) {
+    return false;
   }
-  if (delete_login_stmt) {
-    sqlite3_finalize(delete_login_stmt);
+  snapshot = m_profiler->snapshot();
+  return true;
+}
+
+/*
+ * Lookups go through a ReadBatcher: the thread that leads a batch runs one
+ * of the get_credentials statements for all waiting secids. No other thread
+ * uses those statements, so lookups are safe to make concurrently.
+ */
+int Database::enableReadBatching(bool enable, int max_wait_us) {
+  m_batcher.reset();
+  if (!enable) {
+    return SQLITE_OK;
   }
-  if (delete_password_stmt) {
-    sqlite3_finalize(delete_password_stmt);
+  m_batcher.reset(new ReadBatcher(
+      [this](const std::vector<string> &secids,
+             std::unordered_map<string, CredentialCache::Entry> &found) {
+        return fetchCredentials(secids, found);
+      },
+      max_wait_us));
+  m_log->entry(LogLevel::INFO,
+               "Database::enableReadBatching read batching enabled, "
+               "window up to " +
+                   std::to_string(max_wait_us) + " us.");
+  return SQLITE_OK;
+}
+
+bool Database::readBatchStats(ReadBatcher::Stats &stats) {
+  if (!m_batcher) {
+    return false;
   }
-  if (add_login_stmt) {
-    sqlite3_finalize(add_login_stmt);
+  stats = m_batcher->stats();
+  return true;
+}
+
+/*
+ * Fetch of the ReadBatcher. Found credentials go into the cache as well,
+ * under versions taken before the read, like loadCredentials.
+ */
+int Database::fetchCredentials(
+    const std::vector<string> &secids,
+    std::unordered_map<string, CredentialCache::Entry> &found) {
+  std::vector<uint64_t> versions;
+  if (m_cache) {
+    for (const string &secid : secids) {
+      versions.push_back(m_cache->version(secid));
+    }
   }
-  if (add_password_stmt) {
-    sqlite3_finalize(add_password_stmt);
+
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  int rc;
+  if (secids.size() == 1) {
+    auto get = get_credentials_stmt.bind(secids[0]);
+    rc = get.step();
+    if (rc == SQLITE_ROW) {
+      CredentialCache::Entry &entry = found[secids[0]];
+      std::tie(entry.salt, entry.password) = get.row();
+      rc = get.step();
+    }
+  } else {
+    auto get = secids.size() <= READ_BATCH_SMALL
+                   ? get_credentials_batch_small_stmt.bindRange(secids)
+                   : get_credentials_batch_stmt.bindRange(secids);
+    while ((rc = get.step()) == SQLITE_ROW) {
+      string secid;
+      CredentialCache::Entry entry;
+      std::tie(secid, entry.salt, entry.password) = get.row();
+      found[secid] = std::move(entry);
+    }
   }
-  if (get_password_stmt) {
-    sqlite3_finalize(get_password_stmt);
+  if (rc != SQLITE_DONE) {
+    return fail("Database::fetchCredentials get_credentials", rc);
   }
-  if (get_salt_stmt) {
-    sqlite3_finalize(get_salt_stmt);
+
+  for (size_t i = 0; m_cache && i < secids.size(); i++) {
+    auto row = found.find(secids[i]);
+    if (row != found.end()) {
+      m_cache->put(secids[i], row->second, versions[i]);
+    }
   }
-  if (upd_salt_stmt) {
-    sqlite3_finalize(upd_salt_stmt);
+  return SQLITE_OK;
+}
+
+/*
+ * Batch lookup. Cached users are answered from the cache, the filter
+ * rejects unknown ones, and the rest are read with the IN-list queries of
+ * the ReadBatcher, READ_BATCH_MAX secids per query.
+ */
+int Database::getCredentials(const std::vector<string> &secids,
+                             std::vector<CredentialCache::Entry> &entries,
+                             std::vector<int> &rcs) {
+  entries.assign(secids.size(), CredentialCache::Entry());
+  rcs.assign(secids.size(), SQLITE_DONE);
+  std::vector<string> missing;
+  for (size_t i = 0; i < secids.size(); i++) {
+    if (!knownUser(secids[i])) {
+      continue;
+    }
+    if (m_cache && m_cache->get(secids[i], entries[i])) {
+      rcs[i] = SQLITE_OK;
+    } else {
+      missing.push_back(secids[i]);
+    }
   }
-  if (upd_password_stmt) {
-    sqlite3_finalize(upd_password_stmt);
+  std::sort(missing.begin(), missing.end());
+  missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+  std::unordered_map<string, CredentialCache::Entry> found;
+  for (size_t start = 0; start < missing.size(); start += READ_BATCH_MAX) {
+    auto end = missing.begin() +
+               std::min<size_t>(missing.size(), start + READ_BATCH_MAX);
+    int rc = fetchCredentials(
+        std::vector<string>(missing.begin() + start, end), found);
+    if (rc != SQLITE_OK) {
+      for (size_t i = 0; i < secids.size(); i++) {
+        if (rcs[i] != SQLITE_OK && knownUser(secids[i])) {
+          rcs[i] = rc;
+        }
+      }
+      return rc;
+    }
   }
-  if (db) {
-    sqlite3_close(db);
+  for (size_t i = 0; i < secids.size(); i++) {
+    auto row = found.find(secids[i]);
+    if (rcs[i] != SQLITE_OK && row != found.end()) {
+      entries[i] = row->second;
+      rcs[i] = SQLITE_OK;
+    }
   }
+  return SQLITE_OK;
+}
+
+void Database::setBusyDeadline(int deadline_ms) {
+  m_busy_deadline_ms = std::max(deadline_ms, 0);
+}
+
+bool Database::busyStats(BusyStats &stats) {
+  stats.contended = m_busy.contended;
+  stats.retries = m_busy.retries;
+  stats.gave_up = m_busy.gave_up;
+  stats.wait_seconds = m_busy.wait_us / 1e6;
+  stats.max_wait_seconds = m_busy.max_wait_us / 1e6;
+  return true;
 }
 
 void Database::setLogger(Logger *log) {
@@ -195,54 +723,213 @@ void Database::setLogger(Logger *log) {
   }
 }
 
-int Database::checkPassword(const std::string &secid,
-                            const std::string &password) {
-  if (!check_password_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::checkPassword check_password_stmt not initialized");
-    return SQLITE_ERROR;
+void Database::enableCache(size_t capacity_bytes) {
+  if (capacity_bytes == 0) {
+    m_cache.reset();
+    return;
+  }
+  m_cache.reset(new CredentialCache(capacity_bytes));
+  m_log->entry(LogLevel::INFO,
+               "Database::enableCache credential cache of " +
+                   std::to_string(capacity_bytes) + " bytes enabled.");
+}
+
+bool Database::cacheStats(CredentialCache::Stats &stats) {
+  if (!m_cache) {
+    return false;
+  }
+  stats = m_cache->stats();
+  return true;
+}
+
+int Database::enableFilter(bool enable) {
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  std::lock_guard<std::mutex> lock(m_filter_mtx);
+  if (!enable) {
+    std::atomic_store(&m_filter, std::shared_ptr<CuckooFilter>());
+    return SQLITE_OK;
   }
+  return buildFilter(0);
+}
 
-  int rc = sqlite3_bind_text(
-      check_password_stmt,
-      sqlite3_bind_parameter_index(check_password_stmt, ":secid"),
-      secid.c_str(), secid.length(), SQLITE_TRANSIENT);
+bool Database::filterStats(CuckooFilter::Stats &stats) {
+  std::shared_ptr<CuckooFilter> filter = std::atomic_load(&m_filter);
+  if (!filter) {
+    return false;
+  }
+  stats = filter->stats();
+  return true;
+}
+
+/*
+ * Changes are captured inside SQLite: temporary triggers on the login table
+ * call feed_change() with the secid of each added, updated or deleted row.
+ * The commit hook moves the captured events of a transaction aside, the
+ * rollback hook drops them, and they are published after COMMIT returned,
+ * in commit order. The triggers are temporary, other connections to the
+ * file are not affected.
+ */
+int Database::setChangeFeed(std::shared_ptr<ChangeFeed> feed) {
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  std::lock_guard<std::mutex> lock(m_filter_mtx);
+  const char *drop = u8"DROP TRIGGER IF EXISTS temp.feed_add;"
+                     u8"DROP TRIGGER IF EXISTS temp.feed_update;"
+                     u8"DROP TRIGGER IF EXISTS temp.feed_delete;";
+  if (!feed) {
+    sqlite3_commit_hook(db, nullptr, nullptr);
+    sqlite3_rollback_hook(db, nullptr, nullptr);
+    m_feed.reset();
+    int rc = sqlite3_exec(db, drop, nullptr, nullptr, nullptr);
+    return rc == SQLITE_OK ? rc : fail("Database::setChangeFeed drop", rc);
+  }
+
+  int rc = sqlite3_create_function(db, "feed_change", 2, SQLITE_UTF8, this,
+                                   feedChange, nullptr, nullptr);
   if (rc != SQLITE_OK) {
-    string text = "Database::checkPassword statement bind 'secid': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
+    return fail("Database::setChangeFeed create_function", rc);
+  }
+  rc = sqlite3_exec(
+      db,
+      u8"CREATE TEMP TRIGGER IF NOT EXISTS feed_add AFTER INSERT ON "
+      u8"main.login BEGIN SELECT feed_change('A', NEW.secid); END;"
+      u8"CREATE TEMP TRIGGER IF NOT EXISTS feed_update AFTER UPDATE ON "
+      u8"main.login BEGIN SELECT feed_change('U', NEW.secid); END;"
+      u8"CREATE TEMP TRIGGER IF NOT EXISTS feed_delete AFTER DELETE ON "
+      u8"main.login BEGIN SELECT feed_change('D', OLD.secid); END;",
+      nullptr, nullptr, nullptr);
+  if (rc != SQLITE_OK) {
+    rc = fail("Database::setChangeFeed create triggers", rc);
+    sqlite3_exec(db, drop, nullptr, nullptr, nullptr);
     return rc;
   }
+  sqlite3_commit_hook(db, onCommit, this);
+  sqlite3_rollback_hook(db, onRollback, this);
+  m_feed = std::move(feed);
+  return SQLITE_OK;
+}
+
+// Called by the triggers while a statement runs, only records the change
+void Database::feedChange(sqlite3_context *ctx, int, sqlite3_value **argv) {
+  Database *self = static_cast<Database *>(sqlite3_user_data(ctx));
+  const unsigned char *op = sqlite3_value_text(argv[0]);
+  const char *secid =
+      reinterpret_cast<const char *>(sqlite3_value_text(argv[1]));
+  if (op && secid) {
+    self->m_changes.push_back(
+        {0, static_cast<ChangeFeed::Op>(op[0]),
+         string(secid, sqlite3_value_bytes(argv[1]))});
+  }
+  sqlite3_result_null(ctx);
+}
+
+int Database::onCommit(void *self) {
+  Database *database = static_cast<Database *>(self);
+  std::move(database->m_changes.begin(), database->m_changes.end(),
+            std::back_inserter(database->m_committed));
+  database->m_changes.clear();
+  return 0; // let the commit go ahead
+}
+
+void Database::onRollback(void *self) {
+  Database *database = static_cast<Database *>(self);
+  database->m_changes.clear();
+  database->m_committed.clear();
+}
+
+// Caller holds m_conn_mtx and m_filter_mtx, right after a successful COMMIT
+void Database::publishChanges() {
+  if (m_feed && !m_committed.empty()) {
+    m_feed->publish(std::move(m_committed));
+  }
+  m_committed.clear();
+}
+
+/*
+ * Builds the secid filter with a streaming scan over the login table and
+ * swaps it in. It is sized with 25% headroom over the current users and is
+ * rebuilt twice as large when an insert finds it full. Caller holds
+ * m_conn_mtx and m_filter_mtx.
+ */
+int Database::buildFilter(size_t min_capacity) {
+  Statement<sqlite3_int64> count;
+  sqlite3_int64 users = 0;
+  int rc = count.prepare(db, "SELECT count(*) FROM login;", {});
+  if (rc == SQLITE_OK) {
+    auto scope = count.bind();
+    if (scope.step() == SQLITE_ROW) {
+      std::tie(users) = scope.row();
+    }
+  }
 
-  rc = sqlite3_bind_text(
-      check_password_stmt,
-      sqlite3_bind_parameter_index(check_password_stmt, ":password"),
-      password.c_str(), password.length(), SQLITE_TRANSIENT);
+  size_t capacity = std::max<size_t>(users + users / 4, 1024);
+  capacity = std::max(capacity, min_capacity);
+  std::shared_ptr<CuckooFilter> filter(new CuckooFilter(capacity));
+
+  Statement<string> scan;
+  rc = scan.prepare(db, "SELECT secid FROM login;", {});
   if (rc != SQLITE_OK) {
-    string text = "Database::checkPassword statement bind 'password': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    return rc;
+    return fail("Database::buildFilter prepare scan", rc);
+  }
+  {
+    auto scope = scan.bind();
+    while ((rc = scope.step()) == SQLITE_ROW) {
+      if (!filter->insert(std::get<0>(scope.row()))) {
+        return buildFilter(capacity * 2);
+      }
+    }
+    if (rc != SQLITE_DONE) {
+      return fail("Database::buildFilter execute step scan", rc);
+    }
   }
 
-  rc = sqlite3_step(check_password_stmt);
-  if (rc != SQLITE_ROW) {
-    string text = "Database::checkPassword execute step check_password_stmt: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(check_password_stmt);
-    return rc;
+  CuckooFilter::Stats stats = filter->stats();
+  string text = "Database::buildFilter ";
+  text.append(std::to_string(stats.items));
+  text.append(" users, capacity ");
+  text.append(std::to_string(stats.capacity));
+  text.append(", ");
+  text.append(std::to_string(stats.bytes));
+  text.append(" bytes (");
+  text.append(std::to_string(stats.bytes * 1000000.0 / stats.capacity /
+                             (1024 * 1024)));
+  text.append(" MiB per million users at full capacity)");
+  m_log->entry(LogLevel::INFO, text);
+
+  std::atomic_store(&m_filter, filter);
+  return SQLITE_OK;
+}
+
+// False only when secid is certainly not a user
+bool Database::knownUser(const string &secid) {
+  std::shared_ptr<CuckooFilter> filter = std::atomic_load(&m_filter);
+  return !filter || filter->contains(secid);
+}
+
+int Database::checkPassword(const std::string &secid,
+                            const std::string &password) {
+  if (!knownUser(secid)) {
+    return SQLITE_NOTFOUND;
+  }
+  CredentialCache::Entry cached;
+  if (m_cache && m_cache->get(secid, cached)) {
+    return cached.password == password ? SQLITE_OK : SQLITE_NOTFOUND;
+  }
+  if (m_batcher) {
+    int rc = m_batcher->lookup(secid, cached);
+    if (rc == SQLITE_OK) {
+      return cached.password == password ? SQLITE_OK : SQLITE_NOTFOUND;
+    }
+    return rc == SQLITE_DONE ? SQLITE_NOTFOUND : rc;
   }
 
-  int exists = sqlite3_column_int(check_password_stmt, 0);
-  sqlite3_reset(check_password_stmt);
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  auto check = check_password_stmt.bind(secid, Blob(password));
+  int rc = check.step();
+  if (rc != SQLITE_ROW) {
+    return fail("Database::checkPassword check_password_stmt", rc);
+  }
 
+  int exists = std::get<0>(check.row());
   if (exists == 0) {
     return SQLITE_NOTFOUND;
   } else if (exists == 1) {
@@ -262,188 +949,50 @@ int Database::deleteUser(const std::string &secid,
   /*
    * INPUT: secid and password for the user to be deleted.
    * RETURN: Integer value. 0-200 represent sqlite3 return codes, 500 is
-   * internal server error. Function utilize the global instance statements
-   * select_id_stmt, delete_login_stmt and delete_password_stmt. New
-   * parameters provided to the function are binded to these statements. The
-   * statements are reset upon function completion.
+   * internal server error. SQLITE_DONE when no user has this secid and
+   * password. Any failure after BEGIN rolls the transaction back.
    */
-  if (!select_id_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::deleteUser select_id_stmt not initialized");
-    return SQLITE_ERROR;
-  }
-
-  if (!delete_login_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::deleteUser delete_login_stmt not initialized");
-    return SQLITE_ERROR;
-  }
-
-  if (!delete_password_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::deleteUser delete_password_stmt not initialized");
-    return SQLITE_ERROR;
-  }
-
-  int rc = sqlite3_bind_text(
-      select_id_stmt, sqlite3_bind_parameter_index(select_id_stmt, ":secid"),
-      secid.c_str(), secid.length(), SQLITE_TRANSIENT);
-  if (rc != SQLITE_OK) {
-    string text = "Database::deleteUser bind statement 'secid': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(select_id_stmt);
-    return rc;
-  }
-
-  rc = sqlite3_bind_text(
-      select_id_stmt, sqlite3_bind_parameter_index(select_id_stmt, ":password"),
-      password.c_str(), password.length(), SQLITE_TRANSIENT);
-  if (rc != SQLITE_OK) {
-    string text = "Database::deleteUser bind statement 'password': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(select_id_stmt);
-    return rc;
-  }
-
-  char *errMsg = nullptr;
-  rc = sqlite3_exec(db, "BEGIN IMMEDIATE TRANSACTION;", 0, 0, &errMsg);
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  Transaction transaction(db);
+  int rc = transaction.begin();
   if (rc != SQLITE_OK) {
-    string text = "Database::deleteUser execute BEGIN: ";
-    text.append(errMsg);
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_free(errMsg);
-    sqlite3_reset(select_id_stmt);
-    return rc;
+    return fail("Database::deleteUser BEGIN IMMEDIATE", rc);
   }
 
-  rc = sqlite3_step(select_id_stmt);
-  if (rc != SQLITE_ROW) {
-    string text = "Database::deleteUser execute step select id: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-
-    if (rc == SQLITE_DONE) {
-      m_log->entry(LogLevel::INFO, text);
-    } else {
-      m_log->entry(LogLevel::ERROR, text);
+  sqlite3_int64 id;
+  {
+    auto select = select_id_stmt.bind(secid, Blob(password));
+    rc = select.step();
+    if (rc != SQLITE_ROW) {
+      return fail("Database::deleteUser select_id_stmt >> ROLLBACK", rc,
+                  rc == SQLITE_DONE ? LogLevel::INFO : LogLevel::ERROR);
     }
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Database::deleteUser exevute step select id following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    sqlite3_reset(select_id_stmt);
-    return rc;
+    id = std::get<0>(select.row());
   }
-  sqlite3_int64 id = sqlite3_column_int(select_id_stmt, 0);
-  sqlite3_reset(select_id_stmt);
 
-  // Delete from table login
-  rc = sqlite3_bind_int(delete_login_stmt,
-                        sqlite3_bind_parameter_index(delete_login_stmt, ":id"),
-                        id);
-  if (rc != SQLITE_OK) {
-    string text = "Database::deleteUser bind delete login statement 'id': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    sqlite3_reset(delete_login_stmt);
-    return rc;
+  rc = delete_login_stmt.bind(id).step();
+  if (rc != SQLITE_DONE) {
+    return fail("Database::deleteUser delete_login_stmt >> ROLLBACK", rc);
   }
-
-  rc = sqlite3_step(delete_login_stmt);
-  sqlite3_reset(delete_login_stmt);
+  rc = delete_password_stmt.bind(id).step();
   if (rc != SQLITE_DONE) {
-    string text = "Database::deleteUser execute step delete login: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    return rc;
+    return fail("Database::deleteUser delete_password_stmt >> ROLLBACK", rc);
   }
 
-  // Delete from table password
-  rc = sqlite3_bind_int(
-      delete_password_stmt,
-      sqlite3_bind_parameter_index(delete_password_stmt, ":id"), id);
+  // Filter updates and feed events are applied in commit order
+  std::lock_guard<std::mutex> filter_lock(m_filter_mtx);
+  rc = transaction.commit();
   if (rc != SQLITE_OK) {
-    string text = "Database::deleteUser bind delete password statement 'id': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    sqlite3_reset(delete_password_stmt);
-    return rc;
+    return fail("Database::deleteUser COMMIT >> ROLLBACK", rc);
   }
 
-  rc = sqlite3_step(delete_password_stmt);
-  sqlite3_reset(delete_password_stmt);
-  if (rc != SQLITE_DONE) {
-    string text = "Database::deleteUser execute step delete password: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    return rc;
+  publishChanges();
+  if (m_filter) {
+    m_filter->remove(secid);
   }
-
-  rc = sqlite3_exec(db, "COMMIT;", 0, 0, &errMsg);
-  if (rc != SQLITE_OK) {
-    string text = "Database::deleteUser execute step COMMIT: ";
-    text.append(errMsg);
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    return rc;
+  if (m_cache) {
+    m_cache->invalidate(secid);
   }
-
   return rc;
 }
 
@@ -454,138 +1003,98 @@ int Database::addUser(const string &secid, const string &password,
    * RETURN: Integer value. 0-200 represent sqlite3 return codes, 500 is
    * internal server error.
    */
-  if (!add_login_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::addUser add_login_stmt not initialized");
-    return SQLITE_ERROR;
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  Transaction transaction(db);
+  int rc = transaction.begin();
+  if (rc != SQLITE_OK) {
+    return fail("Database::addUser BEGIN IMMEDIATE", rc);
   }
 
-  if (!add_password_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::addUser add_password_stmt not initialized");
-    return SQLITE_ERROR;
+  rc = add_login_stmt.bind(secid, Blob(salt)).step();
+  if (rc != SQLITE_DONE) {
+    return fail("Database::addUser add_login_stmt >> ROLLBACK", rc);
   }
-
-  int rc = sqlite3_bind_text(
-      add_login_stmt, sqlite3_bind_parameter_index(add_login_stmt, ":secid"),
-      secid.c_str(), secid.length(), SQLITE_TRANSIENT);
-  if (rc != SQLITE_OK) {
-    string text = "Database::addUser bind statement 'secid': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(add_login_stmt);
-    return rc;
+  sqlite3_int64 login_id = sqlite3_last_insert_rowid(db);
+  rc = add_password_stmt.bind(login_id, Blob(password)).step();
+  if (rc != SQLITE_DONE) {
+    return fail("Database::addUser add_password_stmt >> ROLLBACK", rc);
   }
 
-  rc = sqlite3_bind_text(add_login_stmt,
-                         sqlite3_bind_parameter_index(add_login_stmt, ":salt"),
-                         salt.c_str(), salt.length(), SQLITE_TRANSIENT);
+  // Filter updates and feed events are applied in commit order
+  std::lock_guard<std::mutex> filter_lock(m_filter_mtx);
+  rc = transaction.commit();
   if (rc != SQLITE_OK) {
-    string text = "Database::addUser bind statement 'salt': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(add_login_stmt);
-    return rc;
-  }
-  char *errMsg = nullptr;
-  rc = sqlite3_exec(db, "BEGIN IMMEDIATE TRANSACTION;", 0, 0, &errMsg);
-  if (rc != SQLITE_OK) {
-    string text = "Database::addUser BEGIN IMMEDIATE: ";
-    text.append(errMsg);
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_free(errMsg);
-    sqlite3_reset(add_login_stmt);
-    return rc;
+    return fail("Database::addUser COMMIT >> ROLLBACK", rc);
   }
 
-  rc = sqlite3_step(add_login_stmt);
-  sqlite3_reset(add_login_stmt);
-  if (rc != SQLITE_DONE) {
-    string text = "Database::addUser execute step add_login_stmt: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Database::addUser execute step select id following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    return rc;
+  publishChanges();
+  if (m_filter && !m_filter->insert(secid)) {
+    // Full, grow it. The new scan includes the user just committed.
+    buildFilter(m_filter->stats().capacity * 2);
   }
-
-  // Bind password statement
-  sqlite3_int64 login_id = sqlite3_last_insert_rowid(db);
-
-  rc = sqlite3_bind_int64(
-      add_password_stmt,
-      sqlite3_bind_parameter_index(add_password_stmt, ":login_id"), login_id);
-  if (rc != SQLITE_OK) {
-    string text = "Database::addUser bind statement 'login_id': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(add_password_stmt);
-    return rc;
+  if (m_cache) {
+    m_cache->invalidate(secid);
   }
+  return rc;
+}
 
-  rc = sqlite3_bind_text(
-      add_password_stmt,
-      sqlite3_bind_parameter_index(add_password_stmt, ":password"),
-      password.c_str(), password.length(), SQLITE_TRANSIENT);
+/*
+ * Adds all users in one transaction. A secid that is already taken fails
+ * with SQLITE_CONSTRAINT on its own, SQLite undoes just that statement;
+ * any other error rolls back the whole batch and is every user's result.
+ */
+int Database::addUsers(const std::vector<NewUser> &users,
+                       std::vector<int> &rcs) {
+  rcs.assign(users.size(), SQLITE_CONSTRAINT);
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  Transaction transaction(db);
+  int rc = transaction.begin();
+  auto failAll = [&](const char *what) {
+    rcs.assign(users.size(), rc);
+    return fail(what, rc);
+  };
   if (rc != SQLITE_OK) {
-    string text = "Database::addUser bind statement 'password': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(add_password_stmt);
-    return rc;
+    return failAll("Database::addUsers BEGIN IMMEDIATE");
   }
 
-  rc = sqlite3_step(add_password_stmt);
-  sqlite3_reset(add_password_stmt);
-  if (rc != SQLITE_DONE) {
-    string text = "Database::addUser execute step add_password_stmt: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Database::addUser execute step add_password_stmt following "
-             "ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
+  for (size_t i = 0; i < users.size(); i++) {
+    rc = add_login_stmt.bind(users[i].secid, Blob(users[i].salt)).step();
+    if (rc == SQLITE_CONSTRAINT) {
+      continue;
+    } else if (rc != SQLITE_DONE) {
+      return failAll("Database::addUsers add_login_stmt >> ROLLBACK");
     }
-    sqlite3_free(errMsg);
-    return rc;
+    sqlite3_int64 login_id = sqlite3_last_insert_rowid(db);
+    rc = add_password_stmt.bind(login_id, Blob(users[i].password)).step();
+    if (rc != SQLITE_DONE) {
+      return failAll("Database::addUsers add_password_stmt >> ROLLBACK");
+    }
+    rcs[i] = SQLITE_OK;
   }
 
-  rc = sqlite3_exec(db, "COMMIT;", 0, 0, &errMsg);
+  // Filter updates and feed events are applied in commit order
+  std::lock_guard<std::mutex> filter_lock(m_filter_mtx);
+  rc = transaction.commit();
   if (rc != SQLITE_OK) {
-    string text = "Database::addUser execute step COMMIT: ";
-    text.append(errMsg);
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
+    return failAll("Database::addUsers COMMIT >> ROLLBACK");
   }
 
-  return rc;
+  publishChanges();
+  bool rebuilt = false;
+  for (size_t i = 0; i < users.size(); i++) {
+    if (rcs[i] != SQLITE_OK) {
+      continue;
+    }
+    if (m_filter && !rebuilt && !m_filter->insert(users[i].secid)) {
+      // Full, grow it. The new scan includes every user just committed.
+      buildFilter(m_filter->stats().capacity * 2);
+      rebuilt = true;
+    }
+    if (m_cache) {
+      m_cache->invalidate(users[i].secid);
+    }
+  }
+  return SQLITE_OK;
 }
 
 int Database::updatePassword(const string &secid, const string &password,
@@ -593,108 +1102,19 @@ int Database::updatePassword(const string &secid, const string &password,
   /*
    * INPUT: secid for existing user, password and generated salt to be updated.
    * RETURN: Integer value. 0-200 represent sqlite3 return codes, 500 is
-   * internal server error.
+   * internal server error. SQLITE_ABORT when secid is not a user.
    */
-  if (!upd_salt_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::updatePassword upd_salt_stmt not initialized");
-    return SQLITE_ERROR;
-  }
-
-  if (!upd_password_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::updatePassword upd_password_stmt not initialized");
-    return SQLITE_ERROR;
-  }
-
-  // Bind parameters to SQL-queries
-  int rc = sqlite3_bind_text(
-      upd_salt_stmt, sqlite3_bind_parameter_index(upd_salt_stmt, ":secid"),
-      secid.c_str(), secid.length(), SQLITE_TRANSIENT);
-  if (rc != SQLITE_OK) {
-    string text = "Database::updatePassword bind upd_salt_stmt w/ 'secid': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(upd_salt_stmt);
-    return rc;
-  }
-
-  rc = sqlite3_bind_text(upd_salt_stmt,
-                         sqlite3_bind_parameter_index(upd_salt_stmt, ":salt"),
-                         salt.c_str(), salt.length(), SQLITE_TRANSIENT);
-  if (rc != SQLITE_OK) {
-    string text = "Database::updatePassword bind upd 'salt': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(upd_salt_stmt);
-    return rc;
-  }
-
-  rc = sqlite3_bind_text(
-      upd_password_stmt,
-      sqlite3_bind_parameter_index(upd_password_stmt, ":secid"), secid.c_str(),
-      secid.length(), SQLITE_TRANSIENT);
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  Transaction transaction(db);
+  int rc = transaction.begin();
   if (rc != SQLITE_OK) {
-    string text =
-        "Database::updatePassword bind upd_password_stmt w/ 'secid': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(upd_password_stmt);
-    return rc;
-  }
-
-  rc = sqlite3_bind_text(
-      upd_password_stmt,
-      sqlite3_bind_parameter_index(upd_password_stmt, ":password"),
-      password.c_str(), password.length(), SQLITE_TRANSIENT);
-  if (rc != SQLITE_OK) {
-    string text = "Database::updatePassword bind upd_salt_stmt w/ 'password': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(upd_password_stmt);
-    return rc;
+    return fail("Database::updatePassword BEGIN IMMEDIATE", rc);
   }
 
-  // Start database transatction
-  char *errMsg = nullptr;
-  rc = sqlite3_exec(db, "BEGIN IMMEDIATE TRANSACTION;", 0, 0, &errMsg);
-  if (rc != SQLITE_OK) {
-    string text = "Database::updatePassword BEGIN IMMEDIATE: ";
-    text.append(errMsg);
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_free(errMsg);
-    sqlite3_reset(upd_salt_stmt);
-    sqlite3_reset(upd_password_stmt);
-    return rc;
-  }
-  // Execute the first update statement
-  rc = sqlite3_step(upd_salt_stmt);
-  sqlite3_reset(upd_salt_stmt);
+  rc = upd_salt_stmt.bind(Blob(salt), secid).step();
   if (rc != SQLITE_DONE) {
-    string text = "Database::updatePassword execute step upd_salt_stmt: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Database::updatePassword execute step upd_salt_stmt following "
-             "ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    return rc;
+    return fail("Database::updatePassword upd_salt_stmt >> ROLLBACK", rc);
   }
-
   // Check the row count, abort if no unique secid
   int rowsAffected = sqlite3_changes(db);
   if (rowsAffected != 1) {
@@ -702,37 +1122,13 @@ int Database::updatePassword(const string &secid, const string &password,
                   "1, actual: ";
     text.append(std::to_string(rowsAffected));
     m_log->entry(LogLevel::INFO, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Database::updatePassword ROLLBACK after invalid rowsAffected: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg);
-    sqlite3_reset(upd_password_stmt);
     return SQLITE_ABORT;
   }
 
-  // Execute the second update statement
-  rc = sqlite3_step(upd_password_stmt);
-  sqlite3_reset(upd_password_stmt);
+  rc = upd_password_stmt.bind(Blob(password), secid).step();
   if (rc != SQLITE_DONE) {
-    string text = "Database::updatePassword execute step upd_password_stmt: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Database::updatePassword execute step upd_password_stmt "
-             "following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
-    return rc;
+    return fail("Database::updatePassword upd_password_stmt >> ROLLBACK", rc);
   }
-
-  // Check the row count, abort if no unique secid
   rowsAffected = sqlite3_changes(db);
   if (rowsAffected != 1) {
     string text =
@@ -740,105 +1136,231 @@ int Database::updatePassword(const string &secid, const string &password,
         "1, actual: ";
     text.append(std::to_string(rowsAffected));
     m_log->entry(LogLevel::INFO, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Database::updatePassword ROLLBACK after invalid rowsAffected: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
     return SQLITE_ABORT;
   }
 
-  rc = sqlite3_exec(db, "COMMIT;", 0, 0, &errMsg);
+  // Feed events are published in commit order
+  std::lock_guard<std::mutex> filter_lock(m_filter_mtx);
+  rc = transaction.commit();
   if (rc != SQLITE_OK) {
-    string text = "Database::updatePassword execute step COMMIT: ";
-    text.append(errMsg);
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    text.append(" >> ROLLBACK");
-    m_log->entry(LogLevel::ERROR, text);
-    if (sqlite3_exec(db, "ROLLBACK;", 0, 0, &errMsg) != SQLITE_OK) {
-      text = "Following ROLLBACK: ";
-      text.append(errMsg);
-      m_log->entry(LogLevel::ERROR, text);
-    }
-    sqlite3_free(errMsg);
+    return fail("Database::updatePassword COMMIT >> ROLLBACK", rc);
   }
+  publishChanges();
 
+  if (m_cache) {
+    m_cache->invalidate(secid);
+  }
   return rc;
 }
+
 int Database::getUserSalt(const string &secid, string &salt) {
-  if (!get_salt_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::getUserSalt get_salt_stmt not initialized");
-    return SQLITE_ERROR;
+  if (!knownUser(secid)) {
+    // Same result as a lookup that found no row
+    return SQLITE_DONE;
   }
-
-  int rc = sqlite3_bind_text(
-      get_salt_stmt, sqlite3_bind_parameter_index(get_salt_stmt, ":secid"),
-      secid.c_str(), secid.length(), SQLITE_TRANSIENT);
-  if (rc != SQLITE_OK) {
-    string text = "Database::getUserSalt bind get_salt_stmt w/ 'secid': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(get_salt_stmt);
-    return rc;
+  CredentialCache::Entry cached;
+  if (m_cache && m_cache->get(secid, cached)) {
+    salt = cached.salt;
+    return SQLITE_OK;
   }
-  rc = sqlite3_step(get_salt_stmt);
+  if (m_batcher) {
+    int rc = m_batcher->lookup(secid, cached);
+    if (rc != SQLITE_OK) {
+      if (rc == SQLITE_DONE) {
+        m_log->entry(LogLevel::INFO,
+                     "Database::getUserSalt no user with secid: " + secid);
+      }
+      return rc;
+    }
+    salt = cached.salt;
+    return SQLITE_OK;
+  }
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  if (m_cache) {
+    return loadCredentials(secid, salt);
+  }
+
+  auto get = get_salt_stmt.bind(secid);
+  int rc = get.step();
   if (rc != SQLITE_ROW) {
-    string text = "Database::getUserSalt execute step get_salt_stmt: ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
-    m_log->entry(LogLevel::INFO, text);
-    sqlite3_reset(get_salt_stmt);
-    return rc;
+    return fail("Database::getUserSalt get_salt_stmt", rc, LogLevel::INFO);
   }
-  const unsigned char *text = sqlite3_column_text(get_salt_stmt, 0);
-  if (text) {
-    salt.assign(reinterpret_cast<const char *>(text));
+  std::tie(salt) = get.row();
+  return SQLITE_OK;
+}
+
+/*
+ * Reads salt and password for secid in one query and adds them to the cache.
+ * The cache version is taken before the read so that a concurrent update
+ * that commits in between keeps the old values out of the cache.
+ */
+int Database::loadCredentials(const string &secid, string &salt) {
+  uint64_t version = m_cache->version(secid);
+
+  CredentialCache::Entry entry;
+  {
+    auto get = get_credentials_stmt.bind(secid);
+    int rc = get.step();
+    if (rc != SQLITE_ROW) {
+      return fail("Database::loadCredentials get_credentials_stmt", rc,
+                  LogLevel::INFO);
+    }
+    std::tie(entry.salt, entry.password) = get.row();
   }
-  sqlite3_reset(get_salt_stmt);
+
+  salt = entry.salt;
+  m_cache->put(secid, entry, version);
   return SQLITE_OK;
 }
 
 int Database::getUserPassword(const string &secid, string &password) {
-  if (!get_password_stmt) {
-    m_log->entry(LogLevel::ERROR,
-                 "Database::getUserPassword get_password_stmt not initialized");
-    return SQLITE_ERROR;
+  if (m_batcher) {
+    CredentialCache::Entry entry;
+    int rc = m_batcher->lookup(secid, entry);
+    if (rc != SQLITE_OK) {
+      if (rc == SQLITE_DONE) {
+        m_log->entry(LogLevel::INFO,
+                     "Database::getUserPassword no user with secid: " + secid);
+      }
+      return rc;
+    }
+    password = entry.password;
+    return SQLITE_OK;
   }
+  std::lock_guard<std::mutex> conn(m_conn_mtx);
+  auto get = get_password_stmt.bind(secid);
+  int rc = get.step();
+  if (rc != SQLITE_ROW) {
+    return fail("Database::getUserPassword get_password_stmt", rc,
+                LogLevel::INFO);
+  }
+  std::tie(password) = get.row();
+  return SQLITE_OK;
+}
 
-  int rc = sqlite3_bind_text(
-      get_password_stmt,
-      sqlite3_bind_parameter_index(get_password_stmt, ":secid"), secid.c_str(),
-      secid.length(), SQLITE_TRANSIENT);
+void Database::setBackupRate(int pages_per_step, int max_pages_per_sec) {
+  m_backup.pages_per_step = pages_per_step > 0 ? pages_per_step : -1;
+  m_backup.max_pages_per_sec = max_pages_per_sec > 0 ? max_pages_per_sec : 0;
+}
+
+/*
+ * Copies the live database into destFile with the SQLite online backup API.
+ * The copy is made m_backup.pages_per_step pages at a time. Between steps the
+ * connection is released and the thread sleeps long enough to keep the copy
+ * rate under m_backup.max_pages_per_sec, so logins are served in between.
+ * Writes made through this connection during the backup are carried over by
+ * SQLite, the result is a consistent snapshot.
+ */
+int Database::backup(const char *destFile, BackupStats *stats) {
+  using clock = std::chrono::steady_clock;
+  sqlite3 *dest = nullptr;
+  int rc = sqlite3_open(destFile, &dest);
   if (rc != SQLITE_OK) {
-    string text =
-        "Database::getUserPassword bind get_password_stmt w/ 'secid': ";
-    text.append(sqlite3_errmsg(db));
-    text.append(", rc: ");
-    text.append(std::to_string(rc));
+    string text = "Database::backup Can't open destination: ";
+    text.append(sqlite3_errmsg(dest));
     m_log->entry(LogLevel::ERROR, text);
-    sqlite3_reset(get_password_stmt);
+    sqlite3_close(dest);
     return rc;
   }
-  rc = sqlite3_step(get_password_stmt);
-  if (rc != SQLITE_ROW) {
-    string text = "Database::getUserPassword execute step get_password_stmt: ";
-    text.append(sqlite3_errmsg(db));
+
+  // Each call touching db holds m_conn_mtx, so a step never runs inside
+  // another thread's transaction; the pacing sleep runs without it
+  sqlite3_backup *bk;
+  {
+    std::lock_guard<std::mutex> conn(m_conn_mtx);
+    bk = sqlite3_backup_init(dest, "main", db, "main");
+  }
+  if (!bk) {
+    rc = sqlite3_errcode(dest);
+    string text = "Database::backup backup_init: ";
+    text.append(sqlite3_errmsg(dest));
+    m_log->entry(LogLevel::ERROR, text);
+    sqlite3_close(dest);
+    return rc;
+  }
+
+  // Time budget of a single step when the rate is bounded
+  clock::duration step_budget = clock::duration::zero();
+  if (m_backup.max_pages_per_sec > 0 && m_backup.pages_per_step > 0) {
+    step_budget = std::chrono::microseconds(
+        1000000LL * m_backup.pages_per_step / m_backup.max_pages_per_sec);
+  }
+
+  const int max_busy_retries = 100;
+  int busy_retries = 0;
+  auto start = clock::now();
+  do {
+    auto step_start = clock::now();
+    {
+      std::lock_guard<std::mutex> conn(m_conn_mtx);
+      rc = sqlite3_backup_step(bk, m_backup.pages_per_step);
+    }
+    if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+      if (++busy_retries > max_busy_retries) {
+        break;
+      }
+    } else {
+      busy_retries = 0;
+    }
+    if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+      // Yield to live traffic before the next step
+      auto elapsed = clock::now() - step_start;
+      if (elapsed < step_budget) {
+        std::this_thread::sleep_for(step_budget - elapsed);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+  double seconds =
+      std::chrono::duration<double>(clock::now() - start).count();
+  int pages;
+  int finish_rc;
+  {
+    std::lock_guard<std::mutex> conn(m_conn_mtx);
+    pages = sqlite3_backup_pagecount(bk);
+    finish_rc = sqlite3_backup_finish(bk);
+  }
+  if (rc == SQLITE_DONE) {
+    rc = finish_rc;
+  }
+  if (rc != SQLITE_OK) {
+    string text = "Database::backup step: ";
+    text.append(sqlite3_errstr(rc));
     text.append(", rc: ");
     text.append(std::to_string(rc));
-    m_log->entry(LogLevel::INFO, text);
-    sqlite3_reset(get_password_stmt);
+    m_log->entry(LogLevel::ERROR, text);
+    sqlite3_close(dest);
     return rc;
   }
-  const unsigned char *text = sqlite3_column_text(get_password_stmt, 0);
-  if (text) {
-    password.assign(reinterpret_cast<const char *>(text));
+
+  int page_size = 0;
+  sqlite3_stmt *page_size_stmt = nullptr;
+  if (sqlite3_prepare_v2(dest, "PRAGMA page_size;", -1, &page_size_stmt,
+                         nullptr) == SQLITE_OK &&
+      sqlite3_step(page_size_stmt) == SQLITE_ROW) {
+    page_size = sqlite3_column_int(page_size_stmt, 0);
+  }
+  sqlite3_finalize(page_size_stmt);
+  sqlite3_close(dest);
+
+  double pages_per_sec = seconds > 0 ? pages / seconds : 0;
+  string text = "Database::backup copied ";
+  text.append(std::to_string(pages));
+  text.append(" pages to ");
+  text.append(destFile);
+  text.append(" in ");
+  text.append(std::to_string(seconds));
+  text.append(" s, ");
+  text.append(std::to_string(static_cast<long>(pages_per_sec)));
+  text.append(" pages/s");
+  m_log->entry(LogLevel::INFO, text);
+
+  if (stats) {
+    stats->pages = pages;
+    stats->page_size = page_size;
+    stats->seconds = seconds;
+    stats->pages_per_sec = pages_per_sec;
   }
-  sqlite3_reset(get_password_stmt);
   return SQLITE_OK;
 }
@@ -0,0 +1,43 @@
+#include "executor.h"
+
+Executor::Executor() : m_stop(false) {
+  m_thread = std::thread(&Executor::loop, this);
+}
+
+Executor::~Executor() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_thread.join();
+}
+
+void Executor::post(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_tasks.push_back(std::move(task));
+  }
+  m_cv.notify_one();
+}
+
+size_t Executor::pending() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_tasks.size();
+}
+
+void Executor::loop() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mtx);
+      m_cv.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+      if (m_tasks.empty()) {
+        return; // stopped and drained
+      }
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+    task();
+  }
+}
@@ -1,9 +1,35 @@
 #include <hash_password.h>
+#include "argon2.h"
 #include <vector>
 #include <string>
 #include <cstdint>
 #include <iostream>
 #include <cstdio>   // For snprint
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_NI_TARGET __attribute__((target("sha,sse4.1")))
+#define SHA256_AVX2_TARGET __attribute__((target("avx2")))
+#define SHA256_AVX512_TARGET __attribute__((target("avx512f")))
+#elif defined(__aarch64__)
+#define SHA256_ARM 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#if defined(__ARM_FEATURE_SHA2)
+#define SHA256_ARM_TARGET
+#elif defined(__clang__)
+#define SHA256_ARM_TARGET __attribute__((target("sha2")))
+#else
+#define SHA256_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
 
 const uint32_t HashPassword::h_init[8] = {
   0x6a09e667,
@@ -26,53 +52,494 @@ const uint32_t HashPassword::k[64] = {
    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-std::vector<uint8_t> HashPassword::padd(const std::string& text){
-  uint64_t len = text.length() * 8;
-  size_t padd_len = (512 - ((len + 65) % 512)) % 512;
-  size_t tot_bytes = ((len + 65) + padd_len) / 8;
-  std::vector<uint8_t> bytes(tot_bytes, 0x00);
-  std::copy(text.begin(), text.end(), bytes.begin());
-  // Append single '1' bit. 0x80 = 0b10000000
-  bytes[text.length()] = 0x80;
-  // 0-bit padding already applied during init
-  // Add big-endian integer of text length
+uint32_t HashPassword::rrot(const uint32_t v, const uint32_t n){
+  return (v >> n) | (v << (32 - n));
+}
+std::string HashPassword::usingSHA256(std::string_view text){
+  Digest digest;
+  Hasher().update(text).final(digest);
+  std::string hex(SHA256_BYTES * 2, '\0');
+  toHex(digest.data(), digest.size(), &hex[0]);
+  return hex;
+}
+std::string HashPassword::toHex(const std::string& bytes){
+  std::string hex(bytes.size() * 2, '\0');
+  toHex(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size(),
+        &hex[0]);
+  return hex;
+}
+namespace {
+// The two hex digits of every byte value
+struct HexTable {
+  char pairs[512];
+  constexpr HexTable() : pairs() {
+    const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < 256; i++) {
+      pairs[2 * i] = digits[i >> 4];
+      pairs[2 * i + 1] = digits[i & 0x0f];
+    }
+  }
+};
+constexpr HexTable hex_table;
+}
+void HashPassword::toHex(const uint8_t* bytes, size_t n, char* hex){
+  for (size_t i = 0; i < n; i++) {
+    std::memcpy(hex + 2 * i, &hex_table.pairs[2 * bytes[i]], 2);
+  }
+}
+bool HashPassword::fromHexDigest(const std::string& hex, std::string& bytes){
+  if (hex.size() != SHA256_BYTES * 2) {
+    return false;
+  }
+  std::string decoded(SHA256_BYTES, '\0');
+  for (size_t i = 0; i < hex.size(); i++) {
+    char c = hex[i];
+    int v = (c >= '0' && c <= '9') ? c - '0'
+          : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+          : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+    if (v < 0) {
+      return false;
+    }
+    decoded[i / 2] = static_cast<char>((decoded[i / 2] << 4) | v);
+  }
+  bytes = decoded;
+  return true;
+}
+std::string HashPassword::digestSHA256(std::string_view text){
+  Digest digest;
+  Hasher().update(text).final(digest);
+  return std::string(digest.begin(), digest.end());
+}
+
+void HashPassword::Hasher::init(){
+  std::copy(h_init, h_init + 8, m_state);
+  m_used = 0;
+  m_length = 0;
+  // One implementation for the whole message
+  m_compress = compressor().load(std::memory_order_relaxed);
+}
+
+HashPassword::Hasher& HashPassword::Hasher::update(std::string_view data){
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  size_t n = data.size();
+  if (n == 0) {
+    return *this;
+  }
+  m_length += n;
+  if (m_used > 0) {
+    size_t take = std::min(n, sizeof(m_block) - m_used);
+    std::memcpy(m_block + m_used, bytes, take);
+    m_used += take;
+    bytes += take;
+    n -= take;
+    if (m_used < sizeof(m_block)) {
+      return *this;
+    }
+    m_compress(m_state, m_block, 1);
+    m_used = 0;
+  }
+  // Whole blocks straight from the input
+  if (n >= 64) {
+    m_compress(m_state, bytes, n / 64);
+    bytes += n / 64 * 64;
+    n %= 64;
+  }
+  if (n > 0) {
+    std::memcpy(m_block, bytes, n);
+    m_used = n;
+  }
+  return *this;
+}
+
+void HashPassword::Hasher::final(Digest& digest){
+  // Append single '1' bit, zeros and the big-endian bit length
+  uint64_t len = m_length * 8;
+  m_block[m_used++] = 0x80;
+  if (m_used > 56) {
+    std::memset(m_block + m_used, 0, sizeof(m_block) - m_used);
+    m_compress(m_state, m_block, 1);
+    m_used = 0;
+  }
+  std::memset(m_block + m_used, 0, 56 - m_used);
+  for (int i = 0; i < 8; i++) {
+    m_block[63 - i] = static_cast<uint8_t>(len >> (8 * i));
+  }
+  m_compress(m_state, m_block, 1);
   for (int i = 0; i < 8; i++) {
-    bytes[tot_bytes - 1 - i] = static_cast<uint8_t>(len >> (8 * i));
+    digest[i * 4 + 0] = static_cast<uint8_t>(m_state[i] >> 24);
+    digest[i * 4 + 1] = static_cast<uint8_t>(m_state[i] >> 16);
+    digest[i * 4 + 2] = static_cast<uint8_t>(m_state[i] >> 8);
+    digest[i * 4 + 3] = static_cast<uint8_t>(m_state[i]);
   }
-  return bytes;
 }
-uint32_t HashPassword::rrot(const uint32_t v, const uint32_t n){
-  return (v >> n) | (v << (32 - n));
+
+void HashPassword::Hasher::resume(const uint32_t state[8]){
+  init();
+  std::copy(state, state + 8, m_state);
+  m_length = 64;
+}
+
+void HashPassword::hmacPads(std::string_view key, HmacPads& pads){
+  uint8_t block[64] = {};
+  if (key.size() > sizeof(block)) {
+    Digest digest;
+    Hasher().update(key).final(digest);
+    std::copy(digest.begin(), digest.end(), block);
+  } else if (!key.empty()) {
+    std::memcpy(block, key.data(), key.size());
+  }
+  Compress compress = compressor().load(std::memory_order_relaxed);
+  uint8_t pad[64];
+  for (size_t i = 0; i < sizeof(pad); i++) {
+    pad[i] = block[i] ^ 0x36;
+  }
+  std::copy(h_init, h_init + 8, pads.inner);
+  compress(pads.inner, pad, 1);
+  for (size_t i = 0; i < sizeof(pad); i++) {
+    pad[i] = block[i] ^ 0x5c;
+  }
+  std::copy(h_init, h_init + 8, pads.outer);
+  compress(pads.outer, pad, 1);
+}
+
+void HashPassword::hmac(const HmacPads& pads, std::string_view message,
+                        Digest& mac){
+  Digest inner;
+  Hasher hasher;
+  hasher.resume(pads.inner);
+  hasher.update(message).final(inner);
+  hasher.resume(pads.outer);
+  hasher.update(std::string_view(reinterpret_cast<const char*>(inner.data()),
+                                 inner.size()))
+      .final(mac);
+}
+
+void HashPassword::hmacSHA256(std::string_view key, std::string_view message,
+                              Digest& mac){
+  HmacPads pads;
+  hmacPads(key, pads);
+  hmac(pads, message, mac);
+}
+
+static inline void storeBigEndian(const uint32_t state[8], uint8_t* out){
+  for (int i = 0; i < 8; i++) {
+    uint32_t word = __builtin_bswap32(state[i]);
+    std::memcpy(out + 4 * i, &word, 4);
+  }
+}
+
+std::string HashPassword::pbkdf2SHA256(std::string_view password,
+                                       std::string_view salt,
+                                       uint32_t iterations, size_t length){
+  std::string key(length, '\0');
+  HmacPads pads;
+  hmacPads(password, pads);
+  Compress compress = compressor().load(std::memory_order_relaxed);
+
+  // After the pad block, an HMAC of a digest is one more block each for
+  // the inner and outer hash: the digest, padding and 96 bytes in bits.
+  // Only the digest changes between iterations.
+  uint8_t inner_block[64] = {};
+  uint8_t outer_block[64] = {};
+  for (uint8_t* block : {inner_block, outer_block}) {
+    block[SHA256_BYTES] = 0x80;
+    block[62] = (64 + SHA256_BYTES) * 8 >> 8;
+    block[63] = static_cast<uint8_t>((64 + SHA256_BYTES) * 8);
+  }
+
+  for (size_t offset = 0, index = 1; offset < length;
+       offset += SHA256_BYTES, index++) {
+    const char count[4] = {static_cast<char>(index >> 24),
+                           static_cast<char>(index >> 16),
+                           static_cast<char>(index >> 8),
+                           static_cast<char>(index)};
+    // U1 = HMAC(password, salt || INT(index))
+    Digest u;
+    Hasher hasher;
+    hasher.resume(pads.inner);
+    hasher.update(salt).update(std::string_view(count, 4)).final(u);
+    std::copy(u.begin(), u.end(), outer_block);
+    uint32_t state[8];
+    std::copy(pads.outer, pads.outer + 8, state);
+    compress(state, outer_block, 1);
+
+    uint32_t sum[8];
+    std::copy(state, state + 8, sum);
+    for (uint32_t i = 1; i < iterations; i++) {
+      storeBigEndian(state, inner_block);
+      std::copy(pads.inner, pads.inner + 8, state);
+      compress(state, inner_block, 1);
+      storeBigEndian(state, outer_block);
+      std::copy(pads.outer, pads.outer + 8, state);
+      compress(state, outer_block, 1);
+      for (int w = 0; w < 8; w++) {
+        sum[w] ^= state[w];
+      }
+    }
+    uint8_t block[SHA256_BYTES];
+    storeBigEndian(sum, block);
+    std::memcpy(&key[offset], block, std::min<size_t>(SHA256_BYTES,
+                                                      length - offset));
+  }
+  return key;
+}
+
+std::string HashPassword::argon2id(std::string_view password,
+                                   std::string_view salt, uint32_t passes,
+                                   uint32_t memory_kib, uint32_t lanes,
+                                   size_t length){
+  Argon2::Params params;
+  params.passes = passes;
+  params.memory_kib = memory_kib;
+  params.lanes = lanes;
+  params.tag_length = static_cast<uint32_t>(length);
+  return Argon2::hash(password, salt, params);
+}
+
+/*
+ * A message as a lane sees it: the full blocks are read from the message
+ * in place, the padded tail (one or two blocks) from tail.
+ */
+struct HashPassword::Lane {
+  const uint8_t* data;
+  size_t full;
+  size_t blocks; // 0 for an unused lane
+  uint8_t tail[128];
+
+  const uint8_t* block(size_t b) const {
+    return b < full ? data + 64 * b : tail + 64 * (b - full);
+  }
+};
+
+void HashPassword::setLane(Lane& lane, std::string_view message){
+  size_t rest = message.size() % 64;
+  size_t tail_blocks = rest < 56 ? 1 : 2;
+  lane.data = reinterpret_cast<const uint8_t*>(message.data());
+  lane.full = message.size() / 64;
+  lane.blocks = lane.full + tail_blocks;
+  std::memset(lane.tail, 0, 64 * tail_blocks);
+  if (rest > 0) {
+    std::memcpy(lane.tail, lane.data + 64 * lane.full, rest);
+  }
+  lane.tail[rest] = 0x80;
+  uint64_t len = uint64_t(message.size()) * 8;
+  for (int i = 0; i < 8; i++) {
+    lane.tail[64 * tail_blocks - 1 - i] = static_cast<uint8_t>(len >> (8 * i));
+  }
+}
+
+std::vector<std::string> HashPassword::digestSHA256Batch(
+    const std::vector<std::string_view>& messages){
+  std::vector<std::string> digests(messages.size());
+  Impl impl = batchImpl().load(std::memory_order_relaxed);
+  size_t width = impl == Impl::AVX512 ? 16 : impl == Impl::AVX2 ? 8 : 1;
+  if (width == 1) {
+    for (size_t i = 0; i < messages.size(); i++) {
+      digests[i] = digestSHA256(messages[i]);
+    }
+    return digests;
+  }
+  // Lanes of a group run as many blocks as the longest of them, so group
+  // messages of the same block count
+  auto blocks = [&](size_t i) {
+    return messages[i].size() / 64 + (messages[i].size() % 64 >= 56);
+  };
+  auto fewer = [&](size_t a, size_t b) { return blocks(a) < blocks(b); };
+  std::vector<size_t> order(messages.size());
+  std::iota(order.begin(), order.end(), 0);
+  if (!std::is_sorted(order.begin(), order.end(), fewer)) {
+    std::stable_sort(order.begin(), order.end(), fewer);
+  }
+  Lane lanes[16];
+  char* out[16];
+  for (size_t start = 0; start < order.size(); start += width) {
+    for (size_t j = 0; j < width; j++) {
+      if (start + j < order.size()) {
+        size_t i = order[start + j];
+        setLane(lanes[j], messages[i]);
+        digests[i].resize(SHA256_BYTES);
+        out[j] = &digests[i][0];
+      } else {
+        lanes[j].blocks = 0;
+        out[j] = nullptr;
+      }
+    }
+    if (width == 16) {
+      digestAVX512(lanes, out);
+    } else {
+      digestAVX2(lanes, out);
+    }
+  }
+  return digests;
+}
+
+std::vector<std::string> HashPassword::usingSHA256Batch(
+    const std::vector<std::string_view>& messages){
+  std::vector<std::string> digests = digestSHA256Batch(messages);
+  for (std::string& digest : digests) {
+    digest = toHex(digest);
+  }
+  return digests;
+}
+
+bool HashPassword::supported(Impl impl){
+  switch (impl) {
+  case Impl::SCALAR:
+    return true;
+  case Impl::SHA_NI: {
+#if defined(SHA256_X86)
+    unsigned int eax, ebx, ecx, edx;
+    // SSSE3 and SSE4.1 for the shuffles, leaf 7 EBX bit 29 for SHA
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & (1u << 9)) || !(ecx & (1u << 19))) {
+      return false;
+    }
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+           (ebx & (1u << 29));
+#else
+    return false;
+#endif
+  }
+  case Impl::ARMV8:
+#if defined(SHA256_ARM) && defined(__APPLE__)
+    return true; // every Apple arm64 core has the crypto extensions
+#elif defined(SHA256_ARM) && defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#elif defined(SHA256_ARM) && defined(__ARM_FEATURE_SHA2)
+    return true;
+#else
+    return false;
+#endif
+  case Impl::AVX2:
+#if defined(SHA256_X86)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+  case Impl::AVX512:
+#if defined(SHA256_X86)
+    return __builtin_cpu_supports("avx512f");
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+HashPassword::Impl HashPassword::implementation(){
+  Compress active = compressor().load(std::memory_order_relaxed);
+  for (Impl impl : {Impl::SHA_NI, Impl::ARMV8}) {
+    if (active == compressFor(impl)) {
+      return impl;
+    }
+  }
+  return Impl::SCALAR;
+}
+
+const char* HashPassword::name(Impl impl){
+  switch (impl) {
+  case Impl::SHA_NI:
+    return "sha-ni";
+  case Impl::ARMV8:
+    return "armv8";
+  case Impl::AVX2:
+    return "avx2";
+  case Impl::AVX512:
+    return "avx512";
+  default:
+    return "scalar";
+  }
+}
+
+bool HashPassword::useImplementation(Impl impl){
+  if (!supported(impl) || impl == Impl::AVX2 || impl == Impl::AVX512) {
+    return false;
+  }
+  compressor().store(compressFor(impl), std::memory_order_relaxed);
+  return true;
+}
+
+HashPassword::Impl HashPassword::batchImplementation(){
+  Impl impl = batchImpl().load(std::memory_order_relaxed);
+  return impl == Impl::AVX2 || impl == Impl::AVX512 ? impl
+                                                    : implementation();
+}
+
+bool HashPassword::useBatchImplementation(Impl impl){
+  if (!supported(impl)) {
+    return false;
+  }
+  batchImpl().store(impl, std::memory_order_relaxed);
+  return true;
+}
+
+std::atomic<HashPassword::Impl>& HashPassword::batchImpl(){
+  // Eight AVX2 lanes are about as fast as SHA-NI one message at a time
+  static std::atomic<Impl> active([] {
+    if (supported(Impl::AVX512)) {
+      return Impl::AVX512;
+    }
+    if (supported(Impl::AVX2) && !supported(Impl::SHA_NI)) {
+      return Impl::AVX2;
+    }
+    return Impl::SCALAR;
+  }());
+  return active;
 }
-std::string HashPassword::usingSHA256(const std::string& text){
-  std::vector<uint8_t> padded_text = HashPassword::padd(text);
 
-  uint32_t hash[8];
-  for(int i = 0; i < 8; i++){hash[i] = h_init[i];}
+HashPassword::Compress HashPassword::compressFor(Impl impl){
+  switch (impl) {
+#if defined(SHA256_X86)
+  case Impl::SHA_NI:
+    return compressSHANI;
+#endif
+#if defined(SHA256_ARM)
+  case Impl::ARMV8:
+    return compressARMv8;
+#endif
+  default:
+    return compressScalar;
+  }
+}
+
+std::atomic<HashPassword::Compress>& HashPassword::compressor(){
+  // Decided once, on first use, so static initializers may hash too
+  static std::atomic<Compress> active([] {
+    for (Impl impl : {Impl::SHA_NI, Impl::ARMV8}) {
+      if (supported(impl)) {
+        return compressFor(impl);
+      }
+    }
+    return compressFor(Impl::SCALAR);
+  }());
+  return active;
+}
 
+void HashPassword::compressScalar(uint32_t state[8], const uint8_t* blocks,
+                                  size_t n){
   uint32_t w[64] = {};
   // work on 512 bit chunks
-  for (size_t chunk = 0; chunk < padded_text.size(); chunk += 64) {
+  for (size_t chunk = 0; chunk < n * 64; chunk += 64) {
     for (size_t i = 0; i < 16; i++) {
       w[i] = 
-          (padded_text[chunk + (i*4) + 0] << 3*8)
-        | (padded_text[chunk + (i*4) + 1] << 2*8)
-        | (padded_text[chunk + (i*4) + 2] << 1*8)
-        | (padded_text[chunk + (i*4) + 3] << 0*8);
+          (uint32_t(blocks[chunk + (i*4) + 0]) << 3*8)
+        | (uint32_t(blocks[chunk + (i*4) + 1]) << 2*8)
+        | (uint32_t(blocks[chunk + (i*4) + 2]) << 1*8)
+        | (uint32_t(blocks[chunk + (i*4) + 3]) << 0*8);
     }
     for (size_t i = 16; i < 64; i++) {
       uint32_t s0 = (rrot(w[i-15], 7) ^ rrot(w[i-15], 18)) ^ (w[i-15] >> 3);
       uint32_t s1 = (rrot(w[i-2], 17) ^ rrot(w[i-2], 19))  ^ (w[i-2] >> 10);
       w[i] = w[i-16] + s0 + w[i-7] + s1;
     }
-    uint32_t a = hash[0];
-    uint32_t b = hash[1];
-    uint32_t c = hash[2];
-    uint32_t d = hash[3];
-    uint32_t e = hash[4];
-    uint32_t f = hash[5];
-    uint32_t g = hash[6];
-    uint32_t h = hash[7];
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+    uint32_t f = state[5];
+    uint32_t g = state[6];
+    uint32_t h = state[7];
     // Compression
     for (size_t i = 0; i < 64; i++) {
       uint32_t sum1 = (rrot(e, 6) ^ rrot(e, 11)) ^ rrot(e, 25);
@@ -92,23 +559,329 @@ std::string HashPassword::usingSHA256(const std::string& text){
       a = tmp1 + tmp2;
     }
 
-    //add to hash
-    hash[0] += a;
-    hash[1] += b;
-    hash[2] += c;
-    hash[3] += d;
-    hash[4] += e;
-    hash[5] += f;
-    hash[6] += g;
-    hash[7] += h;
+    //add to state
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#if defined(SHA256_X86)
+/*
+ * SHA-NI works on the state as two vectors, ABEF and CDGH. Each
+ * sha256rnds2 does two rounds, so four rounds take two of them, with the
+ * high half of the message+constant vector moved down for the second.
+ */
+SHA256_NI_TARGET static inline void niRounds(__m128i& abef, __m128i& cdgh,
+                                             __m128i msg, const uint32_t* k){
+  __m128i wk = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)k));
+  cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+  abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(wk, 0x0e));
+}
+// Next four schedule words from the sixteen before them, w[t-16..t-1]
+SHA256_NI_TARGET static inline __m128i niSchedule(__m128i w0, __m128i w4,
+                                                  __m128i w8, __m128i w12){
+  __m128i t = _mm_add_epi32(_mm_sha256msg1_epu32(w0, w4),
+                            _mm_alignr_epi8(w12, w8, 4));
+  return _mm_sha256msg2_epu32(t, w12);
+}
+
+SHA256_NI_TARGET void HashPassword::compressSHANI(uint32_t state[8],
+                                                  const uint8_t* blocks,
+                                                  size_t n){
+  // Big-endian words
+  const __m128i swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                      0x0405060700010203ULL);
+  __m128i dcba = _mm_loadu_si128((const __m128i*)&state[0]);
+  __m128i hgfe = _mm_loadu_si128((const __m128i*)&state[4]);
+  __m128i cdab = _mm_shuffle_epi32(dcba, 0xb1);
+  __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1b);
+  __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+  __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xf0);
+
+  for (size_t chunk = 0; chunk < n * 64; chunk += 64) {
+    const __m128i* in = (const __m128i*)(blocks + chunk);
+    __m128i abef_in = abef;
+    __m128i cdgh_in = cdgh;
+    __m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128(in + 0), swap);
+    __m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), swap);
+    __m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), swap);
+    __m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), swap);
+    for (int i = 0; i < 64; i += 16) {
+      niRounds(abef, cdgh, w0, &k[i]);
+      niRounds(abef, cdgh, w1, &k[i + 4]);
+      niRounds(abef, cdgh, w2, &k[i + 8]);
+      niRounds(abef, cdgh, w3, &k[i + 12]);
+      if (i < 48) {
+        w0 = niSchedule(w0, w1, w2, w3);
+        w1 = niSchedule(w1, w2, w3, w0);
+        w2 = niSchedule(w2, w3, w0, w1);
+        w3 = niSchedule(w3, w0, w1, w2);
+      }
+    }
+    abef = _mm_add_epi32(abef, abef_in);
+    cdgh = _mm_add_epi32(cdgh, cdgh_in);
+  }
+
+  __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+  __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+  _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(feba, dchg, 0xf0));
+  _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif
+
+#if defined(SHA256_ARM)
+// Four rounds; sha256h and sha256h2 each need the other's input state
+SHA256_ARM_TARGET static inline void armRounds(uint32x4_t& abcd,
+                                               uint32x4_t& efgh,
+                                               uint32x4_t msg,
+                                               const uint32_t* k){
+  uint32x4_t wk = vaddq_u32(msg, vld1q_u32(k));
+  uint32x4_t abcd_in = abcd;
+  abcd = vsha256hq_u32(abcd, efgh, wk);
+  efgh = vsha256h2q_u32(efgh, abcd_in, wk);
+}
+SHA256_ARM_TARGET static inline uint32x4_t armSchedule(uint32x4_t w0,
+                                                       uint32x4_t w4,
+                                                       uint32x4_t w8,
+                                                       uint32x4_t w12){
+  return vsha256su1q_u32(vsha256su0q_u32(w0, w4), w8, w12);
+}
+SHA256_ARM_TARGET static inline uint32x4_t armLoad(const uint8_t* p){
+  return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(p)));
+}
+
+SHA256_ARM_TARGET void HashPassword::compressARMv8(uint32_t state[8],
+                                                   const uint8_t* blocks,
+                                                   size_t n){
+  uint32x4_t abcd = vld1q_u32(&state[0]);
+  uint32x4_t efgh = vld1q_u32(&state[4]);
+  for (size_t chunk = 0; chunk < n * 64; chunk += 64) {
+    uint32x4_t abcd_in = abcd;
+    uint32x4_t efgh_in = efgh;
+    uint32x4_t w0 = armLoad(blocks + chunk);
+    uint32x4_t w1 = armLoad(blocks + chunk + 16);
+    uint32x4_t w2 = armLoad(blocks + chunk + 32);
+    uint32x4_t w3 = armLoad(blocks + chunk + 48);
+    for (int i = 0; i < 64; i += 16) {
+      armRounds(abcd, efgh, w0, &k[i]);
+      armRounds(abcd, efgh, w1, &k[i + 4]);
+      armRounds(abcd, efgh, w2, &k[i + 8]);
+      armRounds(abcd, efgh, w3, &k[i + 12]);
+      if (i < 48) {
+        w0 = armSchedule(w0, w1, w2, w3);
+        w1 = armSchedule(w1, w2, w3, w0);
+        w2 = armSchedule(w2, w3, w0, w1);
+        w3 = armSchedule(w3, w0, w1, w2);
+      }
+    }
+    abcd = vaddq_u32(abcd, abcd_in);
+    efgh = vaddq_u32(efgh, efgh_in);
+  }
+  vst1q_u32(&state[0], abcd);
+  vst1q_u32(&state[4], efgh);
+}
+#endif
+
+#if defined(SHA256_X86)
+/*
+ * Multi-buffer: vector register i holds word i of every lane's state, so
+ * each instruction does one step of the scalar rounds for 8 (AVX2) or 16
+ * (AVX-512) messages. Block words are gathered into that layout first.
+ * Lanes that have run out of blocks keep their state through the rest.
+ */
+SHA256_AVX2_TARGET static inline __m256i ror8(__m256i x, int n){
+  return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+SHA256_AVX2_TARGET void HashPassword::digestAVX2(const Lane* lanes,
+                                                 char* const* digests){
+  size_t blocks = 0;
+  alignas(32) uint32_t counts[8];
+  for (int j = 0; j < 8; j++) {
+    blocks = std::max(blocks, lanes[j].blocks);
+    counts[j] = static_cast<uint32_t>(lanes[j].blocks);
+  }
+  const __m256i count = _mm256_load_si256((const __m256i*)counts);
+  __m256i state[8];
+  for (int i = 0; i < 8; i++) {
+    state[i] = _mm256_set1_epi32(static_cast<int>(h_init[i]));
+  }
+  alignas(32) uint32_t words[16][8];
+  for (size_t b = 0; b < blocks; b++) {
+    for (int j = 0; j < 8; j++) {
+      const uint8_t* block = b < lanes[j].blocks ? lanes[j].block(b)
+                                                 : lanes[0].block(0);
+      for (int i = 0; i < 16; i++) {
+        uint32_t word;
+        std::memcpy(&word, block + 4 * i, 4);
+        words[i][j] = __builtin_bswap32(word);
+      }
+    }
+    __m256i w[16];
+    for (int i = 0; i < 16; i++) {
+      w[i] = _mm256_load_si256((const __m256i*)words[i]);
+    }
+    __m256i a = state[0], b_ = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      if (i >= 16) {
+        __m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+        __m256i s0 = _mm256_xor_si256(
+            _mm256_xor_si256(ror8(w15, 7), ror8(w15, 18)),
+            _mm256_srli_epi32(w15, 3));
+        __m256i s1 = _mm256_xor_si256(
+            _mm256_xor_si256(ror8(w2, 17), ror8(w2, 19)),
+            _mm256_srli_epi32(w2, 10));
+        w[i & 15] = _mm256_add_epi32(
+            _mm256_add_epi32(w[i & 15], s0),
+            _mm256_add_epi32(w[(i - 7) & 15], s1));
+      }
+      __m256i sum1 = _mm256_xor_si256(_mm256_xor_si256(ror8(e, 6),
+                                                       ror8(e, 11)),
+                                      ror8(e, 25));
+      __m256i chce = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                      _mm256_andnot_si256(e, g));
+      __m256i tmp1 = _mm256_add_epi32(
+          _mm256_add_epi32(h, sum1),
+          _mm256_add_epi32(
+              chce, _mm256_add_epi32(
+                        _mm256_set1_epi32(static_cast<int>(k[i])),
+                        w[i & 15])));
+      __m256i sum2 = _mm256_xor_si256(_mm256_xor_si256(ror8(a, 2),
+                                                       ror8(a, 13)),
+                                      ror8(a, 22));
+      __m256i majy = _mm256_or_si256(
+          _mm256_and_si256(a, b_),
+          _mm256_and_si256(c, _mm256_or_si256(a, b_)));
+      h = g;
+      g = f;
+      f = e;
+      e = _mm256_add_epi32(d, tmp1);
+      d = c;
+      c = b_;
+      b_ = a;
+      a = _mm256_add_epi32(tmp1, _mm256_add_epi32(sum2, majy));
+    }
+    const __m256i live =
+        _mm256_cmpgt_epi32(count, _mm256_set1_epi32(static_cast<int>(b)));
+    const __m256i out[8] = {a, b_, c, d, e, f, g, h};
+    for (int i = 0; i < 8; i++) {
+      state[i] = _mm256_blendv_epi8(state[i],
+                                    _mm256_add_epi32(state[i], out[i]), live);
+    }
+  }
+  alignas(32) uint32_t result[8][8];
+  for (int i = 0; i < 8; i++) {
+    _mm256_store_si256((__m256i*)result[i], state[i]);
+  }
+  for (int j = 0; j < 8; j++) {
+    if (digests[j] == nullptr) {
+      continue;
+    }
+    for (int i = 0; i < 8; i++) {
+      uint32_t word = __builtin_bswap32(result[i][j]);
+      std::memcpy(digests[j] + 4 * i, &word, 4);
+    }
+  }
+}
 
+// As digestAVX2 with 16 lanes, native rotates and three-input logic
+SHA256_AVX512_TARGET void HashPassword::digestAVX512(const Lane* lanes,
+                                                     char* const* digests){
+  size_t blocks = 0;
+  alignas(64) uint32_t counts[16];
+  for (int j = 0; j < 16; j++) {
+    blocks = std::max(blocks, lanes[j].blocks);
+    counts[j] = static_cast<uint32_t>(lanes[j].blocks);
+  }
+  const __m512i count = _mm512_load_si512(counts);
+  __m512i state[8];
+  for (int i = 0; i < 8; i++) {
+    state[i] = _mm512_set1_epi32(static_cast<int>(h_init[i]));
+  }
+  alignas(64) uint32_t words[16][16];
+  for (size_t b = 0; b < blocks; b++) {
+    for (int j = 0; j < 16; j++) {
+      const uint8_t* block = b < lanes[j].blocks ? lanes[j].block(b)
+                                                 : lanes[0].block(0);
+      for (int i = 0; i < 16; i++) {
+        uint32_t word;
+        std::memcpy(&word, block + 4 * i, 4);
+        words[i][j] = __builtin_bswap32(word);
+      }
+    }
+    __m512i w[16];
+    for (int i = 0; i < 16; i++) {
+      w[i] = _mm512_load_si512(words[i]);
+    }
+    __m512i a = state[0], b_ = state[1], c = state[2], d = state[3];
+    __m512i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      if (i >= 16) {
+        __m512i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+        // 0x96 is a ^ b ^ c
+        __m512i s0 = _mm512_ternarylogic_epi32(
+            _mm512_ror_epi32(w15, 7), _mm512_ror_epi32(w15, 18),
+            _mm512_srli_epi32(w15, 3), 0x96);
+        __m512i s1 = _mm512_ternarylogic_epi32(
+            _mm512_ror_epi32(w2, 17), _mm512_ror_epi32(w2, 19),
+            _mm512_srli_epi32(w2, 10), 0x96);
+        w[i & 15] = _mm512_add_epi32(
+            _mm512_add_epi32(w[i & 15], s0),
+            _mm512_add_epi32(w[(i - 7) & 15], s1));
+      }
+      __m512i sum1 = _mm512_ternarylogic_epi32(
+          _mm512_ror_epi32(e, 6), _mm512_ror_epi32(e, 11),
+          _mm512_ror_epi32(e, 25), 0x96);
+      // 0xca is a ? b : c, 0xe8 the majority
+      __m512i chce = _mm512_ternarylogic_epi32(e, f, g, 0xca);
+      __m512i tmp1 = _mm512_add_epi32(
+          _mm512_add_epi32(h, sum1),
+          _mm512_add_epi32(
+              chce, _mm512_add_epi32(
+                        _mm512_set1_epi32(static_cast<int>(k[i])),
+                        w[i & 15])));
+      __m512i sum2 = _mm512_ternarylogic_epi32(
+          _mm512_ror_epi32(a, 2), _mm512_ror_epi32(a, 13),
+          _mm512_ror_epi32(a, 22), 0x96);
+      __m512i majy = _mm512_ternarylogic_epi32(a, b_, c, 0xe8);
+      h = g;
+      g = f;
+      f = e;
+      e = _mm512_add_epi32(d, tmp1);
+      d = c;
+      c = b_;
+      b_ = a;
+      a = _mm512_add_epi32(tmp1, _mm512_add_epi32(sum2, majy));
+    }
+    const __mmask16 live = _mm512_cmpgt_epi32_mask(
+        count, _mm512_set1_epi32(static_cast<int>(b)));
+    const __m512i out[8] = {a, b_, c, d, e, f, g, h};
+    for (int i = 0; i < 8; i++) {
+      state[i] = _mm512_mask_add_epi32(state[i], live, state[i], out[i]);
+    }
+  }
+  alignas(64) uint32_t result[8][16];
+  for (int i = 0; i < 8; i++) {
+    _mm512_store_si512(result[i], state[i]);
   }
-  std::string result;
-  result.reserve(128);
-  for(const auto& bytes : hash) {
-    char hex_byte[9];
-    snprintf(hex_byte, 9, "%08x", bytes);
-    result += hex_byte;
+  for (int j = 0; j < 16; j++) {
+    if (digests[j] == nullptr) {
+      continue;
+    }
+    for (int i = 0; i < 8; i++) {
+      uint32_t word = __builtin_bswap32(result[i][j]);
+      std::memcpy(digests[j] + 4 * i, &word, 4);
+    }
   }
-  return result;
 }
+#else
+void HashPassword::digestAVX2(const Lane*, char* const*){}
+void HashPassword::digestAVX512(const Lane*, char* const*){}
+#endif
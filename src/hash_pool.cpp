@@ -0,0 +1,147 @@
+#include "hash_pool.h"
+#include "hash_password.h"
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+HashPool::HashPool(size_t threads, const std::vector<int> &cpus)
+    : m_stop(false), m_stats() {
+  for (size_t i = 0; i < std::max<size_t>(threads, 1); i++) {
+    m_threads.emplace_back(&HashPool::loop, this);
+#ifdef __linux__
+    if (!cpus.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus[i % cpus.size()], &set);
+      // Best effort, a CPU outside the process's set leaves it unpinned
+      pthread_setaffinity_np(m_threads.back().native_handle(), sizeof(set),
+                             &set);
+    }
+#endif
+  }
+}
+
+HashPool::~HashPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+size_t HashPool::batchWidth() {
+  switch (HashPassword::batchImplementation()) {
+  case HashPassword::Impl::AVX512:
+    return 16;
+  case HashPassword::Impl::AVX2:
+    return 8;
+  default:
+    return 1;
+  }
+}
+
+std::future<std::string> HashPool::submit(const HashScheme &scheme,
+                                          std::string pepper,
+                                          std::string password,
+                                          std::string salt) {
+  Job job{scheme, std::move(pepper), std::move(password), std::move(salt),
+          std::promise<std::string>()};
+  std::future<std::string> result = job.result.get_future();
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_jobs.push_back(std::move(job));
+    m_stats.jobs++;
+  }
+  m_cv.notify_one();
+  return result;
+}
+
+HashPool::Stats HashPool::stats() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_stats;
+}
+
+/*
+ * Takes the oldest job, and with it the SHA-256 jobs queued behind it up
+ * to the batch width. Nothing waits for a batch to fill: a job that finds
+ * a free worker runs alone, batches only form from jobs that had to queue.
+ */
+void HashPool::loop() {
+  const size_t width = batchWidth();
+  std::vector<Job> batch;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(m_mtx);
+      m_cv.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+      if (m_jobs.empty()) {
+        return; // stopped and drained
+      }
+      batch.push_back(std::move(m_jobs.front()));
+      m_jobs.pop_front();
+      if (batch[0].scheme.algorithm == HashScheme::LEGACY_SHA256) {
+        for (auto job = m_jobs.begin();
+             job != m_jobs.end() && batch.size() < width;) {
+          if (job->scheme.algorithm == HashScheme::LEGACY_SHA256) {
+            batch.push_back(std::move(*job));
+            job = m_jobs.erase(job);
+          } else {
+            ++job;
+          }
+        }
+      }
+      if (batch.size() > 1) {
+        m_stats.batches++;
+        m_stats.batched += batch.size();
+        m_stats.max_batch = std::max<uint64_t>(m_stats.max_batch,
+                                               batch.size());
+      }
+      if (!m_jobs.empty()) {
+        m_cv.notify_one();
+      }
+    }
+    run(batch);
+    batch.clear();
+  }
+}
+
+void HashPool::run(std::vector<Job> &batch) {
+  if (batch.size() > 1) {
+    // The legacy hash is one SHA-256 of pepper, password and salt
+    std::vector<std::string> messages;
+    std::vector<std::string_view> views;
+    messages.reserve(batch.size());
+    for (Job &job : batch) {
+      messages.push_back(job.pepper + job.password + job.salt);
+      views.push_back(messages.back());
+    }
+    std::vector<std::string> digests;
+    try {
+      digests = HashPassword::digestSHA256Batch(views);
+    } catch (...) {
+      for (Job &job : batch) {
+        job.result.set_exception(std::current_exception());
+      }
+      return;
+    }
+    for (size_t i = 0; i < batch.size(); i++) {
+      std::fill(messages[i].begin(), messages[i].end(), '\0');
+      std::fill(batch[i].password.begin(), batch[i].password.end(), '\0');
+      batch[i].result.set_value(std::move(digests[i]));
+    }
+    return;
+  }
+  Job &job = batch[0];
+  try {
+    std::string hashed;
+    job.scheme.hash(job.pepper, job.password, job.salt, hashed);
+    std::fill(job.password.begin(), job.password.end(), '\0');
+    job.result.set_value(std::move(hashed));
+  } catch (...) {
+    job.result.set_exception(std::current_exception());
+  }
+}
@@ -0,0 +1,169 @@
+#include "hash_scheme.h"
+#include "argon2.h"
+#include "database.h"
+#include "hash_password.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+const char *HashScheme::name() const {
+  switch (algorithm) {
+  case PBKDF2_SHA256:
+    return "pbkdf2-sha256";
+  case ARGON2ID:
+    return "argon2id";
+  default:
+    return "sha256";
+  }
+}
+
+bool HashScheme::needsRehash(const HashScheme &current) const {
+  if (algorithm != current.algorithm) {
+    return current.algorithm > algorithm;
+  }
+  if (algorithm == ARGON2ID) {
+    if (passes() != current.passes() || lanes() != current.lanes()) {
+      return true;
+    }
+    return memoryMB() < current.memoryMB() * (1 - HASH_COST_TOLERANCE) ||
+           memoryMB() > current.memoryMB() * (1 + HASH_COST_TOLERANCE);
+  }
+  return cost < current.cost * (1 - HASH_COST_TOLERANCE) ||
+         cost > current.cost * (1 + HASH_COST_TOLERANCE);
+}
+
+HashScheme HashScheme::argon2id(uint32_t passes, uint32_t memory_mb,
+                                uint32_t lanes) {
+  HashScheme scheme;
+  scheme.algorithm = ARGON2ID;
+  scheme.cost = std::min<uint32_t>(passes, 0xff) << 24 |
+                (std::min<uint32_t>(std::max<uint32_t>(lanes, 1),
+                                    ARGON2_MAX_LANES) -
+                 1) << 20 |
+                std::min<uint32_t>(memory_mb, 0xfffff);
+  return scheme;
+}
+
+bool HashScheme::decode(const std::string &stored, HashScheme &scheme,
+                        std::string &salt) {
+  if (stored.size() != HASH_SCHEME_HEADER + SALT_SIZE ||
+      stored[0] != HASH_SCHEME_MAGIC) {
+    scheme = HashScheme();
+    salt = stored;
+    return true;
+  }
+  uint32_t cost = 0;
+  for (int i = 2; i < HASH_SCHEME_HEADER; i++) {
+    cost = cost << 8 | static_cast<uint8_t>(stored[i]);
+  }
+  uint8_t algorithm = static_cast<uint8_t>(stored[1]);
+  if (algorithm == PBKDF2_SHA256 && cost != 0) {
+    scheme.algorithm = PBKDF2_SHA256;
+    scheme.cost = cost;
+  } else if (algorithm == ARGON2ID && cost >> 24 != 0 &&
+             (cost & 0xfffff) != 0) {
+    scheme.algorithm = ARGON2ID;
+    scheme.cost = cost;
+  } else {
+    return false;
+  }
+  salt = stored.substr(HASH_SCHEME_HEADER);
+  return true;
+}
+
+std::string HashScheme::encode(const std::string &salt) const {
+  if (algorithm == LEGACY_SHA256) {
+    return salt;
+  }
+  std::string stored = {HASH_SCHEME_MAGIC, static_cast<char>(algorithm),
+                        static_cast<char>(cost >> 24),
+                        static_cast<char>(cost >> 16),
+                        static_cast<char>(cost >> 8), static_cast<char>(cost)};
+  return stored + salt;
+}
+
+// pepper + password in one buffer sized up front, wiped when it goes
+struct Peppered {
+  std::string text;
+  Peppered(const std::string &pepper, const std::string &password) {
+    text.reserve(pepper.size() + password.size());
+    text.append(pepper).append(password);
+  }
+  ~Peppered() { std::fill(text.begin(), text.end(), '\0'); }
+};
+
+void HashScheme::hash(const std::string &pepper, const std::string &password,
+                      const std::string &salt, std::string &hashed) const {
+  if (algorithm == PBKDF2_SHA256) {
+    Peppered key(pepper, password);
+    hashed = HashPassword::pbkdf2SHA256(key.text, salt, cost);
+    return;
+  }
+  if (algorithm == ARGON2ID) {
+    Peppered key(pepper, password);
+    hashed = HashPassword::argon2id(key.text, salt, passes(),
+                                    memoryMB() * 1024, lanes());
+    return;
+  }
+  HashPassword::Digest digest;
+  HashPassword::Hasher().update(pepper).update(password).update(salt).final(
+      digest);
+  hashed.assign(digest.begin(), digest.end());
+}
+
+/*
+ * Times a short derivation until the clock has seen enough of them to
+ * trust, keeps the fastest time, then scales to the target. The fastest
+ * run is the one least disturbed by other work on the machine.
+ */
+static double fastestMs(const std::function<void()> &derive) {
+  using clock = std::chrono::steady_clock;
+  double best_ms = 0;
+  auto start = clock::now();
+  for (int runs = 0;
+       runs < 5 || clock::now() - start < std::chrono::milliseconds(20);
+       runs++) {
+    auto t0 = clock::now();
+    derive();
+    double ms = std::chrono::duration<double, std::milli>(clock::now() - t0)
+                    .count();
+    best_ms = runs == 0 ? ms : std::min(best_ms, ms);
+  }
+  return best_ms;
+}
+
+HashScheme HashScheme::calibrate(Algorithm algorithm, double target_ms,
+                                 uint32_t lanes) {
+  const std::string password = "calibration password", salt(SALT_SIZE, 's');
+  if (algorithm == PBKDF2_SHA256) {
+    const uint32_t probe = HASH_MIN_PBKDF2_ITERATIONS;
+    double ms = fastestMs(
+        [&] { HashPassword::pbkdf2SHA256(password, salt, probe); });
+    double iterations = target_ms / (ms / probe);
+    HashScheme scheme;
+    scheme.algorithm = PBKDF2_SHA256;
+    scheme.cost = static_cast<uint32_t>(std::min<double>(
+        std::max<double>(std::round(iterations), HASH_MIN_PBKDF2_ITERATIONS),
+        UINT32_MAX));
+    return scheme;
+  }
+  if (algorithm == ARGON2ID) {
+    // The time grows linearly with the memory. More than the pool's budget
+    // could never be leased.
+    const double budget_mb =
+        MemoryPool::shared().stats().budget / (1024.0 * 1024.0);
+    const uint32_t probe = HASH_ARGON2_MIN_MB;
+    double ms = fastestMs([&] {
+      HashPassword::argon2id(password, salt, HASH_ARGON2_PASSES, probe * 1024,
+                             lanes);
+    });
+    double mb = target_ms / (ms / probe);
+    return argon2id(HASH_ARGON2_PASSES,
+                    static_cast<uint32_t>(std::min<double>(
+                        std::max<double>(std::round(mb), HASH_ARGON2_MIN_MB),
+                        std::min<double>(HASH_ARGON2_MAX_MB, budget_mb))),
+                    lanes);
+  }
+  return HashScheme();
+}
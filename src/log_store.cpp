@@ -0,0 +1,881 @@
+#include "log_store.h"
+#include "hash_password.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using LogLevel = Logger::LogLevel;
+
+static const size_t npos = static_cast<size_t>(-1);
+static const uint64_t INDEX_MAGIC = 0x31584449474f4cULL; // "LOGIDX1"
+
+static bool equals(const char *field, uint8_t len, const string &value) {
+  return len == value.size() && memcmp(field, value.data(), len) == 0;
+}
+
+// The password field as bytes, records from before hashes were stored as
+// bytes hold hex digests. Compaction rewrites those as bytes.
+static string storedHash(const char *field, uint8_t len) {
+  string hash(field, len);
+  HashPassword::fromHexDigest(hash, hash);
+  return hash;
+}
+
+static bool hashEquals(const char *field, uint8_t len, const string &hash) {
+  if (equals(field, len, hash)) {
+    return true;
+  }
+  return len == SHA256_BYTES * 2 && storedHash(field, len) == hash;
+}
+
+/*
+ * Constructor opens or creates the log at path and recovers the index.
+ * segment_records sets how many records a segment holds before a new one is
+ * started.
+ */
+LogStore::LogStore(const string &path, bool sync, uint32_t segment_records)
+    : m_log(nullptr), m_path(path), m_sync(sync),
+      m_segment_records(segment_records), m_index_fd(-1), m_header(nullptr),
+      m_slots(nullptr), m_mask(0), m_compactions(0), m_stop(false) {
+  if (path.empty() || segment_records == 0) {
+    throw std::runtime_error("LogStore::LogStore Invalid path or segment size");
+  }
+  recover();
+  m_thread = std::thread(&LogStore::loop, this);
+}
+
+LogStore::~LogStore() {
+  {
+    std::lock_guard<std::mutex> lock(m_thread_mtx);
+    m_stop = true;
+  }
+  m_thread_cv.notify_all();
+  m_thread.join();
+  checkpoint();
+  for (auto &segment : m_segments) {
+    closeSegment(segment.second);
+  }
+  unmapIndex();
+}
+
+void LogStore::setLogger(Logger *log) {
+  if (log) {
+    m_log = log;
+    m_log->entry(LogLevel::INFO,
+                 "LogStore::setLogger Logger added to LogStore object.");
+    if (!m_recovery_note.empty()) {
+      m_log->entry(LogLevel::WARNING, m_recovery_note);
+    }
+  }
+}
+
+// FNV-1a with a final mix. The index is persisted, so the hash must not
+// change between builds the way std::hash may.
+uint64_t LogStore::hashOf(const char *secid, size_t len) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= static_cast<uint8_t>(secid[i]);
+    h *= 1099511628211ULL;
+  }
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h ? h : 1;
+}
+
+uint32_t LogStore::checksum(const Record &record) {
+  const char *data = reinterpret_cast<const char *>(&record);
+  uint32_t h = 2166136261u;
+  for (size_t i = offsetof(Record, op); i < sizeof(Record); i++) {
+    h ^= static_cast<uint8_t>(data[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+string LogStore::segmentPath(uint32_t seq) const {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%06u", seq);
+  return m_path + suffix;
+}
+
+/*
+ * Segments are mapped for their full size up front. Only records already
+ * written are read, so the part past the end of the file is never touched.
+ */
+void LogStore::openSegment(uint32_t seq) {
+  string path = segmentPath(seq);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    throw std::runtime_error("LogStore::openSegment Can't open " + path);
+  }
+  Segment segment;
+  segment.fd = fd;
+  segment.records = static_cast<uint32_t>(st.st_size / LOG_STORE_RECORD_SIZE);
+  segment.live = 0;
+  segment.map_bytes =
+      std::max<size_t>(static_cast<size_t>(segment.records),
+                       static_cast<size_t>(m_segment_records)) *
+      LOG_STORE_RECORD_SIZE;
+  void *map = mmap(nullptr, segment.map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("LogStore::openSegment Can't map " + path);
+  }
+  segment.map = static_cast<const char *>(map);
+  m_segments[seq] = segment;
+}
+
+void LogStore::closeSegment(Segment &segment) {
+  munmap(const_cast<char *>(segment.map), segment.map_bytes);
+  close(segment.fd);
+}
+
+const LogStore::Record *LogStore::recordAt(uint32_t seq,
+                                           uint32_t record) const {
+  auto it = m_segments.find(seq);
+  if (it == m_segments.end() || record >= it->second.records) {
+    return nullptr;
+  }
+  return reinterpret_cast<const Record *>(
+      it->second.map + static_cast<size_t>(record) * LOG_STORE_RECORD_SIZE);
+}
+
+size_t LogStore::find(const string &secid, uint64_t hash) const {
+  for (size_t i = hash & m_mask;; i = (i + 1) & m_mask) {
+    const Slot &slot = m_slots[i];
+    if (slot.hash == 0) {
+      return npos;
+    }
+    if (slot.hash == hash) {
+      const Record *record = recordAt(slot.segment, slot.record);
+      if (record && equals(record->secid, record->secid_len, secid)) {
+        return i;
+      }
+    }
+  }
+}
+
+int LogStore::append(Op op, const string &secid, const string &salt,
+                     const string &password, uint32_t &seq,
+                     uint32_t &number, bool sync) {
+  Record record;
+  memset(&record, 0, sizeof(record));
+  if (secid.size() > sizeof(record.secid) ||
+      salt.size() > sizeof(record.salt) ||
+      password.size() > sizeof(record.password)) {
+    return SQLITE_TOOBIG;
+  }
+  record.op = op;
+  record.secid_len = static_cast<uint8_t>(secid.size());
+  record.salt_len = static_cast<uint8_t>(salt.size());
+  record.password_len = static_cast<uint8_t>(password.size());
+  memcpy(record.secid, secid.data(), secid.size());
+  memcpy(record.salt, salt.data(), salt.size());
+  memcpy(record.password, password.data(), password.size());
+  record.checksum = checksum(record);
+
+  auto active = std::prev(m_segments.end());
+  if (active->second.records >= m_segment_records) {
+    // Seal the full segment, later checkpoints only sync the active one
+    if (fdatasync(active->second.fd) != 0) {
+      m_log->entry(LogLevel::ERROR, "LogStore::append fdatasync failed.");
+      return SQLITE_IOERR;
+    }
+    try {
+      openSegment(active->first + 1);
+    } catch (const std::runtime_error &e) {
+      m_log->entry(LogLevel::ERROR, e.what());
+      return SQLITE_CANTOPEN;
+    }
+    active = std::prev(m_segments.end());
+  }
+  Segment &segment = active->second;
+  off_t offset = static_cast<off_t>(segment.records) * LOG_STORE_RECORD_SIZE;
+  if (pwrite(segment.fd, &record, sizeof(record), offset) !=
+      static_cast<ssize_t>(sizeof(record))) {
+    m_log->entry(LogLevel::ERROR, "LogStore::append write failed.");
+    return SQLITE_IOERR;
+  }
+  if (m_sync && sync && fdatasync(segment.fd) != 0) {
+    m_log->entry(LogLevel::ERROR, "LogStore::append fdatasync failed.");
+    return SQLITE_IOERR;
+  }
+  seq = active->first;
+  number = segment.records++;
+  return SQLITE_OK;
+}
+
+/*
+ * Called before every index change. The first one after a checkpoint sets
+ * the dirty flag and syncs it, so the flag is on disk before any changed
+ * slot can be: a crash between checkpoints may leave any mix of old and new
+ * slot pages, and recover() then rebuilds instead of trusting them.
+ */
+bool LogStore::markDirty() {
+  if (m_header->dirty) {
+    return true;
+  }
+  m_header->dirty = 1;
+  if (msync(m_header, sizeof(IndexHeader), MS_SYNC) != 0) {
+    m_header->dirty = 0;
+    return false;
+  }
+  return true;
+}
+
+// Points slot (or a new slot when npos) at the record seq/number
+void LogStore::put(size_t slot, uint64_t hash, uint32_t seq,
+                   uint32_t number) {
+  if (slot == npos) {
+    slot = hash & m_mask;
+    while (m_slots[slot].hash != 0) {
+      slot = (slot + 1) & m_mask;
+    }
+    m_slots[slot].hash = hash;
+    m_header->size++;
+  } else {
+    release(m_slots[slot].segment);
+  }
+  m_slots[slot].segment = seq;
+  m_slots[slot].record = number;
+  m_segments[seq].live++;
+}
+
+// Backward-shift deletion, see MemoryStore::erase
+void LogStore::erase(size_t slot) {
+  release(m_slots[slot].segment);
+  size_t i = slot;
+  size_t j = slot;
+  for (;;) {
+    j = (j + 1) & m_mask;
+    if (m_slots[j].hash == 0) {
+      break;
+    }
+    size_t home = m_slots[j].hash & m_mask;
+    bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+    if (!stays) {
+      m_slots[i] = m_slots[j];
+      i = j;
+    }
+  }
+  m_slots[i] = Slot{0, 0, 0};
+  m_header->size--;
+}
+
+void LogStore::release(uint32_t seq) {
+  auto it = m_segments.find(seq);
+  if (it != m_segments.end() && it->second.live > 0) {
+    it->second.live--;
+  }
+}
+
+void LogStore::apply(const Record &record, uint32_t seq, uint32_t number) {
+  string secid(record.secid, record.secid_len);
+  uint64_t hash = hashOf(record.secid, record.secid_len);
+  size_t slot = find(secid, hash);
+  if (!markDirty()) {
+    throw std::runtime_error("LogStore::apply Can't mark the index dirty");
+  }
+  if (record.op == OP_DELETE) {
+    if (slot != npos) {
+      erase(slot);
+    }
+    return;
+  }
+  if (slot == npos && !reserve()) {
+    throw std::runtime_error("LogStore::apply Can't grow the index");
+  }
+  put(slot, hash, seq, number);
+}
+
+bool LogStore::mapIndex(const string &file, size_t slots, bool create) {
+  size_t bytes = sizeof(IndexHeader) + slots * sizeof(Slot);
+  int fd = open(file.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0600);
+  if (fd < 0 || (create && ftruncate(fd, bytes) != 0)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  void *map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  m_index_fd = fd;
+  m_header = static_cast<IndexHeader *>(map);
+  m_slots = reinterpret_cast<Slot *>(static_cast<char *>(map) +
+                                     sizeof(IndexHeader));
+  m_mask = slots - 1;
+  if (create) {
+    m_header->magic = INDEX_MAGIC;
+    m_header->slots = slots;
+    m_header->size = 0;
+    m_header->checkpoint_segment = 0;
+    m_header->checkpoint_record = 0;
+    m_header->dirty = 1; // until the first checkpoint
+  }
+  return true;
+}
+
+void LogStore::unmapIndex() {
+  munmap(m_header, sizeof(IndexHeader) + (m_mask + 1) * sizeof(Slot));
+  close(m_index_fd);
+  m_header = nullptr;
+  m_slots = nullptr;
+  m_index_fd = -1;
+}
+
+// Makes a file created or renamed in the directory of path durable
+static bool syncDirectory(const string &path) {
+  size_t slash = path.find_last_of('/');
+  string dir = slash == string::npos ? "." : path.substr(0, slash + 1);
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced;
+}
+
+/*
+ * Keeps the load factor under 70%. The larger index is written to a new
+ * file, synced and renamed over the old one, so a crash leaves one of the
+ * two complete. The old index stays in use if any step fails.
+ */
+bool LogStore::reserve() {
+  if ((m_header->size + 1) * 10 <= (m_mask + 1) * 7) {
+    return true;
+  }
+  string index = m_path + ".idx";
+  string tmp = index + ".tmp";
+  int old_fd = m_index_fd;
+  IndexHeader *old_header = m_header;
+  Slot *old_slots = m_slots;
+  size_t old_mask = m_mask;
+  size_t old_slot_count = m_mask + 1;
+  if (!mapIndex(tmp, old_slot_count * 2, true)) {
+    m_index_fd = old_fd;
+    m_header = old_header;
+    m_slots = old_slots;
+    m_mask = old_mask;
+    return false;
+  }
+  for (size_t i = 0; i < old_slot_count; i++) {
+    if (old_slots[i].hash == 0) {
+      continue;
+    }
+    size_t slot = old_slots[i].hash & m_mask;
+    while (m_slots[slot].hash != 0) {
+      slot = (slot + 1) & m_mask;
+    }
+    m_slots[slot] = old_slots[i];
+  }
+  m_header->size = old_header->size;
+  m_header->checkpoint_segment = old_header->checkpoint_segment;
+  m_header->checkpoint_record = old_header->checkpoint_record;
+  m_header->dirty = old_header->dirty;
+  size_t bytes = sizeof(IndexHeader) + (m_mask + 1) * sizeof(Slot);
+  if (msync(m_header, bytes, MS_SYNC) != 0 || !syncDirectory(index) ||
+      rename(tmp.c_str(), index.c_str()) != 0) {
+    unmapIndex();
+    unlink(tmp.c_str());
+    m_index_fd = old_fd;
+    m_header = old_header;
+    m_slots = old_slots;
+    m_mask = old_mask;
+    return false;
+  }
+  munmap(old_header, sizeof(IndexHeader) + old_slot_count * sizeof(Slot));
+  close(old_fd);
+  syncDirectory(index);
+  return true;
+}
+
+/*
+ * Opens all segments, then brings the index up to date: replay of the tail
+ * after the checkpoint when the index is usable, a full rebuild otherwise.
+ */
+void LogStore::recover() {
+  string dir = ".";
+  string base = m_path;
+  size_t slash = m_path.find_last_of('/');
+  if (slash != string::npos) {
+    dir = m_path.substr(0, slash);
+    base = m_path.substr(slash + 1);
+  }
+  std::vector<uint32_t> seqs;
+  if (DIR *d = opendir(dir.c_str())) {
+    while (struct dirent *entry = readdir(d)) {
+      string name = entry->d_name;
+      if (name.size() == base.size() + 7 &&
+          name.compare(0, base.size(), base) == 0 && name[base.size()] == '.' &&
+          name.find_first_not_of("0123456789", base.size() + 1) ==
+              string::npos) {
+        seqs.push_back(std::stoul(name.substr(base.size() + 1)));
+      }
+    }
+    closedir(d);
+  }
+  std::sort(seqs.begin(), seqs.end());
+  for (uint32_t seq : seqs) {
+    openSegment(seq);
+  }
+  if (m_segments.empty()) {
+    openSegment(1);
+  }
+
+  string index = m_path + ".idx";
+  bool usable = false;
+  int fd = open(index.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    IndexHeader header;
+    struct stat st;
+    usable = pread(fd, &header, sizeof(header), 0) ==
+                 static_cast<ssize_t>(sizeof(header)) &&
+             fstat(fd, &st) == 0 && header.magic == INDEX_MAGIC &&
+             header.slots >= LOG_STORE_INIT_SLOTS &&
+             (header.slots & (header.slots - 1)) == 0 &&
+             static_cast<size_t>(st.st_size) ==
+                 sizeof(IndexHeader) + header.slots * sizeof(Slot) &&
+             header.dirty == 0;
+    close(fd);
+    if (usable) {
+      usable = mapIndex(index, header.slots, false);
+    }
+  }
+  if (usable) {
+    usable = replay(m_header->checkpoint_segment,
+                    m_header->checkpoint_record);
+    if (!usable) {
+      unmapIndex();
+    }
+  }
+  if (!usable) {
+    if (!mapIndex(index, LOG_STORE_INIT_SLOTS, true)) {
+      throw std::runtime_error("LogStore::recover Can't create " + index);
+    }
+    replay(0, 0);
+    m_recovery_note += "LogStore::recover rebuilt the index from the log. ";
+  }
+
+  for (auto &segment : m_segments) {
+    segment.second.live = 0;
+  }
+  for (size_t i = 0; i <= m_mask; i++) {
+    auto it = m_segments.find(m_slots[i].segment);
+    if (m_slots[i].hash != 0 && it != m_segments.end()) {
+      it->second.live++;
+    }
+  }
+  checkpoint();
+}
+
+/*
+ * Applies every record from the given position on. A record that fails its
+ * checksum ends the segment: the file is cut there, as it can only be a
+ * torn write. Returns whether the index agrees with the log afterwards.
+ */
+bool LogStore::replay(uint32_t from_seq, uint32_t from_record) {
+  for (auto it = m_segments.lower_bound(from_seq); it != m_segments.end();
+       ++it) {
+    Segment &segment = it->second;
+    uint32_t number = it->first == from_seq ? from_record : 0;
+    for (; number < segment.records; number++) {
+      const Record &record = *recordAt(it->first, number);
+      bool valid = record.checksum == checksum(record) &&
+                   (record.op == OP_ADD || record.op == OP_UPDATE ||
+                    record.op == OP_DELETE) &&
+                   record.secid_len <= sizeof(record.secid) &&
+                   record.salt_len <= sizeof(record.salt) &&
+                   record.password_len <= sizeof(record.password);
+      if (!valid) {
+        m_recovery_note += "LogStore::replay discarded " +
+                           std::to_string(segment.records - number) +
+                           " records from " + segmentPath(it->first) + ". ";
+        segment.records = number;
+        if (ftruncate(segment.fd, static_cast<off_t>(number) *
+                                      LOG_STORE_RECORD_SIZE) != 0) {
+          throw std::runtime_error("LogStore::replay Can't truncate " +
+                                   segmentPath(it->first));
+        }
+        break;
+      }
+      apply(record, it->first, number);
+    }
+  }
+
+  // Slots written after the checkpoint may point at records that never
+  // reached the disk
+  for (size_t i = 0; i <= m_mask; i++) {
+    const Slot &slot = m_slots[i];
+    if (slot.hash == 0) {
+      continue;
+    }
+    const Record *record = recordAt(slot.segment, slot.record);
+    if (!record) {
+      return false;
+    }
+    bool after = slot.segment > from_seq ||
+                 (slot.segment == from_seq && slot.record >= from_record);
+    if (after && hashOf(record->secid, record->secid_len) != slot.hash) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int LogStore::getUserSalt(const string &secid, string &salt) {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid.data(), secid.size()));
+  if (slot == npos) {
+    return SQLITE_DONE;
+  }
+  const Record *record = recordAt(m_slots[slot].segment, m_slots[slot].record);
+  salt.assign(record->salt, record->salt_len);
+  return SQLITE_OK;
+}
+
+int LogStore::getUserPassword(const string &secid, string &password) {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid.data(), secid.size()));
+  if (slot == npos) {
+    return SQLITE_DONE;
+  }
+  const Record *record = recordAt(m_slots[slot].segment, m_slots[slot].record);
+  password = storedHash(record->password, record->password_len);
+  return SQLITE_OK;
+}
+
+int LogStore::checkPassword(const string &secid, const string &password) {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid.data(), secid.size()));
+  if (slot == npos) {
+    return SQLITE_NOTFOUND;
+  }
+  const Record *record = recordAt(m_slots[slot].segment, m_slots[slot].record);
+  if (!hashEquals(record->password, record->password_len, password)) {
+    return SQLITE_NOTFOUND;
+  }
+  return SQLITE_OK;
+}
+
+int LogStore::addUser(const string &secid, const string &password,
+                      const string &salt) {
+  uint64_t hash = hashOf(secid.data(), secid.size());
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  if (find(secid, hash) != npos) {
+    m_log->entry(LogLevel::INFO,
+                 "LogStore::addUser secid already exists: " + secid);
+    return SQLITE_CONSTRAINT;
+  }
+  if (!markDirty()) {
+    m_log->entry(LogLevel::ERROR, "LogStore::addUser Can't mark the index.");
+    return SQLITE_IOERR;
+  }
+  if (!reserve()) {
+    m_log->entry(LogLevel::ERROR, "LogStore::addUser Can't grow the index.");
+    return SQLITE_FULL;
+  }
+  uint32_t seq, number;
+  int rc = append(OP_ADD, secid, salt, password, seq, number);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  put(npos, hash, seq, number);
+  return SQLITE_OK;
+}
+
+int LogStore::deleteUser(const string &secid, const string &password) {
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid.data(), secid.size()));
+  const Record *record =
+      slot == npos ? nullptr
+                   : recordAt(m_slots[slot].segment, m_slots[slot].record);
+  if (!record ||
+      !hashEquals(record->password, record->password_len, password)) {
+    m_log->entry(LogLevel::INFO,
+                 "LogStore::deleteUser no user with secid and password: " +
+                     secid);
+    return SQLITE_DONE;
+  }
+  if (!markDirty()) {
+    m_log->entry(LogLevel::ERROR, "LogStore::deleteUser Can't mark the index.");
+    return SQLITE_IOERR;
+  }
+  uint32_t seq, number;
+  int rc = append(OP_DELETE, secid, "", "", seq, number);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  erase(slot);
+  return SQLITE_OK;
+}
+
+int LogStore::updatePassword(const string &secid, const string &password,
+                             const string &salt) {
+  uint64_t hash = hashOf(secid.data(), secid.size());
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hash);
+  if (slot == npos) {
+    m_log->entry(LogLevel::INFO,
+                 "LogStore::updatePassword no user with secid: " + secid);
+    return SQLITE_ABORT;
+  }
+  if (!markDirty()) {
+    m_log->entry(LogLevel::ERROR,
+                 "LogStore::updatePassword Can't mark the index.");
+    return SQLITE_IOERR;
+  }
+  uint32_t seq, number;
+  int rc = append(OP_UPDATE, secid, salt, password, seq, number);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  put(slot, hash, seq, number);
+  return SQLITE_OK;
+}
+
+/*
+ * Syncs the active segment and the index, then records the end of the log
+ * as the checkpoint. Sealed segments were synced when they were sealed.
+ */
+int LogStore::checkpoint() {
+  std::lock_guard<std::mutex> maintenance(m_maintenance_mtx);
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  auto active = std::prev(m_segments.end());
+  if (!m_header->dirty && m_header->checkpoint_segment == active->first &&
+      m_header->checkpoint_record == active->second.records) {
+    return SQLITE_OK;
+  }
+  size_t bytes = sizeof(IndexHeader) + (m_mask + 1) * sizeof(Slot);
+  if (fdatasync(active->second.fd) != 0 ||
+      msync(m_header, bytes, MS_SYNC) != 0) {
+    if (m_log) {
+      m_log->entry(LogLevel::ERROR, "LogStore::checkpoint sync failed.");
+    }
+    return SQLITE_IOERR;
+  }
+  m_header->checkpoint_segment = active->first;
+  m_header->checkpoint_record = active->second.records;
+  m_header->dirty = 0;
+  if (msync(m_header, sizeof(IndexHeader), MS_SYNC) != 0) {
+    return SQLITE_IOERR;
+  }
+  return SQLITE_OK;
+}
+
+/*
+ * Rewrites sealed segments where at least LOG_STORE_COMPACT_RATIO of the
+ * records are overwritten or deleted. A delete record is kept while an older
+ * segment may still hold an add for the same user, unless the user was
+ * added again since. The segment is copied LOG_STORE_COMPACT_CHUNK records
+ * per hold of the lock, so logins and writes wait for one chunk at most;
+ * between chunks a user may change, which the next chunk sees in the
+ * index. The copies are not synced one by one, the checkpoint before the
+ * segment is removed syncs them all.
+ */
+int LogStore::compact() {
+  std::unique_lock<std::mutex> maintenance(m_maintenance_mtx);
+  std::vector<uint32_t> candidates;
+  {
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    uint32_t active = m_segments.rbegin()->first;
+    for (auto &segment : m_segments) {
+      const Segment &s = segment.second;
+      if (segment.first != active && s.records > 0 &&
+          s.records - s.live >= s.records * LOG_STORE_COMPACT_RATIO) {
+        candidates.push_back(segment.first);
+      }
+    }
+  }
+
+  int removed = 0;
+  for (uint32_t seq : candidates) {
+    size_t copied = 0;
+    uint32_t records;
+    bool oldest;
+    {
+      std::shared_lock<std::shared_mutex> lock(m_mtx);
+      records = m_segments[seq].records;
+      oldest = seq == m_segments.begin()->first;
+    }
+    for (uint32_t chunk = 0; chunk < records;
+         chunk += LOG_STORE_COMPACT_CHUNK) {
+      std::unique_lock<std::shared_mutex> lock(m_mtx);
+      if (!markDirty()) {
+        return removed;
+      }
+      uint32_t end =
+          std::min<uint32_t>(records, chunk + LOG_STORE_COMPACT_CHUNK);
+      for (uint32_t number = chunk; number < end; number++) {
+        const Record *record = recordAt(seq, number);
+        string secid(record->secid, record->secid_len);
+        size_t slot = find(secid, hashOf(record->secid, record->secid_len));
+        bool live = record->op != OP_DELETE && slot != npos &&
+                    m_slots[slot].segment == seq &&
+                    m_slots[slot].record == number;
+        bool keep = record->op == OP_DELETE && !oldest && slot == npos;
+        if (!live && !keep) {
+          continue;
+        }
+        uint32_t new_seq, new_number;
+        int rc = append(static_cast<Op>(record->op), secid,
+                        string(record->salt, record->salt_len),
+                        storedHash(record->password, record->password_len),
+                        new_seq, new_number, false);
+        if (rc != SQLITE_OK) {
+          return removed; // the segment stays, nothing was lost
+        }
+        if (live) {
+          put(slot, m_slots[slot].hash, new_seq, new_number);
+        }
+        copied++;
+      }
+    }
+    // The copies and the index must be on disk before the segment goes
+    maintenance.unlock();
+    int rc = checkpoint();
+    maintenance.lock();
+    if (rc != SQLITE_OK) {
+      return removed;
+    }
+    {
+      std::unique_lock<std::shared_mutex> lock(m_mtx);
+      closeSegment(m_segments[seq]);
+      unlink(segmentPath(seq).c_str());
+      m_segments.erase(seq);
+      m_compactions++;
+    }
+    removed++;
+    if (m_log) {
+      m_log->entry(LogLevel::INFO,
+                   "LogStore::compact removed " + segmentPath(seq) +
+                       ", copied " + std::to_string(copied) + " records.");
+    }
+  }
+  return removed;
+}
+
+void LogStore::loop() {
+  std::unique_lock<std::mutex> lock(m_thread_mtx);
+  while (!m_thread_cv.wait_for(lock,
+                               std::chrono::milliseconds(LOG_STORE_INTERVAL_MS),
+                               [this] { return m_stop; })) {
+    lock.unlock();
+    compact();
+    checkpoint();
+    lock.lock();
+  }
+}
+
+LogStore::Stats LogStore::stats() {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  Stats stats = {};
+  stats.users = m_header->size;
+  stats.segments = m_segments.size();
+  for (auto &segment : m_segments) {
+    stats.records += segment.second.records;
+    stats.live += segment.second.live;
+  }
+  stats.compactions = m_compactions;
+  stats.index_bytes = sizeof(IndexHeader) + (m_mask + 1) * sizeof(Slot);
+  return stats;
+}
+
+/*
+ * Writes one add record per current user into the segments of a new log at
+ * destFile. Its index is built when the copy is first opened. The records
+ * are copied into memory under the shared lock, so writers only wait for
+ * that, and written without it to temporary files. Those are renamed over
+ * the copy's segments only once all of them are on disk, so a failed
+ * backup leaves the previous copy as it was.
+ */
+int LogStore::backup(const char *destFile, BackupStats *stats) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Record> records;
+  {
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    records.reserve(m_header->size);
+    for (size_t i = 0; i <= m_mask; i++) {
+      if (m_slots[i].hash != 0) {
+        records.push_back(*recordAt(m_slots[i].segment, m_slots[i].record));
+      }
+    }
+  }
+  for (Record &record : records) {
+    record.op = OP_ADD;
+    record.checksum = checksum(record);
+  }
+
+  string dest = destFile;
+  auto segment = [&dest](uint32_t seq) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%06u", seq);
+    return dest + suffix;
+  };
+  const size_t chunk = (1 << 16) / sizeof(Record);
+  uint32_t segments = 0;
+  bool failed = false;
+  for (size_t first = 0; first < records.size() && !failed;
+       first += m_segment_records) {
+    string tmp = segment(++segments) + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    failed = fd < 0;
+    size_t last = std::min<size_t>(records.size(), first + m_segment_records);
+    for (size_t i = first; i < last && !failed; i += chunk) {
+      size_t bytes = std::min(chunk, last - i) * sizeof(Record);
+      failed = write(fd, &records[i], bytes) != static_cast<ssize_t>(bytes);
+    }
+    if (fd >= 0) {
+      failed = fsync(fd) != 0 || failed;
+      failed = close(fd) != 0 || failed;
+    }
+  }
+  // The older copy's index does not match the new segments, without it
+  // the copy is rebuilt from its log whichever segments it holds
+  if (!failed) {
+    unlink((dest + ".idx").c_str());
+    failed = !syncDirectory(dest);
+  }
+  for (uint32_t seq = 1; seq <= segments && !failed; seq++) {
+    failed = rename((segment(seq) + ".tmp").c_str(), segment(seq).c_str()) != 0;
+  }
+  if (failed) {
+    for (uint32_t seq = 1; seq <= segments; seq++) {
+      unlink((segment(seq) + ".tmp").c_str());
+    }
+    m_log->entry(LogLevel::ERROR, "LogStore::backup write failed: " + dest);
+    return SQLITE_IOERR;
+  }
+  // Segments of an older copy would be replayed after ours
+  for (uint32_t stale = segments + 1;; stale++) {
+    if (unlink(segment(stale).c_str()) != 0) {
+      break;
+    }
+  }
+  syncDirectory(dest);
+  size_t bytes = records.size() * sizeof(Record);
+
+  if (stats) {
+    stats->page_size = LOG_STORE_RECORD_SIZE;
+    stats->pages = static_cast<int>(bytes / LOG_STORE_RECORD_SIZE);
+    stats->seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    stats->pages_per_sec =
+        stats->seconds > 0 ? stats->pages / stats->seconds : 0;
+  }
+  return SQLITE_OK;
+}
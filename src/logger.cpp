@@ -39,6 +39,7 @@ void Logger::level(LogLevel level) {
 }
 
 void Logger::outFilePath(string fpath) {
+  std::lock_guard<std::mutex> lock(m_mtx);
   if (LogOut::FILE != m_out) {
     m_out = LogOut::FILE;
   } else {
@@ -56,8 +57,8 @@ void Logger::closeFile() {
 }
 
 void Logger::entry(LogLevel const &level, std::string const &text) {
-  if (level >= m_level) {
-    string log_entry;
+  if (level >= m_level.load(std::memory_order_relaxed)) {
+    thread_local string log_entry;
     switch (level) {
     case LogLevel::INFO:
       log_entry = "<INF>[";
@@ -72,15 +73,17 @@ void Logger::entry(LogLevel const &level, std::string const &text) {
     log_entry.append(getTimeStamp());
     log_entry.append("]");
     log_entry.append(text);
+    log_entry.push_back('\n');
+    std::lock_guard<std::mutex> lock(m_mtx);
     if (LogOut::FILE == m_out) {
-      m_file.handle << log_entry << '\n';
+      m_file.handle << log_entry;
       m_file.current += 1;
       if (m_file.current >= m_file.limit) {
         m_file.handle.close();
         setFileHandler();
       }
     } else if (LogOut::STDOUT == m_out) {
-      std::cout << log_entry << std::endl;
+      std::cout << log_entry << std::flush;
     }
   }
 }
@@ -98,7 +101,8 @@ void Logger::setFileHandler() {
 }
 string Logger::getTimeStamp() {
   std::time_t time = std::time(NULL);
-  std::tm *tm = std::localtime(&time);
+  std::tm local;
+  std::tm *tm = localtime_r(&time, &local);
   std::stringstream tmstmp;
   tmstmp << 'D' << (1900 + tm->tm_year) << tm->tm_mon << tm->tm_mday;
   tmstmp << 'T' << tm->tm_hour << ':' << tm->tm_min << ':' << tm->tm_sec;
@@ -1,9 +1,10 @@
 #include "login_manager.h"
 #include "database.h"
 #include "hash_password.h"
+#include "salt_generator.h"
 #include "udp_server.h"
+#include <algorithm>
 #include <iostream>
-#include <sstream>
 #include <stdexcept>
 
 using std::string;
@@ -13,15 +14,29 @@ using LogOut = Logger::LogOut;
  * Initialize LoginManager with the path to the database (login.db)
  */
 LoginManager::LoginManager(const string &dbFile) try
-    : m_db(dbFile.c_str()), m_log(LogLevel::ERROR, LogOut::STDOUT) {
-  m_db.setLogger(&m_log);
-  auto seed = std::chrono::system_clock::now().time_since_epoch().count();
-  m_salt_generator.seed(seed);
+    : m_store(new Database(dbFile.c_str())),
+      m_log(LogLevel::ERROR, LogOut::STDOUT), m_scheme(HashScheme()) {
+  m_store->setLogger(&m_log);
+  m_flight_key.assign(32, '\0');
+  SaltGenerator::fill(&m_flight_key[0], m_flight_key.size());
 } catch (const std::runtime_error &e) {
   std::cerr << "LoginManager::LoginManager Failed to initialize database: "
             << e.what() << std::endl;
   throw;
 }
+/*
+ * Initialize LoginManager with any credential store backend
+ */
+LoginManager::LoginManager(std::unique_ptr<CredentialStore> store)
+    : m_store(std::move(store)), m_log(LogLevel::ERROR, LogOut::STDOUT),
+      m_scheme(HashScheme()) {
+  if (!m_store) {
+    throw std::runtime_error("LoginManager::LoginManager No credential store");
+  }
+  m_store->setLogger(&m_log);
+  m_flight_key.assign(32, '\0');
+  SaltGenerator::fill(&m_flight_key[0], m_flight_key.size());
+}
 /*
  * Methods for Logger settings
  */
@@ -48,16 +63,194 @@ void LoginManager::stopAPI() {
 /*
  * Class methods for managing database interaction
  */
+/*
+ * Identical logins that run at the same time, as in a retry storm, share
+ * one salt lookup and hash. They are matched on the username and a digest
+ * of the password keyed with m_flight_key, so no password is kept and the
+ * key cannot be compared with stored hashes.
+ */
 int LoginManager::login(const string &username, const string &password) {
+  HashPassword::Digest digest;
+  HashPassword::Hasher().update(m_flight_key).update(password).final(digest);
+  string key = username;
+  key.push_back('\0');
+  key.append(digest.begin(), digest.end());
+  return m_logins.run(key, [&] { return verify(username, password); });
+}
+
+SingleFlight::Stats LoginManager::loginFlightStats() {
+  return m_logins.stats();
+}
+
+/*
+ * The salt and the hash are read separately, a password change or rehash
+ * can commit in between and the hash made with the old salt no longer
+ * matches. A check that fails is therefore retried, at most
+ * LOGIN_VERIFY_ATTEMPTS times, when the write sequence of the user's lock
+ * shows a password being replaced meanwhile. A plain wrong password costs
+ * no extra lookup.
+ */
+int LoginManager::verify(const string &username, const string &password) {
+  string hash_pw, stored_salt;
+  HashScheme scheme;
+  const std::atomic<uint64_t> &seq = m_write_seq[writeStripe(username)];
+  int rc;
+  for (int attempt = 1;; attempt++) {
+    uint64_t before = seq.load();
+    if (!getHashedPassword(username, password, hash_pw, &stored_salt,
+                           &scheme)) {
+      string text =
+          "LoginManager::login Could not get hashed password for username: " +
+          username;
+      m_log.entry(LogLevel::INFO, text);
+      return -1;
+    }
+    rc = m_store->checkPassword(username, hash_pw);
+    if (rc == SQLITE_OK || attempt == LOGIN_VERIFY_ATTEMPTS ||
+        (before % 2 == 0 && seq.load() == before)) {
+      break;
+    }
+  }
+  if (rc == SQLITE_OK && scheme.needsRehash(m_scheme.load())) {
+    postRehash(username, password, stored_salt);
+  }
+  return rc;
+}
+
+/*
+ * Many logins with one store lookup for all of them and the hashes made
+ * together. Results are those of login. A check that fails is retried
+ * through verify when a password write raced it, as verify does.
+ */
+std::vector<int>
+LoginManager::loginBatch(const std::vector<Credential> &credentials) {
+  std::vector<int> results(credentials.size(), -1);
+  std::vector<string> usernames;
+  std::vector<uint64_t> seqs;
+  usernames.reserve(credentials.size());
+  for (const Credential &credential : credentials) {
+    usernames.push_back(credential.username);
+    seqs.push_back(m_write_seq[writeStripe(credential.username)].load());
+  }
+  std::vector<CredentialCache::Entry> entries;
+  std::vector<int> rcs;
+  m_store->getCredentials(usernames, entries, rcs);
+
+  std::vector<size_t> items;
+  std::vector<HashScheme> schemes;
+  std::vector<const string *> passwords;
+  std::vector<string> salts;
+  for (size_t i = 0; i < credentials.size(); i++) {
+    HashScheme used;
+    string d_salt;
+    if (rcs[i] != SQLITE_OK || entries[i].salt.empty() ||
+        !HashScheme::decode(entries[i].salt, used, d_salt)) {
+      continue;
+    }
+    items.push_back(i);
+    schemes.push_back(used);
+    passwords.push_back(&credentials[i].password);
+    salts.push_back(std::move(d_salt));
+  }
+  if (items.size() < credentials.size()) {
+    m_log.entry(LogLevel::INFO,
+                "LoginManager::loginBatch Could not get hashed password for " +
+                    std::to_string(credentials.size() - items.size()) +
+                    " of " + std::to_string(credentials.size()) +
+                    " usernames");
+  }
+  std::vector<string> hashed;
+  hashBatch(schemes, passwords, salts, hashed);
+
+  const HashScheme current = m_scheme.load();
+  for (size_t k = 0; k < items.size(); k++) {
+    size_t i = items[k];
+    if (hashed[k].empty()) {
+      continue;
+    }
+    if (hashed[k] != entries[i].password) {
+      const string &username = credentials[i].username;
+      bool raced = seqs[i] % 2 == 1 ||
+                   m_write_seq[writeStripe(username)].load() != seqs[i];
+      results[i] = raced ? verify(username, credentials[i].password)
+                         : SQLITE_NOTFOUND;
+      continue;
+    }
+    results[i] = SQLITE_OK;
+    if (schemes[k].needsRehash(current)) {
+      postRehash(credentials[i].username, credentials[i].password,
+                 entries[i].salt);
+    }
+  }
+  return results;
+}
+
+/*
+ * The password copy is shared by the task's copies rather than copied
+ * with them, so the wipe in rehash clears the only one.
+ */
+void LoginManager::postRehash(const string &username, const string &password,
+                              const string &stored_salt) {
+  auto secret = std::make_shared<string>(password);
+  m_rehasher.post([this, username, secret, stored_salt] {
+    rehash(username, *secret, stored_salt);
+  });
+}
+
+/*
+ * Moves a user who just logged in to the current scheme. The password
+ * is only written if the stored salt is still the one it was verified
+ * against, under the lock password changes take to write, so a rehash
+ * can never bring back a password that was changed meanwhile.
+ */
+void LoginManager::rehash(const string &username, string &password,
+                          const string &stored_salt) {
+  const HashScheme scheme = m_scheme.load();
+  string d_salt = generateSalt();
   string hash_pw;
-  if (!getHashedPassword(username, password, hash_pw)) {
-    string text =
-        "LoginManager::login Could not get hashed password for username: " +
-        username;
-    m_log.entry(LogLevel::INFO, text);
-    return -1;
+  hash(scheme, password, d_salt, hash_pw);
+  std::fill(password.begin(), password.end(), '\0');
+
+  std::lock_guard<std::mutex> lock(writeLock(username));
+  string current;
+  if (!getSalt(username, current) || current != stored_salt) {
+    m_rehash_skipped++;
+    return;
+  }
+  if (replacePassword(username, hash_pw, scheme.encode(d_salt)) ==
+      SQLITE_OK) {
+    m_rehashed++;
+  } else {
+    m_rehash_failed++;
+    m_log.entry(LogLevel::WARNING,
+                "LoginManager::rehash Could not rehash password of: " +
+                    username);
   }
-  return m_db.checkPassword(username, hash_pw);
+}
+
+void LoginManager::setHashScheme(const HashScheme &scheme) {
+  m_scheme.store(scheme);
+}
+HashScheme LoginManager::hashScheme() const { return m_scheme.load(); }
+RehashStats LoginManager::rehashStats() const {
+  return {m_rehashed, m_rehash_skipped, m_rehash_failed};
+}
+
+void LoginManager::enableHashPool(size_t threads,
+                                  const std::vector<int> &cpus) {
+  std::shared_ptr<HashPool> pool;
+  if (threads > 0) {
+    pool.reset(new HashPool(threads, cpus));
+  }
+  std::atomic_store(&m_hash_pool, pool);
+}
+bool LoginManager::hashPoolStats(HashPool::Stats &stats) {
+  std::shared_ptr<HashPool> pool = std::atomic_load(&m_hash_pool);
+  if (!pool) {
+    return false;
+  }
+  stats = pool->stats();
+  return true;
 }
 
 int LoginManager::addLogin(const string &username, const string &password) {
@@ -66,19 +259,73 @@ int LoginManager::addLogin(const string &username, const string &password) {
     return -1;
   }
 
-  string hashedPassword =
-      HashPassword::usingSHA256(STATIC_SALT + password + d_salt);
+  string hashedPassword;
+  const HashScheme scheme = m_scheme.load();
+  hash(scheme, password, d_salt, hashedPassword);
   if (hashedPassword.empty()) {
     return -2;
   }
-  return m_db.addUser(username, hashedPassword, d_salt);
+  std::lock_guard<std::mutex> lock(writeLock(username));
+  return m_store->addUser(username, hashedPassword, scheme.encode(d_salt));
+}
+/*
+ * The users are hashed together and handed to the store in one call, under
+ * the write locks of all of them, taken in address order.
+ */
+std::vector<int>
+LoginManager::addLogins(const std::vector<Credential> &credentials) {
+  std::vector<int> results(credentials.size(), -1);
+  const HashScheme scheme = m_scheme.load();
+  std::vector<size_t> items;
+  std::vector<const string *> passwords;
+  std::vector<string> salts;
+  for (size_t i = 0; i < credentials.size(); i++) {
+    string d_salt = generateSalt();
+    if (d_salt.empty()) {
+      continue;
+    }
+    items.push_back(i);
+    passwords.push_back(&credentials[i].password);
+    salts.push_back(std::move(d_salt));
+  }
+  std::vector<string> hashed;
+  hashBatch(std::vector<HashScheme>(items.size(), scheme), passwords, salts,
+            hashed);
+
+  std::vector<NewUser> users;
+  std::vector<size_t> added;
+  std::vector<std::mutex *> locks;
+  for (size_t k = 0; k < items.size(); k++) {
+    size_t i = items[k];
+    if (hashed[k].empty()) {
+      results[i] = -2;
+      continue;
+    }
+    users.push_back({credentials[i].username, std::move(hashed[k]),
+                     scheme.encode(salts[k])});
+    added.push_back(i);
+    locks.push_back(&writeLock(credentials[i].username));
+  }
+  std::sort(locks.begin(), locks.end());
+  locks.erase(std::unique(locks.begin(), locks.end()), locks.end());
+  std::vector<std::unique_lock<std::mutex>> held;
+  for (std::mutex *lock : locks) {
+    held.emplace_back(*lock);
+  }
+  std::vector<int> rcs;
+  m_store->addUsers(users, rcs);
+  for (size_t j = 0; j < added.size(); j++) {
+    results[added[j]] = rcs[j];
+  }
+  return results;
 }
 int LoginManager::delLogin(const string &username, const string &password) {
   string hash_pw;
   if (!getHashedPassword(username, password, hash_pw)) {
     return -1;
   }
-  return m_db.deleteUser(username, hash_pw);
+  std::lock_guard<std::mutex> lock(writeLock(username));
+  return m_store->deleteUser(username, hash_pw);
 }
 
 int LoginManager::changePassword(const string &username,
@@ -88,33 +335,196 @@ int LoginManager::changePassword(const string &username,
     return -1;
   }
 
-  string hash_pw = HashPassword::usingSHA256(STATIC_SALT + password + d_salt);
+  string hash_pw;
+  const HashScheme scheme = m_scheme.load();
+  hash(scheme, password, d_salt, hash_pw);
   if (hash_pw.empty()) {
     return -2;
   }
-  return m_db.updatePassword(username, hash_pw, d_salt);
+  std::lock_guard<std::mutex> lock(writeLock(username));
+  return replacePassword(username, hash_pw, scheme.encode(d_salt));
+}
+
+/*
+ * Online backup of the database, logins are served while it runs.
+ */
+int LoginManager::backup(const string &path, BackupStats *stats) {
+  return m_store->backup(path.c_str(), stats);
+}
+void LoginManager::setBackupRate(int pages_per_step, int max_pages_per_sec) {
+  m_store->setBackupRate(pages_per_step, max_pages_per_sec);
+}
+
+/*
+ * Credential cache in front of the database, 0 bytes disables it.
+ */
+void LoginManager::setCacheSize(size_t capacity_bytes) {
+  m_store->enableCache(capacity_bytes);
+}
+bool LoginManager::cacheStats(CredentialCache::Stats &stats) {
+  return m_store->cacheStats(stats);
+}
+
+/*
+ * Filter over all usernames, logins for unknown users never reach SQLite.
+ */
+int LoginManager::enableUserFilter(bool enable) {
+  return m_store->enableFilter(enable);
+}
+bool LoginManager::userFilterStats(CuckooFilter::Stats &stats) {
+  return m_store->filterStats(stats);
+}
+
+/*
+ * Concurrent logins share their salt and password lookups.
+ */
+int LoginManager::enableReadBatching(bool enable, int max_wait_us) {
+  return m_store->enableReadBatching(enable, max_wait_us);
+}
+bool LoginManager::readBatchStats(ReadBatcher::Stats &stats) {
+  return m_store->readBatchStats(stats);
+}
+
+/*
+ * Latency histogram per database statement and page cache counters.
+ */
+int LoginManager::enableProfiling(bool enable) {
+  return m_store->enableProfiling(enable);
+}
+bool LoginManager::profile(Profiler::Snapshot &snapshot) {
+  return m_store->profile(snapshot);
+}
+
+/*
+ * How long a write waits for a database locked by another connection.
+ */
+void LoginManager::setBusyDeadline(int deadline_ms) {
+  m_store->setBusyDeadline(deadline_ms);
+}
+bool LoginManager::busyStats(BusyStats &stats) {
+  return m_store->busyStats(stats);
+}
+
+/*
+ * Memory-first databases: snapshots written back to the database file.
+ */
+bool LoginManager::persistStats(PersistStats &stats) {
+  return m_store->persistStats(stats);
+}
+
+/*
+ * Committed user changes are published to feed, nullptr stops publishing.
+ */
+int LoginManager::setChangeFeed(std::shared_ptr<ChangeFeed> feed) {
+  if (feed) {
+    feed->setLogger(&m_log);
+  }
+  return m_store->setChangeFeed(feed);
 }
 
 /*
  * Helper-functions defined below.
  */
 bool LoginManager::getHashedPassword(const string &usid, const string &pw,
-                                     string &hashed_pw) {
-  string d_salt;
-  if (!getSalt(usid, d_salt) || d_salt.empty()) {
+                                     string &hashed_pw, string *stored_salt,
+                                     HashScheme *scheme) {
+  string stored, d_salt;
+  HashScheme used;
+  if (!getSalt(usid, stored) || stored.empty()) {
     string text =
         "LoginManager::getHashedPassword Could not get salt with usid: " + usid;
     m_log.entry(LogLevel::WARNING, text);
     return false;
   }
-  hashed_pw = HashPassword::usingSHA256(STATIC_SALT + pw + d_salt);
+  if (!HashScheme::decode(stored, used, d_salt)) {
+    m_log.entry(LogLevel::ERROR,
+                "LoginManager::getHashedPassword Unknown hash scheme for "
+                "usid: " +
+                    usid);
+    return false;
+  }
+  hash(used, pw, d_salt, hashed_pw);
+  if (stored_salt) {
+    *stored_salt = stored;
+  }
+  if (scheme) {
+    *scheme = used;
+  }
   return !hashed_pw.empty();
 }
+void LoginManager::hash(const HashScheme &scheme, const string &password,
+                        const string &salt, string &hashed) {
+  std::shared_ptr<HashPool> pool = std::atomic_load(&m_hash_pool);
+  if (pool) {
+    hashed = pool->submit(scheme, STATIC_SALT, password, salt).get();
+  } else {
+    scheme.hash(STATIC_SALT, password, salt, hashed);
+  }
+}
+void LoginManager::hashBatch(const std::vector<HashScheme> &schemes,
+                             const std::vector<const string *> &passwords,
+                             const std::vector<string> &salts,
+                             std::vector<string> &hashed) {
+  hashed.assign(schemes.size(), string());
+  std::shared_ptr<HashPool> pool = std::atomic_load(&m_hash_pool);
+  if (pool) {
+    // All queued at once, so the pool can batch and spread them
+    std::vector<std::future<string>> jobs;
+    for (size_t i = 0; i < schemes.size(); i++) {
+      jobs.push_back(
+          pool->submit(schemes[i], STATIC_SALT, *passwords[i], salts[i]));
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+      hashed[i] = jobs[i].get();
+    }
+    return;
+  }
+  // The legacy hash is one SHA-256 of pepper, password and salt
+  std::vector<size_t> legacy;
+  std::vector<string> messages;
+  for (size_t i = 0; i < schemes.size(); i++) {
+    if (schemes[i].algorithm == HashScheme::LEGACY_SHA256) {
+      legacy.push_back(i);
+      messages.push_back(STATIC_SALT + *passwords[i] + salts[i]);
+    } else {
+      schemes[i].hash(STATIC_SALT, *passwords[i], salts[i], hashed[i]);
+    }
+  }
+  if (legacy.empty()) {
+    return;
+  }
+  std::vector<std::string_view> views(messages.begin(), messages.end());
+  std::vector<string> digests = HashPassword::digestSHA256Batch(views);
+  for (size_t j = 0; j < legacy.size(); j++) {
+    std::fill(messages[j].begin(), messages[j].end(), '\0');
+    hashed[legacy[j]] = std::move(digests[j]);
+  }
+}
+size_t LoginManager::writeStripe(const string &username) {
+  return std::hash<string>()(username) % LOGIN_WRITE_LOCKS;
+}
+std::mutex &LoginManager::writeLock(const string &username) {
+  return m_write_mtx[writeStripe(username)];
+}
+int LoginManager::replacePassword(const string &username,
+                                  const string &hashed_pw,
+                                  const string &stored_salt) {
+  std::atomic<uint64_t> &seq = m_write_seq[writeStripe(username)];
+  seq++;
+  int rc = m_store->updatePassword(username, hashed_pw, stored_salt);
+  seq++;
+  return rc;
+}
 bool LoginManager::getSalt(const string &username, string &salt) {
-  return (m_db.getUserSalt(username, salt) == 0);
+  return (m_store->getUserSalt(username, salt) == 0);
 }
+// SALT_SIZE random bytes, stored as they are. Empty if there is no seed.
 string LoginManager::generateSalt() {
-  std::stringstream stream;
-  stream << std::hex << m_salt_generator();
-  return string(stream.str());
+  SaltGenerator::Salt salt;
+  if (!SaltGenerator::generate(salt)) {
+    m_log.entry(LogLevel::ERROR,
+                "LoginManager::generateSalt No random seed from the kernel");
+    return string();
+  }
+  return string(salt.begin(), salt.end());
 }
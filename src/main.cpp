@@ -1,18 +1,28 @@
+#include "log_store.h"
 #include "login_manager.h"
+#include "memory_pool.h"
+#include "memory_store.h"
+#include "sharded_store.h"
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <ostream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include <yaml-cpp/yaml.h>
 
 void print_usage() {
   std::cout
-      << "./login_manager [-sp path_to_settings] | [-dp path_to_database] \n\n";
+      << "./login_manager [-sp path_to_settings] | [-dp path_to_database] \n";
+  std::cout << "./login_manager -rs source shards destination shards\n\n";
 
   std::cout << "Options:\n";
   std::cout << "  -sp  Path to the settings file.\n";
-  std::cout << "  -dp  Path to the database file.\n\n";
+  std::cout << "  -dp  Path to the database file.\n";
+  std::cout << "  -rs  Offline reshard of the source database (with its shard "
+               "count) into the destination.\n\n";
 
   std::cout
       << "Note: You must provide either the path to a settings file with `-sp`";
@@ -25,6 +35,9 @@ void print_commands(bool const &server) {
   std::cout << "a    - add new user \n";
   std::cout << "d    - delete existing user \n";
   std::cout << "c    - change password for an existing user \n";
+  std::cout << "b    - online backup of the database to a file \n";
+  std::cout << "m    - show cache, user filter and lock contention statistics\n";
+  std::cout << "p    - show database statement latencies and page cache \n";
   std::cout << "s    - starts or stops the server \n";
   if (server) {
     std::cout << "       > Server is running, s will stop.\n";
@@ -100,6 +113,119 @@ void event_loop(LoginManager *lm) {
         std::cout << "Username: " << username << ", Password: " << password
                   << " gave return code: " << rc << std::endl;
       }
+    } else if (command == "b") {
+      std::string path;
+      std::cout << "Backup database." << std::endl;
+      std::cout << "Enter backup file path: ";
+      std::cin >> path;
+      BackupStats stats;
+      int rc = lm->backup(path, &stats);
+      if (0 == rc) {
+        std::cout << "Success! " << stats.pages << " pages ("
+                  << stats.pages * stats.page_size / 1024 << " KiB) in "
+                  << stats.seconds << " s, "
+                  << static_cast<long>(stats.pages_per_sec) << " pages/s."
+                  << std::endl;
+      } else {
+        std::cout << "Failed. Backup gave return code: " << rc << std::endl;
+      }
+    } else if (command == "m") {
+      CredentialCache::Stats stats;
+      if (lm->cacheStats(stats)) {
+        std::cout << "Credential cache: " << stats.entries << " entries, "
+                  << stats.bytes / 1024 << " of " << stats.capacity / 1024
+                  << " KiB\n";
+        std::cout << "  hits " << stats.hits << ", misses " << stats.misses
+                  << ", hit rate " << stats.hitRate() * 100 << " %\n";
+        std::cout << "  admitted " << stats.admitted << ", rejected "
+                  << stats.rejected << ", evicted " << stats.evictions
+                  << ", invalidated " << stats.invalidations << std::endl;
+      } else {
+        std::cout << "Credential cache is disabled." << std::endl;
+      }
+      CuckooFilter::Stats filter_stats;
+      if (lm->userFilterStats(filter_stats)) {
+        std::cout << "User filter: " << filter_stats.items << " of "
+                  << filter_stats.capacity << " users, "
+                  << filter_stats.bytes / 1024 << " KiB\n";
+        std::cout << "  lookups " << filter_stats.lookups
+                  << ", unknown users rejected " << filter_stats.rejected
+                  << std::endl;
+      } else {
+        std::cout << "User filter is disabled." << std::endl;
+      }
+      ReadBatcher::Stats batch;
+      if (lm->readBatchStats(batch)) {
+        std::cout << "Read batching: " << batch.lookups << " lookups in "
+                  << batch.batches << " queries, mean batch "
+                  << batch.meanBatch() << ", largest " << batch.max_batch
+                  << ", window " << batch.wait_us << " us" << std::endl;
+      }
+      SingleFlight::Stats flights = lm->loginFlightStats();
+      std::cout << "Login coalescing: " << flights.shared << " of "
+                << flights.calls << " logins shared a check in flight"
+                << std::endl;
+      HashScheme scheme = lm->hashScheme();
+      RehashStats rehashes = lm->rehashStats();
+      std::cout << "Hash scheme: " << scheme.name() << ", cost ";
+      if (HashScheme::ARGON2ID == scheme.algorithm) {
+        MemoryPool::Stats pool = MemoryPool::shared().stats();
+        std::cout << "t=" << scheme.passes() << " m=" << scheme.memoryMB()
+                  << " MiB p=" << scheme.lanes() << ", pool "
+                  << (pool.in_use >> 20) << " of " << (pool.budget >> 20)
+                  << " MiB in use, " << pool.waits << " waits";
+      } else {
+        std::cout << scheme.cost;
+      }
+      std::cout << ", " << rehashes.rehashed
+                << " logins rehashed, " << rehashes.skipped << " skipped, "
+                << rehashes.failed << " failed" << std::endl;
+      HashPool::Stats hashing;
+      if (lm->hashPoolStats(hashing)) {
+        std::cout << "Hash pool: " << hashing.jobs << " hashes, "
+                  << hashing.batched << " in " << hashing.batches
+                  << " batches, mean batch " << hashing.meanBatch()
+                  << std::endl;
+      }
+      PersistStats persisted;
+      if (lm->persistStats(persisted)) {
+        std::cout << "Persistence: " << persisted.snapshots
+                  << " snapshots, " << persisted.failures << " failed, last "
+                  << persisted.pages << " pages in "
+                  << persisted.last_seconds * 1000 << " ms (writers waited "
+                  << persisted.copy_seconds * 1000 << " ms), "
+                  << persisted.age_seconds << " s ago" << std::endl;
+      }
+      BusyStats busy;
+      if (lm->busyStats(busy)) {
+        std::cout << "Lock contention: " << busy.contended
+                  << " statements waited, " << busy.retries << " retries, "
+                  << busy.gave_up << " gave up\n";
+        std::cout << "  waited " << busy.wait_seconds << " s, longest "
+                  << busy.max_wait_seconds * 1000 << " ms" << std::endl;
+      }
+    } else if (command == "p") {
+      Profiler::Snapshot snapshot;
+      if (lm->profile(snapshot)) {
+        for (const Profiler::Histogram &h : snapshot.statements) {
+          printf("%-24.24s %9llu runs  mean %8.1f us  p50 <%6.0f us  "
+                 "p99 <%6.0f us  max %8.1f us\n",
+                 h.name.c_str(), static_cast<unsigned long long>(h.count),
+                 h.meanMicros(), h.percentile(50), h.percentile(99),
+                 h.max_ns / 1000.0);
+        }
+        const Profiler::DbStatus &st = snapshot.status;
+        std::cout << "Page cache: " << st.cache_hits << " hits, "
+                  << st.cache_misses << " misses ("
+                  << st.cacheHitRate() * 100 << " % hit rate), "
+                  << st.cache_writes << " writes, " << st.cache_spills
+                  << " spills, " << st.cache_bytes / 1024 << " KiB used\n";
+        std::cout << "Lookaside: " << st.lookaside_slots_used
+                  << " slots in use, " << st.lookaside_hits << " hits, "
+                  << st.lookaside_misses << " misses" << std::endl;
+      } else {
+        std::cout << "Profiling is disabled." << std::endl;
+      }
     } else if (command == "s" && !server_running) {
       std::cout << "Start server." << std::endl;
       lm->startAPI();
@@ -122,19 +248,69 @@ void event_loop(LoginManager *lm) {
   std::cout << "Login Manager Exits." << std::endl;
 }
 
+int reshard(char **argv) {
+  Logger log(Logger::LogLevel::INFO, Logger::LogOut::STDOUT);
+  int rc = ShardedStore::reshard(argv[2], std::atoi(argv[3]), argv[4],
+                                 std::atoi(argv[5]), &log);
+  if (0 != rc) {
+    std::cout << "Reshard failed with return code: " << rc << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
+  if (argc == 6 && strcmp(argv[1], "-rs") == 0) {
+    return reshard(argv);
+  }
   if (argc != 3) {
     print_usage();
     return 1;
   }
   std::string db_path = "";
+  std::string db_engine = "sqlite";
+  bool db_sync = false;
+  int db_shards = 1;
+  int db_busy_deadline_ms = BUSY_DEADLINE_MS;
+  int db_persist_interval_ms = 0;
   Logger::LogOut log_out;
   Logger::LogLevel log_level;
   std::string logger_path = "";
+  int backup_pages_per_step = BACKUP_PAGES_PER_STEP;
+  int backup_max_pages_per_sec = BACKUP_MAX_PAGES_PER_SEC;
+  size_t cache_size_mb = 0;
+  bool user_filter = false;
+  std::string feed_socket = "";
+  bool profiling = false;
+  bool read_batching = false;
+  int read_batch_wait_us = READ_BATCH_MAX_WAIT_US;
+  std::string hash_scheme = "sha256";
+  double hash_target_ms = HASH_TARGET_MS;
+  uint32_t hash_memory_mb = 0;
+  uint32_t hash_lanes = 1;
+  size_t hash_pool_mb = MEMORY_POOL_MB;
+  size_t hash_threads = 0;
+  std::vector<int> hash_cpus;
 
   if (strcmp(argv[1], "-sp") == 0) {
     YAML::Node config = YAML::LoadFile(argv[2]);
     db_path = config["database"]["path"].as<std::string>();
+    if (config["database"]["engine"]) {
+      db_engine = config["database"]["engine"].as<std::string>();
+    }
+    if (config["database"]["sync"]) {
+      db_sync = config["database"]["sync"].as<bool>();
+    }
+    if (config["database"]["shards"]) {
+      db_shards = config["database"]["shards"].as<int>();
+    }
+    if (config["database"]["busy_deadline_ms"]) {
+      db_busy_deadline_ms = config["database"]["busy_deadline_ms"].as<int>();
+    }
+    if (config["database"]["persist_interval_ms"]) {
+      db_persist_interval_ms =
+          config["database"]["persist_interval_ms"].as<int>();
+    }
 
     string logger_out = config["logging"]["out"].as<std::string>();
     if ("file" == logger_out || "File" == logger_out || "FILE" == logger_out) {
@@ -156,6 +332,60 @@ int main(int argc, char **argv) {
                "info" == logger_level) {
       log_level = Logger::LogLevel::INFO;
     }
+
+    if (config["backup"]) {
+      if (config["backup"]["pages_per_step"]) {
+        backup_pages_per_step = config["backup"]["pages_per_step"].as<int>();
+      }
+      if (config["backup"]["max_pages_per_second"]) {
+        backup_max_pages_per_sec =
+            config["backup"]["max_pages_per_second"].as<int>();
+      }
+    }
+
+    if (config["cache"] && config["cache"]["size_mb"]) {
+      cache_size_mb = config["cache"]["size_mb"].as<size_t>();
+    }
+    if (config["filter"] && config["filter"]["enabled"]) {
+      user_filter = config["filter"]["enabled"].as<bool>();
+    }
+    if (config["batch"]) {
+      if (config["batch"]["enabled"]) {
+        read_batching = config["batch"]["enabled"].as<bool>();
+      }
+      if (config["batch"]["max_wait_us"]) {
+        read_batch_wait_us = config["batch"]["max_wait_us"].as<int>();
+      }
+    }
+    if (config["hashing"]) {
+      if (config["hashing"]["scheme"]) {
+        hash_scheme = config["hashing"]["scheme"].as<std::string>();
+      }
+      if (config["hashing"]["target_ms"]) {
+        hash_target_ms = config["hashing"]["target_ms"].as<double>();
+      }
+      if (config["hashing"]["memory_mb"]) {
+        hash_memory_mb = config["hashing"]["memory_mb"].as<uint32_t>();
+      }
+      if (config["hashing"]["lanes"]) {
+        hash_lanes = config["hashing"]["lanes"].as<uint32_t>();
+      }
+      if (config["hashing"]["pool_mb"]) {
+        hash_pool_mb = config["hashing"]["pool_mb"].as<size_t>();
+      }
+      if (config["hashing"]["threads"]) {
+        hash_threads = config["hashing"]["threads"].as<size_t>();
+      }
+      if (config["hashing"]["cpus"]) {
+        hash_cpus = config["hashing"]["cpus"].as<std::vector<int>>();
+      }
+    }
+    if (config["profile"] && config["profile"]["enabled"]) {
+      profiling = config["profile"]["enabled"].as<bool>();
+    }
+    if (config["feed"] && config["feed"]["socket"]) {
+      feed_socket = config["feed"]["socket"].as<std::string>();
+    }
   } else if (strcmp(argv[1], "-dp") == 0) {
     db_path = argv[2];
   } else {
@@ -167,13 +397,79 @@ int main(int argc, char **argv) {
   std::cout << "Path: " << db_path << std::endl;
 
   try {
-    LoginManager lm(db_path);
+    std::unique_ptr<CredentialStore> store;
+    if ("memory" == db_engine) {
+      // db_path is the append-only file, empty for an ephemeral store
+      store.reset(new MemoryStore(db_path, db_sync));
+    } else if ("log" == db_engine) {
+      // db_path is the prefix of the segment and index files
+      store.reset(new LogStore(db_path, db_sync));
+    } else if ("sqlite" == db_engine && db_shards > 1) {
+      store.reset(new ShardedStore(db_path, db_shards, db_persist_interval_ms));
+    } else if ("sqlite" == db_engine) {
+      store.reset(new Database(db_path.c_str(), db_persist_interval_ms));
+    } else {
+      std::cout << "Invalid database engine: " << db_engine << std::endl;
+      return 1;
+    }
+    LoginManager lm(std::move(store));
     if (Logger::LogOut::FILE == log_out) {
       lm.logToFile(logger_path);
     }
     if (log_level) {
       lm.setLogLevel(log_level);
     }
+    if ("pbkdf2" == hash_scheme) {
+      HashScheme scheme =
+          HashScheme::calibrate(HashScheme::PBKDF2_SHA256, hash_target_ms);
+      lm.setHashScheme(scheme);
+      std::cout << "Hash scheme: " << scheme.name() << ", " << scheme.cost
+                << " iterations for " << hash_target_ms << " ms" << std::endl;
+    } else if ("argon2id" == hash_scheme) {
+      MemoryPool::shared().setBudget(hash_pool_mb * 1024 * 1024);
+      HashScheme scheme =
+          hash_memory_mb > 0
+              ? HashScheme::argon2id(HASH_ARGON2_PASSES, hash_memory_mb,
+                                     hash_lanes)
+              : HashScheme::calibrate(HashScheme::ARGON2ID, hash_target_ms,
+                                      hash_lanes);
+      if (scheme.memoryMB() > hash_pool_mb) {
+        std::cout << "Argon2id memory above hashing.pool_mb" << std::endl;
+        return 1;
+      }
+      lm.setHashScheme(scheme);
+      std::cout << "Hash scheme: " << scheme.name() << ", "
+                << scheme.memoryMB() << " MiB, " << scheme.passes()
+                << " passes, " << scheme.lanes() << " lanes, at most "
+                << hash_pool_mb / scheme.memoryMB()
+                << " hashes at once" << std::endl;
+    } else if ("sha256" != hash_scheme) {
+      std::cout << "Invalid hash scheme: " << hash_scheme << std::endl;
+      return 1;
+    }
+    if (hash_threads > 0) {
+      lm.enableHashPool(hash_threads, hash_cpus);
+    }
+    lm.setBackupRate(backup_pages_per_step, backup_max_pages_per_sec);
+    lm.setBusyDeadline(db_busy_deadline_ms);
+    if (profiling) {
+      lm.enableProfiling(true);
+    }
+    if (read_batching) {
+      lm.enableReadBatching(true, read_batch_wait_us);
+    }
+    lm.setCacheSize(cache_size_mb * 1024 * 1024);
+    if (user_filter) {
+      lm.enableUserFilter(true);
+    }
+    if (!feed_socket.empty()) {
+      std::shared_ptr<ChangeFeed> feed(new ChangeFeed());
+      if (lm.setChangeFeed(feed) != SQLITE_OK ||
+          feed->listen(feed_socket) != SQLITE_OK) {
+        std::cout << "Change feed not available on " << feed_socket
+                  << std::endl;
+      }
+    }
     event_loop(&lm);
   } catch (const std::runtime_error &e) {
     std::cerr << "Error starting Login Manager CLI: " << e.what() << std::endl;
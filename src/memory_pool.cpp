@@ -0,0 +1,131 @@
+#include "memory_pool.h"
+#include <chrono>
+#include <new>
+
+MemoryPool::Lease::Lease(Lease &&other) noexcept
+    : m_pool(other.m_pool), m_data(other.m_data), m_size(other.m_size) {
+  other.m_pool = nullptr;
+  other.m_data = nullptr;
+  other.m_size = 0;
+}
+
+MemoryPool::Lease &MemoryPool::Lease::operator=(Lease &&other) noexcept {
+  if (this != &other) {
+    if (m_data) {
+      m_pool->release(m_data, m_size);
+    }
+    m_pool = other.m_pool;
+    m_data = other.m_data;
+    m_size = other.m_size;
+    other.m_pool = nullptr;
+    other.m_data = nullptr;
+    other.m_size = 0;
+  }
+  return *this;
+}
+
+MemoryPool::Lease::~Lease() {
+  if (m_data) {
+    m_pool->release(m_data, m_size);
+  }
+}
+
+MemoryPool::MemoryPool(size_t budget_bytes) : m_stats() {
+  m_stats.budget = budget_bytes;
+}
+
+MemoryPool::~MemoryPool() {
+  // Leases must not outlive the pool, only cached buffers are left
+  for (auto &buffer : m_free) {
+    ::operator delete(buffer.second, std::align_val_t(MEMORY_POOL_ALIGN));
+  }
+}
+
+MemoryPool::Lease MemoryPool::acquire(size_t bytes) {
+  Lease lease;
+  std::unique_lock<std::mutex> lock(m_mtx);
+  m_stats.acquires++;
+  if (bytes == 0 || bytes > m_stats.budget) {
+    return lease;
+  }
+  auto start = std::chrono::steady_clock::now();
+  bool waited = false;
+  while (true) {
+    auto cached = m_free.find(bytes);
+    if (cached != m_free.end()) {
+      lease.m_data = cached->second;
+      m_free.erase(cached);
+      m_stats.cached -= bytes;
+      break;
+    }
+    if (m_stats.in_use + bytes <= m_stats.budget) {
+      trim(bytes);
+      lease.m_data =
+          ::operator new(bytes, std::align_val_t(MEMORY_POOL_ALIGN));
+      m_stats.allocations++;
+      break;
+    }
+    if (bytes > m_stats.budget) {
+      // The budget was lowered while waiting
+      return lease;
+    }
+    waited = true;
+    m_released.wait(lock);
+  }
+  if (waited) {
+    m_stats.waits++;
+    m_stats.wait_seconds += std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start)
+                                .count();
+  }
+  m_stats.in_use += bytes;
+  lease.m_pool = this;
+  lease.m_size = bytes;
+  return lease;
+}
+
+void MemoryPool::release(void *data, size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stats.in_use -= size;
+    if (m_stats.in_use + m_stats.cached + size <= m_stats.budget) {
+      m_free.emplace(size, data);
+      m_stats.cached += size;
+      data = nullptr;
+    }
+  }
+  if (data) {
+    ::operator delete(data, std::align_val_t(MEMORY_POOL_ALIGN));
+  }
+  m_released.notify_all();
+}
+
+void MemoryPool::trim(size_t need) {
+  // Largest first, they make room fastest
+  while (!m_free.empty() &&
+         m_stats.in_use + m_stats.cached + need > m_stats.budget) {
+    auto largest = std::prev(m_free.end());
+    ::operator delete(largest->second, std::align_val_t(MEMORY_POOL_ALIGN));
+    m_stats.cached -= largest->first;
+    m_free.erase(largest);
+  }
+}
+
+void MemoryPool::setBudget(size_t budget_bytes) {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stats.budget = budget_bytes;
+    trim(0);
+  }
+  m_released.notify_all();
+}
+
+MemoryPool::Stats MemoryPool::stats() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_stats;
+}
+
+MemoryPool &MemoryPool::shared() {
+  static MemoryPool pool(size_t(MEMORY_POOL_MB) * 1024 * 1024);
+  return pool;
+}
@@ -0,0 +1,436 @@
+#include "memory_store.h"
+#include "hash_password.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using LogLevel = Logger::LogLevel;
+
+static const size_t npos = static_cast<size_t>(-1);
+// checksum(4) op(1) secid_len(2) salt_len(2) password_len(2)
+static const size_t AOF_HEADER_SIZE = 11;
+
+static uint32_t checksum(const char *data, size_t len) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= static_cast<uint8_t>(data[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void putU16(string &out, size_t v) {
+  out.push_back(static_cast<char>(v & 0xff));
+  out.push_back(static_cast<char>((v >> 8) & 0xff));
+}
+
+static size_t getU16(const char *in) {
+  return static_cast<uint8_t>(in[0]) | (static_cast<uint8_t>(in[1]) << 8);
+}
+
+/*
+ * Constructor replays aofFile when given, an empty path gives an ephemeral
+ * store.
+ */
+MemoryStore::MemoryStore(const string &aofFile, bool sync)
+    : m_log(nullptr), m_hashes(MEMORY_STORE_INIT_SLOTS, 0),
+      m_records(MEMORY_STORE_INIT_SLOTS), m_size(0),
+      m_mask(MEMORY_STORE_INIT_SLOTS - 1), m_aof_fd(-1), m_aof_size(0),
+      m_aof_broken(false), m_sync(sync) {
+  if (aofFile.empty()) {
+    return;
+  }
+  replay(aofFile);
+  m_aof_fd = open(aofFile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if (m_aof_fd < 0) {
+    throw std::runtime_error("MemoryStore::MemoryStore Can't open " + aofFile);
+  }
+  m_aof_size = lseek(m_aof_fd, 0, SEEK_END);
+}
+
+MemoryStore::~MemoryStore() {
+  if (m_aof_fd >= 0) {
+    close(m_aof_fd);
+  }
+}
+
+void MemoryStore::setLogger(Logger *log) {
+  if (log) {
+    m_log = log;
+    m_log->entry(LogLevel::INFO,
+                 "MemoryStore::setLogger Logger added to MemoryStore object.");
+    if (!m_replay_note.empty()) {
+      m_log->entry(LogLevel::WARNING, m_replay_note);
+    }
+  }
+}
+
+uint64_t MemoryStore::hashOf(const string &secid) {
+  uint64_t h = std::hash<string>{}(secid);
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h ? h : 1;
+}
+
+size_t MemoryStore::find(const string &secid, uint64_t hash) const {
+  for (size_t i = hash & m_mask;; i = (i + 1) & m_mask) {
+    if (m_hashes[i] == 0) {
+      return npos;
+    }
+    if (m_hashes[i] == hash && m_records[i].secid == secid) {
+      return i;
+    }
+  }
+}
+
+void MemoryStore::insert(uint64_t hash, Record &&record) {
+  // Keep the load factor under 70%
+  if ((m_size + 1) * 10 > m_hashes.size() * 7) {
+    grow();
+  }
+  size_t i = hash & m_mask;
+  while (m_hashes[i] != 0) {
+    i = (i + 1) & m_mask;
+  }
+  m_hashes[i] = hash;
+  m_records[i] = std::move(record);
+  m_size++;
+}
+
+// Backward-shift deletion: pull later entries of the probe run into the hole
+// unless their home slot lies between the hole and their current slot.
+void MemoryStore::erase(size_t slot) {
+  size_t i = slot;
+  size_t j = slot;
+  for (;;) {
+    j = (j + 1) & m_mask;
+    if (m_hashes[j] == 0) {
+      break;
+    }
+    size_t home = m_hashes[j] & m_mask;
+    bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+    if (!stays) {
+      m_hashes[i] = m_hashes[j];
+      m_records[i] = std::move(m_records[j]);
+      i = j;
+    }
+  }
+  m_hashes[i] = 0;
+  m_records[i] = Record();
+  m_size--;
+}
+
+void MemoryStore::grow() {
+  std::vector<uint64_t> hashes(m_hashes.size() * 2, 0);
+  std::vector<Record> records(m_records.size() * 2);
+  m_hashes.swap(hashes);
+  m_records.swap(records);
+  m_mask = m_hashes.size() - 1;
+  m_size = 0;
+  for (size_t i = 0; i < hashes.size(); i++) {
+    if (hashes[i] != 0) {
+      insert(hashes[i], std::move(records[i]));
+    }
+  }
+}
+
+void MemoryStore::apply(AofOp op, Record &&record) {
+  uint64_t hash = hashOf(record.secid);
+  size_t slot = find(record.secid, hash);
+  switch (op) {
+  case AOF_ADD:
+  case AOF_UPDATE:
+    if (slot == npos) {
+      insert(hash, std::move(record));
+    } else {
+      m_records[slot] = std::move(record);
+    }
+    break;
+  case AOF_DELETE:
+    if (slot != npos) {
+      erase(slot);
+    }
+    break;
+  }
+}
+
+string MemoryStore::encode(AofOp op, const Record &record) {
+  string out(4, '\0');
+  out.push_back(static_cast<char>(op));
+  putU16(out, record.secid.size());
+  putU16(out, record.salt.size());
+  putU16(out, record.password.size());
+  out.append(record.secid);
+  out.append(record.salt);
+  out.append(record.password);
+  uint32_t sum = checksum(out.data() + 4, out.size() - 4);
+  for (int i = 0; i < 4; i++) {
+    out[i] = static_cast<char>((sum >> (8 * i)) & 0xff);
+  }
+  return out;
+}
+
+int MemoryStore::append(AofOp op, const Record &record) {
+  // Field lengths are stored in 16 bits
+  if (record.secid.size() > 0xffff || record.salt.size() > 0xffff ||
+      record.password.size() > 0xffff) {
+    return SQLITE_TOOBIG;
+  }
+  if (m_aof_fd < 0) {
+    return SQLITE_OK;
+  }
+  if (m_aof_broken) {
+    return SQLITE_READONLY;
+  }
+  string data = encode(op, record);
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t n = write(m_aof_fd, data.data() + written, data.size() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return discardAppend("MemoryStore::append write failed.");
+    }
+    written += n;
+  }
+  if (m_sync && fdatasync(m_aof_fd) != 0) {
+    return discardAppend("MemoryStore::append fdatasync failed.");
+  }
+  m_aof_size += data.size();
+  return SQLITE_OK;
+}
+
+/*
+ * Cuts the file back to the last complete record, so a failed record can
+ * neither come back on replay nor hide the records written after it. If
+ * that fails too the store stops writing.
+ */
+int MemoryStore::discardAppend(const char *what) {
+  m_log->entry(LogLevel::ERROR, what);
+  if (ftruncate(m_aof_fd, m_aof_size) != 0 ||
+      (m_sync && fdatasync(m_aof_fd) != 0)) {
+    m_aof_broken = true;
+    m_log->entry(LogLevel::ERROR,
+                 "MemoryStore::append Can't cut off the failed record, the "
+                 "store is read-only.");
+  }
+  return SQLITE_IOERR;
+}
+
+void MemoryStore::replay(const string &aofFile) {
+  FILE *file = fopen(aofFile.c_str(), "rb");
+  if (!file) {
+    return; // new store
+  }
+  string data;
+  char chunk[1 << 16];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.append(chunk, n);
+  }
+  fclose(file);
+
+  size_t offset = 0;
+  while (offset + AOF_HEADER_SIZE <= data.size()) {
+    const char *rec = data.data() + offset;
+    size_t secid_len = getU16(rec + 5);
+    size_t salt_len = getU16(rec + 7);
+    size_t password_len = getU16(rec + 9);
+    size_t len = AOF_HEADER_SIZE + secid_len + salt_len + password_len;
+    if (offset + len > data.size()) {
+      break;
+    }
+    uint32_t sum = static_cast<uint8_t>(rec[0]) |
+                   (static_cast<uint8_t>(rec[1]) << 8) |
+                   (static_cast<uint8_t>(rec[2]) << 16) |
+                   (static_cast<uint32_t>(static_cast<uint8_t>(rec[3])) << 24);
+    if (sum != checksum(rec + 4, len - 4)) {
+      break;
+    }
+    const char *body = rec + AOF_HEADER_SIZE;
+    Record record{string(body, secid_len),
+                  string(body + secid_len, salt_len),
+                  string(body + secid_len + salt_len, password_len)};
+    // Files written before hashes were stored as bytes hold hex digests
+    HashPassword::fromHexDigest(record.password, record.password);
+    apply(static_cast<AofOp>(rec[4]), std::move(record));
+    offset += len;
+  }
+
+  if (offset < data.size()) {
+    // Torn or corrupt tail from a crash, drop it so new records follow
+    // the last good one.
+    if (truncate(aofFile.c_str(), offset) != 0) {
+      throw std::runtime_error("MemoryStore::replay Can't truncate " +
+                               aofFile);
+    }
+    m_replay_note = "MemoryStore::replay discarded " +
+                    std::to_string(data.size() - offset) +
+                    " bytes of incomplete records from " + aofFile;
+  }
+}
+
+int MemoryStore::getUserSalt(const string &secid, string &salt) {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid));
+  if (slot == npos) {
+    return SQLITE_DONE;
+  }
+  salt = m_records[slot].salt;
+  return SQLITE_OK;
+}
+
+int MemoryStore::getUserPassword(const string &secid, string &password) {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid));
+  if (slot == npos) {
+    return SQLITE_DONE;
+  }
+  password = m_records[slot].password;
+  return SQLITE_OK;
+}
+
+int MemoryStore::checkPassword(const string &secid, const string &password) {
+  std::shared_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid));
+  if (slot == npos || m_records[slot].password != password) {
+    return SQLITE_NOTFOUND;
+  }
+  return SQLITE_OK;
+}
+
+int MemoryStore::addUser(const string &secid, const string &password,
+                         const string &salt) {
+  uint64_t hash = hashOf(secid);
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  if (find(secid, hash) != npos) {
+    m_log->entry(LogLevel::INFO,
+                 "MemoryStore::addUser secid already exists: " + secid);
+    return SQLITE_CONSTRAINT;
+  }
+  Record record{secid, salt, password};
+  int rc = append(AOF_ADD, record);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  insert(hash, std::move(record));
+  return SQLITE_OK;
+}
+
+int MemoryStore::deleteUser(const string &secid, const string &password) {
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid));
+  if (slot == npos || m_records[slot].password != password) {
+    m_log->entry(LogLevel::INFO,
+                 "MemoryStore::deleteUser no user with secid and password: " +
+                     secid);
+    return SQLITE_DONE;
+  }
+  int rc = append(AOF_DELETE, Record{secid, "", ""});
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  erase(slot);
+  return SQLITE_OK;
+}
+
+int MemoryStore::updatePassword(const string &secid, const string &password,
+                                const string &salt) {
+  std::unique_lock<std::shared_mutex> lock(m_mtx);
+  size_t slot = find(secid, hashOf(secid));
+  if (slot == npos) {
+    m_log->entry(LogLevel::INFO,
+                 "MemoryStore::updatePassword no user with secid: " + secid);
+    return SQLITE_ABORT;
+  }
+  Record record{secid, salt, password};
+  int rc = append(AOF_UPDATE, record);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  m_records[slot] = std::move(record);
+  return SQLITE_OK;
+}
+
+// Makes a rename into the directory of path durable
+static void syncDirectory(const string &path) {
+  size_t slash = path.find_last_of('/');
+  string dir = slash == string::npos ? "." : path.substr(0, slash + 1);
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+/*
+ * Writes every current user as one add record into destFile. The records
+ * are encoded in memory under the shared lock, so writers only wait for
+ * that, and written without it. The file is written next to the
+ * destination and renamed into place, so destFile is always a complete
+ * snapshot. It can be used to compact the append-only file or as the file
+ * of a new MemoryStore.
+ */
+int MemoryStore::backup(const char *destFile, BackupStats *stats) {
+  auto start = std::chrono::steady_clock::now();
+  string buffer;
+  {
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    for (size_t i = 0; i < m_hashes.size(); i++) {
+      if (m_hashes[i] != 0) {
+        buffer.append(encode(AOF_ADD, m_records[i]));
+      }
+    }
+  }
+
+  string tmp = string(destFile) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    m_log->entry(LogLevel::ERROR,
+                 "MemoryStore::backup Can't open destination: " + tmp);
+    return SQLITE_CANTOPEN;
+  }
+  size_t bytes = buffer.size();
+  size_t written = 0;
+  bool failed = false;
+  while (written < bytes && !failed) {
+    size_t chunk = std::min<size_t>(bytes - written, 1 << 16);
+    ssize_t n = write(fd, buffer.data() + written, chunk);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    failed = n <= 0;
+    written += failed ? 0 : n;
+  }
+  failed = fsync(fd) != 0 || failed;
+  failed = close(fd) != 0 || failed;
+  failed = failed || rename(tmp.c_str(), destFile) != 0;
+  if (failed) {
+    unlink(tmp.c_str());
+    m_log->entry(LogLevel::ERROR,
+                 "MemoryStore::backup write/sync/rename failed.");
+    return SQLITE_IOERR;
+  }
+  syncDirectory(destFile);
+
+  if (stats) {
+    stats->page_size = 4096;
+    stats->pages = static_cast<int>((bytes + 4095) / 4096);
+    stats->seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    stats->pages_per_sec =
+        stats->seconds > 0 ? stats->pages / stats->seconds : 0;
+  }
+  return SQLITE_OK;
+}
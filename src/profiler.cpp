@@ -0,0 +1,184 @@
+#include "profiler.h"
+#include <algorithm>
+
+double Profiler::Histogram::percentile(double p) const {
+  uint64_t rank = static_cast<uint64_t>(p / 100.0 * count);
+  uint64_t seen = 0;
+  for (int i = 0; i < PROFILE_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen > rank) {
+      return static_cast<double>(2ULL << i);
+    }
+  }
+  return max_ns / 1000.0;
+}
+
+Profiler::Profiler(sqlite3 *db) : m_db(db) {
+  // Counters start from zero for this profiler
+  sample();
+  m_status = DbStatus();
+  sqlite3_trace_v2(m_db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, onTrace,
+                   this);
+}
+
+Profiler::~Profiler() { sqlite3_trace_v2(m_db, 0, nullptr, nullptr); }
+
+void Profiler::name(sqlite3_stmt *stmt, const std::string &name) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  Histogram &h = m_statements[name];
+  h.name = name;
+  m_named[stmt] = &h;
+}
+
+int Profiler::onTrace(unsigned type, void *self, void *stmt, void *arg) {
+  Profiler *profiler = static_cast<Profiler *>(self);
+  if (type == SQLITE_TRACE_STMT) {
+    profiler->start(static_cast<sqlite3_stmt *>(stmt),
+                    static_cast<const char *>(arg));
+  } else if (type == SQLITE_TRACE_PROFILE) {
+    profiler->record(static_cast<sqlite3_stmt *>(stmt),
+                     *static_cast<sqlite3_int64 *>(arg));
+  }
+  return 0;
+}
+
+void Profiler::start(sqlite3_stmt *stmt, const char *sql) {
+  // Triggers report "-- TRIGGER name" on the statement already running
+  if (sql && sql[0] == '-' && sql[1] == '-') {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_started[stmt] = now;
+}
+
+void Profiler::record(sqlite3_stmt *stmt, uint64_t sqlite_ns) {
+  auto now = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(m_mtx);
+  uint64_t ns = sqlite_ns;
+  auto started = m_started.find(stmt);
+  if (started != m_started.end()) {
+    ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+             now - started->second)
+             .count();
+    m_started.erase(started);
+  }
+  auto named = m_named.find(stmt);
+  Histogram *found;
+  if (named != m_named.end()) {
+    found = named->second;
+  } else {
+    const char *sql = sqlite3_sql(stmt);
+    found = &m_statements[sql ? sql : "?"];
+    if (found->name.empty()) {
+      found->name = sql ? sql : "?";
+    }
+  }
+  Histogram &h = *found;
+  uint64_t us = ns / 1000;
+  int bucket = 0;
+  while (us > 1 && bucket < PROFILE_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  h.buckets[bucket]++;
+  h.count++;
+  h.total_ns += ns;
+  h.max_ns = std::max(h.max_ns, ns);
+
+  if (now - m_last_sample >= std::chrono::milliseconds(PROFILE_SAMPLE_MS)) {
+    m_last_sample = now;
+    lock.unlock();
+    sample();
+  }
+}
+
+/*
+ * Counters are read with the reset flag and added up here, so they are
+ * totals since the profiler started. Caller must not hold m_mtx: the trace
+ * callback takes it with the connection's mutex held, and sqlite3_db_status
+ * takes that mutex, so reading under m_mtx would lock in the other order.
+ */
+void Profiler::sample() {
+  int current, highwater;
+  auto counter = [&](int op, bool use_highwater) -> uint64_t {
+    current = highwater = 0;
+    sqlite3_db_status(m_db, op, &current, &highwater, 1);
+    return static_cast<uint64_t>(use_highwater ? highwater : current);
+  };
+  DbStatus read;
+  read.cache_hits = counter(SQLITE_DBSTATUS_CACHE_HIT, false);
+  read.cache_misses = counter(SQLITE_DBSTATUS_CACHE_MISS, false);
+  read.cache_writes = counter(SQLITE_DBSTATUS_CACHE_WRITE, false);
+  read.cache_spills = counter(SQLITE_DBSTATUS_CACHE_SPILL, false);
+  read.lookaside_hits = counter(SQLITE_DBSTATUS_LOOKASIDE_HIT, true);
+  read.lookaside_misses = counter(SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, true) +
+                          counter(SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, true);
+  sqlite3_db_status(m_db, SQLITE_DBSTATUS_CACHE_USED, &current, &highwater, 0);
+  read.cache_bytes = current;
+  sqlite3_db_status(m_db, SQLITE_DBSTATUS_LOOKASIDE_USED, &current, &highwater,
+                    0);
+  read.lookaside_slots_used = current;
+
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_status.cache_hits += read.cache_hits;
+  m_status.cache_misses += read.cache_misses;
+  m_status.cache_writes += read.cache_writes;
+  m_status.cache_spills += read.cache_spills;
+  m_status.lookaside_hits += read.lookaside_hits;
+  m_status.lookaside_misses += read.lookaside_misses;
+  m_status.cache_bytes = read.cache_bytes;
+  m_status.lookaside_slots_used = read.lookaside_slots_used;
+  m_status.samples++;
+  m_last_sample = std::chrono::steady_clock::now();
+}
+
+Profiler::Snapshot Profiler::snapshot() {
+  sample();
+  std::lock_guard<std::mutex> lock(m_mtx);
+  Snapshot snapshot;
+  for (auto &entry : m_statements) {
+    if (entry.second.count > 0) {
+      snapshot.statements.push_back(entry.second);
+    }
+  }
+  std::sort(snapshot.statements.begin(), snapshot.statements.end(),
+            [](const Histogram &a, const Histogram &b) {
+              return a.total_ns > b.total_ns;
+            });
+  snapshot.status = m_status;
+  return snapshot;
+}
+
+void Profiler::merge(Snapshot &into, const Snapshot &from) {
+  for (const Histogram &h : from.statements) {
+    auto it = std::find_if(
+        into.statements.begin(), into.statements.end(),
+        [&h](const Histogram &other) { return other.name == h.name; });
+    if (it == into.statements.end()) {
+      into.statements.push_back(h);
+      continue;
+    }
+    it->count += h.count;
+    it->total_ns += h.total_ns;
+    it->max_ns = std::max(it->max_ns, h.max_ns);
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+      it->buckets[i] += h.buckets[i];
+    }
+  }
+  std::sort(into.statements.begin(), into.statements.end(),
+            [](const Histogram &a, const Histogram &b) {
+              return a.total_ns > b.total_ns;
+            });
+  DbStatus &s = into.status;
+  const DbStatus &f = from.status;
+  s.cache_hits += f.cache_hits;
+  s.cache_misses += f.cache_misses;
+  s.cache_writes += f.cache_writes;
+  s.cache_spills += f.cache_spills;
+  s.cache_bytes += f.cache_bytes;
+  s.lookaside_slots_used += f.lookaside_slots_used;
+  s.lookaside_hits += f.lookaside_hits;
+  s.lookaside_misses += f.lookaside_misses;
+  s.samples += f.samples;
+}
@@ -0,0 +1,95 @@
+#include "read_batcher.h"
+#include <algorithm>
+#include <chrono>
+#include <sqlite3.h>
+
+ReadBatcher::ReadBatcher(Fetch fetch, int max_wait_us)
+    : m_fetch(std::move(fetch)),
+      m_max_wait_us(static_cast<uint64_t>(std::max(max_wait_us, 0))),
+      m_leading(false), m_wait_us(0), m_stats() {}
+
+int ReadBatcher::lookup(const std::string &secid, Entry &entry) {
+  Pending pending = {&secid, &entry, SQLITE_OK, false};
+  std::unique_lock<std::mutex> lock(m_mtx);
+  m_queue.push_back(&pending);
+  m_stats.lookups++;
+  if (m_leading) {
+    m_arrival.notify_one();
+  }
+  while (!pending.done) {
+    if (!m_leading) {
+      lead(lock);
+    } else {
+      m_cv.wait(lock);
+    }
+  }
+  return pending.rc;
+}
+
+/*
+ * Runs one batch with the lock held on entry and exit; it is released for
+ * the fetch. The batch is the oldest READ_BATCH_MAX waiting lookups, which
+ * need not include the leader's own, it then waits for the next leader.
+ */
+void ReadBatcher::lead(std::unique_lock<std::mutex> &lock) {
+  using clock = std::chrono::steady_clock;
+  m_leading = true;
+  auto deadline = clock::now() + std::chrono::microseconds(m_wait_us);
+  while (m_wait_us > 0 && m_queue.size() < READ_BATCH_MAX) {
+    size_t waiting = m_queue.size();
+    auto idle = clock::now() + std::chrono::microseconds(READ_BATCH_IDLE_US);
+    m_arrival.wait_until(lock, std::min(deadline, idle),
+                         [&] { return m_queue.size() != waiting; });
+    if (m_queue.size() == waiting) {
+      break;
+    }
+  }
+  size_t n = std::min<size_t>(m_queue.size(), READ_BATCH_MAX);
+  std::vector<Pending *> batch(m_queue.begin(), m_queue.begin() + n);
+  m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+
+  // Several callers at once means more would have come, wait longer
+  if (n > 1) {
+    m_wait_us = std::min(m_max_wait_us,
+                         std::max<uint64_t>(READ_BATCH_MIN_WAIT_US,
+                                            m_wait_us * 2));
+  } else {
+    m_wait_us = m_wait_us / 2 < READ_BATCH_MIN_WAIT_US ? 0 : m_wait_us / 2;
+  }
+  m_stats.batches++;
+  m_stats.max_batch = std::max<uint64_t>(m_stats.max_batch, n);
+  lock.unlock();
+
+  std::vector<std::string> secids;
+  secids.reserve(n);
+  for (Pending *pending : batch) {
+    secids.push_back(*pending->secid);
+  }
+  std::sort(secids.begin(), secids.end());
+  secids.erase(std::unique(secids.begin(), secids.end()), secids.end());
+  std::unordered_map<std::string, Entry> found;
+  int rc = m_fetch(secids, found);
+
+  lock.lock();
+  for (Pending *pending : batch) {
+    auto row = found.find(*pending->secid);
+    if (rc != SQLITE_OK) {
+      pending->rc = rc;
+    } else if (row == found.end()) {
+      pending->rc = SQLITE_DONE;
+    } else {
+      *pending->entry = row->second;
+      pending->rc = SQLITE_OK;
+    }
+    pending->done = true;
+  }
+  m_leading = false;
+  m_cv.notify_all();
+}
+
+ReadBatcher::Stats ReadBatcher::stats() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  Stats stats = m_stats;
+  stats.wait_us = m_wait_us;
+  return stats;
+}
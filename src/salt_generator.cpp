@@ -0,0 +1,144 @@
+#include "salt_generator.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+namespace {
+
+inline uint32_t rotl32(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+inline void quarterRound(uint32_t &a, uint32_t &b, uint32_t &c, uint32_t &d) {
+  a += b;
+  d = rotl32(d ^ a, 16);
+  c += d;
+  b = rotl32(b ^ c, 12);
+  a += b;
+  d = rotl32(d ^ a, 8);
+  c += d;
+  b = rotl32(b ^ c, 7);
+}
+
+// Seed bytes from the kernel, false if it has none to give
+bool kernelRandom(void *out, size_t n) {
+  uint8_t *bytes = static_cast<uint8_t *>(out);
+  while (n > 0) {
+#ifdef __linux__
+    ssize_t got = getrandom(bytes, n, 0);
+#else
+    // getentropy takes at most 256 bytes at a time
+    size_t want = n < 256 ? n : 256;
+    ssize_t got = getentropy(bytes, want) == 0 ? want : -1;
+#endif
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += got;
+    n -= got;
+  }
+  return true;
+}
+
+// Bumped in the child of every fork, threads compare it with their own
+std::atomic<uint64_t> fork_generation{0};
+void onForkChild() {
+  fork_generation.fetch_add(1, std::memory_order_relaxed);
+}
+const int atfork_registered = pthread_atfork(nullptr, nullptr, onForkChild);
+
+struct Keystream {
+  uint32_t key[8];
+  uint8_t buffer[SALT_BUFFER_BLOCKS * 64];
+  size_t used = sizeof(buffer); // empty until seeded
+  size_t since_seed = 0;
+  uint64_t generation = 0;
+  bool seeded = false;
+
+  ~Keystream() {
+    volatile uint8_t *wipe = reinterpret_cast<volatile uint8_t *>(this);
+    for (size_t i = 0; i < sizeof(*this); i++) {
+      wipe[i] = 0;
+    }
+  }
+
+  bool reseed() {
+    seeded = kernelRandom(key, sizeof(key));
+    since_seed = 0;
+    used = sizeof(buffer);
+    generation = fork_generation.load(std::memory_order_relaxed);
+    return seeded;
+  }
+
+  // Fast key erasure: the first 32 bytes of a refill are the next key
+  void refill() {
+    const uint32_t nonce[3] = {0, 0, 0};
+    for (uint32_t block = 0; block < SALT_BUFFER_BLOCKS; block++) {
+      SaltGenerator::chacha20Block(key, block, nonce, buffer + 64 * block);
+    }
+    std::memcpy(key, buffer, sizeof(key));
+    std::memset(buffer, 0, sizeof(key));
+    used = sizeof(key);
+  }
+};
+
+thread_local Keystream keystream;
+
+} // namespace
+
+void SaltGenerator::chacha20Block(const uint32_t key[8], uint32_t counter,
+                                  const uint32_t nonce[3], uint8_t out[64]) {
+  const uint32_t input[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+                              key[0],     key[1],     key[2],     key[3],
+                              key[4],     key[5],     key[6],     key[7],
+                              counter,    nonce[0],   nonce[1],   nonce[2]};
+  uint32_t x[16];
+  std::memcpy(x, input, sizeof(x));
+  for (int round = 0; round < 10; round++) {
+    quarterRound(x[0], x[4], x[8], x[12]);
+    quarterRound(x[1], x[5], x[9], x[13]);
+    quarterRound(x[2], x[6], x[10], x[14]);
+    quarterRound(x[3], x[7], x[11], x[15]);
+    quarterRound(x[0], x[5], x[10], x[15]);
+    quarterRound(x[1], x[6], x[11], x[12]);
+    quarterRound(x[2], x[7], x[8], x[13]);
+    quarterRound(x[3], x[4], x[9], x[14]);
+  }
+  for (int i = 0; i < 16; i++) {
+    uint32_t word = x[i] + input[i];
+    out[4 * i] = static_cast<uint8_t>(word);
+    out[4 * i + 1] = static_cast<uint8_t>(word >> 8);
+    out[4 * i + 2] = static_cast<uint8_t>(word >> 16);
+    out[4 * i + 3] = static_cast<uint8_t>(word >> 24);
+  }
+}
+
+bool SaltGenerator::fill(void *out, size_t n) {
+  (void)atfork_registered;
+  Keystream &ks = keystream;
+  if (!ks.seeded || ks.since_seed >= SALT_RESEED_BYTES ||
+      ks.generation != fork_generation.load(std::memory_order_relaxed)) {
+    if (!ks.reseed()) {
+      return false;
+    }
+  }
+  uint8_t *bytes = static_cast<uint8_t *>(out);
+  while (n > 0) {
+    if (ks.used == sizeof(ks.buffer)) {
+      ks.refill();
+    }
+    size_t take = std::min(n, sizeof(ks.buffer) - ks.used);
+    std::memcpy(bytes, ks.buffer + ks.used, take);
+    std::memset(ks.buffer + ks.used, 0, take);
+    ks.used += take;
+    ks.since_seed += take;
+    bytes += take;
+    n -= take;
+  }
+  return true;
+}
@@ -0,0 +1,528 @@
+#include "sharded_store.h"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using LogLevel = Logger::LogLevel;
+
+ShardedStore::ShardedStore(const string &dbFile, int shards,
+                           int persist_interval_ms)
+    : m_log(nullptr) {
+  if (shards < 1) {
+    throw std::runtime_error("ShardedStore::ShardedStore Invalid shard count");
+  }
+  for (int i = 0; i < shards; i++) {
+    Shard shard;
+    shard.db.reset(new Database(shardPath(dbFile, i, shards).c_str(),
+                                persist_interval_ms));
+    shard.writer.reset(new Executor());
+    m_shards.push_back(std::move(shard));
+  }
+}
+
+// Writers are stopped first, they may still hold queued work for the db
+ShardedStore::~ShardedStore() {
+  for (auto &shard : m_shards) {
+    shard.writer.reset();
+  }
+}
+
+void ShardedStore::setLogger(Logger *log) {
+  if (log) {
+    m_log = log;
+    for (auto &shard : m_shards) {
+      shard.db->setLogger(log);
+    }
+    m_log->entry(LogLevel::INFO, "ShardedStore::setLogger " +
+                                     std::to_string(m_shards.size()) +
+                                     " shards opened.");
+  }
+}
+
+string ShardedStore::shardPath(const string &dbFile, int shard, int shards) {
+  if (shards == 1) {
+    return dbFile;
+  }
+  size_t slash = dbFile.find_last_of('/');
+  size_t dot = dbFile.find_last_of('.');
+  string stem = dbFile;
+  string ext;
+  if (dot != string::npos && (slash == string::npos || dot > slash)) {
+    stem = dbFile.substr(0, dot);
+    ext = dbFile.substr(dot);
+  }
+  return stem + "." + std::to_string(shard) + "-of-" +
+         std::to_string(shards) + ext;
+}
+
+// FNV-1a, stable across builds and platforms unlike std::hash
+int ShardedStore::shardOf(const string &secid, int shards) {
+  uint64_t h = 14695981039346656037ULL;
+  for (unsigned char c : secid) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return static_cast<int>(h % static_cast<uint64_t>(shards));
+}
+
+ShardedStore::Shard &ShardedStore::shardFor(const string &secid) {
+  return m_shards[shardOf(secid, m_shards.size())];
+}
+
+int ShardedStore::getUserPassword(const string &secid, string &password) {
+  return shardFor(secid).db->getUserPassword(secid, password);
+}
+
+int ShardedStore::getUserSalt(const string &secid, string &salt) {
+  return shardFor(secid).db->getUserSalt(secid, salt);
+}
+
+int ShardedStore::checkPassword(const string &secid, const string &password) {
+  return shardFor(secid).db->checkPassword(secid, password);
+}
+
+int ShardedStore::addUser(const string &secid, const string &password,
+                          const string &salt) {
+  Shard &shard = shardFor(secid);
+  return shard.writer
+      ->submit([&] { return shard.db->addUser(secid, password, salt); })
+      .get();
+}
+
+int ShardedStore::deleteUser(const string &secid, const string &password) {
+  Shard &shard = shardFor(secid);
+  return shard.writer
+      ->submit([&] { return shard.db->deleteUser(secid, password); })
+      .get();
+}
+
+int ShardedStore::updatePassword(const string &secid, const string &password,
+                                 const string &salt) {
+  Shard &shard = shardFor(secid);
+  return shard.writer
+      ->submit([&] { return shard.db->updatePassword(secid, password, salt); })
+      .get();
+}
+
+int ShardedStore::getCredentials(const std::vector<string> &secids,
+                                 std::vector<CredentialCache::Entry> &entries,
+                                 std::vector<int> &rcs) {
+  entries.assign(secids.size(), CredentialCache::Entry());
+  rcs.assign(secids.size(), SQLITE_OK);
+  std::vector<std::vector<size_t>> items(m_shards.size());
+  for (size_t i = 0; i < secids.size(); i++) {
+    items[shardOf(secids[i], m_shards.size())].push_back(i);
+  }
+  int first = SQLITE_OK;
+  for (size_t shard = 0; shard < m_shards.size(); shard++) {
+    if (items[shard].empty()) {
+      continue;
+    }
+    std::vector<string> shard_secids;
+    for (size_t i : items[shard]) {
+      shard_secids.push_back(secids[i]);
+    }
+    std::vector<CredentialCache::Entry> shard_entries;
+    std::vector<int> shard_rcs;
+    int rc = m_shards[shard].db->getCredentials(shard_secids, shard_entries,
+                                                shard_rcs);
+    first = first == SQLITE_OK ? rc : first;
+    for (size_t j = 0; j < items[shard].size(); j++) {
+      entries[items[shard][j]] = std::move(shard_entries[j]);
+      rcs[items[shard][j]] = shard_rcs[j];
+    }
+  }
+  return first;
+}
+
+int ShardedStore::addUsers(const std::vector<NewUser> &users,
+                           std::vector<int> &rcs) {
+  rcs.assign(users.size(), SQLITE_OK);
+  std::vector<std::vector<size_t>> items(m_shards.size());
+  for (size_t i = 0; i < users.size(); i++) {
+    items[shardOf(users[i].secid, m_shards.size())].push_back(i);
+  }
+  std::vector<std::vector<int>> shard_rcs(m_shards.size());
+  std::vector<std::future<int>> commits(m_shards.size());
+  for (size_t shard = 0; shard < m_shards.size(); shard++) {
+    if (items[shard].empty()) {
+      continue;
+    }
+    commits[shard] = m_shards[shard].writer->submit([&, shard] {
+      std::vector<NewUser> shard_users;
+      for (size_t i : items[shard]) {
+        shard_users.push_back(users[i]);
+      }
+      return m_shards[shard].db->addUsers(shard_users, shard_rcs[shard]);
+    });
+  }
+  int first = SQLITE_OK;
+  for (size_t shard = 0; shard < m_shards.size(); shard++) {
+    if (items[shard].empty()) {
+      continue;
+    }
+    int rc = commits[shard].get();
+    first = first == SQLITE_OK ? rc : first;
+    for (size_t j = 0; j < items[shard].size(); j++) {
+      rcs[items[shard][j]] = shard_rcs[shard][j];
+    }
+  }
+  return first;
+}
+
+int ShardedStore::backup(const char *destFile, BackupStats *stats) {
+  BackupStats total = {};
+  int shards = m_shards.size();
+  for (int i = 0; i < shards; i++) {
+    BackupStats shard_stats = {};
+    int rc = m_shards[i].db->backup(shardPath(destFile, i, shards).c_str(),
+                                    &shard_stats);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+    total.pages += shard_stats.pages;
+    total.page_size = shard_stats.page_size;
+    total.seconds += shard_stats.seconds;
+  }
+  total.pages_per_sec = total.seconds > 0 ? total.pages / total.seconds : 0;
+  if (stats) {
+    *stats = total;
+  }
+  return SQLITE_OK;
+}
+
+void ShardedStore::setBackupRate(int pages_per_step, int max_pages_per_sec) {
+  for (auto &shard : m_shards) {
+    shard.db->setBackupRate(pages_per_step, max_pages_per_sec);
+  }
+}
+
+void ShardedStore::enableCache(size_t capacity_bytes) {
+  for (auto &shard : m_shards) {
+    shard.db->enableCache(capacity_bytes / m_shards.size());
+  }
+}
+
+bool ShardedStore::cacheStats(CredentialCache::Stats &stats) {
+  CredentialCache::Stats total = {};
+  for (auto &shard : m_shards) {
+    CredentialCache::Stats shard_stats;
+    if (!shard.db->cacheStats(shard_stats)) {
+      return false;
+    }
+    total.hits += shard_stats.hits;
+    total.misses += shard_stats.misses;
+    total.admitted += shard_stats.admitted;
+    total.rejected += shard_stats.rejected;
+    total.evictions += shard_stats.evictions;
+    total.invalidations += shard_stats.invalidations;
+    total.entries += shard_stats.entries;
+    total.bytes += shard_stats.bytes;
+    total.capacity += shard_stats.capacity;
+  }
+  stats = total;
+  return true;
+}
+
+int ShardedStore::enableFilter(bool enable) {
+  for (auto &shard : m_shards) {
+    int rc = shard.db->enableFilter(enable);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+  }
+  return SQLITE_OK;
+}
+
+// One feed for all shards, it numbers the events of every shard in order
+int ShardedStore::setChangeFeed(std::shared_ptr<ChangeFeed> feed) {
+  for (auto &shard : m_shards) {
+    int rc = shard.writer
+                 ->submit([&] { return shard.db->setChangeFeed(feed); })
+                 .get();
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+  }
+  return SQLITE_OK;
+}
+
+// Each shard batches the lookups of its own users
+int ShardedStore::enableReadBatching(bool enable, int max_wait_us) {
+  for (auto &shard : m_shards) {
+    int rc = shard.db->enableReadBatching(enable, max_wait_us);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+  }
+  return SQLITE_OK;
+}
+
+bool ShardedStore::readBatchStats(ReadBatcher::Stats &stats) {
+  ReadBatcher::Stats total = {};
+  for (auto &shard : m_shards) {
+    ReadBatcher::Stats shard_stats;
+    if (!shard.db->readBatchStats(shard_stats)) {
+      return false;
+    }
+    total.lookups += shard_stats.lookups;
+    total.batches += shard_stats.batches;
+    total.max_batch = std::max(total.max_batch, shard_stats.max_batch);
+    total.wait_us = std::max(total.wait_us, shard_stats.wait_us);
+  }
+  stats = total;
+  return true;
+}
+
+// Pages and time add up, the age is that of the oldest shard snapshot
+bool ShardedStore::persistStats(PersistStats &stats) {
+  PersistStats total = {};
+  for (auto &shard : m_shards) {
+    PersistStats shard_stats;
+    if (!shard.db->persistStats(shard_stats)) {
+      return false;
+    }
+    total.snapshots += shard_stats.snapshots;
+    total.failures += shard_stats.failures;
+    total.pages += shard_stats.pages;
+    total.last_seconds += shard_stats.last_seconds;
+    total.copy_seconds += shard_stats.copy_seconds;
+    total.age_seconds = std::max(total.age_seconds, shard_stats.age_seconds);
+  }
+  stats = total;
+  return true;
+}
+
+int ShardedStore::enableProfiling(bool enable) {
+  for (auto &shard : m_shards) {
+    int rc = shard.db->enableProfiling(enable);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+  }
+  return SQLITE_OK;
+}
+
+// Statements of the same name are added up over the shards
+bool ShardedStore::profile(Profiler::Snapshot &snapshot) {
+  Profiler::Snapshot total;
+  for (auto &shard : m_shards) {
+    Profiler::Snapshot shard_snapshot;
+    if (!shard.db->profile(shard_snapshot)) {
+      return false;
+    }
+    Profiler::merge(total, shard_snapshot);
+  }
+  snapshot = total;
+  return true;
+}
+
+void ShardedStore::setBusyDeadline(int deadline_ms) {
+  for (auto &shard : m_shards) {
+    shard.db->setBusyDeadline(deadline_ms);
+  }
+}
+
+bool ShardedStore::busyStats(BusyStats &stats) {
+  BusyStats total = {};
+  for (auto &shard : m_shards) {
+    BusyStats shard_stats;
+    shard.db->busyStats(shard_stats);
+    total.contended += shard_stats.contended;
+    total.retries += shard_stats.retries;
+    total.gave_up += shard_stats.gave_up;
+    total.wait_seconds += shard_stats.wait_seconds;
+    total.max_wait_seconds =
+        std::max(total.max_wait_seconds, shard_stats.max_wait_seconds);
+  }
+  stats = total;
+  return true;
+}
+
+bool ShardedStore::filterStats(CuckooFilter::Stats &stats) {
+  CuckooFilter::Stats total = {};
+  for (auto &shard : m_shards) {
+    CuckooFilter::Stats shard_stats;
+    if (!shard.db->filterStats(shard_stats)) {
+      return false;
+    }
+    total.items += shard_stats.items;
+    total.capacity += shard_stats.capacity;
+    total.bytes += shard_stats.bytes;
+    total.lookups += shard_stats.lookups;
+    total.rejected += shard_stats.rejected;
+  }
+  stats = total;
+  return true;
+}
+
+/*
+ * Offline reshard. Reads every user from the source layout and writes it
+ * into the destination shard chosen by its secid, committing every
+ * RESHARD_BATCH users per destination. Salts and hashes are written as
+ * BLOBs, hex hashes of an unmigrated source are decoded on the way. The
+ * destination files must not exist yet. Each shard is written to a .tmp
+ * file beside it, renamed only once every shard is complete, so a failed
+ * run leaves nothing behind and can simply be run again. Run it
+ * while no LoginManager has the source open.
+ */
+int ShardedStore::reshard(const string &srcFile, int srcShards,
+                          const string &dstFile, int dstShards, Logger *log) {
+  if (srcShards < 1 || dstShards < 1) {
+    return SQLITE_MISUSE;
+  }
+  struct Out {
+    string path;
+    string tmp;
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *add_login = nullptr;
+    sqlite3_stmt *add_password = nullptr;
+    int pending = 0;
+  };
+  std::vector<Out> out(dstShards);
+  auto closeAll = [&out](bool commit) {
+    int rc = SQLITE_OK;
+    for (auto &o : out) {
+      sqlite3_finalize(o.add_login);
+      sqlite3_finalize(o.add_password);
+      if (o.db && sqlite3_get_autocommit(o.db) == 0) {
+        int end_rc =
+            sqlite3_exec(o.db, commit ? "COMMIT;" : "ROLLBACK;", 0, 0, 0);
+        rc = rc == SQLITE_OK ? end_rc : rc;
+      }
+      sqlite3_close(o.db);
+      o.db = nullptr;
+    }
+    return rc;
+  };
+  auto removeAll = [&out] {
+    for (auto &o : out) {
+      unlink(o.tmp.c_str());
+    }
+  };
+
+  int rc = SQLITE_OK;
+  for (int i = 0; i < dstShards && rc == SQLITE_OK; i++) {
+    string path = shardPath(dstFile, i, dstShards);
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+      log->entry(LogLevel::ERROR,
+                 "ShardedStore::reshard destination exists: " + path);
+      rc = SQLITE_CANTOPEN;
+      break;
+    }
+    out[i].path = path;
+    out[i].tmp = path + ".tmp";
+    unlink(out[i].tmp.c_str()); // left by an interrupted run
+    rc = sqlite3_open(out[i].tmp.c_str(), &out[i].db);
+    if (rc == SQLITE_OK) {
+      rc = Database::createSchema(out[i].db);
+    }
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_prepare_v2(
+          out[i].db, "INSERT INTO login (secid, salt) VALUES (?1, ?2);", -1,
+          &out[i].add_login, nullptr);
+    }
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_prepare_v2(
+          out[i].db,
+          "INSERT INTO password (login_id, password) VALUES (?1, ?2);", -1,
+          &out[i].add_password, nullptr);
+    }
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_exec(out[i].db, "BEGIN IMMEDIATE TRANSACTION;", 0, 0, 0);
+    }
+    if (rc != SQLITE_OK) {
+      log->entry(LogLevel::ERROR, "ShardedStore::reshard Can't prepare " +
+                                      path + ": " +
+                                      sqlite3_errmsg(out[i].db));
+    }
+  }
+  if (rc != SQLITE_OK) {
+    closeAll(false);
+    removeAll();
+    return rc;
+  }
+
+  size_t users = 0;
+  for (int i = 0; i < srcShards && rc == SQLITE_OK; i++) {
+    string path = shardPath(srcFile, i, srcShards);
+    sqlite3 *src = nullptr;
+    sqlite3_stmt *scan = nullptr;
+    rc = sqlite3_open_v2(path.c_str(), &src, SQLITE_OPEN_READONLY, nullptr);
+    if (rc == SQLITE_OK) {
+      rc = Database::addSqlFunctions(src);
+    }
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_prepare_v2(src,
+                              "SELECT l.secid, CAST(l.salt AS BLOB), "
+                              "hash_from_hex(p.password) FROM login l "
+                              "INNER JOIN password p ON l.id = p.login_id;",
+                              -1, &scan, nullptr);
+    }
+    if (rc != SQLITE_OK) {
+      log->entry(LogLevel::ERROR, "ShardedStore::reshard Can't read " + path +
+                                      ": " + sqlite3_errmsg(src));
+    }
+    while (rc == SQLITE_OK && (rc = sqlite3_step(scan)) == SQLITE_ROW) {
+      const char *secid =
+          reinterpret_cast<const char *>(sqlite3_column_text(scan, 0));
+      Out &o = out[shardOf(string(secid, sqlite3_column_bytes(scan, 0)),
+                           dstShards)];
+      sqlite3_bind_value(o.add_login, 1, sqlite3_column_value(scan, 0));
+      sqlite3_bind_value(o.add_login, 2, sqlite3_column_value(scan, 1));
+      rc = sqlite3_step(o.add_login);
+      sqlite3_reset(o.add_login);
+      if (rc == SQLITE_DONE) {
+        sqlite3_bind_int64(o.add_password, 1, sqlite3_last_insert_rowid(o.db));
+        sqlite3_bind_value(o.add_password, 2, sqlite3_column_value(scan, 2));
+        rc = sqlite3_step(o.add_password);
+        sqlite3_reset(o.add_password);
+      }
+      if (rc == SQLITE_DONE && ++o.pending >= RESHARD_BATCH) {
+        o.pending = 0;
+        rc = sqlite3_exec(o.db, "COMMIT; BEGIN IMMEDIATE TRANSACTION;", 0, 0,
+                          0);
+        rc = rc == SQLITE_OK ? SQLITE_DONE : rc;
+      }
+      if (rc != SQLITE_DONE) {
+        log->entry(LogLevel::ERROR, "ShardedStore::reshard Can't write user " +
+                                        string(secid) + ": " +
+                                        sqlite3_errmsg(o.db));
+        break;
+      }
+      users++;
+      rc = SQLITE_OK;
+    }
+    if (rc == SQLITE_DONE) {
+      rc = SQLITE_OK;
+    }
+    sqlite3_finalize(scan);
+    sqlite3_close(src);
+  }
+
+  int close_rc = closeAll(rc == SQLITE_OK);
+  rc = rc == SQLITE_OK ? close_rc : rc;
+  for (size_t i = 0; i < out.size() && rc == SQLITE_OK; i++) {
+    if (rename(out[i].tmp.c_str(), out[i].path.c_str()) != 0) {
+      log->entry(LogLevel::ERROR,
+                 "ShardedStore::reshard Can't rename " + out[i].tmp);
+      rc = SQLITE_IOERR;
+      // Shards already in place would make the layout incomplete
+      for (size_t j = 0; j < i; j++) {
+        unlink(out[j].path.c_str());
+      }
+    }
+  }
+  if (rc != SQLITE_OK) {
+    removeAll();
+    return rc;
+  }
+  log->entry(LogLevel::INFO, "ShardedStore::reshard moved " +
+                                 std::to_string(users) + " users from " +
+                                 std::to_string(srcShards) + " to " +
+                                 std::to_string(dstShards) + " shards.");
+  return SQLITE_OK;
+}
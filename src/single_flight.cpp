@@ -0,0 +1,46 @@
+#include "single_flight.h"
+
+int SingleFlight::run(const std::string &key,
+                      const std::function<int()> &call) {
+  Shard &shard =
+      m_shards[std::hash<std::string>()(key) % SINGLE_FLIGHT_SHARDS];
+  std::unique_lock<std::mutex> lock(shard.mtx);
+  shard.stats.calls++;
+  auto flight = shard.flights.find(key);
+  if (flight != shard.flights.end()) {
+    shard.stats.shared++;
+    std::shared_future<int> shared = flight->second;
+    lock.unlock();
+    return shared.get();
+  }
+  std::promise<int> result;
+  shard.flights.emplace(key, result.get_future().share());
+  lock.unlock();
+
+  int rc;
+  try {
+    rc = call();
+  } catch (...) {
+    lock.lock();
+    shard.flights.erase(key);
+    lock.unlock();
+    result.set_exception(std::current_exception());
+    throw;
+  }
+  lock.lock();
+  shard.flights.erase(key);
+  lock.unlock();
+  // Waiters hold their own copy of the future
+  result.set_value(rc);
+  return rc;
+}
+
+SingleFlight::Stats SingleFlight::stats() {
+  Stats total = {};
+  for (Shard &shard : m_shards) {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    total.calls += shard.stats.calls;
+    total.shared += shard.stats.shared;
+  }
+  return total;
+}
@@ -34,7 +34,7 @@
  * 2 : Login with username, TODO
  * 3 : Add user(e-mail {string utf8}, password {string utf8})
  * 4 : Delete user with e-mail(e-mail {string utf8}, password {string utf8})
- * 5 : Delete user with username, TODO
+ * 5 : Change password(e-mail {string utf8}, new password {string utf8})
  * Return codes.
  * bit 1: represents api communication {0 = OK | 1 = not OK}
  * bit 2-7 represents reason.
@@ -221,13 +221,38 @@ int udpServer::process_msg(Operation &op) {
 }
 
 // this function is operated async and must handle memory allocated
-void udpServer::handle_client(Operation *op, const int sockfd) {
+void udpServer::handle_client(Operation *op, const int sockfd, Status *st) {
   int rc = process_msg(*op);
   // std::cerr << "Debug - RC Value: " << rc << std::endl;
   // std::cerr << "Debug - RC Hex Value: 0x" << std::hex << rc << std::dec
   //          << std::endl;
   sendto(sockfd, (const char *)&rc, sizeof(int), 0, op->cliaddr, op->addr_len);
   delete op;
+  delTransaction(*st);
+}
+
+int udpServer::addTransaction(Status &st) {
+  std::lock_guard<std::mutex> lock(st.mtx);
+  return ++st.current_transactions;
+}
+
+// Notifies under the lock, the listener may free st once it sees 0
+int udpServer::delTransaction(Status &st) {
+  std::lock_guard<std::mutex> lock(st.mtx);
+  if (--st.current_transactions == 0) {
+    st.idle.notify_all();
+  }
+  return st.current_transactions;
+}
+
+int udpServer::getTransactions(Status &st) {
+  std::lock_guard<std::mutex> lock(st.mtx);
+  return st.current_transactions;
+}
+
+int udpServer::getControl(Status &st) {
+  std::lock_guard<std::mutex> lock(st.mtx);
+  return st.control;
 }
 
 // Listens to incoming datagrams. Starts a new thread to handle requests.
@@ -236,7 +261,7 @@ void udpServer::listen(int sockfd, sockaddr_in servaddr, Status *st,
   socklen_t len;
   int n;
   // Stop-bit @ [_ _ _ ?  _ _ _ _]
-  while (st->control & 0x10) {
+  while (getControl(*st) & 0x10) {
     char *buffer = new char[MAXLINE];
     struct sockaddr_in *client_address = new struct sockaddr_in;
     len = sizeof(*client_address);
@@ -263,18 +288,22 @@ void udpServer::listen(int sockfd, sockaddr_in servaddr, Status *st,
 
     buffer[n] = '\0';
     Operation *op = new Operation(buffer, lm, client_address);
-    std::thread t(handle_client, op, sockfd);
+    addTransaction(*st);
+    std::thread t(handle_client, op, sockfd, st);
     t.detach();
 
     // Check stop-request-bit @ [_ _ _ _  _ _ _ ?]
-    st->mtx.lock();
-    if (st->control & 0x1) {
-      st->control &= ~0x10;
+    if (getControl(*st) & 0x1) {
+      break;
     }
-    st->mtx.unlock();
   }
 
+  // Handlers use the socket and the LoginManager, let them finish before
+  // the socket closes and stop() reports the server as stopped
+  std::unique_lock<std::mutex> lock(st->mtx);
+  st->idle.wait(lock, [st] { return st->current_transactions == 0; });
   close(sockfd);
+  st->control &= ~0x10;
 }
 
 // Spin up the API server. Returns a void pointer to the Status struct that is
@@ -337,7 +366,7 @@ int udpServer::stop(void *st) {
   servaddr.sin_addr.s_addr = inet_addr("127.0.0.1");
 
   int it = 0;
-  while ((status->control & 0x10) == 0x10) {
+  while ((getControl(*status) & 0x10) == 0x10) {
     if (it > 10) {
       std::cerr << "Could not stop API server within current timeframe."
                 << std::endl;
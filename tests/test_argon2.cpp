@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "argon2.h"
+#include "hash_password.h"
+#include "memory_pool.h"
+
+void testVectors() {
+  // RFC 9106 5.3, with a secret and associated data over four lanes
+  Argon2::Params params;
+  params.passes = 3;
+  params.memory_kib = 32;
+  params.lanes = 4;
+  std::string tag = Argon2::hash(std::string(32, '\x01'),
+                                 std::string(16, '\x02'), params,
+                                 MemoryPool::shared(), std::string(8, '\x03'),
+                                 std::string(12, '\x04'));
+  assert(HashPassword::toHex(tag) ==
+         "0d640df58d78766c08c037a34a8b53c9d01ef0452d75b65eb52520e96b01e659");
+
+  // The reference implementation's argon2id test vectors
+  assert(HashPassword::toHex(
+             HashPassword::argon2id("password", "somesalt", 2, 256)) ==
+         "9dfeb910e80bad0311fee20f9c0e2b12c17987b4cac90c2ef54d5b3021c68bfe");
+  assert(HashPassword::toHex(
+             HashPassword::argon2id("password", "somesalt", 2, 65536)) ==
+         "09316115d5cf24ed5a15a31a3ba326e5cf32edc24702987c02b6566f61913cf7");
+
+  // Lanes change the result, the threads filling them do not
+  std::string two = HashPassword::argon2id("password", "somesalt", 2, 256, 2);
+  assert(two.size() == SHA256_BYTES && two != HashPassword::argon2id(
+                                                  "password", "somesalt", 2,
+                                                  256));
+  assert(two == HashPassword::argon2id("password", "somesalt", 2, 256, 2));
+  assert(HashPassword::argon2id("password", "somesalt", 2, 256, 1, 64)
+             .size() == 64);
+
+  // Invalid parameters
+  assert(HashPassword::argon2id("password", "somesalt", 0, 256).empty());
+  assert(HashPassword::argon2id("password", "short", 2, 256).empty());
+  assert(HashPassword::argon2id("password", "somesalt", 2, 16, 4).empty());
+  assert(HashPassword::argon2id("password", "somesalt", 2, 256, 17).empty());
+  std::cout << "01 Argon2id test vectors test passed." << std::endl;
+}
+
+void testPoolReuse() {
+  MemoryPool pool(1 << 20);
+  void *first;
+  {
+    MemoryPool::Lease lease = pool.acquire(256 << 10);
+    assert(lease && lease.size() == 256 << 10);
+    assert(reinterpret_cast<uintptr_t>(lease.data()) % MEMORY_POOL_ALIGN ==
+           0);
+    first = lease.data();
+  }
+  for (int i = 0; i < 10; i++) {
+    MemoryPool::Lease lease = pool.acquire(256 << 10);
+    assert(lease.data() == first);
+  }
+  MemoryPool::Stats stats = pool.stats();
+  assert(stats.acquires == 11 && stats.allocations == 1);
+  assert(stats.in_use == 0 && stats.cached == 256 << 10);
+
+  // A size that does not fit next to the cached buffer evicts it
+  {
+    MemoryPool::Lease lease = pool.acquire(1 << 20);
+    assert(lease);
+    stats = pool.stats();
+    assert(stats.in_use == 1 << 20 && stats.cached == 0);
+  }
+  assert(!pool.acquire(0) && !pool.acquire((1 << 20) + 1));
+
+  // Hashes through a pool reuse its blocks
+  Argon2::Params params;
+  params.passes = 1;
+  params.memory_kib = 64;
+  std::string tag = Argon2::hash("password", "somesalt", params, pool);
+  for (int i = 0; i < 5; i++) {
+    assert(Argon2::hash("password", "somesalt", params, pool) == tag);
+  }
+  assert(pool.stats().allocations == 3);
+  // and hand them back cleared of the password-derived blocks
+  MemoryPool::Lease reused = pool.acquire(64 << 10);
+  const char *bytes = static_cast<const char *>(reused.data());
+  assert(pool.stats().allocations == 3 &&
+         std::all_of(bytes, bytes + reused.size(),
+                     [](char byte) { return byte == 0; }));
+  std::cout << "02 Memory pool reuse test passed." << std::endl;
+}
+
+void testPoolBudget() {
+  // Room for two 64 KiB hashes at a time, eight threads asking
+  const size_t bytes = 64 * ARGON2_BLOCK_SIZE;
+  MemoryPool pool(2 * bytes);
+  Argon2::Params params;
+  params.passes = 2;
+  params.memory_kib = 64;
+  const std::string expected =
+      Argon2::hash("password", "somesalt", params, pool);
+
+  std::atomic<int> running(0), most(0), wrong(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 5; i++) {
+        MemoryPool::Lease lease = pool.acquire(bytes);
+        int now = ++running;
+        int seen = most;
+        while (now > seen && !most.compare_exchange_weak(seen, now)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        running--;
+        lease = MemoryPool::Lease();
+        wrong += Argon2::hash("password", "somesalt", params, pool) !=
+                 expected;
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  assert(wrong == 0 && most <= 2);
+  MemoryPool::Stats stats = pool.stats();
+  assert(stats.in_use == 0 && stats.cached <= 2 * bytes);
+  assert(stats.allocations <= 2 && stats.waits > 0);
+
+  // Raising the budget wakes a waiter
+  MemoryPool::Lease first = pool.acquire(bytes), second = pool.acquire(bytes);
+  std::thread waiter([&] { assert(pool.acquire(bytes)); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  pool.setBudget(3 * bytes);
+  waiter.join();
+  std::cout << "03 Memory pool budget test passed." << std::endl;
+}
+
+int main() {
+  testVectors();
+  testPoolReuse();
+  testPoolBudget();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "async_store.h"
+#include "database.h"
+#include "hash_password.h"
+#include "memory_store.h"
+
+void testFutures() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_async_store.db";
+  std::remove(path.c_str());
+  std::unique_ptr<CredentialStore> db(new Database(path.c_str()));
+  db->setLogger(&log);
+  // Database keeps hashes of PASSWORD_SIZE bytes
+  const std::string hash = HashPassword::digestSHA256("hash");
+  const std::string hash2 = HashPassword::digestSHA256("hash2");
+  {
+    AsyncStore store(std::move(db));
+    // Queued in order, so the lookups see the add
+    std::future<int> added = store.async_addUser("user@mail.io", hash, "salt");
+    std::future<AsyncStore::Result> salt =
+        store.async_getUserSalt("user@mail.io");
+    std::future<int> checked =
+        store.async_checkPassword("user@mail.io", hash);
+    assert(added.get() == SQLITE_OK);
+    AsyncStore::Result result = salt.get();
+    assert(result.rc == SQLITE_OK && result.value == "salt");
+    assert(checked.get() == SQLITE_OK);
+
+    assert(store.async_updatePassword("user@mail.io", hash2, "salt2").get() ==
+           SQLITE_OK);
+    result = store.async_getUserPassword("user@mail.io").get();
+    assert(result.rc == SQLITE_OK && result.value == hash2);
+    assert(store.async_deleteUser("user@mail.io", hash2).get() == SQLITE_OK);
+    assert(store.async_getUserSalt("user@mail.io").get().rc == SQLITE_DONE);
+  }
+  std::remove(path.c_str());
+  std::cout << "01 AsyncStore futures test passed." << std::endl;
+}
+
+void testCallbacks() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  std::unique_ptr<CredentialStore> memory(new MemoryStore());
+  memory->setLogger(&log);
+  const int threads = 4, users = 250;
+  std::atomic<int> ok(0);
+  std::atomic<int> salts(0);
+  {
+    AsyncStore store(std::move(memory));
+    std::vector<std::thread> callers;
+    for (int t = 0; t < threads; t++) {
+      callers.emplace_back([&store, &ok, &salts, t] {
+        for (int i = 0; i < users; i++) {
+          std::string id = std::to_string(t) + "." + std::to_string(i);
+          store.async_addUser(id + "@mail.io", "hash", id, [&ok](int rc) {
+            ok += rc == SQLITE_OK;
+          });
+          store.async_getUserSalt(
+              id + "@mail.io", [&salts, id](const AsyncStore::Result &r) {
+                salts += r.rc == SQLITE_OK && r.value == id;
+              });
+        }
+      });
+    }
+    for (auto &caller : callers) {
+      caller.join();
+    }
+    // Destruction runs the calls still queued
+  }
+  assert(ok == threads * users);
+  assert(salts == threads * users);
+  std::cout << "02 AsyncStore callbacks test passed." << std::endl;
+}
+
+int main() {
+  testFutures();
+  testCallbacks();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
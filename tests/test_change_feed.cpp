@@ -0,0 +1,123 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include "change_feed.h"
+#include "database.h"
+#include "hash_password.h"
+#include "sharded_store.h"
+
+void testSubscribers() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_change_feed.db";
+  const std::string hash = HashPassword::digestSHA256("hash");
+  const std::string hash2 = HashPassword::digestSHA256("hash2");
+  std::remove(path.c_str());
+  std::shared_ptr<ChangeFeed> feed(new ChangeFeed());
+  std::vector<ChangeFeed::Event> events;
+  feed->subscribe([&events](const ChangeFeed::Event &e) {
+    events.push_back(e);
+  });
+  {
+    Database db(path.c_str());
+    db.setLogger(&log);
+    assert(db.setChangeFeed(feed) == SQLITE_OK);
+    assert(db.addUser("a@mail.io", hash, "salt") == SQLITE_OK);
+    assert(db.addUser("b@mail.io", hash, "salt") == SQLITE_OK);
+    // Rolled back, nothing is published
+    assert(db.addUser("a@mail.io", hash, "salt") != SQLITE_OK);
+    assert(db.addUser("c@mail.io", "short", "salt") != SQLITE_OK);
+    assert(db.updatePassword("a@mail.io", hash2, "salt2") == SQLITE_OK);
+    assert(db.deleteUser("b@mail.io", hash) == SQLITE_OK);
+    assert(db.setChangeFeed(nullptr) == SQLITE_OK);
+    assert(db.deleteUser("a@mail.io", hash2) == SQLITE_OK);
+  }
+  feed->flush();
+  assert(events.size() == 4);
+  const char *ops = "AAUD";
+  const char *secids[] = {"a@mail.io", "b@mail.io", "a@mail.io", "b@mail.io"};
+  for (size_t i = 0; i < events.size(); i++) {
+    assert(events[i].seq == i + 1);
+    assert(events[i].op == ops[i]);
+    assert(events[i].secid == secids[i]);
+  }
+  assert(feed->lastSeq() == 4);
+  std::remove(path.c_str());
+  std::cout << "01 ChangeFeed subscribers test passed." << std::endl;
+}
+
+void testSocket() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string socket_path = "test_change_feed.sock";
+  ChangeFeed feed;
+  feed.setLogger(&log);
+  assert(feed.listen(socket_path) == SQLITE_OK);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path.c_str());
+  assert(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0);
+  // Give the accept loop time to pick the client up
+  usleep(3 * CHANGE_FEED_POLL_MS * 1000);
+
+  feed.publish({{0, ChangeFeed::ADD, "a@mail.io"},
+                {0, ChangeFeed::DELETE, "a@mail.io"}});
+  const std::string expected = "1 A a@mail.io\n2 D a@mail.io\n";
+  std::string received;
+  char buffer[256];
+  while (received.size() < expected.size()) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    assert(n > 0);
+    received.append(buffer, n);
+  }
+  assert(received == expected);
+  close(fd);
+  std::cout << "02 ChangeFeed socket test passed." << std::endl;
+}
+
+void testShards() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_change_feed_sharded.db";
+  const int shards = 3, users = 30;
+  const std::string hash = HashPassword::digestSHA256("hash");
+  std::shared_ptr<ChangeFeed> feed(new ChangeFeed());
+  uint64_t last = 0;
+  int added = 0;
+  feed->subscribe([&last, &added](const ChangeFeed::Event &e) {
+    assert(e.seq == last + 1);
+    last = e.seq;
+    added += e.op == ChangeFeed::ADD;
+  });
+  {
+    ShardedStore store(path, shards);
+    store.setLogger(&log);
+    assert(store.setChangeFeed(feed) == SQLITE_OK);
+    for (int i = 0; i < users; i++) {
+      assert(store.addUser(std::to_string(i) + "@mail.io", hash, "salt") ==
+             SQLITE_OK);
+    }
+  }
+  feed->flush();
+  assert(added == users);
+  for (int i = 0; i < shards; i++) {
+    std::remove(ShardedStore::shardPath(path, i, shards).c_str());
+  }
+  std::cout << "03 ChangeFeed sharded store test passed." << std::endl;
+}
+
+int main() {
+  testSubscribers();
+  testSocket();
+  testShards();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include "credential_cache.h"
+
+void testGetPut() {
+  CredentialCache cache(1024 * 1024);
+  CredentialCache::Entry entry;
+  assert(cache.get("user@mail.io", entry) == false);
+
+  uint64_t version = cache.version("user@mail.io");
+  cache.put("user@mail.io", {"salt", "hash"}, version);
+  assert(cache.get("user@mail.io", entry) == true);
+  assert(entry.salt == "salt" && entry.password == "hash");
+
+  CredentialCache::Stats stats = cache.stats();
+  assert(stats.hits == 1 && stats.misses == 1 && stats.entries == 1);
+  std::cout << "01 Cache get/put test passed." << std::endl;
+}
+
+void testInvalidate() {
+  CredentialCache cache(1024 * 1024);
+  CredentialCache::Entry entry;
+  cache.put("user@mail.io", {"salt", "hash"}, cache.version("user@mail.io"));
+  cache.invalidate("user@mail.io");
+  assert(cache.get("user@mail.io", entry) == false);
+
+  // A read that started before the invalidation must not be cached
+  uint64_t version = cache.version("user@mail.io");
+  cache.invalidate("user@mail.io");
+  cache.put("user@mail.io", {"old salt", "old hash"}, version);
+  assert(cache.get("user@mail.io", entry) == false);
+  std::cout << "02 Cache invalidate test passed." << std::endl;
+}
+
+void testBounded() {
+  const size_t capacity = 64 * 1024;
+  CredentialCache cache(capacity, 4);
+  CredentialCache::Entry entry;
+  // Hot keys are read often, one-hit wonders should not push them out
+  for (int round = 0; round < 50; round++) {
+    for (int i = 0; i < 20; i++) {
+      std::string secid = "hot" + std::to_string(i) + "@mail.io";
+      if (!cache.get(secid, entry)) {
+        cache.put(secid, {"salt", "hash"}, cache.version(secid));
+      }
+    }
+    for (int i = 0; i < 100; i++) {
+      std::string secid =
+          "cold" + std::to_string(round * 100 + i) + "@mail.io";
+      if (!cache.get(secid, entry)) {
+        cache.put(secid, {"salt", "hash"}, cache.version(secid));
+      }
+    }
+  }
+  CredentialCache::Stats stats = cache.stats();
+  assert(stats.bytes <= capacity);
+  int hot_cached = 0;
+  for (int i = 0; i < 20; i++) {
+    hot_cached += cache.get("hot" + std::to_string(i) + "@mail.io", entry);
+  }
+  assert(hot_cached == 20);
+  assert(stats.rejected > 0);
+  std::cout << "03 Cache bounded admission test passed." << std::endl;
+}
+
+int main() {
+  testGetPut();
+  testInvalidate();
+  testBounded();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
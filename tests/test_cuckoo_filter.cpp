@@ -0,0 +1,60 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include "cuckoo_filter.h"
+
+void testMembership() {
+  const int users = 100000;
+  CuckooFilter filter(users + users / 4);
+  for (int i = 0; i < users; i++) {
+    assert(filter.insert("user" + std::to_string(i) + "@mail.io"));
+  }
+  for (int i = 0; i < users; i++) {
+    assert(filter.contains("user" + std::to_string(i) + "@mail.io"));
+  }
+  int false_positives = 0;
+  for (int i = 0; i < users; i++) {
+    false_positives += filter.contains("nobody" + std::to_string(i) + "@mail.io");
+  }
+  assert(false_positives < users / 1000);
+
+  CuckooFilter::Stats stats = filter.stats();
+  std::cout << "01 Filter membership test passed. False positives: "
+            << false_positives << " of " << users << ", "
+            << stats.bytes * (1000000.0 / users) / (1024 * 1024)
+            << " MiB per million users." << std::endl;
+}
+
+void testRemove() {
+  CuckooFilter filter(1024);
+  assert(filter.insert("user@mail.io"));
+  assert(filter.insert("other@mail.io"));
+  assert(filter.remove("user@mail.io"));
+  assert(!filter.contains("user@mail.io"));
+  assert(filter.contains("other@mail.io"));
+  assert(filter.stats().items == 1);
+  std::cout << "02 Filter remove test passed." << std::endl;
+}
+
+void testFull() {
+  CuckooFilter filter(64);
+  int inserted = 0;
+  while (filter.insert("user" + std::to_string(inserted) + "@mail.io")) {
+    inserted++;
+  }
+  // The key that did not fit is still reported, no false negatives
+  for (int i = 0; i <= inserted; i++) {
+    assert(filter.contains("user" + std::to_string(i) + "@mail.io"));
+  }
+  std::cout << "03 Filter full test passed. Inserted " << inserted
+            << " of capacity " << filter.stats().capacity << "." << std::endl;
+}
+
+int main() {
+  testMembership();
+  testRemove();
+  testFull();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
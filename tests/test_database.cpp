@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "database.h"
+#include "hash_password.h"
+
+int queryInt(sqlite3 *db, const char *sql) {
+  sqlite3_stmt *stmt = nullptr;
+  int value = -1;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK &&
+      sqlite3_step(stmt) == SQLITE_ROW) {
+    value = sqlite3_column_int(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+  return value;
+}
+
+void testBinarySchema() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_database.db";
+  const std::string hash = HashPassword::digestSHA256("hash");
+  const std::string salt("\x00\x01\xff salt", 8);
+  std::remove(path.c_str());
+  {
+    Database db(path.c_str());
+    db.setLogger(&log);
+    std::string stored;
+    assert(db.addUser("user@mail.io", hash, salt) == SQLITE_OK);
+    assert(db.getUserSalt("user@mail.io", stored) == SQLITE_OK);
+    assert(stored == salt);
+    assert(db.checkPassword("user@mail.io", hash) == SQLITE_OK);
+    // Only whole digests are stored
+    assert(db.addUser("short@mail.io", "hash", salt) == SQLITE_CONSTRAINT);
+  }
+  sqlite3 *db = nullptr;
+  assert(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+  assert(queryInt(db, "PRAGMA user_version;") == SCHEMA_VERSION);
+  assert(queryInt(db, "SELECT length(password) FROM password;") ==
+         PASSWORD_SIZE);
+  sqlite3_close(db);
+  std::remove(path.c_str());
+  std::cout << "01 Database binary schema test passed." << std::endl;
+}
+
+void testHexMigration() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_database.db";
+  std::remove(path.c_str());
+  {
+    // Schema 0: salt and hash as hex text
+    sqlite3 *db = nullptr;
+    assert(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+    std::string sql =
+        "CREATE TABLE login (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "secid TEXT NOT NULL UNIQUE, salt TEXT NOT NULL);"
+        "CREATE TABLE password (login_id INTEGER NOT NULL, "
+        "password TEXT NOT NULL);"
+        "CREATE INDEX password_login_id ON password (login_id);"
+        "INSERT INTO login (secid, salt) VALUES ('old@mail.io', '1a2b3c');"
+        "INSERT INTO password VALUES (1, '" +
+        HashPassword::usingSHA256("old" + std::string("1a2b3c")) + "');";
+    assert(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) ==
+           SQLITE_OK);
+    sqlite3_close(db);
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    // The second open finds the migrated schema and leaves it alone
+    Database db(path.c_str());
+    db.setLogger(&log);
+    std::string salt, hash;
+    assert(db.getUserSalt("old@mail.io", salt) == SQLITE_OK);
+    assert(salt == "1a2b3c");
+    assert(db.getUserPassword("old@mail.io", hash) == SQLITE_OK);
+    assert(hash == HashPassword::digestSHA256("old" + salt));
+    assert(db.checkPassword("old@mail.io", hash) == SQLITE_OK);
+    assert(db.addUser("new@mail.io", hash, salt) == SQLITE_OK);
+    assert(db.deleteUser("new@mail.io", hash) == SQLITE_OK);
+  }
+  sqlite3 *db = nullptr;
+  assert(sqlite3_open(path.c_str(), &db) == SQLITE_OK);
+  assert(queryInt(db, "PRAGMA user_version;") == SCHEMA_VERSION);
+  assert(queryInt(db, "SELECT count(*) FROM password "
+                      "WHERE typeof(password) = 'blob';") == 1);
+  assert(queryInt(db, "SELECT count(*) FROM sqlite_master "
+                      "WHERE name = 'password_login_id';") == 1);
+  sqlite3_close(db);
+  std::remove(path.c_str());
+  std::cout << "02 Database hex migration test passed." << std::endl;
+}
+
+void testBusyRetry() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_database.db";
+  const std::string hash = HashPassword::digestSHA256("hash");
+  std::remove(path.c_str());
+  Database db(path.c_str());
+  db.setLogger(&log);
+  sqlite3 *other = nullptr;
+  assert(sqlite3_open(path.c_str(), &other) == SQLITE_OK);
+
+  // Another connection holds the write lock for a while
+  assert(sqlite3_exec(other, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) ==
+         SQLITE_OK);
+  std::thread holder([other] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    sqlite3_exec(other, "COMMIT;", nullptr, nullptr, nullptr);
+  });
+  assert(db.addUser("a@mail.io", hash, "salt") == SQLITE_OK);
+  holder.join();
+  BusyStats stats;
+  assert(db.busyStats(stats));
+  assert(stats.contended == 1 && stats.retries > 0 && stats.gave_up == 0);
+  assert(stats.max_wait_seconds >= 0.05);
+
+  // Without a deadline the lock is reported at once
+  db.setBusyDeadline(0);
+  assert(sqlite3_exec(other, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) ==
+         SQLITE_OK);
+  assert(db.addUser("b@mail.io", hash, "salt") == SQLITE_BUSY);
+  sqlite3_exec(other, "COMMIT;", nullptr, nullptr, nullptr);
+  assert(db.busyStats(stats) && stats.gave_up == 1);
+  assert(db.addUser("b@mail.io", hash, "salt") == SQLITE_OK);
+
+  sqlite3_close(other);
+  std::remove(path.c_str());
+  std::cout << "03 Database busy retry test passed." << std::endl;
+}
+
+// Opens path as a plain file, the way a restart would see it
+int fileUsers(const std::string &path) {
+  sqlite3 *db = nullptr;
+  assert(sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) ==
+         SQLITE_OK);
+  int logins = queryInt(db, "SELECT count(*) FROM login;");
+  int passwords = queryInt(db, "SELECT count(*) FROM password;");
+  sqlite3_stmt *stmt = nullptr;
+  sqlite3_prepare_v2(db, "PRAGMA integrity_check;", -1, &stmt, nullptr);
+  assert(sqlite3_step(stmt) == SQLITE_ROW);
+  std::string integrity =
+      reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  // Every snapshot holds whole transactions
+  assert(integrity == "ok" && logins == passwords);
+  return logins;
+}
+
+void testMemoryFirst() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_database.db";
+  const std::string hash = HashPassword::digestSHA256("hash");
+  std::remove(path.c_str());
+  {
+    Database db(path.c_str(), 50);
+    db.setLogger(&log);
+    // The new file is written at once
+    assert(fileUsers(path) == 0);
+    assert(db.addUser("a@mail.io", hash, "salt") == SQLITE_OK);
+    assert(db.persist() == SQLITE_OK);
+    assert(fileUsers(path) == 1);
+
+    // Snapshots taken while another thread writes
+    std::thread writer([&db, &hash] {
+      for (int i = 0; i < 200; i++) {
+        db.addUser(std::to_string(i) + "@mail.io", hash, "salt");
+      }
+    });
+    for (int i = 0; i < 10; i++) {
+      assert(db.persist() == SQLITE_OK);
+      fileUsers(path);
+    }
+    writer.join();
+
+    // The background thread catches up
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    assert(fileUsers(path) == 201);
+    PersistStats stats;
+    assert(db.persistStats(stats));
+    assert(stats.snapshots >= 12 && stats.failures == 0 && stats.pages > 0);
+    assert(db.deleteUser("a@mail.io", hash) == SQLITE_OK);
+    // Not yet written, the destructor does
+  }
+  assert(fileUsers(path) == 200);
+  {
+    // Loaded from the file
+    Database db(path.c_str(), 1000);
+    db.setLogger(&log);
+    assert(db.checkPassword("7@mail.io", hash) == SQLITE_OK);
+    assert(db.checkPassword("a@mail.io", hash) == SQLITE_NOTFOUND);
+    PersistStats stats;
+    assert(db.persistStats(stats) && stats.snapshots == 0);
+  }
+  {
+    Database db(path.c_str());
+    PersistStats stats;
+    assert(!db.persistStats(stats));
+    assert(db.persist() == SQLITE_MISUSE);
+  }
+  std::remove(path.c_str());
+  std::cout << "04 Database memory-first test passed." << std::endl;
+}
+
+/*
+ * Writes keep flowing while a snapshot goes to disk: they only wait for
+ * the copy in memory, a part of the snapshot. Prints the longest write.
+ */
+void testSnapshotLatency() {
+  using clock = std::chrono::steady_clock;
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_database.db";
+  const std::string hash = HashPassword::digestSHA256("hash");
+  std::remove(path.c_str());
+  {
+    Database db(path.c_str(), 60000);
+    db.setLogger(&log);
+    std::vector<NewUser> users;
+    for (int i = 0; i < 20000; i++) {
+      users.push_back({"bulk" + std::to_string(i) + "@mail.io", hash, "salt"});
+    }
+    std::vector<int> rcs;
+    assert(db.addUsers(users, rcs) == SQLITE_OK);
+
+    std::atomic<bool> done(false);
+    double snapshot_seconds = 0;
+    std::thread snapshots([&] {
+      for (int i = 0; i < 3; i++) {
+        assert(db.persist() == SQLITE_OK);
+        PersistStats stats;
+        assert(db.persistStats(stats));
+        assert(stats.copy_seconds < stats.last_seconds);
+        snapshot_seconds = std::max(snapshot_seconds, stats.last_seconds);
+      }
+      done = true;
+    });
+    double max_write = 0;
+    int writes = 0;
+    while (!done) {
+      std::string user = std::to_string(writes++) + "@mail.io";
+      auto start = clock::now();
+      assert(db.addUser(user, hash, "salt") == SQLITE_OK);
+      max_write = std::max(
+          max_write,
+          std::chrono::duration<double>(clock::now() - start).count());
+    }
+    snapshots.join();
+    assert(max_write < snapshot_seconds);
+    assert(fileUsers(path) >= 20000);
+    std::cout << "05 Database snapshot write latency test passed. " << writes
+              << " writes, longest " << max_write * 1000
+              << " ms, longest snapshot " << snapshot_seconds * 1000 << " ms"
+              << std::endl;
+  }
+  std::remove(path.c_str());
+}
+
+int main() {
+  testBinarySchema();
+  testHexMigration();
+  testBusyRetry();
+  testMemoryFirst();
+  testSnapshotLatency();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
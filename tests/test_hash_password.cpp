@@ -1,8 +1,27 @@
+#include <cstdlib>
 #include <iostream>
+#include <new>
 #include <string>
+#include <vector>
 #include "hash_password.h"
 using std::string;
 
+// Counts heap allocations, to check the streaming hasher makes none
+static size_t allocations = 0;
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  allocations++;
+  return std::malloc(size ? size : 1);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
 void testHashPassword() {
   const string empty_hash = HashPassword::usingSHA256("");
   const string empty_hash_target = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
@@ -15,8 +34,249 @@ void testHashPassword() {
   }
 }
 
+void testDigest() {
+  const string digest = HashPassword::digestSHA256("");
+  string decoded;
+  if (digest.size() == SHA256_BYTES &&
+      HashPassword::toHex(digest) == HashPassword::usingSHA256("") &&
+      HashPassword::fromHexDigest(HashPassword::usingSHA256(""), decoded) &&
+      decoded == digest && !HashPassword::fromHexDigest("e3b0", decoded)) {
+      std::cout << "02 Digest bytes test passed." << std::endl;
+  } else {
+      std::cout << "02 Digest bytes test failed." << std::endl;
+  }
+}
+
+// FIPS 180-2 examples and the NIST one million 'a' message
+void testNISTVectors() {
+  const struct {
+    string message;
+    string digest;
+  } vectors[] = {
+    {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc",
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+     "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+     "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+    {string(1000000, 'a'),
+     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+  };
+  const HashPassword::Impl impls[] = {HashPassword::Impl::SCALAR,
+                                      HashPassword::Impl::SHA_NI,
+                                      HashPassword::Impl::ARMV8};
+  const HashPassword::Impl active = HashPassword::implementation();
+  bool passed = HashPassword::supported(active);
+  for (HashPassword::Impl impl : impls) {
+    if (!HashPassword::useImplementation(impl)) {
+      passed = passed && !HashPassword::supported(impl);
+      continue;
+    }
+    std::cout << "03 Checking " << HashPassword::name(impl) << std::endl;
+    for (const auto &vector : vectors) {
+      passed = passed &&
+               HashPassword::usingSHA256(vector.message) == vector.digest;
+    }
+  }
+  HashPassword::useImplementation(active);
+  if (passed) {
+      std::cout << "03 NIST vectors test passed." << std::endl;
+  } else {
+      std::cout << "03 NIST vectors test failed." << std::endl;
+  }
+}
+
+// Every length across the padding edges, each implementation against scalar
+void testImplementationsAgree() {
+  const HashPassword::Impl active = HashPassword::implementation();
+  bool passed = true;
+  string message;
+  for (int length = 0; length < 300; length++) {
+    HashPassword::useImplementation(HashPassword::Impl::SCALAR);
+    const string expected = HashPassword::digestSHA256(message);
+    for (HashPassword::Impl impl : {HashPassword::Impl::SHA_NI,
+                                    HashPassword::Impl::ARMV8}) {
+      if (HashPassword::useImplementation(impl)) {
+        passed = passed && HashPassword::digestSHA256(message) == expected;
+      }
+    }
+    message += static_cast<char>(length * 7 + 1);
+  }
+  HashPassword::useImplementation(active);
+  passed = passed && HashPassword::implementation() == active;
+  if (passed) {
+      std::cout << "04 Implementations agree test passed." << std::endl;
+  } else {
+      std::cout << "04 Implementations agree test failed." << std::endl;
+  }
+}
+
+// Batches mixing lengths, including partly filled lane groups
+void testBatch() {
+  std::vector<string> messages;
+  for (int i = 0; i < 203; i++) {
+    // Mostly password sized, some long enough for several blocks
+    size_t length = i % 10 == 0 ? i * 3 : i % 70;
+    messages.push_back(string(length, static_cast<char>('a' + i % 26)));
+  }
+  const HashPassword::Impl active = HashPassword::batchImplementation();
+  bool passed = HashPassword::supported(active);
+  for (HashPassword::Impl impl : {HashPassword::Impl::SCALAR,
+                                  HashPassword::Impl::AVX2,
+                                  HashPassword::Impl::AVX512}) {
+    if (!HashPassword::useBatchImplementation(impl)) {
+      continue;
+    }
+    std::cout << "05 Checking " << HashPassword::name(impl) << std::endl;
+    for (size_t n : {size_t(0), size_t(1), size_t(9), messages.size()}) {
+      std::vector<std::string_view> views(messages.begin(),
+                                          messages.begin() + n);
+      std::vector<string> digests = HashPassword::digestSHA256Batch(views);
+      passed = passed && digests.size() == n;
+      for (size_t i = 0; i < digests.size(); i++) {
+        passed = passed &&
+                 digests[i] == HashPassword::digestSHA256(messages[i]);
+      }
+    }
+  }
+  std::vector<std::string_view> abc = {"abc"};
+  passed = passed && HashPassword::usingSHA256Batch(abc)[0] ==
+      "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+  HashPassword::useBatchImplementation(active);
+  if (passed) {
+      std::cout << "05 Batch digest test passed." << std::endl;
+  } else {
+      std::cout << "05 Batch digest test failed." << std::endl;
+  }
+}
+
+// Any split of a message into pieces gives the digest of the whole
+void testStreaming() {
+  string message;
+  for (int i = 0; i < 300; i++) {
+    message += static_cast<char>(i * 13 + 5);
+  }
+  bool passed = true;
+  for (size_t length : {size_t(0), size_t(55), size_t(56), size_t(64),
+                        size_t(119), size_t(300)}) {
+    const string whole = HashPassword::digestSHA256(
+        std::string_view(message).substr(0, length));
+    for (size_t first = 0; first <= length; first += 7) {
+      for (size_t second = first; second <= length; second += 31) {
+        std::string_view view(message);
+        HashPassword::Digest digest;
+        HashPassword::Hasher()
+            .update(view.substr(0, first))
+            .update(view.substr(first, second - first))
+            .update(view.substr(second, length - second))
+            .final(digest);
+        passed = passed && string(digest.begin(), digest.end()) == whole;
+      }
+    }
+  }
+
+  // Salt and password fed as pieces, reusing one hasher
+  const string salt = "42", password = "secret", d_salt(16, '\x7f');
+  const string expected = HashPassword::digestSHA256(salt + password + d_salt);
+  HashPassword::Hasher hasher;
+  HashPassword::Digest digest;
+  char hex[SHA256_BYTES * 2];
+  size_t before = allocations;
+  for (int i = 0; i < 100; i++) {
+    hasher.init();
+    hasher.update(salt).update(password).update(d_salt).final(digest);
+    HashPassword::toHex(digest.data(), digest.size(), hex);
+  }
+  size_t made = allocations - before;
+  passed = passed && string(digest.begin(), digest.end()) == expected &&
+           string(hex, sizeof(hex)) == HashPassword::toHex(expected);
+  if (passed && made == 0) {
+      std::cout << "06 Streaming hasher test passed." << std::endl;
+  } else {
+      std::cout << "06 Streaming hasher test failed, " << made
+                << " allocations." << std::endl;
+  }
+}
+
+// RFC 4231 test cases 1, 2 and 6 (key longer than a block)
+void testHMAC() {
+  const struct {
+    string key;
+    string message;
+    string mac;
+  } cases[] = {
+    {string(20, '\x0b'), "Hi There",
+     "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+    {"Jefe", "what do ya want for nothing?",
+     "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+    {string(131, '\xaa'),
+     "Test Using Larger Than Block-Size Key - Hash Key First",
+     "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+  };
+  bool passed = true;
+  for (const auto &c : cases) {
+    HashPassword::Digest mac;
+    HashPassword::hmacSHA256(c.key, c.message, mac);
+    passed = passed && HashPassword::toHex(string(mac.begin(), mac.end())) ==
+                           c.mac;
+  }
+  if (passed) {
+      std::cout << "07 HMAC-SHA256 test passed." << std::endl;
+  } else {
+      std::cout << "07 HMAC-SHA256 test failed." << std::endl;
+  }
+}
+
+// Published PBKDF2-HMAC-SHA256 vectors, RFC 7914 section 11 among them
+void testPBKDF2() {
+  const struct {
+    string password;
+    string salt;
+    uint32_t iterations;
+    size_t length;
+    string key;
+  } cases[] = {
+    {"password", "salt", 1, 32,
+     "120fb6cffcf8b32c43e7225256c4f837a86548c92ccc35480805987cb70be17b"},
+    {"password", "salt", 2, 32,
+     "ae4d0c95af6b46d32d0adff928f06dd02a303f8ef3c251dfd6e2d85a95474c43"},
+    {"password", "salt", 4096, 32,
+     "c5e478d59288c841aa530db6845c4c8d962893a001ce4e11a4963873aa98134a"},
+    {"passwd", "salt", 1, 64,
+     "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+     "49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"},
+    {"Password", "NaCl", 80000, 64,
+     "4ddcd8f60b98be21830cee5ef22701f9641a4418d04c0414aeff08876b34ab56"
+     "a1d425a1225833549adb841b51c9b3176a272bdebba1d078478f62b397f33c8d"},
+  };
+  bool passed = true;
+  for (const auto &c : cases) {
+    string key = HashPassword::pbkdf2SHA256(c.password, c.salt, c.iterations,
+                                            c.length);
+    passed = passed && HashPassword::toHex(key) == c.key;
+  }
+  // A length that is not a whole number of blocks is a prefix
+  passed = passed && HashPassword::pbkdf2SHA256("passwd", "salt", 1, 40) ==
+                         HashPassword::pbkdf2SHA256("passwd", "salt", 1, 64)
+                             .substr(0, 40);
+  if (passed) {
+      std::cout << "08 PBKDF2-HMAC-SHA256 test passed." << std::endl;
+  } else {
+      std::cout << "08 PBKDF2-HMAC-SHA256 test failed." << std::endl;
+  }
+}
+
 int main() {
     testHashPassword();
+    testDigest();
+    testNISTVectors();
+    testImplementationsAgree();
+    testBatch();
+    testStreaming();
+    testHMAC();
+    testPBKDF2();
     return 0;
 }
 
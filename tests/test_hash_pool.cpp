@@ -0,0 +1,99 @@
+#include <atomic>
+#include <cassert>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hash_password.h"
+#include "hash_pool.h"
+
+void testResults() {
+  HashPool pool(2);
+  HashScheme pbkdf2;
+  pbkdf2.algorithm = HashScheme::PBKDF2_SHA256;
+  pbkdf2.cost = 1000;
+  const HashScheme schemes[] = {HashScheme(), pbkdf2,
+                                HashScheme::argon2id(1, 1, 2)};
+  std::vector<std::future<std::string>> results;
+  std::vector<std::string> expected;
+  for (int i = 0; i < 30; i++) {
+    const HashScheme &scheme = schemes[i % 3];
+    std::string password = "password" + std::to_string(i);
+    std::string salt = "salt-of-16-bytes";
+    results.push_back(pool.submit(scheme, "42", password, salt));
+    std::string hashed;
+    scheme.hash("42", password, salt, hashed);
+    expected.push_back(hashed);
+  }
+  for (size_t i = 0; i < results.size(); i++) {
+    assert(results[i].get() == expected[i]);
+  }
+  assert(pool.threads() == 2 && pool.stats().jobs == 30);
+  std::cout << "01 HashPool results test passed." << std::endl;
+}
+
+void testBatching() {
+  // An idle pool hashes a job alone
+  HashPool pool(1);
+  for (int i = 0; i < 10; i++) {
+    assert(pool.submit(HashScheme(), "42", "pw", "salt").get() ==
+           HashPassword::digestSHA256("42pwsalt"));
+  }
+  assert(pool.stats().batches == 0);
+
+  // Jobs queued behind a slow one are hashed together
+  const size_t width = HashPool::batchWidth();
+  std::future<std::string> slow =
+      pool.submit(HashScheme::argon2id(2, 8, 1), "42", "pw", "saltsalt");
+  std::vector<std::future<std::string>> queued;
+  for (int i = 0; i < 40; i++) {
+    queued.push_back(
+        pool.submit(HashScheme(), "42", std::to_string(i), "salt"));
+  }
+  assert(!slow.get().empty());
+  for (int i = 0; i < 40; i++) {
+    assert(queued[i].get() ==
+           HashPassword::digestSHA256("42" + std::to_string(i) + "salt"));
+  }
+  HashPool::Stats stats = pool.stats();
+  assert(stats.jobs == 51 && stats.max_batch <= width);
+  if (width > 1) {
+    assert(stats.batches > 0 && stats.max_batch == width);
+    assert(stats.batched <= 40);
+  }
+  std::cout << "02 HashPool batching test passed. Batch width " << width
+            << ", mean batch " << stats.meanBatch() << "." << std::endl;
+}
+
+void testConcurrentClients() {
+  std::atomic<int> wrong(0);
+  {
+    HashPool pool(2, {0});
+    std::vector<std::thread> clients;
+    for (int t = 0; t < 8; t++) {
+      clients.emplace_back([&, t] {
+        for (int i = 0; i < 200; i++) {
+          std::string pw = std::to_string(t) + ":" + std::to_string(i);
+          wrong += pool.submit(HashScheme(), "42", pw, "salt").get() !=
+                   HashPassword::digestSHA256("42" + pw + "salt");
+        }
+      });
+    }
+    for (auto &c : clients) {
+      c.join();
+    }
+    assert(pool.stats().jobs == 1600);
+  }
+  assert(wrong == 0);
+  std::cout << "03 HashPool concurrent clients test passed." << std::endl;
+}
+
+int main() {
+  testResults();
+  testBatching();
+  testConcurrentClients();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include "database.h"
+#include "hash_password.h"
+#include "hash_scheme.h"
+#include "memory_pool.h"
+
+void testEncoding() {
+  const std::string salt(SALT_SIZE, '\x5a');
+  HashScheme pbkdf2;
+  pbkdf2.algorithm = HashScheme::PBKDF2_SHA256;
+  pbkdf2.cost = 0x01020304;
+  std::string stored = pbkdf2.encode(salt);
+  assert(stored.size() == HASH_SCHEME_HEADER + SALT_SIZE);
+
+  HashScheme scheme;
+  std::string decoded;
+  assert(HashScheme::decode(stored, scheme, decoded));
+  assert(scheme == pbkdf2 && decoded == salt);
+
+  // Legacy salts: random bytes, even starting with the magic, and hex text
+  const std::string legacy[] = {salt, std::string("$") + salt.substr(1),
+                                "3f1a9c0e5b7d2468ace13579bdf02468"};
+  for (const std::string &old : legacy) {
+    assert(HashScheme::decode(old, scheme, decoded));
+    assert(scheme == HashScheme() && decoded == old);
+    assert(HashScheme().encode(old) == old);
+  }
+
+  // A versioned salt of an unknown algorithm or without a cost
+  std::string unknown = stored;
+  unknown[1] = 9;
+  assert(!HashScheme::decode(unknown, scheme, decoded));
+  HashScheme no_cost = pbkdf2;
+  no_cost.cost = 0;
+  assert(!HashScheme::decode(no_cost.encode(salt), scheme, decoded));
+
+  HashScheme argon2 = HashScheme::argon2id(3, 19, 2);
+  assert(HashScheme::decode(argon2.encode(salt), scheme, decoded));
+  assert(scheme == argon2 && decoded == salt);
+  HashScheme no_memory = HashScheme::argon2id(3, 0, 2);
+  assert(!HashScheme::decode(no_memory.encode(salt), scheme, decoded));
+  std::cout << "01 Hash scheme encoding test passed." << std::endl;
+}
+
+void testHash() {
+  const std::string pepper = "42", password = "p4ssw0rd", salt(SALT_SIZE, 's');
+  std::string hashed;
+  HashScheme().hash(pepper, password, salt, hashed);
+  assert(hashed == HashPassword::digestSHA256(pepper + password + salt));
+
+  HashScheme pbkdf2;
+  pbkdf2.algorithm = HashScheme::PBKDF2_SHA256;
+  pbkdf2.cost = 1000;
+  pbkdf2.hash(pepper, password, salt, hashed);
+  assert(hashed == HashPassword::pbkdf2SHA256(pepper + password, salt, 1000));
+  assert(hashed.size() == SHA256_BYTES);
+
+  HashScheme::argon2id(1, 1, 2).hash(pepper, password, salt, hashed);
+  assert(hashed == HashPassword::argon2id(pepper + password, salt, 1, 1024, 2));
+  assert(hashed.size() == SHA256_BYTES);
+  std::cout << "02 Hash scheme hash test passed." << std::endl;
+}
+
+void testNeedsRehash() {
+  HashScheme legacy, pbkdf2;
+  pbkdf2.algorithm = HashScheme::PBKDF2_SHA256;
+  pbkdf2.cost = 10000;
+  assert(legacy.needsRehash(pbkdf2) && !pbkdf2.needsRehash(legacy));
+  assert(!legacy.needsRehash(legacy) && !pbkdf2.needsRehash(pbkdf2));
+  HashScheme other = pbkdf2;
+  for (uint32_t cost : {8000u, 12000u}) {
+    other.cost = cost;
+    assert(!other.needsRehash(pbkdf2));
+  }
+  for (uint32_t cost : {7000u, 13000u}) {
+    other.cost = cost;
+    assert(other.needsRehash(pbkdf2));
+  }
+
+  // Argon2id: stronger than both, exact passes and lanes, memory in a band
+  HashScheme argon2 = HashScheme::argon2id(2, 64, 4);
+  assert(argon2.passes() == 2 && argon2.memoryMB() == 64);
+  assert(argon2.lanes() == 4);
+  assert(legacy.needsRehash(argon2) && pbkdf2.needsRehash(argon2));
+  assert(!argon2.needsRehash(pbkdf2) && !argon2.needsRehash(argon2));
+  assert(!HashScheme::argon2id(2, 56, 4).needsRehash(argon2));
+  assert(HashScheme::argon2id(2, 40, 4).needsRehash(argon2));
+  assert(HashScheme::argon2id(3, 64, 4).needsRehash(argon2));
+  assert(HashScheme::argon2id(2, 64, 1).needsRehash(argon2));
+  std::cout << "03 Hash scheme rehash policy test passed." << std::endl;
+}
+
+void testCalibrate() {
+  using clock = std::chrono::steady_clock;
+  HashScheme scheme = HashScheme::calibrate(HashScheme::PBKDF2_SHA256, 20);
+  assert(scheme.algorithm == HashScheme::PBKDF2_SHA256);
+  assert(scheme.cost >= HASH_MIN_PBKDF2_ITERATIONS);
+  // Only loosely, the machine may be busy
+  std::string hashed;
+  auto start = clock::now();
+  scheme.hash("42", "password", std::string(SALT_SIZE, 's'), hashed);
+  double ms =
+      std::chrono::duration<double, std::milli>(clock::now() - start).count();
+  assert(ms > 2 && ms < 400);
+  assert(HashScheme::calibrate(HashScheme::LEGACY_SHA256, 20) ==
+         HashScheme());
+  HashScheme argon2 = HashScheme::calibrate(HashScheme::ARGON2ID, 20, 2);
+  assert(argon2.algorithm == HashScheme::ARGON2ID);
+  assert(argon2.passes() == HASH_ARGON2_PASSES && argon2.lanes() == 2);
+  assert(argon2.memoryMB() >= HASH_ARGON2_MIN_MB &&
+         argon2.memoryMB() <= MEMORY_POOL_MB);
+  std::cout << "04 Hash scheme calibration test passed. " << scheme.cost
+            << " iterations took " << ms << " ms for a 20 ms target."
+            << std::endl;
+}
+
+int main() {
+  testEncoding();
+  testHash();
+  testNeedsRehash();
+  testCalibrate();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
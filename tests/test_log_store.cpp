@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "hash_password.h"
+#include "log_store.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+void removeLog(const std::string &path) {
+  std::remove((path + ".idx").c_str());
+  for (int seq = 1; seq < 1000; seq++) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%06d", seq);
+    std::remove((path + suffix).c_str());
+  }
+}
+
+void testOperations() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_log_store.log";
+  removeLog(path);
+  {
+    LogStore store(path);
+    store.setLogger(&log);
+    std::string salt;
+
+    assert(store.addUser("user@mail.io", "hash", "salt") == SQLITE_OK);
+    assert(store.addUser("user@mail.io", "hash", "salt") == SQLITE_CONSTRAINT);
+    assert(store.getUserSalt("user@mail.io", salt) == SQLITE_OK);
+    assert(salt == "salt");
+    assert(store.getUserSalt("nobody@mail.io", salt) == SQLITE_DONE);
+    assert(store.checkPassword("user@mail.io", "hash") == SQLITE_OK);
+    assert(store.checkPassword("user@mail.io", "other") == SQLITE_NOTFOUND);
+    assert(store.updatePassword("user@mail.io", "hash2", "salt2") ==
+           SQLITE_OK);
+    assert(store.updatePassword("nobody@mail.io", "hash", "salt") ==
+           SQLITE_ABORT);
+    assert(store.deleteUser("user@mail.io", "hash") == SQLITE_DONE);
+    assert(store.deleteUser("user@mail.io", "hash2") == SQLITE_OK);
+    assert(store.getUserSalt("user@mail.io", salt) == SQLITE_DONE);
+    assert(store.addUser(std::string(200, 'x'), "hash", "salt") ==
+           SQLITE_TOOBIG);
+  }
+  removeLog(path);
+  std::cout << "01 LogStore operations test passed." << std::endl;
+}
+
+void testRecovery() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_log_store.log";
+  const int users = 3000;
+  removeLog(path);
+  {
+    LogStore store(path, false, 1000);
+    store.setLogger(&log);
+    for (int i = 0; i < users; i++) {
+      std::string id = std::to_string(i);
+      assert(store.addUser(id + "@mail.io", "hash" + id, "salt") ==
+             SQLITE_OK);
+    }
+    assert(store.checkpoint() == SQLITE_OK);
+    // The tail after the checkpoint is replayed on open
+    assert(store.updatePassword("1@mail.io", "new", "salt") == SQLITE_OK);
+    assert(store.deleteUser("2@mail.io", "hash2") == SQLITE_OK);
+  }
+  // Simulate a torn write at the end of the active segment: the update
+  // record again, of which only the first half reached the disk
+  const std::string active = path + ".000004";
+  struct stat st;
+  assert(stat(active.c_str(), &st) == 0);
+  const off_t intact = st.st_size;
+  {
+    std::ifstream in(active, std::ios::binary);
+    std::string record(LOG_STORE_RECORD_SIZE, '\0');
+    in.seekg(intact - 2 * LOG_STORE_RECORD_SIZE);
+    in.read(&record[0], record.size());
+    std::fill(record.begin() + LOG_STORE_RECORD_SIZE / 2, record.end(), '\0');
+    std::ofstream out(active, std::ios::app | std::ios::binary);
+    out.write(record.data(), record.size());
+  }
+  for (int pass = 0; pass < 2; pass++) {
+    LogStore store(path, false, 1000);
+    if (pass == 0) {
+      // Recovery cut the record off and says so
+      Logger warnings(Logger::LogLevel::WARNING, Logger::LogOut::STDOUT);
+      std::ostringstream captured;
+      std::streambuf *out = std::cout.rdbuf(captured.rdbuf());
+      store.setLogger(&warnings);
+      std::cout.rdbuf(out);
+      assert(captured.str().find("discarded 1 records from " + active) !=
+             std::string::npos);
+      assert(stat(active.c_str(), &st) == 0 && st.st_size == intact);
+    }
+    store.setLogger(&log);
+    assert(store.stats().users == users - 1);
+    assert(store.checkPassword("1@mail.io", "new") == SQLITE_OK);
+    assert(store.checkPassword("2@mail.io", "hash2") == SQLITE_NOTFOUND);
+    assert(store.checkPassword("2999@mail.io", "hash2999") == SQLITE_OK);
+    // Second pass rebuilds the index from the log alone
+    std::remove((path + ".idx").c_str());
+  }
+  removeLog(path);
+  std::cout << "02 LogStore recovery test passed." << std::endl;
+}
+
+void testCompaction() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_log_store.log";
+  removeLog(path);
+  {
+    LogStore store(path, false, 100);
+    store.setLogger(&log);
+    for (int i = 0; i < 300; i++) {
+      std::string id = std::to_string(i);
+      assert(store.addUser(id + "@mail.io", "hash" + id, "salt") ==
+             SQLITE_OK);
+    }
+    // Overwrite most of the first segment and delete part of the second
+    for (int i = 0; i < 80; i++) {
+      std::string id = std::to_string(i);
+      assert(store.updatePassword(id + "@mail.io", "new" + id, "salt") ==
+             SQLITE_OK);
+    }
+    for (int i = 100; i < 160; i++) {
+      std::string id = std::to_string(i);
+      assert(store.deleteUser(id + "@mail.io", "hash" + id) == SQLITE_OK);
+    }
+    // 100 is deleted in the second segment and added back later
+    assert(store.addUser("100@mail.io", "again", "salt") == SQLITE_OK);
+    LogStore::Stats before = store.stats();
+    assert(store.compact() == 2);
+    LogStore::Stats after = store.stats();
+    assert(after.records < before.records);
+    assert(after.users == before.users);
+    assert(after.live == after.users);
+  }
+  {
+    std::remove((path + ".idx").c_str());
+    LogStore store(path, false, 100);
+    store.setLogger(&log);
+    assert(store.stats().users == 300 - 60 + 1);
+    assert(store.checkPassword("5@mail.io", "new5") == SQLITE_OK);
+    assert(store.checkPassword("95@mail.io", "hash95") == SQLITE_OK);
+    assert(store.checkPassword("100@mail.io", "again") == SQLITE_OK);
+    assert(store.checkPassword("101@mail.io", "hash101") == SQLITE_NOTFOUND);
+    assert(store.checkPassword("299@mail.io", "hash299") == SQLITE_OK);
+  }
+  removeLog(path);
+  std::cout << "03 LogStore compaction test passed." << std::endl;
+}
+
+void testBackup() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_log_store.log";
+  const std::string copy = "test_log_store_copy.log";
+  removeLog(path);
+  removeLog(copy);
+  {
+    LogStore store(path);
+    store.setLogger(&log);
+    store.addUser("a@mail.io", "hash a", "salt a");
+    store.addUser("b@mail.io", "hash b", "salt b");
+    store.deleteUser("b@mail.io", "hash b");
+    // Hashes were written as hex before they were kept as bytes
+    store.addUser("c@mail.io", HashPassword::usingSHA256("c"), "salt c");
+    BackupStats stats;
+    assert(store.backup(copy.c_str(), &stats) == SQLITE_OK);
+    assert(stats.pages == 2);
+    // A backup that fails leaves the previous copy as it was
+    const std::string blocked = copy + ".000001.tmp";
+    assert(mkdir(blocked.c_str(), 0700) == 0);
+    store.addUser("d@mail.io", "hash d", "salt d");
+    assert(store.backup(copy.c_str()) == SQLITE_IOERR);
+    rmdir(blocked.c_str());
+  }
+  {
+    LogStore store(copy);
+    store.setLogger(&log);
+    assert(store.checkPassword("a@mail.io", "hash a") == SQLITE_OK);
+    assert(store.checkPassword("b@mail.io", "hash b") == SQLITE_NOTFOUND);
+    std::string hash;
+    assert(store.getUserPassword("c@mail.io", hash) == SQLITE_OK);
+    assert(hash == HashPassword::digestSHA256("c"));
+    assert(store.checkPassword("c@mail.io", hash) == SQLITE_OK);
+    assert(store.checkPassword("d@mail.io", "hash d") == SQLITE_NOTFOUND);
+  }
+  removeLog(path);
+  removeLog(copy);
+  std::cout << "04 LogStore backup test passed." << std::endl;
+}
+
+/*
+ * The kernel writes mapped index pages back in any order. A crash after the
+ * first change since a checkpoint can leave the header page on disk but
+ * not the slot pages: the index is rebuilt instead of trusted.
+ */
+void testDirtyIndex() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_log_store.log";
+  const std::string index = path + ".idx";
+  const int users = 2000;
+  removeLog(path);
+  std::string crashed;
+  {
+    LogStore store(path, false, 1000);
+    store.setLogger(&log);
+    for (int i = 0; i < users; i++) {
+      std::string id = std::to_string(i);
+      assert(store.addUser(id + "@mail.io", "hash" + id, "salt") ==
+             SQLITE_OK);
+    }
+    assert(store.checkpoint() == SQLITE_OK);
+    assert(store.updatePassword("1@mail.io", "new", "salt") == SQLITE_OK);
+    std::ifstream in(index, std::ios::binary);
+    crashed.assign(std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>());
+  }
+  std::fill(crashed.begin() + 4096, crashed.end(), '\0');
+  {
+    std::ofstream out(index, std::ios::binary | std::ios::trunc);
+    out.write(crashed.data(), crashed.size());
+  }
+  {
+    LogStore store(path, false, 1000);
+    store.setLogger(&log);
+    assert(store.stats().users == users);
+    assert(store.checkPassword("1@mail.io", "new") == SQLITE_OK);
+    for (int i = 2; i < users; i++) {
+      std::string id = std::to_string(i);
+      assert(store.checkPassword(id + "@mail.io", "hash" + id) == SQLITE_OK);
+    }
+  }
+  removeLog(path);
+  std::cout << "05 LogStore dirty index test passed." << std::endl;
+}
+
+// Segments larger than a chunk are compacted while logins and writes run
+void testCompactionUnderLoad() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_log_store.log";
+  const int users = 3 * LOG_STORE_COMPACT_CHUNK;
+  removeLog(path);
+  {
+    LogStore store(path, true, users);
+    store.setLogger(&log);
+    for (int i = 0; i < users; i++) {
+      std::string id = std::to_string(i);
+      assert(store.addUser(id + "@mail.io", "hash" + id, "salt") ==
+             SQLITE_OK);
+    }
+    // Overwrite most of the first segment
+    for (int i = 0; i < users * 3 / 4; i++) {
+      std::string id = std::to_string(i);
+      assert(store.updatePassword(id + "@mail.io", "new" + id, "salt") ==
+             SQLITE_OK);
+    }
+    std::thread compaction([&] { store.compact(); });
+    int wrong = 0;
+    for (int i = users - 200; i < users; i++) {
+      std::string id = std::to_string(i);
+      wrong += store.checkPassword(id + "@mail.io", "hash" + id) != SQLITE_OK;
+      wrong += store.updatePassword(id + "@mail.io", "load" + id, "salt") !=
+               SQLITE_OK;
+    }
+    compaction.join();
+    // The background thread may have been first
+    LogStore::Stats stats = store.stats();
+    assert(wrong == 0 && stats.compactions == 1);
+    assert(stats.users == static_cast<size_t>(users));
+  }
+  {
+    std::remove((path + ".idx").c_str());
+    LogStore store(path, true, users);
+    store.setLogger(&log);
+    for (int i = 0; i < users; i++) {
+      std::string id = std::to_string(i);
+      std::string hash = "hash" + id;
+      if (i >= users - 200) {
+        hash = "load" + id;
+      } else if (i < users * 3 / 4) {
+        hash = "new" + id;
+      }
+      assert(store.checkPassword(id + "@mail.io", hash) == SQLITE_OK);
+    }
+  }
+  removeLog(path);
+  std::cout << "06 LogStore compaction under load test passed." << std::endl;
+}
+
+int main() {
+  testOperations();
+  testRecovery();
+  testCompaction();
+  testBackup();
+  testDirtyIndex();
+  testCompactionUnderLoad();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * LoginManager from many threads at once, as the API server uses it:
+ * logins with right and wrong passwords, single and batched, mixed with
+ * adds, password changes, deletes, background rehashes and an online backup,
+ * on each storage engine. Every result is checked, and in a -DTSAN=ON build
+ * ThreadSanitizer checks for races.
+ * Login throughput is printed for 1 thread up to twice the cores.
+ */
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "log_store.h"
+#include "login_manager.h"
+#include "memory_store.h"
+#include "sharded_store.h"
+
+const int USERS = 200;
+
+static std::string user(int i) { return "u" + std::to_string(i) + "@mail.io"; }
+static std::string password(int i) { return "pw" + std::to_string(i); }
+
+// Files of every engine's store at path
+static void removeStore(const std::string &path) {
+  std::remove(path.c_str());
+  for (int i = 0; i < 4; i++) {
+    std::remove(ShardedStore::shardPath(path, i, 4).c_str());
+  }
+  std::remove((path + ".000001").c_str());
+  std::remove((path + ".idx").c_str());
+}
+
+static std::unique_ptr<LoginManager> populate(CredentialStore *store,
+                                              size_t cache_bytes) {
+  std::unique_ptr<LoginManager> lm(
+      new LoginManager(std::unique_ptr<CredentialStore>(store)));
+  lm->setCacheSize(cache_bytes);
+  for (int i = 0; i < USERS; i++) {
+    assert(lm->addLogin(user(i), password(i)) == 0);
+  }
+  return lm;
+}
+
+// threads log in ops times each, one in eight a write on a user of its own
+static int stress(LoginManager &lm, int threads, int ops) {
+  std::atomic<int> wrong(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      for (int i = 0; i < ops; i++) {
+        int u = (t * 7919 + i * 31) % USERS;
+        wrong += lm.login(user(u), password(u)) != 0;
+        wrong += lm.login(user(u), password(u) + "x") == 0;
+        if (i % 8 == 4) {
+          std::vector<int> rcs = lm.loginBatch(
+              {{user(u), password(u)}, {user(u), password(u) + "x"}});
+          wrong += rcs[0] != 0 || rcs[1] == 0;
+        }
+        if (i % 8 == 0) {
+          std::string own = "t" + std::to_string(t) + "@mail.io";
+          wrong += lm.addLogin(own, "first") != 0;
+          wrong += lm.login(own, "first") != 0;
+          wrong += lm.changePassword(own, "second") != 0;
+          wrong += lm.login(own, "first") == 0;
+          wrong += lm.delLogin(own, "second") != 0;
+          wrong += lm.login(own, "second") == 0;
+        }
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  return wrong;
+}
+
+static double loginsPerSecond(LoginManager &lm, int threads, int logins) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      for (int i = 0; i < logins; i++) {
+        int u = (t * 7919 + i * 31) % USERS;
+        lm.login(user(u), password(u));
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return threads * logins / seconds;
+}
+
+static void testEngine(const char *name,
+                       const std::function<CredentialStore *()> &open,
+                       size_t cache_bytes = 0) {
+  std::unique_ptr<LoginManager> lm = populate(open(), cache_bytes);
+  const int threads =
+      std::max(4u, 2 * std::thread::hardware_concurrency());
+
+  // Plain SHA-256 users, moved to PBKDF2 by rehashes during the run
+  HashScheme pbkdf2;
+  pbkdf2.algorithm = HashScheme::PBKDF2_SHA256;
+  pbkdf2.cost = 1000;
+  lm->setHashScheme(pbkdf2);
+  assert(stress(*lm, threads, 40) == 0);
+  // Again with hashing on a pool, enabled while logins run
+  std::thread enable([&] { lm->enableHashPool(2); });
+  int wrong = stress(*lm, threads, 24);
+  enable.join();
+  assert(wrong == 0);
+  lm->enableHashPool(0);
+  // Again while an online backup copies pages, where the store has one
+  const std::string copy = "test_login_concurrency_backup.db";
+  std::thread backup([&] {
+    int rc = lm->backup(copy);
+    assert(rc == SQLITE_OK || rc == SQLITE_MISUSE);
+  });
+  wrong = stress(*lm, threads, 16);
+  backup.join();
+  removeStore(copy);
+  assert(wrong == 0);
+  RehashStats rehashes = lm->rehashStats();
+  assert(rehashes.failed == 0);
+
+  std::cout << name << ":";
+  double single = 0;
+  for (int t = 1; t <= threads; t *= 2) {
+    double rate = loginsPerSecond(*lm, t, 300);
+    single = t == 1 ? rate : single;
+    printf(" %d threads %.0f/s (x%.1f)", t, rate, rate / single);
+  }
+  std::cout << std::endl;
+}
+
+int main() {
+  const std::string path = "test_login_concurrency.db";
+  auto remove = [&] { removeStore(path); };
+  remove();
+  std::cout << std::thread::hardware_concurrency() << " hardware threads"
+            << std::endl;
+  testEngine("memory", [] { return new MemoryStore(); });
+  std::cout << "01 Concurrent logins, memory store test passed." << std::endl;
+  testEngine("sqlite", [&] { return new Database(path.c_str()); });
+  remove();
+  std::cout << "02 Concurrent logins, sqlite test passed." << std::endl;
+  testEngine("sqlite, 4 shards, cache",
+             [&] { return new ShardedStore(path, 4); }, 1 << 20);
+  remove();
+  std::cout << "03 Concurrent logins, sharded sqlite test passed."
+            << std::endl;
+  testEngine("log", [&] { return new LogStore(path); });
+  remove();
+  std::cout << "04 Concurrent logins, log store test passed." << std::endl;
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -1,6 +1,46 @@
 #include "login_manager.h"
+#include "memory_store.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
+
+// MemoryStore with slow salt lookups that counts them
+class SlowStore : public MemoryStore {
+public:
+  std::atomic<int> lookups{0};
+  int getUserSalt(const string &secid, string &salt) override {
+    lookups++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return MemoryStore::getUserSalt(secid, salt);
+  }
+};
+
+// Every user's secid, salt and hash in path, in secid order
+static std::vector<std::string> credentials(const std::string &path) {
+  std::vector<std::string> rows;
+  sqlite3 *db = nullptr;
+  sqlite3_stmt *stmt = nullptr;
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) ==
+          SQLITE_OK &&
+      sqlite3_prepare_v2(db,
+                         "SELECT l.secid || x'00' || l.salt || x'00' || "
+                         "p.password FROM login l INNER JOIN password p "
+                         "ON l.id = p.login_id ORDER BY l.secid;",
+                         -1, &stmt, nullptr) == SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      rows.emplace_back(
+          static_cast<const char *>(sqlite3_column_blob(stmt, 0)),
+          sqlite3_column_bytes(stmt, 0));
+    }
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  return rows;
+}
 
 void testLogin() {
   LoginManager lm("../database/login.db");
@@ -108,9 +148,276 @@ void testLogin() {
   } else {
     std::cout << "13 Delete login3 test failed." << std::endl;
   }
+
+  BackupStats stats;
+  const std::string backup_path = "../database/login_backup.db";
+  lm.setBackupRate(1, 0);
+  rc = lm.backup(backup_path, &stats);
+  std::vector<std::string> users = credentials("../database/login.db");
+  if (rc == 0 && stats.pages > 0 && !users.empty() &&
+      users == credentials(backup_path)) {
+    std::cout << "14 Online backup test passed." << std::endl;
+  } else {
+    std::cout << "14 Online backup test failed. rc: " << rc << std::endl;
+  }
+  std::remove(backup_path.c_str());
+}
+
+void testCachedLogin() {
+  LoginManager lm("../database/login.db");
+  lm.setCacheSize(1024 * 1024);
+
+  const std::string secid = "cached@mail.io";
+  const std::string pw = "cachedPassW0rd";
+  const std::string pw_changed = "changedPassW0rd";
+  lm.addLogin(secid, pw);
+  lm.login(secid, pw);
+  int rc = lm.login(secid, pw);
+  CredentialCache::Stats stats;
+  if (rc == 0 && lm.cacheStats(stats) && stats.hits > 0) {
+    std::cout << "15 Cached login test passed." << std::endl;
+  } else {
+    std::cout << "15 Cached login test failed. rc: " << rc << std::endl;
+  }
+
+  lm.changePassword(secid, pw_changed);
+  if (lm.login(secid, pw) != 0 && lm.login(secid, pw_changed) == 0) {
+    std::cout << "16 Cached login after password change test passed."
+              << std::endl;
+  } else {
+    std::cout << "16 Cached login after password change test failed."
+              << std::endl;
+  }
+
+  lm.delLogin(secid, pw_changed);
+  if (lm.login(secid, pw_changed) != 0) {
+    std::cout << "17 Cached login after delete test passed." << std::endl;
+  } else {
+    std::cout << "17 Cached login after delete test failed." << std::endl;
+  }
+}
+
+void testUserFilter() {
+  LoginManager lm("../database/login.db");
+  lm.enableUserFilter(true);
+
+  const std::string secid = "filtered@mail.io";
+  const std::string pw = "filteredPassW0rd";
+  CuckooFilter::Stats before;
+  lm.userFilterStats(before);
+  int rc = lm.login("unknown@mail.io", pw);
+  CuckooFilter::Stats after;
+  lm.userFilterStats(after);
+  if (rc != 0 && after.rejected == before.rejected + 1) {
+    std::cout << "18 Unknown user filtered test passed." << std::endl;
+  } else {
+    std::cout << "18 Unknown user filtered test failed." << std::endl;
+  }
+
+  lm.addLogin(secid, pw);
+  if (lm.login(secid, pw) == 0) {
+    std::cout << "19 Added user passes filter test passed." << std::endl;
+  } else {
+    std::cout << "19 Added user passes filter test failed." << std::endl;
+  }
+  lm.delLogin(secid, pw);
+}
+
+void testSingleFlight() {
+  SlowStore *store = new SlowStore();
+  LoginManager lm{std::unique_ptr<CredentialStore>(store)};
+  const std::string secid = "storm@mail.io";
+  const std::string pw = "stormPassW0rd";
+  lm.addLogin(secid, pw);
+
+  std::atomic<int> ok(0), rejected(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 16; i++) {
+    threads.emplace_back([&, i] {
+      // One in four tries a wrong password, it must not share the result
+      const std::string attempt = i % 4 ? pw : pw + "x";
+      int rc = lm.login(secid, attempt);
+      (rc == 0 ? ok : rejected)++;
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  SingleFlight::Stats stats = lm.loginFlightStats();
+  // At most one lookup per distinct password, unless a thread came late
+  if (ok == 12 && rejected == 4 && store->lookups < 16 && stats.shared > 0 &&
+      stats.calls == 16) {
+    std::cout << "20 Concurrent identical logins share one check test "
+                 "passed."
+              << std::endl;
+  } else {
+    std::cout << "20 Concurrent identical logins share one check test "
+                 "failed. lookups: "
+              << store->lookups << std::endl;
+  }
+
+  // Nothing is in flight any more, the next login runs again
+  int before = store->lookups;
+  lm.changePassword(secid, pw + "new");
+  if (lm.login(secid, pw) != 0 && lm.login(secid, pw + "new") == 0 &&
+      store->lookups == before + 2) {
+    std::cout << "21 Login after coalesced logins test passed." << std::endl;
+  } else {
+    std::cout << "21 Login after coalesced logins test failed." << std::endl;
+  }
+}
+
+// Waits for the background rehashes of lm to reach n
+static bool rehashed(LoginManager &lm, uint64_t n) {
+  for (int i = 0; i < 500 && lm.rehashStats().rehashed < n; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return lm.rehashStats().rehashed == n;
+}
+
+void testRehash() {
+  MemoryStore *store = new MemoryStore();
+  LoginManager lm{std::unique_ptr<CredentialStore>(store)};
+  const std::string secid = "old@mail.io";
+  const std::string pw = "oldPassW0rd";
+  lm.addLogin(secid, pw);
+  std::string legacy_salt, salt;
+  store->getUserSalt(secid, legacy_salt);
+
+  HashScheme scheme;
+  scheme.algorithm = HashScheme::PBKDF2_SHA256;
+  scheme.cost = 1000;
+  lm.setHashScheme(scheme);
+  HashScheme stored;
+  std::string random_salt;
+  bool passed = lm.login(secid, pw + "x") != 0 && lm.login(secid, pw) == 0 &&
+                rehashed(lm, 1);
+  store->getUserSalt(secid, salt);
+  passed = passed && salt != legacy_salt &&
+           HashScheme::decode(salt, stored, random_salt) && stored == scheme;
+  // Logins on the current scheme are not rehashed, a higher cost is
+  passed = passed && lm.login(secid, pw) == 0 && lm.login(secid, pw) == 0;
+  scheme.cost = 2000;
+  lm.setHashScheme(scheme);
+  passed = passed && lm.login(secid, pw) == 0 && rehashed(lm, 2) &&
+           lm.login(secid, pw) == 0 && lm.login(secid, pw + "x") != 0;
+  if (passed && lm.rehashStats().failed == 0) {
+    std::cout << "22 Rehash on login test passed." << std::endl;
+  } else {
+    std::cout << "22 Rehash on login test failed." << std::endl;
+  }
+
+  // A password changed before the rehash runs is kept
+  const std::string other = "changed@mail.io";
+  lm.setHashScheme(HashScheme());
+  lm.addLogin(other, pw);
+  lm.setHashScheme(scheme);
+  RehashStats before = lm.rehashStats();
+  std::thread logins([&] {
+    for (int i = 0; i < 20; i++) {
+      lm.login(other, pw);
+    }
+  });
+  lm.changePassword(other, pw + "new");
+  logins.join();
+  for (int i = 0; i < 500; i++) {
+    RehashStats now = lm.rehashStats();
+    if (now.rehashed + now.skipped + now.failed ==
+        before.rehashed + before.skipped + before.failed + 20) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if (lm.login(other, pw + "new") == 0 && lm.login(other, pw) != 0) {
+    std::cout << "23 Rehash keeps a changed password test passed."
+              << std::endl;
+  } else {
+    std::cout << "23 Rehash keeps a changed password test failed."
+              << std::endl;
+  }
+}
+
+void testHashPool() {
+  LoginManager lm{std::unique_ptr<CredentialStore>(new MemoryStore())};
+  const std::string pw = "poolPassW0rd";
+  lm.addLogin("before@mail.io", pw);
+  lm.enableHashPool(2);
+  bool passed = lm.login("before@mail.io", pw) == 0 &&
+                lm.addLogin("pool@mail.io", pw) == 0 &&
+                lm.login("pool@mail.io", pw) == 0 &&
+                lm.login("pool@mail.io", pw + "x") != 0 &&
+                lm.changePassword("pool@mail.io", pw + "new") == 0 &&
+                lm.login("pool@mail.io", pw + "new") == 0 &&
+                lm.delLogin("pool@mail.io", pw + "new") == 0;
+  HashPool::Stats stats;
+  passed = passed && lm.hashPoolStats(stats) && stats.jobs == 7;
+  lm.enableHashPool(0);
+  passed = passed && !lm.hashPoolStats(stats) &&
+           lm.login("before@mail.io", pw) == 0;
+  if (passed) {
+    std::cout << "24 Hash pool test passed." << std::endl;
+  } else {
+    std::cout << "24 Hash pool test failed." << std::endl;
+  }
+}
+
+// Batches on the SQLite store and on the per-item defaults of MemoryStore
+void testBatch() {
+  std::vector<std::unique_ptr<LoginManager>> managers;
+  managers.emplace_back(new LoginManager("../database/login.db"));
+  managers.emplace_back(new LoginManager(
+      std::unique_ptr<CredentialStore>(new MemoryStore())));
+  bool added = true, logged_in = true;
+  for (auto &lm : managers) {
+    std::vector<Credential> users;
+    for (int i = 0; i < 20; i++) {
+      users.push_back({"batch" + std::to_string(i) + "@mail.io",
+                       "batchPassW0rd" + std::to_string(i)});
+    }
+    lm->addLogin(users[3].username, "taken");
+    users.push_back(users[5]);
+    std::vector<int> rcs = lm->addLogins(users);
+    for (size_t i = 0; i < rcs.size(); i++) {
+      bool taken = i == 3 || i == 20;
+      added = added && rcs.size() == users.size() &&
+              (rcs[i] == SQLITE_OK) != taken;
+    }
+
+    users.pop_back();
+    users[7].password += "x";
+    users.push_back({"nobatch@mail.io", "batchPassW0rd"});
+    rcs = lm->loginBatch(users);
+    for (size_t i = 0; i < users.size(); i++) {
+      bool ok = i != 3 && i != 7 && i != 20;
+      logged_in = logged_in && rcs.size() == users.size() &&
+                  (rcs[i] == 0) == ok && rcs[i] == lm->login(users[i].username,
+                                                             users[i].password);
+    }
+    users[7].password.pop_back();
+    for (size_t i = 0; i < 20; i++) {
+      lm->delLogin(users[i].username, users[i].password);
+    }
+    lm->delLogin(users[3].username, "taken");
+  }
+  if (added) {
+    std::cout << "25 Batch add test passed." << std::endl;
+  } else {
+    std::cout << "25 Batch add test failed." << std::endl;
+  }
+  if (logged_in) {
+    std::cout << "26 Batch login test passed." << std::endl;
+  } else {
+    std::cout << "26 Batch login test failed." << std::endl;
+  }
 }
 
 int main() {
   testLogin();
+  testCachedLogin();
+  testUserFilter();
+  testSingleFlight();
+  testRehash();
+  testHashPool();
+  testBatch();
   return 0;
 }
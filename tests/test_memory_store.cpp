@@ -0,0 +1,178 @@
+#include <cassert>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "hash_password.h"
+#include "memory_store.h"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void testOperations() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  MemoryStore store;
+  store.setLogger(&log);
+  std::string salt;
+
+  assert(store.addUser("user@mail.io", "hash", "salt") == SQLITE_OK);
+  assert(store.addUser("user@mail.io", "hash", "salt") == SQLITE_CONSTRAINT);
+  assert(store.getUserSalt("user@mail.io", salt) == SQLITE_OK);
+  assert(salt == "salt");
+  assert(store.getUserSalt("nobody@mail.io", salt) == SQLITE_DONE);
+  assert(store.checkPassword("user@mail.io", "hash") == SQLITE_OK);
+  assert(store.checkPassword("user@mail.io", "other") == SQLITE_NOTFOUND);
+  assert(store.updatePassword("user@mail.io", "hash2", "salt2") == SQLITE_OK);
+  assert(store.updatePassword("nobody@mail.io", "hash", "salt") ==
+         SQLITE_ABORT);
+  assert(store.deleteUser("user@mail.io", "hash") == SQLITE_DONE);
+  assert(store.deleteUser("user@mail.io", "hash2") == SQLITE_OK);
+  assert(store.getUserSalt("user@mail.io", salt) == SQLITE_DONE);
+  std::cout << "01 MemoryStore operations test passed." << std::endl;
+}
+
+void testGrowAndDelete() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  MemoryStore store;
+  store.setLogger(&log);
+  const int users = 20000;
+  for (int i = 0; i < users; i++) {
+    std::string id = std::to_string(i);
+    assert(store.addUser(id + "@mail.io", "hash" + id, "salt") == SQLITE_OK);
+  }
+  // Every other user removed, the rest must still be reachable
+  for (int i = 0; i < users; i += 2) {
+    std::string id = std::to_string(i);
+    assert(store.deleteUser(id + "@mail.io", "hash" + id) == SQLITE_OK);
+  }
+  for (int i = 0; i < users; i++) {
+    std::string id = std::to_string(i);
+    int expected = (i % 2) ? SQLITE_OK : SQLITE_NOTFOUND;
+    assert(store.checkPassword(id + "@mail.io", "hash" + id) == expected);
+  }
+  std::cout << "02 MemoryStore grow and delete test passed." << std::endl;
+}
+
+void testReplay() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_memory_store.aof";
+  std::remove(path.c_str());
+  {
+    MemoryStore store(path);
+    store.setLogger(&log);
+    store.addUser("a@mail.io", "hash a", "salt a");
+    store.addUser("b@mail.io", "hash b", "salt b");
+    store.updatePassword("a@mail.io", "hash a2", "salt a2");
+    store.deleteUser("b@mail.io", "hash b");
+    // Hashes were written as hex before they were kept as bytes
+    store.addUser("d@mail.io", HashPassword::usingSHA256("d"), "salt d");
+  }
+  {
+    // Simulate a torn write at the end of the file
+    std::ofstream out(path, std::ios::app | std::ios::binary);
+    out << "\x01\x02\x03";
+  }
+  {
+    MemoryStore store(path);
+    store.setLogger(&log);
+    std::string salt;
+    assert(store.checkPassword("a@mail.io", "hash a2") == SQLITE_OK);
+    assert(store.getUserSalt("a@mail.io", salt) == SQLITE_OK);
+    assert(salt == "salt a2");
+    assert(store.getUserSalt("b@mail.io", salt) == SQLITE_DONE);
+    assert(store.checkPassword("d@mail.io", HashPassword::digestSHA256("d")) ==
+           SQLITE_OK);
+    assert(store.addUser("c@mail.io", "hash c", "salt c") == SQLITE_OK);
+  }
+  {
+    MemoryStore store(path);
+    store.setLogger(&log);
+    assert(store.checkPassword("c@mail.io", "hash c") == SQLITE_OK);
+  }
+  std::remove(path.c_str());
+  std::cout << "03 MemoryStore append-only file replay test passed."
+            << std::endl;
+}
+
+// A file size limit makes the kernel write only part of the next record
+void testShortWrite() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_memory_store_short.aof";
+  std::remove(path.c_str());
+  signal(SIGXFSZ, SIG_IGN);
+  struct rlimit unlimited;
+  getrlimit(RLIMIT_FSIZE, &unlimited);
+  {
+    MemoryStore store(path);
+    store.setLogger(&log);
+    assert(store.addUser("a@mail.io", "hash a", "salt a") == SQLITE_OK);
+    struct stat st;
+    stat(path.c_str(), &st);
+    struct rlimit limited = unlimited;
+    limited.rlim_cur = st.st_size + 8;
+    setrlimit(RLIMIT_FSIZE, &limited);
+    assert(store.addUser("b@mail.io", "hash b", "salt b") == SQLITE_IOERR);
+    setrlimit(RLIMIT_FSIZE, &unlimited);
+    // The limit fails writes to a stdout redirected to a file as well
+    std::cout.clear();
+    assert(store.addUser("c@mail.io", "hash c", "salt c") == SQLITE_OK);
+  }
+  {
+    MemoryStore store(path);
+    store.setLogger(&log);
+    std::string salt;
+    assert(store.checkPassword("a@mail.io", "hash a") == SQLITE_OK);
+    assert(store.getUserSalt("b@mail.io", salt) == SQLITE_DONE);
+    assert(store.checkPassword("c@mail.io", "hash c") == SQLITE_OK);
+  }
+  signal(SIGXFSZ, SIG_DFL);
+  std::remove(path.c_str());
+  std::cout << "04 MemoryStore short write test passed." << std::endl;
+}
+
+void testBackup() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string copy = "test_memory_store_backup.aof";
+  const std::string dir = "test_memory_store_backup.dir";
+  std::remove(copy.c_str());
+  rmdir(dir.c_str());
+  {
+    MemoryStore store;
+    store.setLogger(&log);
+    for (int i = 0; i < 3000; i++) {
+      std::string id = std::to_string(i);
+      assert(store.addUser(id + "@mail.io", "hash " + id, "salt " + id) ==
+             SQLITE_OK);
+    }
+    BackupStats stats;
+    assert(store.backup(copy.c_str(), &stats) == SQLITE_OK);
+    assert(stats.pages > 0);
+    // A failed rename leaves no temporary file behind
+    assert(mkdir(dir.c_str(), 0700) == 0);
+    assert(store.backup(dir.c_str()) == SQLITE_IOERR);
+    assert(access((dir + ".tmp").c_str(), F_OK) != 0);
+    rmdir(dir.c_str());
+  }
+  {
+    MemoryStore store(copy);
+    store.setLogger(&log);
+    for (int i = 0; i < 3000; i++) {
+      std::string id = std::to_string(i);
+      assert(store.checkPassword(id + "@mail.io", "hash " + id) == SQLITE_OK);
+    }
+  }
+  std::remove(copy.c_str());
+  std::cout << "05 MemoryStore backup test passed." << std::endl;
+}
+
+int main() {
+  testOperations();
+  testGrowAndDelete();
+  testReplay();
+  testShortWrite();
+  testBackup();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
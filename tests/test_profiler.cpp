@@ -0,0 +1,99 @@
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include "database.h"
+#include "hash_password.h"
+#include "sharded_store.h"
+
+const Profiler::Histogram *find(const Profiler::Snapshot &snapshot,
+                                const std::string &name) {
+  for (const Profiler::Histogram &h : snapshot.statements) {
+    if (h.name == name) {
+      return &h;
+    }
+  }
+  return nullptr;
+}
+
+void testStatements() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_profiler.db";
+  const std::string hash = HashPassword::digestSHA256("hash");
+  std::remove(path.c_str());
+  {
+    Database db(path.c_str());
+    db.setLogger(&log);
+    Profiler::Snapshot snapshot;
+    assert(!db.profile(snapshot));
+    assert(db.enableProfiling(true) == SQLITE_OK);
+    for (int i = 0; i < 20; i++) {
+      assert(db.addUser(std::to_string(i) + "@mail.io", hash, "salt") ==
+             SQLITE_OK);
+    }
+    for (int i = 0; i < 50; i++) {
+      assert(db.checkPassword("7@mail.io", hash) == SQLITE_OK);
+    }
+    assert(db.profile(snapshot));
+
+    const Profiler::Histogram *check = find(snapshot, "check_password_stmt");
+    assert(check && check->count == 50);
+    uint64_t in_buckets = 0;
+    for (uint64_t n : check->buckets) {
+      in_buckets += n;
+    }
+    assert(in_buckets == 50);
+    assert(check->percentile(50) <= check->percentile(99));
+    assert(check->max_ns > 0 && check->meanMicros() > 0);
+    assert(find(snapshot, "add_login_stmt")->count == 20);
+    // Transaction control is recorded under its SQL
+    assert(find(snapshot, "COMMIT;") != nullptr);
+    // Sorted by total time
+    for (size_t i = 1; i < snapshot.statements.size(); i++) {
+      assert(snapshot.statements[i - 1].total_ns >=
+             snapshot.statements[i].total_ns);
+    }
+    assert(snapshot.status.samples >= 1);
+    assert(snapshot.status.cache_hits + snapshot.status.cache_misses > 0);
+    assert(snapshot.status.cache_writes > 0);
+    assert(snapshot.status.cache_bytes > 0);
+
+    assert(db.enableProfiling(false) == SQLITE_OK);
+    assert(!db.profile(snapshot));
+  }
+  std::remove(path.c_str());
+  std::cout << "01 Profiler statement histogram test passed." << std::endl;
+}
+
+void testShards() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_profiler_sharded.db";
+  const int shards = 2;
+  const std::string hash = HashPassword::digestSHA256("hash");
+  {
+    ShardedStore store(path, shards);
+    store.setLogger(&log);
+    assert(store.enableProfiling(true) == SQLITE_OK);
+    for (int i = 0; i < 10; i++) {
+      std::string secid = std::to_string(i) + "@mail.io";
+      assert(store.addUser(secid, hash, "salt") == SQLITE_OK);
+      assert(store.checkPassword(secid, hash) == SQLITE_OK);
+    }
+    Profiler::Snapshot snapshot;
+    assert(store.profile(snapshot));
+    assert(find(snapshot, "check_password_stmt")->count == 10);
+    assert(find(snapshot, "add_password_stmt")->count == 10);
+  }
+  for (int i = 0; i < shards; i++) {
+    std::remove(ShardedStore::shardPath(path, i, shards).c_str());
+  }
+  std::cout << "02 Profiler sharded store test passed." << std::endl;
+}
+
+int main() {
+  testStatements();
+  testShards();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
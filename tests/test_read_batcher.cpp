@@ -0,0 +1,167 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "database.h"
+#include "hash_password.h"
+#include "read_batcher.h"
+
+using Entry = ReadBatcher::Entry;
+
+void testCoalescing() {
+  std::mutex mtx;
+  std::vector<size_t> sizes;
+  ReadBatcher batcher(
+      [&](const std::vector<std::string> &secids,
+          std::unordered_map<std::string, Entry> &found) {
+        {
+          std::lock_guard<std::mutex> lock(mtx);
+          sizes.push_back(secids.size());
+        }
+        // Slow enough that lookups pile up behind it
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        for (const std::string &secid : secids) {
+          if (secid != "missing") {
+            found[secid] = {"salt-" + secid, "hash-" + secid};
+          }
+        }
+        return SQLITE_OK;
+      });
+
+  const int threads = 16, lookups = 50;
+  std::atomic<int> wrong(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      for (int i = 0; i < lookups; i++) {
+        // Threads share secids, duplicates in a batch are fetched once
+        std::string secid = std::to_string((t + i) % 10);
+        Entry entry;
+        if (batcher.lookup(secid, entry) != SQLITE_OK ||
+            entry.salt != "salt-" + secid ||
+            entry.password != "hash-" + secid) {
+          wrong++;
+        }
+      }
+      Entry entry;
+      if (batcher.lookup("missing", entry) != SQLITE_DONE) {
+        wrong++;
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  assert(wrong == 0);
+
+  ReadBatcher::Stats stats = batcher.stats();
+  assert(stats.lookups == threads * (lookups + 1));
+  assert(stats.batches == sizes.size());
+  assert(stats.batches < stats.lookups / 4);
+  assert(stats.max_batch > 1 && stats.max_batch <= READ_BATCH_MAX);
+  for (size_t n : sizes) {
+    assert(n <= 11); // distinct secids only
+  }
+  std::cout << "01 ReadBatcher coalescing test passed." << std::endl;
+}
+
+void testAdaptiveWindow() {
+  int fetches = 0;
+  ReadBatcher batcher(
+      [&](const std::vector<std::string> &secids,
+          std::unordered_map<std::string, Entry> &found) {
+        fetches++;
+        found[secids[0]] = {"salt", "hash"};
+        return fetches == 3 ? SQLITE_IOERR : SQLITE_OK;
+      },
+      100);
+  // A single caller never waits
+  for (int i = 0; i < 20; i++) {
+    Entry entry;
+    int rc = batcher.lookup("a", entry);
+    assert(rc == (i == 2 ? SQLITE_IOERR : SQLITE_OK));
+    assert(batcher.stats().wait_us == 0);
+  }
+  ReadBatcher::Stats stats = batcher.stats();
+  assert(stats.batches == 20 && stats.max_batch == 1);
+  std::cout << "02 ReadBatcher adaptive window test passed." << std::endl;
+}
+
+void testDatabase() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_read_batcher.db";
+  const int users = 200;
+  std::remove(path.c_str());
+  for (int cached = 0; cached < 2; cached++) {
+    Database db(path.c_str());
+    db.setLogger(&log);
+    if (cached) {
+      db.enableCache(1024 * 1024);
+    }
+    assert(db.enableReadBatching(true, 50) == SQLITE_OK);
+    if (!cached) {
+      for (int i = 0; i < users; i++) {
+        std::string secid = std::to_string(i) + "@mail.io";
+        assert(db.addUser(secid, HashPassword::digestSHA256(secid),
+                          "salt" + std::to_string(i)) == SQLITE_OK);
+      }
+    }
+
+    std::atomic<int> wrong(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 8; t++) {
+      workers.emplace_back([&, t] {
+        for (int i = t; i < users; i += 2) {
+          std::string secid = std::to_string(i) + "@mail.io";
+          std::string hash = HashPassword::digestSHA256(secid);
+          std::string salt, stored;
+          wrong += db.getUserSalt(secid, salt) != SQLITE_OK ||
+                   salt != "salt" + std::to_string(i);
+          wrong += db.checkPassword(secid, hash) != SQLITE_OK;
+          wrong += db.checkPassword(secid, salt) != SQLITE_NOTFOUND;
+          wrong += db.getUserPassword(secid, stored) != SQLITE_OK ||
+                   stored != hash;
+        }
+        std::string salt;
+        wrong += db.getUserSalt("nobody@mail.io", salt) != SQLITE_DONE;
+        wrong += db.checkPassword("nobody@mail.io", "x") != SQLITE_NOTFOUND;
+      });
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+    assert(wrong == 0);
+    ReadBatcher::Stats stats;
+    assert(db.readBatchStats(stats));
+    assert(stats.lookups > 0 && stats.batches <= stats.lookups);
+
+    // A change is seen by the next batch
+    std::string salt;
+    assert(db.updatePassword("3@mail.io", HashPassword::digestSHA256("new"),
+                             "new salt") == SQLITE_OK);
+    assert(db.getUserSalt("3@mail.io", salt) == SQLITE_OK);
+    assert(salt == "new salt");
+    assert(db.updatePassword("3@mail.io",
+                             HashPassword::digestSHA256("3@mail.io"),
+                             "salt3") == SQLITE_OK);
+
+    assert(db.enableReadBatching(false) == SQLITE_OK);
+    assert(!db.readBatchStats(stats));
+  }
+  std::remove(path.c_str());
+  std::cout << "03 Database read batching test passed." << std::endl;
+}
+
+int main() {
+  testCoalescing();
+  testAdaptiveWindow();
+  testDatabase();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
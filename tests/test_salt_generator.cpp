@@ -0,0 +1,137 @@
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <set>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "salt_generator.h"
+
+// Counts allocations, generating salts must not make any
+static std::atomic<size_t> allocations(0);
+void* operator new(size_t size) {
+  allocations++;
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  allocations++;
+  return std::malloc(size ? size : 1);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+static std::string hex(const uint8_t* bytes, size_t n) {
+  static const char digits[] = "0123456789abcdef";
+  std::string out;
+  for (size_t i = 0; i < n; i++) {
+    out += digits[bytes[i] >> 4];
+    out += digits[bytes[i] & 0xf];
+  }
+  return out;
+}
+
+void testChaCha20() {
+  // RFC 8439 2.3.2
+  uint32_t key[8];
+  for (uint32_t i = 0; i < 8; i++) {
+    key[i] = (4 * i) | (4 * i + 1) << 8 | (4 * i + 2) << 16 |
+             (4 * i + 3) << 24;
+  }
+  const uint32_t nonce[3] = {0x09000000, 0x4a000000, 0};
+  uint8_t block[64];
+  SaltGenerator::chacha20Block(key, 1, nonce, block);
+  assert(hex(block, 64) ==
+         "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+         "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e");
+  std::cout << "01 ChaCha20 block test passed." << std::endl;
+}
+
+void testDistinct() {
+  const int threads = 8, salts = 20000;
+  std::vector<std::vector<SaltGenerator::Salt>> made(threads);
+  for (auto& m : made) {
+    m.resize(salts);
+  }
+  std::atomic<int> failed(0);
+  {
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (int t = 0; t < threads; t++) {
+      workers.emplace_back([&, t] {
+        for (auto& salt : made[t]) {
+          failed += !SaltGenerator::generate(salt);
+        }
+      });
+    }
+    // Thread starts allocate their state, the salts themselves do not
+    size_t started = allocations;
+    for (auto& w : workers) {
+      w.join();
+    }
+    assert(allocations == started);
+  }
+  assert(failed == 0);
+
+  std::set<std::string> seen;
+  size_t ones = 0;
+  for (auto& m : made) {
+    for (auto& salt : m) {
+      seen.insert(std::string(salt.begin(), salt.end()));
+      for (uint8_t b : salt) {
+        ones += __builtin_popcount(b);
+      }
+    }
+  }
+  assert(seen.size() == size_t(threads) * salts);
+  // Half the bits set, within far more than any chance deviation
+  double bits = 8.0 * SALT_SIZE * threads * salts;
+  assert(ones > bits * 0.49 && ones < bits * 0.51);
+
+  // Past reseeds and across buffer refills
+  std::vector<uint8_t> large(3 * SALT_RESEED_BYTES + 7);
+  assert(SaltGenerator::fill(large.data(), large.size()));
+  std::cout << "02 Salts distinct, allocation-free test passed."
+            << std::endl;
+}
+
+void testFork() {
+  SaltGenerator::Salt parent, child;
+  assert(SaltGenerator::generate(parent));
+  int pipefd[2];
+  assert(pipe(pipefd) == 0);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) {
+    SaltGenerator::generate(child);
+    ssize_t written = write(pipefd[1], child.data(), child.size());
+    _exit(written == ssize_t(child.size()) ? 0 : 1);
+  }
+  close(pipefd[1]);
+  assert(read(pipefd[0], child.data(), child.size()) ==
+         ssize_t(child.size()));
+  close(pipefd[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  // Without the reseed both would take the same next bytes
+  assert(SaltGenerator::generate(parent));
+  assert(parent != child);
+  std::cout << "03 Salts after fork test passed." << std::endl;
+}
+
+int main() {
+  testChaCha20();
+  testDistinct();
+  testFork();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
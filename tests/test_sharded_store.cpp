@@ -0,0 +1,186 @@
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "hash_password.h"
+#include "sharded_store.h"
+
+void removeLayout(const std::string &path, int shards) {
+  for (int i = 0; i < shards; i++) {
+    std::remove(ShardedStore::shardPath(path, i, shards).c_str());
+  }
+}
+
+std::string hashOf(const std::string &text) {
+  return HashPassword::digestSHA256(text);
+}
+
+void testShardPath() {
+  assert(ShardedStore::shardPath("login.db", 0, 1) == "login.db");
+  assert(ShardedStore::shardPath("data/login.db", 2, 4) ==
+         "data/login.2-of-4.db");
+  assert(ShardedStore::shardPath("./data/login", 0, 2) == "./data/login.0-of-2");
+  assert(ShardedStore::shardOf("user@mail.io", 8) ==
+         ShardedStore::shardOf("user@mail.io", 8));
+  std::cout << "01 ShardedStore shard path test passed." << std::endl;
+}
+
+void testParallelWriters() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_sharded.db";
+  const int shards = 4, threads = 4, users = 200;
+  removeLayout(path, shards);
+  {
+    ShardedStore store(path, shards);
+    store.setLogger(&log);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+      workers.emplace_back([&store, t] {
+        for (int i = 0; i < users; i++) {
+          std::string id = std::to_string(t) + "." + std::to_string(i);
+          assert(store.addUser(id + "@mail.io", hashOf("hash" + id), "salt") ==
+                 SQLITE_OK);
+        }
+      });
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+    std::string salt;
+    assert(store.addUser("0.0@mail.io", hashOf("hash"), "salt") != SQLITE_OK);
+    assert(store.checkPassword("3.199@mail.io", hashOf("hash3.199")) ==
+           SQLITE_OK);
+    assert(store.updatePassword("3.199@mail.io", hashOf("new"), "salt2") ==
+           SQLITE_OK);
+    assert(store.getUserSalt("3.199@mail.io", salt) == SQLITE_OK);
+    assert(salt == "salt2");
+    assert(store.deleteUser("0.0@mail.io", hashOf("hash0.0")) == SQLITE_OK);
+    assert(store.getUserSalt("0.0@mail.io", salt) == SQLITE_DONE);
+  }
+  // Every shard file holds only users that hash to it
+  for (int i = 0; i < shards; i++) {
+    Database db(ShardedStore::shardPath(path, i, shards).c_str());
+    db.setLogger(&log);
+    std::string salt;
+    for (int u = 0; u < users; u++) {
+      std::string secid = "1." + std::to_string(u) + "@mail.io";
+      bool here = ShardedStore::shardOf(secid, shards) == i;
+      assert((db.getUserSalt(secid, salt) == SQLITE_OK) == here);
+    }
+  }
+  removeLayout(path, shards);
+  std::cout << "02 ShardedStore parallel writers test passed." << std::endl;
+}
+
+void testReshard() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string src = "test_reshard.db", dst = "test_resharded.db";
+  const int users = 500;
+  removeLayout(src, 1);
+  removeLayout(dst, 4);
+  removeLayout(src, 2);
+  {
+    // The source still has hex text hashes, they are decoded on the way
+    sqlite3 *db = nullptr;
+    assert(sqlite3_open(src.c_str(), &db) == SQLITE_OK);
+    sqlite3_exec(db,
+                 "CREATE TABLE login (id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                 "secid TEXT NOT NULL UNIQUE, salt TEXT NOT NULL);"
+                 "CREATE TABLE password (login_id INTEGER NOT NULL, "
+                 "password TEXT NOT NULL); BEGIN;",
+                 nullptr, nullptr, nullptr);
+    for (int i = 0; i < users; i++) {
+      std::string id = std::to_string(i);
+      std::string sql = "INSERT INTO login (secid, salt) VALUES ('" + id +
+                        "@mail.io', 'salt" + id + "');"
+                        "INSERT INTO password VALUES (last_insert_rowid(), '" +
+                        HashPassword::usingSHA256("hash" + id) + "');";
+      assert(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) ==
+             SQLITE_OK);
+    }
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+  }
+  assert(ShardedStore::reshard(src, 1, dst, 4, &log) == SQLITE_OK);
+  // Refuses to overwrite an existing layout
+  assert(ShardedStore::reshard(src, 1, dst, 4, &log) != SQLITE_OK);
+  // A run failing halfway, on a missing source shard, leaves no files
+  const std::string moved = ShardedStore::shardPath(dst, 3, 4);
+  assert(std::rename(moved.c_str(), (moved + ".away").c_str()) == 0);
+  assert(ShardedStore::reshard(dst, 4, src, 2, &log) != SQLITE_OK);
+  for (int i = 0; i < 2; i++) {
+    std::string path = ShardedStore::shardPath(src, i, 2);
+    assert(access(path.c_str(), F_OK) != 0);
+    assert(access((path + ".tmp").c_str(), F_OK) != 0);
+  }
+  // and can be run again
+  assert(std::rename((moved + ".away").c_str(), moved.c_str()) == 0);
+  assert(ShardedStore::reshard(dst, 4, src, 2, &log) == SQLITE_OK);
+  {
+    ShardedStore store(src, 2);
+    store.setLogger(&log);
+    std::string salt;
+    for (int i = 0; i < users; i++) {
+      std::string id = std::to_string(i);
+      assert(store.checkPassword(id + "@mail.io", hashOf("hash" + id)) ==
+             SQLITE_OK);
+      assert(store.getUserSalt(id + "@mail.io", salt) == SQLITE_OK);
+      assert(salt == "salt" + id);
+    }
+  }
+  removeLayout(src, 1);
+  removeLayout(dst, 4);
+  removeLayout(src, 2);
+  std::cout << "03 ShardedStore reshard test passed." << std::endl;
+}
+
+void testBatch() {
+  Logger log(Logger::LogLevel::ERROR, Logger::LogOut::STDOUT);
+  const std::string path = "test_sharded_batch.db";
+  const int shards = 4;
+  removeLayout(path, shards);
+  {
+    ShardedStore store(path, shards);
+    store.setLogger(&log);
+    std::vector<NewUser> users;
+    std::vector<std::string> secids;
+    for (int i = 0; i < 100; i++) {
+      std::string id = std::to_string(i);
+      users.push_back({id + "@mail.io", hashOf("hash" + id), "salt" + id});
+      secids.push_back(id + "@mail.io");
+    }
+    users.push_back(users[42]);
+    std::vector<int> rcs;
+    assert(store.addUsers(users, rcs) == SQLITE_OK);
+    assert(rcs.size() == users.size());
+    for (size_t i = 0; i < rcs.size(); i++) {
+      assert(rcs[i] == (i == 100 ? SQLITE_CONSTRAINT : SQLITE_OK));
+    }
+
+    secids.push_back("missing@mail.io");
+    std::vector<CredentialCache::Entry> entries;
+    assert(store.getCredentials(secids, entries, rcs) == SQLITE_OK);
+    assert(entries.size() == secids.size() && rcs.size() == secids.size());
+    for (int i = 0; i < 100; i++) {
+      std::string id = std::to_string(i);
+      assert(rcs[i] == SQLITE_OK && entries[i].salt == "salt" + id &&
+             entries[i].password == hashOf("hash" + id));
+    }
+    assert(rcs[100] == SQLITE_DONE);
+  }
+  removeLayout(path, shards);
+  std::cout << "04 ShardedStore batch test passed." << std::endl;
+}
+
+int main() {
+  testShardPath();
+  testParallelWriters();
+  testReshard();
+  testBatch();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}
@@ -0,0 +1,143 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include "statement.h"
+
+sqlite3 *openTestDatabase() {
+  sqlite3 *db = nullptr;
+  assert(sqlite3_open(":memory:", &db) == SQLITE_OK);
+  assert(sqlite3_exec(db,
+                      "CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT);"
+                      "INSERT INTO t (name) VALUES ('one'), ('two');",
+                      nullptr, nullptr, nullptr) == SQLITE_OK);
+  return db;
+}
+
+void testPrepare() {
+  sqlite3 *db = openTestDatabase();
+  {
+    Statement<std::string> stmt;
+    assert(stmt.prepare(db, "SELECT name FROM t WHERE id = :id;", {":nope"}) ==
+           SQLITE_RANGE);
+    assert(stmt.prepare(db, "SELECT id, name FROM t WHERE id = :id;",
+                        {":id"}) == SQLITE_MISMATCH);
+    assert(stmt.prepare(db, "SELECT name FROM tt;", {}) == SQLITE_ERROR);
+    assert(stmt.prepare(db, "SELECT name FROM t WHERE id = :id;", {":id"}) ==
+           SQLITE_OK);
+    // Wrong number of values
+    assert(stmt.bind().step() == SQLITE_RANGE);
+  }
+  sqlite3_close(db);
+  std::cout << "01 Statement prepare test passed." << std::endl;
+}
+
+void testBindAndRows() {
+  sqlite3 *db = openTestDatabase();
+  {
+    Statement<sqlite3_int64, std::string> select;
+    assert(select.prepare(db,
+                          "SELECT id, name FROM t WHERE name = :name "
+                          "AND id >= :min;",
+                          {":name", ":min"}) == SQLITE_OK);
+    std::string name = "two";
+    {
+      auto scope = select.bind(name, 1);
+      assert(scope.step() == SQLITE_ROW);
+      auto row = scope.row();
+      assert(std::get<0>(row) == 2);
+      assert(std::get<1>(row) == "two");
+      assert(scope.step() == SQLITE_DONE);
+    }
+    // The scope reset the statement, it runs again with new values
+    {
+      name = "one";
+      auto scope = select.bind(name, 1);
+      assert(scope.step() == SQLITE_ROW);
+      assert(std::get<1>(scope.row()) == "one");
+    }
+
+    Statement<> insert;
+    assert(insert.prepare(db, "INSERT INTO t (name) VALUES (:name);",
+                          {":name"}) == SQLITE_OK);
+    // An empty string is stored as '' and not as NULL
+    std::string empty_name;
+    assert(insert.bind(empty_name).step() == SQLITE_DONE);
+    Statement<int> empty;
+    assert(empty.prepare(db, "SELECT count(*) FROM t WHERE name = '';", {}) ==
+           SQLITE_OK);
+    auto scope = empty.bind();
+    assert(scope.step() == SQLITE_ROW);
+    assert(std::get<0>(scope.row()) == 1);
+  }
+  sqlite3_close(db);
+  std::cout << "02 Statement bind and rows test passed." << std::endl;
+}
+
+void testTransaction() {
+  sqlite3 *db = openTestDatabase();
+  Statement<int> count;
+  assert(count.prepare(db, "SELECT count(*) FROM t;", {}) == SQLITE_OK);
+  auto rows = [&count] {
+    auto scope = count.bind();
+    scope.step();
+    return std::get<0>(scope.row());
+  };
+  {
+    Transaction transaction(db);
+    assert(transaction.begin() == SQLITE_OK);
+    sqlite3_exec(db, "INSERT INTO t (name) VALUES ('three');", nullptr,
+                 nullptr, nullptr);
+    // No commit, rolled back here
+  }
+  assert(rows() == 2);
+  {
+    Transaction transaction(db);
+    assert(transaction.begin() == SQLITE_OK);
+    sqlite3_exec(db, "INSERT INTO t (name) VALUES ('three');", nullptr,
+                 nullptr, nullptr);
+    assert(transaction.commit() == SQLITE_OK);
+  }
+  assert(rows() == 3);
+  sqlite3_close_v2(db);
+  std::cout << "03 Transaction test passed." << std::endl;
+}
+
+void testBindRange() {
+  sqlite3 *db = openTestDatabase();
+  {
+    Statement<std::string> select;
+    assert(select.prepare(db,
+                          "SELECT name FROM t WHERE name IN (?1, ?2, ?3) "
+                          "ORDER BY id;",
+                          {}) == SQLITE_OK);
+    std::vector<std::string> names = {"two", "none"};
+    {
+      // ?3 stays NULL and matches nothing
+      auto scope = select.bindRange(names);
+      assert(scope.step() == SQLITE_ROW);
+      assert(std::get<0>(scope.row()) == "two");
+      assert(scope.step() == SQLITE_DONE);
+    }
+    names = {"one", "two"};
+    {
+      auto scope = select.bindRange(names);
+      assert(scope.step() == SQLITE_ROW);
+      assert(scope.step() == SQLITE_ROW);
+      assert(scope.step() == SQLITE_DONE);
+    }
+    names = {"one", "two", "three", "four"};
+    assert(select.bindRange(names).step() == SQLITE_RANGE);
+  }
+  sqlite3_close(db);
+  std::cout << "04 Statement bindRange test passed." << std::endl;
+}
+
+int main() {
+  testPrepare();
+  testBindAndRows();
+  testTransaction();
+  testBindRange();
+
+  std::cout << "All tests passed!" << std::endl;
+  return 0;
+}